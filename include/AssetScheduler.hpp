@@ -0,0 +1,132 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "Task.hpp"
+#include "ThreadPool.hpp"
+
+#include <functional>
+#include <mutex>
+
+// Runs asset loading coroutines, written as a plain sequence of co_awaits:
+//
+//	std::vector<U8> bytes = co_await assets.readFile(path);	// on an I/O thread
+//	image.loadMemory(bytes.data(), bytes.size());			// resumed on a worker
+//	co_await assets.resumeOnMain();							// record the upload
+//	co_await assets.gpuComplete(device, fence);				// back on main once done
+//
+// Each await hands the coroutine to where the next step belongs, so the reads
+// of one asset overlap the decode of another and the GPU copies of a third,
+// and no thread ever blocks on another. Blocking reads get their own small
+// pool so they never hold up decoding.
+//
+// "Main" is whichever thread calls pumpMain(), the one owning the Vulkan
+// command pool and queue. Coroutines queued there and GPU waits only go on
+// when it pumps.
+class AssetScheduler
+{
+public:
+	// 0 decode workers uses every core
+	AssetScheduler(U32 ioThreads = 2, U32 workerThreads = 0);
+	~AssetScheduler();
+
+	AssetScheduler(const AssetScheduler&) = delete;
+	AssetScheduler& operator=(const AssetScheduler&) = delete;
+
+	// Starts task and keeps it alive until it's done, an exception out of it
+	// terminates
+	void spawn(Task<void> task);
+
+	// Resumes coroutines queued for main and those whose wait is over. Call
+	// from main only.
+	void pumpMain();
+	// Pumps until every spawned task has finished, from main only
+	void waitIdle();
+	// Spawned tasks not finished yet
+	U32 pending() const { return inFlight.load(std::memory_order_acquire); }
+
+	U32 workerCount() { return workers.size(); }
+
+	// co_await resumeOnWorker() / resumeOnMain() moves the coroutine over
+	struct Hop
+	{
+		AssetScheduler* scheduler;
+		bool main;
+
+		bool await_ready() noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { main ? scheduler->postMain(handle) : scheduler->postWorker(handle); }
+		void await_resume() noexcept {}
+	};
+	Hop resumeOnWorker() { return { this, false }; }
+	Hop resumeOnMain() { return { this, true }; }
+
+	// Whole file read on an I/O thread, resumed on a worker with its bytes,
+	// none when it can't be read
+	struct ReadFile
+	{
+		AssetScheduler* scheduler;
+		std::string path;
+		std::vector<U8> bytes {};
+
+		bool await_ready() noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle);
+		std::vector<U8> await_resume() { return std::move(bytes); }
+	};
+	ReadFile readFile(std::string path) { return { this, std::move(path) }; }
+
+	// f() run on a worker, for decoding and other CPU heavy steps. The
+	// coroutine goes on with its result on that same worker.
+	template<class F>
+	struct Run
+	{
+		using Result = decltype(std::declval<F&>()());
+
+		AssetScheduler* scheduler;
+		F f;
+		std::optional<Result> result {};
+
+		bool await_ready() noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			scheduler->workers.submit([this, handle]()
+			{
+				result.emplace(f());
+				handle.resume();
+			});
+		}
+		Result await_resume() { return std::move(*result); }
+	};
+	template<class F>
+	Run<std::decay_t<F>> run(F&& f) { return { this, std::forward<F>(f) }; }
+
+	// Resumed on main by the first pump that finds ready() true
+	struct When
+	{
+		AssetScheduler* scheduler;
+		std::function<bool()> ready;
+
+		bool await_ready() noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { scheduler->postPoll(std::move(ready), handle); }
+		void await_resume() noexcept {}
+	};
+	When when(std::function<bool()> ready) { return { this, std::move(ready) }; }
+
+	// Resumed on main once the GPU has signalled fence, the pump only polls it
+	When gpuComplete(VkDevice device, VkFence fence)
+	{
+		return when([device, fence]() { return vkGetFenceStatus(device, fence) == VK_SUCCESS; });
+	}
+
+private:
+	void postWorker(std::coroutine_handle<> handle);
+	void postMain(std::coroutine_handle<> handle);
+	void postPoll(std::function<bool()> ready, std::coroutine_handle<> handle);
+
+	ThreadPool io;
+	ThreadPool workers;
+
+	std::mutex mainMutex;
+	std::vector<std::coroutine_handle<>> mainQueue;
+	std::vector<std::pair<std::function<bool()>, std::coroutine_handle<>>> polls;
+
+	std::atomic<U32> inFlight { 0 };
+};
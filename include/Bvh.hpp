@@ -0,0 +1,138 @@
+#pragma once
+
+#include "PCH.hpp"
+
+// Bounding volume hierarchy over world space boxes, so culling, picking and
+// range queries don't have to loop over every object. A Model's boundsMin and
+// boundsMax moved by its transform make a primitive:
+//   Bvh::Bounds{ model.boundsMin, model.boundsMax }.transformed(transform)
+//
+// Built top down with a binned surface area heuristic into a binary tree of
+// 32 byte nodes. That tree is then collapsed into 4 or 8 wide nodes holding
+// their children's boxes as structure of arrays, so one SSE or AVX2 test
+// covers every child. Queries walk the wide tree and test the primitives in
+// the leaves one by one.
+//
+// Moving boxes are handled by refit(), which keeps the shape of the tree, or
+// update(), which also rebuilds the subtrees that have grown too much since
+// they were built.
+class Bvh
+{
+public:
+	struct Bounds
+	{
+		glm::vec3 minimum = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 maximum = glm::vec3(-std::numeric_limits<float>::max());
+
+		void grow(const glm::vec3& point);
+		void grow(const Bounds& bounds);
+		glm::vec3 centre() const { return (minimum + maximum) * 0.5f; }
+		// Half the surface area, 0 when empty
+		float area() const;
+		// Box around this box moved by transform
+		Bounds transformed(const glm::mat4& transform) const;
+	};
+
+	// 32 bytes, two to a cache line
+	struct Node
+	{
+		glm::vec3 minimum;
+		// First child when count is 0, the second child follows it. Otherwise
+		// the first of count entries in the index list.
+		U32 first;
+		glm::vec3 maximum;
+		U32 count;
+
+		bool isLeaf() const { return count != 0; }
+	};
+
+	struct Hit
+	{
+		U32 primitive;
+		float distance;
+	};
+
+	static const U32 maxLeafSize = 4;
+	static const U32 binCount = 16;
+
+	// 4 or 8 children per node, 8 needs AVX2. 0 picks 8 when the CPU has it.
+	Bvh(U32 width = 0);
+
+	void build(const std::vector<Bounds>& bounds);
+	// Same primitives with new boxes, the tree keeps its shape
+	void refit(const std::vector<Bounds>& bounds);
+	// Refits, then rebuilds every subtree whose box has grown by more than
+	// threshold times its surface area at build. Returns the subtrees rebuilt.
+	U32 update(const std::vector<Bounds>& bounds, float threshold = 2.0f);
+
+	// Results are primitive indices in no particular order, appended
+	void queryFrustum(const glm::mat4& viewProjection, std::vector<U32>& results) const;
+	void querySphere(const glm::vec3& centre, float radius, std::vector<U32>& results) const;
+	void queryBox(const Bounds& box, std::vector<U32>& results) const;
+
+	// Nearest primitive box along the ray within maxDistance. exact, when set,
+	// is given each primitive whose box the ray enters closer than the nearest
+	// hit so far, with that distance. It returns true after lowering the
+	// distance for a real hit, e.g. against the primitive's triangles.
+	bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Hit& hit, const std::function<bool(U32, float&)>& exact = nullptr) const;
+
+	U32 getWidth() const { return width; }
+	U32 size() const { return U32(primitives.size()); }
+	const std::vector<Node>& getNodes() const { return nodes; }
+	U32 getWideNodeCount() const { return U32(width == 8 ? nodes8.size() : nodes4.size()); }
+	// Expected cost of a query relative to testing the root, lower is better
+	float getCost() const;
+
+	// The binned SAH build on its own, for other primitives such as triangles.
+	// Node 0 is the root, indices is filled with the primitive order the
+	// leaves refer to.
+	static void buildNodes(const std::vector<Bounds>& bounds, std::vector<Node>& nodes, std::vector<U32>& indices, U32 leafSize = maxLeafSize);
+
+	// Ray against box slabs, the entry distance or a negative value on a miss
+	static float intersect(const Bounds& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance);
+
+	// Children's boxes as structure of arrays, unused lanes are never tested
+	template<U32 W>
+	struct WideNode
+	{
+		float minX[W], minY[W], minZ[W];
+		float maxX[W], maxY[W], maxZ[W];
+		// Wide node index for inner children, first index list entry for leaves
+		U32 child[W];
+		// Primitives in a leaf, 0 for an inner child
+		U32 count[W];
+		U32 used;
+	};
+
+private:
+	// Builds the subtree under node over indices [first, first + count)
+	static void buildRange(const std::vector<Bounds>& bounds, const std::vector<glm::vec3>& centres, std::vector<Node>& nodes, std::vector<U32>& indices, U32 node, U32 first, U32 count, U32 leafSize);
+
+	template<U32 W>
+	void collapse(std::vector<WideNode<W>>& wide);
+	void collapse();
+	void refitWide();
+
+	template<U32 W, class Mask, class Leaf>
+	void traverse(const std::vector<WideNode<W>>& wide, const Mask& mask, const Leaf& leaf) const;
+	template<U32 W>
+	bool raycast(const std::vector<WideNode<W>>& wide, const glm::vec3& origin, const glm::vec3& direction, Hit& hit, const std::function<bool(U32, float&)>& exact) const;
+
+	// Index list entries under an inner node are contiguous
+	void getRange(U32 node, U32& first, U32& count) const;
+	U32 countNodes(U32 node) const;
+
+	U32 width;
+	std::vector<Bounds> primitives;
+	std::vector<Node> nodes;
+	std::vector<U32> indices;
+	// Surface area of each binary node when it was built
+	std::vector<float> builtArea;
+	// Binary nodes cut loose by update(), reclaimed by the next full build
+	U32 deadNodes = 0;
+
+	std::vector<WideNode<4>> nodes4;
+	std::vector<WideNode<8>> nodes8;
+	// Binary node behind each wide lane, for refitting
+	std::vector<U32> laneSources;
+};
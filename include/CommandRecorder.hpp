@@ -0,0 +1,60 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "ThreadPool.hpp"
+
+// Records a frame's draws on several threads. Every frame slot has one
+// command pool per recording thread, pools are reset when the slot comes
+// round again and their command buffers are reused rather than freed.
+// Workers record VK_COMMAND_BUFFER_LEVEL_SECONDARY buffers that the frame's
+// primary buffer executes inside the render pass.
+class CommandRecorder
+{
+public:
+	// Records draws [begin, end) into a secondary buffer that has already
+	// been begun. Called concurrently for disjoint ranges.
+	typedef std::function<void(VkCommandBuffer, U32 begin, U32 end)> RecordRange;
+
+	// Ranges smaller than this aren't worth handing to another thread
+	static const U32 minDrawsPerThread = 64;
+
+	// 0 records on one thread per hardware core
+	void init(VkDevice device, U32 queueFamily, U32 frameCount, U32 threadCount = 0);
+	void destroy();
+
+	// Resets the pools of a frame slot, the GPU must have finished with it.
+	// Returns the slot's primary command buffer, ready to be begun.
+	VkCommandBuffer beginFrame(U32 frame);
+
+	// Splits [0, drawCount) across the recording threads, the calling thread
+	// takes the first range. Appends the recorded secondary buffers, in draw
+	// order, to `secondaries`.
+	void record(const VkCommandBufferInheritanceInfo& inheritance, U32 drawCount, const RecordRange& recordRange, std::vector<VkCommandBuffer>& secondaries);
+
+	U32 threadCount() { return U32(threads); }
+
+private:
+	// Only ever used by one recording thread at a time
+	struct ThreadPools
+	{
+		VkCommandPool pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> secondaries;
+		U32 used = 0;
+
+		VkCommandBuffer nextSecondary(VkDevice device);
+	};
+
+	struct Frame
+	{
+		std::vector<ThreadPools> threads;
+		VkCommandBuffer primary = VK_NULL_HANDLE;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	std::vector<Frame> frames;
+	U32 currentFrame = 0;
+	size_t threads = 1;
+
+	// The calling thread records too, so the pool has threads - 1 workers
+	std::unique_ptr<ThreadPool> workers;
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "PCH.hpp"
+
+// Maps source asset paths to their counterparts in the cooked directory
+// written by the offline asset cooker
+class Cooked
+{
+public:
+	static std::string directory;
+
+	// "models/chalet.obj", ".mesh" -> "cooked/models/chalet.mesh"
+	static std::string path(std::string source, std::string extension);
+
+	// Returns the cooked path if it exists and is not older than the source,
+	// otherwise the source path itself
+	static std::string resolve(std::string source, std::string extension);
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "Image.hpp"
+
+// Texture with its full mip chain baked offline, optionally block compressed.
+// Written by the asset cooker and uploaded by Texture::loadCooked without any
+// decoding, mip generation or blits at runtime.
+class CookedTexture
+{
+public:
+	CookedTexture() : format(RGBA8), width(0), height(0) {}
+	~CookedTexture() {}
+
+	enum Format : U32
+	{
+		RGBA8 = 0,
+		BC1 = 1
+	};
+
+	struct Level
+	{
+		U32 width;
+		U32 height;
+		std::vector<U8> data;
+	};
+
+	Format format;
+	U32 width;
+	U32 height;
+	std::vector<Level> levels;
+
+	void build(Image& image, Format pFormat);
+
+	bool load(std::string path);
+	bool save(std::string path);
+
+	VkFormat getVulkanFormat();
+
+	static const U32 cookedMagic = 0x58545645; // "EVTX"
+	static const U32 cookedVersion = 1;
+
+private:
+	static void downsample(const std::vector<Pixel>& src, U32 srcWidth, U32 srcHeight, std::vector<Pixel>& dst, U32 dstWidth, U32 dstHeight);
+	static void compressBC1(const std::vector<Pixel>& src, U32 srcWidth, U32 srcHeight, std::vector<U8>& dst);
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "ShaderReflection.hpp"
+
+#include <mutex>
+
+// Owns every VkDescriptorSetLayout and VkPipelineLayout built from shader
+// reflection. Requests with identical contents return the same handle, so
+// pipelines sharing an interface also share layouts. Thread safe.
+class DescriptorLayoutCache
+{
+public:
+	VkDescriptorSetLayout getSetLayout(VkDevice device, const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+	VkPipelineLayout getPipelineLayout(VkDevice device, const std::vector<VkDescriptorSetLayout>& setLayouts, const std::vector<VkPushConstantRange>& pushConstants);
+
+	// Layouts for every set in reflection, set layouts are returned through setLayouts
+	VkPipelineLayout getPipelineLayout(VkDevice device, ShaderReflection& reflection, std::vector<VkDescriptorSetLayout>* setLayouts = nullptr);
+
+	U32 getSetLayoutCount() { return U32(setLayouts.size()); }
+	U32 getPipelineLayoutCount() { return U32(pipelineLayouts.size()); }
+
+	void destroy(VkDevice device);
+
+private:
+	std::mutex mutex;
+	std::map<std::vector<U64>, VkDescriptorSetLayout> setLayouts;
+	std::map<std::vector<U64>, VkPipelineLayout> pipelineLayouts;
+};
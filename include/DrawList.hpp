@@ -0,0 +1,72 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "LinearAllocator.hpp"
+#include "Material.hpp"
+
+class Model;
+
+// One frame's draws. The sort key is built when a draw is submitted, draw
+// data goes into a linear allocator and the key arrays keep their capacity
+// across frames, so submitting and sorting don't allocate in steady state.
+//
+// Key layout, most significant first:
+//   layer 4 | pipeline 10 | material 14 | mesh 16 | depth 20
+// so a sorted list changes pipeline least often, then descriptor sets, then
+// vertex buffers, and draws sharing all of them go front to back. Ids wider
+// than their field wrap, which only costs some grouping.
+class DrawList
+{
+public:
+	struct Draw
+	{
+		Model* mesh;
+		const Material* material;
+		glm::mat4 transform;
+	};
+
+	// Depth in the key is the distance from here, as a fraction of farDistance
+	void setCamera(const glm::vec3& position, float farDistance);
+
+	void submit(Model* mesh, const Material* material, const glm::mat4& transform, U32 layer = 0);
+
+	// Drops every draw but the ascending submission indices in keep, e.g.
+	// the visible list from a FrustumCuller. Call before sort().
+	void retain(const std::vector<U32>& keep);
+
+	// Radix sort on the keys
+	void sort();
+
+	// Run of sorted draws sharing mesh and material, drawn as instances
+	struct Batch
+	{
+		U32 first;
+		U32 count;
+	};
+
+	// Call after sort(). With merge off every draw is a batch of its own.
+	void buildBatches(bool merge);
+	const std::vector<Batch>& getBatches() const { return batches; }
+
+	void reset();
+
+	U32 size() const { return U32(entries.size()); }
+	const Draw& operator[](U32 i) const { return *entries[i].draw; }
+
+	static U64 makeKey(U32 layer, const Material* material, const Model* mesh, float depth);
+
+	struct Entry
+	{
+		U64 key;
+		const Draw* draw;
+	};
+
+private:
+	LinearAllocator allocator;
+	std::vector<Entry> entries;
+	std::vector<Entry> scratch;
+	std::vector<Batch> batches;
+
+	glm::vec3 cameraPosition = glm::vec3(0.0f);
+	float inverseFarDistance = 1.0f;
+};
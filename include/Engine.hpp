@@ -6,6 +6,8 @@
 #include "VulkanWrapper.hpp"
 #include "Time.hpp"
 #include "Clock.hpp"
+#include "RenderSnapshot.hpp"
+#include "TripleBuffer.hpp"
 
 class Window;
 class Renderer;
@@ -22,6 +24,11 @@ public:
 	static void createWindow();
 	static void quit();
 
+	// Input and simulation for one frame, filling in what the renderer draws
+	static void simulate(RenderSnapshot& snapshot);
+	// Render thread body, draws the newest snapshot until start() closes the buffer
+	static void renderLoop(TripleBuffer<RenderSnapshot>& snapshots);
+
 	static VkPhysicalDevice getPhysicalDevice() { return vkPhysicalDevice; }
 	static PhysicalDeviceDetails& getPhysicalDeviceDetails() { return physicalDevicesDetails[physicalDeviceIndex]; }
 
@@ -43,7 +50,11 @@ public:
 	static std::vector<PhysicalDeviceDetails> physicalDevicesDetails;
 	static int physicalDeviceIndex;
 	
-	static bool isRunning;
+	// Written by the main thread, read by the render thread
+	static std::atomic<bool> isRunning;
+	// Renders on its own thread, overlapping the next frame's simulation.
+	// Off renders each snapshot on the main thread right after building it.
+	static bool threadedRendering;
 	static Time engineStartTime;
 };
 
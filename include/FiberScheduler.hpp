@@ -0,0 +1,183 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "Job.hpp"
+#include "WorkStealingDeque.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <ucontext.h>
+#endif
+
+// Job scheduler that runs every job on a fiber, so a job can wait for
+// others without holding up its thread. Waiting parks the fiber on its
+// worker and switches back to the worker's scheduler, which goes on with
+// other jobs and resumes the fiber once the counter has reached zero. Code
+// such as load, decode, wait for the decode, upload reads top to bottom and
+// never blocks a worker.
+//
+// Workers steal jobs from each other's Chase-Lev deques like JobSystem.
+// Waits need no locks: a parked fiber belongs to the worker that parked it,
+// which polls the counter's atomic, and resumes on that same thread so
+// thread locals stay valid across a wait. Fibers and their stacks come
+// from a pool made once up front; a job picked up with no fiber free runs
+// on the worker's own stack, where waiting runs other jobs in place.
+//
+// Threads outside the scheduler queue jobs through a locked queue, and
+// their waits block.
+class FiberScheduler
+{
+public:
+	using Counter = JobCounter;
+
+	// threadCount worker threads, 0 uses every core. Stacks are rounded up
+	// to whole pages, with a guard page below each where the platform allows.
+	FiberScheduler(U32 threadCount = 0, U32 fiberCount = 128, U32 stackSize = 64 * 1024, bool pinThreads = false);
+	~FiberScheduler();
+
+	FiberScheduler(const FiberScheduler&) = delete;
+	FiberScheduler& operator=(const FiberScheduler&) = delete;
+
+	// Queues f() to run on a fiber, counted by counter when there is one
+	template<class F>
+	void run(F&& f, Counter* counter = nullptr);
+
+	// Returns once everything counted by counter has finished, switching to
+	// other work in the meantime when called from a job
+	void wait(Counter& counter);
+
+	// From a job: lets other parked fibers and queued jobs run first
+	void yield();
+
+	U32 threadCount() const { return U32(workers.size()); }
+	U32 fiberCount() const { return U32(fibers.size()); }
+	// Switches into fibers so far, each one pairs with a switch back
+	U64 getSwitchCount() const;
+	// Jobs that found no free fiber and ran on a worker's stack
+	U64 getFiberlessCount() const { return fiberless.load(std::memory_order_relaxed); }
+
+private:
+	struct Worker;
+
+	struct Fiber
+	{
+#ifdef _WIN32
+		LPVOID handle = nullptr;
+#else
+		ucontext_t context;
+#endif
+		FiberScheduler* scheduler = nullptr;
+		U32 index = 0;
+		// Next fiber in the free list, index + 1 with 0 ending it
+		std::atomic<U32> nextFree { 0 };
+
+		// Set by whoever switches in, read back by the scheduler after
+		Job* job = nullptr;
+		Worker* worker = nullptr;
+		// Counter the parked fiber waits for, nullptr when it only yielded
+		Counter* waitingOn = nullptr;
+	};
+
+	struct alignas(64) Worker
+	{
+		WorkStealingDeque<Job> deque;
+		JobRing jobs;
+		// Fibers waiting, resumed in the order they parked
+		std::vector<Fiber*> parked;
+		// Where fibers switch back to
+#ifdef _WIN32
+		LPVOID schedulerFiber = nullptr;
+#else
+		ucontext_t schedulerContext;
+#endif
+		// Running on this worker, nullptr on the scheduler's own stack
+		Fiber* current = nullptr;
+		U32 victim = 0;
+		std::atomic<U64> switches { 0 };
+		std::thread thread;
+	};
+
+	Worker* currentWorker();
+	void submit(Worker& self, Job* job);
+	// A job was queued, wakes a sleeping worker
+	void notify();
+	Job* take(Worker& self);
+
+	// Resumes a parked fiber that can go on, or starts a queued job. False
+	// when there was nothing to do.
+	bool runOne(Worker& self);
+	void switchToFiber(Worker& self, Fiber* fiber);
+	void switchToScheduler(Fiber* fiber);
+
+	Fiber* popFreeFiber();
+	void pushFreeFiber(Fiber* fiber);
+
+	void workerLoop(U32 index);
+#ifdef _WIN32
+	static void WINAPI fiberMain(LPVOID parameter);
+#else
+	static void fiberMain(U32 low, U32 high);
+#endif
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::unique_ptr<Fiber>> fibers;
+	// Tagged head of the free list: fiber index + 1 below, ABA tag above
+	std::atomic<U64> freeFibers { 0 };
+	std::atomic<U64> fiberless { 0 };
+
+	// Every stack, one block with a guard page under each stack
+	U8* stackMemory = nullptr;
+	size_t stackMemorySize = 0;
+	size_t stackStride = 0;
+	size_t stackSize = 0;
+
+	// Jobs from threads outside the scheduler
+	std::mutex externalMutex;
+	std::deque<Job*> external;
+	JobRing externalJobs;
+
+	// Jobs sitting in deques or the external queue, idle workers with
+	// nothing parked sleep while it's 0
+	std::atomic<S32> queued { 0 };
+	std::atomic<U32> sleeping { 0 };
+	std::atomic<bool> stopping { false };
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+};
+
+template<class F>
+void FiberScheduler::run(F&& f, Counter* counter)
+{
+	Worker* self = currentWorker();
+	if (self)
+	{
+		Job* job = self->jobs.allocate();
+		if (!job)
+		{
+			f();
+			return;
+		}
+		job->bind(std::forward<F>(f), counter);
+		submit(*self, job);
+		return;
+	}
+
+	Job* job = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(externalMutex);
+		job = externalJobs.allocate();
+		if (job)
+		{
+			job->bind(std::forward<F>(f), counter);
+			external.push_back(job);
+		}
+	}
+	if (job)
+		notify();
+	else
+		f();
+}
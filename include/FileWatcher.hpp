@@ -0,0 +1,41 @@
+#pragma once
+
+#include "PCH.hpp"
+
+#include <filesystem>
+#include <set>
+
+// Reports files that were modified on disk. Uses inotify on Linux, where the
+// containing directories are watched so editors that save by renaming a
+// temporary over the original are caught too. Other platforms fall back to
+// comparing modification times, at most every pollInterval.
+class FileWatcher
+{
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	void watch(const std::string& path);
+
+	// Non blocking, returns each changed file once
+	std::vector<std::string> poll();
+
+	// Paths are normalised so the same file always compares equal
+	static std::string normalise(const std::string& path);
+
+	static const U64 pollIntervalMicroSeconds = 250000;
+
+private:
+	std::set<std::string> files;
+
+#ifdef __linux__
+	int inotifyFd;
+	std::unordered_map<int, std::string> directories;
+#else
+	std::unordered_map<std::string, std::filesystem::file_time_type> modified;
+	U64 lastPoll;
+#endif
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "ThreadPool.hpp"
+
+// CPU frustum culling of world space bounding boxes. Boxes are kept as
+// structure of arrays, centre and half extent per axis, so the kernel tests
+// 4 (SSE) or 8 (AVX2) boxes against a plane with a handful of instructions.
+// The instruction set is picked at runtime, with a scalar fallback for
+// other CPUs.
+//
+// cull() splits the boxes into chunks across worker threads, the calling
+// thread takes the first chunk. Each chunk writes its visible indices in
+// place and the chunks are then packed into one ascending list.
+class FrustumCuller
+{
+public:
+	enum Isa
+	{
+		Scalar,
+		Sse,
+		Avx2
+	};
+
+	// Chunks smaller than this aren't worth handing to another thread
+	static const U32 minObjectsPerThread = 4096;
+
+	// 0 culls on one thread per hardware core
+	FrustumCuller(U32 threadCount = 0);
+
+	static Isa detectIsa();
+	static const char* getIsaName(Isa isa);
+
+	void clear();
+	void reserve(U32 count);
+	U32 size() const { return U32(centreX.size()); }
+	// World space box added at index
+	void getBounds(U32 index, glm::vec3& minimum, glm::vec3& maximum) const;
+
+	// World space box, returns its index
+	U32 add(const glm::vec3& minimum, const glm::vec3& maximum);
+	// Model space box moved into world space by transform
+	U32 add(const glm::vec3& minimum, const glm::vec3& maximum, const glm::mat4& transform);
+
+	// Fills visible with the indices of boxes at least partly inside the
+	// frustum of viewProjection, in ascending order
+	void cull(const glm::mat4& viewProjection, std::vector<U32>& visible);
+	void cull(const glm::mat4& viewProjection, std::vector<U32>& visible, Isa isa, U32 threadCount);
+
+	Isa getIsa() const { return isa; }
+	U32 threadCount() const { return threads; }
+
+	// Planes as (normal, distance) with normals pointing inside, from a clip
+	// space matrix with 0..1 depth
+	static void getFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
+
+private:
+	U32 cullRange(const glm::vec4 planes[6], U32 begin, U32 end, U32* out, Isa useIsa) const;
+	U32 cullScalar(const glm::vec4 planes[6], U32 begin, U32 end, U32* out) const;
+	U32 cullSse(const glm::vec4 planes[6], U32 begin, U32 end, U32* out) const;
+	U32 cullAvx2(const glm::vec4 planes[6], U32 begin, U32 end, U32* out) const;
+
+	std::vector<float> centreX, centreY, centreZ;
+	std::vector<float> extentX, extentY, extentZ;
+
+	Isa isa;
+	U32 threads;
+	// The calling thread culls too, so the pool has threads - 1 workers
+	std::unique_ptr<ThreadPool> workers;
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "DrawList.hpp"
+#include "DescriptorLayoutCache.hpp"
+#include "ShaderPermutations.hpp"
+
+// GPU driven draws. Every frame a compute pass on the compute queue frustum
+// culls the bounding sphere of each draw in the sorted list and writes the
+// survivors as VkDrawIndexedIndirectCommand. The graphics pass then issues
+// one indirect draw per batch, so its recording cost depends on the number
+// of batches rather than objects.
+//
+// Each batch owns the command range [first, first + count). With
+// VK_KHR_draw_indirect_count the survivors are compacted to the front of
+// their range and the per-batch count is read by the GPU. Without it every
+// object keeps its slot and culled ones get instanceCount 0.
+//
+// Commands use firstInstance to index the frame's InstanceBuffer, so only
+// instanced pipelines can be drawn this way.
+class GpuCulling
+{
+public:
+	static bool enabled;
+	// Reads back the visible counts after each frame and compares them with
+	// the same test done on the CPU
+	static bool verify;
+
+	static const U32 groupSize = 64;
+
+	// std430 layout of the shader's Object
+	struct Object
+	{
+		glm::vec4 sphere;
+		U32 indexCount;
+		U32 batch;
+		U32 batchFirst;
+		U32 pad;
+	};
+
+	// Returns false, with a warning, if the device can't draw this way.
+	// indirectCount tells whether VK_KHR_draw_indirect_count was enabled.
+	bool init(VkDevice device, U32 queueFamily, VkQueue queue, U32 frameCount, DescriptorLayoutCache& layoutCache, bool indirectCount);
+	void destroy();
+
+	bool isActive() { return pipeline != VK_NULL_HANDLE; }
+	bool hasDrawCount() { return drawIndirectCount != nullptr; }
+
+	// Uploads the sorted list's objects for a frame slot. transforms is the
+	// slot's InstanceBuffer, holding the draws' transforms in sorted order.
+	void prepare(U32 frame, const DrawList& drawList, VkBuffer transforms, const glm::mat4& viewProjection);
+
+	// Records and submits the cull dispatch. The graphics submit must wait on
+	// the returned semaphore at VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT.
+	VkSemaphore dispatch(U32 frame);
+
+	// Indirect draws for one batch, with its mesh and pipeline already bound
+	void draw(VkCommandBuffer commandBuffer, U32 frame, U32 batch, const DrawList::Batch& range);
+
+	// The slot's indirect commands and per batch counts, none while inactive
+	VkBuffer getCommands(U32 frame) { return frames.empty() ? VK_NULL_HANDLE : frames[frame].commands; }
+	VkBuffer getCounts(U32 frame) { return frames.empty() ? VK_NULL_HANDLE : frames[frame].counts; }
+
+	// Call once the frame's GPU work has finished
+	void check(U32 frame);
+
+	// Planes from FrustumCuller::getFrustumPlanes
+	static bool isVisible(const glm::vec4 planes[6], const glm::vec4& sphere, const glm::mat4& transform);
+
+	U64 getCheckedFrames() { return checkedFrames; }
+	U64 getMismatches() { return mismatches; }
+
+private:
+	// Matches the shader's push constant block
+	struct Constants
+	{
+		glm::vec4 planes[6];
+		U32 objectCount;
+		U32 compact;
+	};
+
+	struct Frame
+	{
+		VkBuffer objects = VK_NULL_HANDLE;
+		VkDeviceMemory objectsMemory = VK_NULL_HANDLE;
+		Object* mappedObjects = nullptr;
+
+		VkBuffer commands = VK_NULL_HANDLE;
+		VkDeviceMemory commandsMemory = VK_NULL_HANDLE;
+
+		VkBuffer counts = VK_NULL_HANDLE;
+		VkDeviceMemory countsMemory = VK_NULL_HANDLE;
+		U32* mappedCounts = nullptr;
+
+		U32 objectCapacity = 0;
+		U32 batchCapacity = 0;
+
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkSemaphore finished = VK_NULL_HANDLE;
+
+		Constants constants;
+		U32 batchCount = 0;
+		VkBuffer transforms = VK_NULL_HANDLE;
+
+		// CPU reference counts, only kept when verifying
+		std::vector<U32> expected;
+	};
+
+	void reserve(Frame& frame, U32 objectCount, U32 batchCount);
+	void release(Frame& frame);
+	void updateDescriptors(Frame& frame);
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueue queue = VK_NULL_HANDLE;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+
+	ShaderPermutations shader { ShaderModule::Compute };
+
+	PFN_vkCmdDrawIndexedIndirectCountKHR drawIndirectCount = nullptr;
+	U32 maxDrawIndirectCount = 1;
+
+	std::vector<Frame> frames;
+
+	U64 checkedFrames = 0;
+	U64 mismatches = 0;
+};
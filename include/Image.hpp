@@ -15,5 +15,7 @@ public:
 	U32 mipLevels;
 
 	void load(std::string path);
+	// Decodes a whole image file already in memory, empty data when it can't
+	void loadMemory(const U8* bytes, size_t size);
 	void save(std::string path);
 };
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "PCH.hpp"
+
+// Per-instance transforms for one frame slot, read by the vertex shader as an
+// instance rate vertex buffer: one mat4 per instance, one vec4 column per
+// location starting at firstLocation. Host visible and mapped for its whole
+// life. reserve() only reallocates when a frame needs more than any before.
+class InstanceBuffer
+{
+public:
+	static const U32 binding = 1;
+	static const U32 firstLocation = 3;
+
+	void reserve(U32 instanceCount);
+	void destroy();
+
+	glm::mat4* data() { return mapped; }
+	VkBuffer getBuffer() { return buffer; }
+	U32 getCapacity() { return capacity; }
+
+	static VkVertexInputBindingDescription getBindingDescription();
+	static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions();
+
+private:
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	glm::mat4* mapped = nullptr;
+	U32 capacity = 0;
+};
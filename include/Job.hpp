@@ -0,0 +1,92 @@
+#pragma once
+
+#include "PCH.hpp"
+
+#include <memory>
+#include <new>
+
+// Jobs still to finish, waited on after spawning them
+class JobCounter
+{
+public:
+	bool isDone() const { return pending.load(std::memory_order_acquire) == 0; }
+
+	void add() { pending.fetch_add(1, std::memory_order_relaxed); }
+	void finish() { pending.fetch_sub(1, std::memory_order_acq_rel); }
+
+private:
+	std::atomic<U32> pending { 0 };
+};
+
+// A callable of up to 40 bytes kept in place, so spawning one allocates
+// nothing. Slots live in a JobRing of the spawning thread and stay busy
+// until the job has run.
+struct Job
+{
+	static const U32 storageSize = 40;
+
+	// Calls and destroys the callable in storage
+	void (*invoke)(Job& job) = nullptr;
+	JobCounter* counter = nullptr;
+	std::atomic<bool> busy { false };
+	alignas(8) unsigned char storage[storageSize];
+
+	template<class F>
+	void bind(F&& f, JobCounter* counter);
+
+	// Runs the callable, frees the slot, then counts the job as finished.
+	// The waiter may destroy the counter as soon as it reaches 0, and the
+	// spawner may reuse the slot as soon as it's free.
+	void execute()
+	{
+		invoke(*this);
+		JobCounter* finished = counter;
+		busy.store(false, std::memory_order_release);
+		if (finished)
+			finished->finish();
+	}
+};
+
+template<class F>
+void Job::bind(F&& f, JobCounter* counter)
+{
+	using Callable = typename std::decay<F>::type;
+	static_assert(sizeof(Callable) <= storageSize, "Job callable too large, capture by reference or pointer");
+	static_assert(alignof(Callable) <= 8, "Job callable over aligned");
+
+	new (storage) Callable(std::forward<F>(f));
+	invoke = [](Job& job)
+	{
+		Callable& callable = *reinterpret_cast<Callable*>(job.storage);
+		callable();
+		callable.~Callable();
+	};
+	this->counter = counter;
+	if (counter)
+		counter->add();
+}
+
+// Job slots handed out in order by one thread, reused once they've run
+class JobRing
+{
+public:
+	static const U32 capacity = 4096;
+
+	JobRing() : jobs(new Job[capacity]) {}
+
+	// nullptr when the oldest slot's job still hasn't run
+	Job* allocate()
+	{
+		Job& job = jobs[next & (capacity - 1)];
+		if (job.busy.load(std::memory_order_acquire))
+			return nullptr;
+
+		job.busy.store(true, std::memory_order_relaxed);
+		++next;
+		return &job;
+	}
+
+private:
+	std::unique_ptr<Job[]> jobs;
+	U32 next = 0;
+};
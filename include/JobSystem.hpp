@@ -0,0 +1,129 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "Job.hpp"
+#include "WorkStealingDeque.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Fork-join job system with work stealing. Every thread taking part, the
+// workers and the thread that made the system, owns a Chase-Lev deque: it
+// pushes and pops its own jobs at the bottom without locking while idle
+// threads steal from the top of the others'. Jobs are grouped by a Counter,
+// and a thread waiting on one runs jobs meanwhile instead of blocking, so
+// jobs can spawn and wait for jobs of their own.
+//
+// A job is any callable of up to 40 bytes, kept in a JobRing of the thread
+// that spawned it. When the deque or the ring is full the job runs right
+// away on the spawning thread. Threads outside the system run their jobs
+// inline too.
+class JobSystem
+{
+public:
+	using Counter = JobCounter;
+
+	// threadCount includes the calling thread, 0 uses every core. Pinning
+	// keeps each worker on its own core, the calling thread isn't moved.
+	JobSystem(U32 threadCount = 0, bool pinThreads = false);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// Queues f() to run on any thread, counted by counter when there is one
+	template<class F>
+	void run(F&& f, Counter* counter = nullptr);
+
+	// Runs jobs until everything counted by counter has finished
+	void wait(Counter& counter);
+
+	// f(begin, end) over [0, count) in chunks of at least grain items, and
+	// returns once all are done. A range is halved only while the halves
+	// split off before are being stolen, so a loop nobody helps with costs a
+	// handful of jobs and a contended one keeps splitting until it balances.
+	template<class F>
+	void parallelFor(U32 count, U32 grain, F&& f);
+
+	U32 threadCount() const { return U32(workers.size()); }
+
+private:
+	struct alignas(64) Worker
+	{
+		WorkStealingDeque<Job> deque;
+		JobRing jobs;
+		// Where stealing starts, spread so thieves don't all hit one victim
+		U32 victim = 0;
+		std::thread thread;
+	};
+
+	// The calling thread's worker, nullptr when it isn't part of the system
+	Worker* currentWorker();
+	void submit(Worker& self, Job* job);
+	// Own jobs newest first, then other threads' oldest first
+	Job* take(Worker& self);
+
+	template<class F>
+	void forRange(U32 begin, U32 end, U32 grain, F& f, Counter& counter);
+
+	void workerLoop(U32 index);
+
+	// Worker 0 is the thread that made the system
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::thread::id ownerThread;
+
+	// Jobs sitting in deques, idle workers sleep while it's 0
+	std::atomic<S32> queued { 0 };
+	std::atomic<U32> sleeping { 0 };
+	std::atomic<bool> stopping { false };
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+};
+
+template<class F>
+void JobSystem::run(F&& f, Counter* counter)
+{
+	Worker* self = currentWorker();
+	Job* job = self ? self->jobs.allocate() : nullptr;
+	if (!job)
+	{
+		f();
+		return;
+	}
+
+	job->bind(std::forward<F>(f), counter);
+	submit(*self, job);
+}
+
+template<class F>
+void JobSystem::parallelFor(U32 count, U32 grain, F&& f)
+{
+	if (count == 0)
+		return;
+
+	Counter counter;
+	forRange(0, count, std::max(grain, 1u), f, counter);
+	wait(counter);
+}
+
+template<class F>
+void JobSystem::forRange(U32 begin, U32 end, U32 grain, F& f, Counter& counter)
+{
+	Worker* self = currentWorker();
+	while (end - begin > grain)
+	{
+		// An empty deque means the last half split off was stolen, or this is
+		// the first piece, so there's demand for another
+		if (self && end - begin >= 2 * grain && self->deque.empty())
+		{
+			U32 middle = begin + (end - begin) / 2;
+			run([this, middle, end, grain, &f, &counter]() { forRange(middle, end, grain, f, counter); }, &counter);
+			end = middle;
+			continue;
+		}
+		f(begin, begin + grain);
+		begin += grain;
+	}
+	f(begin, end);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "LightClusters.hpp"
+
+// The binned lights as the storage buffers shaders/clusters.glsl reads: the
+// lights themselves, the cluster header followed by each froxel's range, and
+// the compact light index list. Host visible and mapped for their whole life.
+// There's one copy, like the uniform buffer, since the renderer waits for
+// each frame to finish before building the next.
+class LightClusterBuffer
+{
+public:
+	static const U32 lightsBinding = 3;
+	static const U32 clustersBinding = 4;
+	static const U32 indicesBinding = 5;
+
+	// Copies the lights and the bins of this frame. Returns true when a buffer
+	// was replaced to make room and the descriptors have to be written again.
+	bool upload(const LightClusters& clusters, const LightClusters::Light* lights, U32 lightCount);
+	void writeDescriptors(VkDescriptorSet descriptorSet);
+	void destroy();
+
+	// Bytes written by the last upload
+	U64 getUploadSize() const { return uploadSize; }
+
+private:
+	struct Buffer
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		U8* mapped = nullptr;
+		VkDeviceSize capacity = 0;
+	};
+
+	// Only reallocates when size is more than any frame needed before, or
+	// creates the buffer at its minimum capacity the first time
+	static bool reserve(Buffer& buffer, VkDeviceSize size);
+	static void release(Buffer& buffer);
+
+	Buffer lightBuffer, clusterBuffer, indexBuffer;
+	U64 uploadSize = 0;
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "FrustumCuller.hpp"
+#include "ThreadPool.hpp"
+
+// Clustered forward lighting, the CPU half. The view frustum is cut into a
+// grid of froxels: gridX by gridY screen tiles and gridZ depth slices spaced
+// exponentially between the near and far plane. Each froxel's view space box
+// is worked out once per projection.
+//
+// bin() moves the frame's lights into view space and tests each against the
+// froxels it could touch: a light's bounding sphere against the boxes, and a
+// spot light's cone against the boxes' bounding spheres as well. The boxes are
+// kept as structure of arrays one row of tiles at a time, so 4 (SSE) or 8
+// (AVX2) froxels are tested per instruction. Slices are handed out to worker
+// threads, and within a slice whole rows are skipped when the light misses
+// their combined box.
+//
+// The result is one compact list of light indices, each froxel owning the
+// range [offset, offset + count) in ascending light order. It doesn't depend
+// on the thread count or instruction set. LightClusterBuffer uploads it for
+// shaders/clusters.glsl.
+class LightClusters
+{
+public:
+	// std430 layout of the shader's Light, world space
+	struct Light
+	{
+		glm::vec3 position;
+		float range;
+		glm::vec3 colour;
+		// Cosine and sine of the cone's half angle, -1 and 0 for point lights
+		float cosAngle;
+		glm::vec3 direction;
+		float sinAngle;
+
+		static Light point(const glm::vec3& position, float range, const glm::vec3& colour);
+		// angle is the half angle of the cone in radians, direction is normalised.
+		// Cones of 90 degrees and wider are binned like point lights.
+		static Light spot(const glm::vec3& position, const glm::vec3& direction, float range, float angle, const glm::vec3& colour);
+	};
+
+	// std430 layout of the header at the start of the shader's cluster buffer
+	struct Header
+	{
+		U32 gridX, gridY, gridZ;
+		U32 lightCount;
+		// Pixels per tile
+		glm::vec2 tileSize;
+		// slice = log(view depth) * sliceScale + sliceBias
+		float sliceScale, sliceBias;
+		float zNear, zFar;
+		U32 pad[2];
+	};
+
+	// Light index range of one froxel
+	struct Cluster
+	{
+		U32 offset;
+		U32 count;
+	};
+
+	// 0 threads bins on every core
+	LightClusters(U32 gridX = 16, U32 gridY = 9, U32 gridZ = 24, U32 threadCount = 0);
+
+	// Perspective projection with 0..1 depth, as the renderer builds it.
+	// Recomputes the froxel boxes only when something changed.
+	void setProjection(const glm::mat4& projection, U32 width, U32 height);
+
+	// Bins the lights seen through view. Lights outside every froxel are
+	// dropped, indices refer to the array passed in.
+	void bin(const glm::mat4& view, const Light* lights, U32 count);
+	void bin(const glm::mat4& view, const Light* lights, U32 count, FrustumCuller::Isa isa, U32 threadCount);
+
+	// Every light against every froxel with the scalar tests, no slice or row
+	// skipping and no threads. Slow, for validating bin().
+	void binReference(const glm::mat4& view, const Light* lights, U32 count, std::vector<Cluster>& clusters, std::vector<U32>& indices) const;
+
+	U32 getClusterCount() const { return gridX * gridY * gridZ; }
+	// Froxel (x, y, z) is at (z * gridY + y) * gridX + x
+	const std::vector<Cluster>& getClusters() const { return clusters; }
+	const std::vector<U32>& getIndices() const { return indices; }
+	const Header& getHeader() const { return header; }
+	FrustumCuller::Isa getIsa() const { return isa; }
+	U32 threadCount() const { return threads; }
+
+	// View space box of a froxel
+	void getBounds(U32 x, U32 y, U32 z, glm::vec3& minimum, glm::vec3& maximum) const;
+
+private:
+	// A light moved into view space with its bounding sphere
+	struct ViewLight
+	{
+		glm::vec3 centre;
+		float radius;
+		glm::vec3 apex;
+		float range;
+		glm::vec3 direction;
+		float cosAngle;
+		float sinAngle;
+		bool spot;
+	};
+
+	static ViewLight toView(const glm::mat4& view, const Light& light);
+
+	// Froxels of one row hit by the light, bit i for tile x = i
+	U32 testRow(const ViewLight& light, U32 row, FrustumCuller::Isa useIsa) const;
+	U32 testRowScalar(const ViewLight& light, U32 row) const;
+	U32 testRowSse(const ViewLight& light, U32 row) const;
+	U32 testRowAvx2(const ViewLight& light, U32 row) const;
+
+	// Appends (froxel in slice, light) pairs for one slice
+	void binSlice(U32 slice, const std::vector<ViewLight>& lights, FrustumCuller::Isa useIsa, std::vector<U32>& pairs) const;
+
+	// Runs task(0..count-1), the calling thread takes part
+	void parallel(U32 count, U32 threadCount, const std::function<void(U32)>& task);
+
+	U32 gridX, gridY, gridZ;
+	// Lanes per row, gridX rounded up to a whole AVX2 block
+	U32 rowStride;
+
+	Header header = {};
+	glm::mat4 projection = glm::mat4(0.0f);
+	U32 width = 0, height = 0;
+
+	// Froxel boxes and bounding spheres by row, padding lanes never hit
+	std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+	std::vector<float> sphereX, sphereY, sphereZ, sphereRadius;
+	// Box around each row's froxels, and each slice's view space z range
+	std::vector<glm::vec3> rowMin, rowMax;
+	std::vector<float> sliceMinZ, sliceMaxZ;
+
+	std::vector<ViewLight> viewLights;
+	std::vector<Cluster> clusters;
+	std::vector<U32> indices;
+	// Per slice pairs, kept to reuse their allocations
+	std::vector<std::vector<U32>> slicePairs;
+
+	FrustumCuller::Isa isa;
+	U32 threads;
+	// The calling thread bins too, so the pool has threads - 1 workers
+	std::unique_ptr<ThreadPool> workers;
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "Mesh.hpp"
+#include "ThreadPool.hpp"
+#include "TriangleBvh.hpp"
+
+class Image;
+
+// Offline ambient occlusion and light baker, CPU only so it runs headlessly.
+// Every texel of the lightmap covered by a triangle in texture space gets a
+// model space position and face normal, and rays are traced from there
+// through the mesh's TriangleBvh:
+//   - a cosine weighted hemisphere ray, which counts as occluded for ambient
+//     occlusion when it hits within aoDistance and otherwise sees the sky or
+//     the sunlight bounced once off the surface it hits
+//   - a shadow ray towards a point on the sun's disc for direct light
+//
+// The texels are split into square tiles handed out to every thread, and the
+// bake runs in passes of samplesPerPass rays per texel so a preview can be
+// resolved between passes. Each sample's random numbers come from a hash of
+// the seed, texel and sample index, so the result is the same whatever the
+// thread count or tile order.
+//
+// Texture coordinates must not overlap, texels claimed by two triangles go to
+// the first. unwrap() gives meshes without a usable unwrap a simple one.
+class LightmapBaker
+{
+public:
+	struct Settings
+	{
+		U32 width = 512;
+		U32 height = 512;
+		// Per texel in total and per refine() call
+		U32 samples = 256;
+		U32 samplesPerPass = 16;
+		U32 tileSize = 32;
+		// 0 uses every core
+		U32 threads = 0;
+		U32 seed = 1;
+
+		// Occluders farther away don't darken ambient occlusion, 0 is a
+		// quarter of the mesh's bounding sphere radius
+		float aoDistance = 0.0f;
+
+		// Light is left out of the bake entirely when false, only ambient
+		// occlusion is traced
+		bool light = true;
+		glm::vec3 skyColour = glm::vec3(0.5f, 0.6f, 0.75f);
+		// Towards the sun, doesn't need to be normalised
+		glm::vec3 sunDirection = glm::vec3(0.4f, 1.0f, 0.3f);
+		glm::vec3 sunColour = glm::vec3(1.0f, 0.95f, 0.85f);
+		// Angular radius of the sun's disc in radians, softens shadows
+		float sunRadius = 0.02f;
+		// Grey reflectance used for the bounce
+		float albedo = 0.5f;
+
+		// Texels grown out of the covered area so filtering at chart edges
+		// doesn't pick up black
+		U32 dilation = 2;
+	};
+
+	struct Stats
+	{
+		U32 texels = 0;
+		// Texels already claimed by another triangle, non zero when the
+		// texture coordinates overlap
+		U32 overlaps = 0;
+		U32 threads = 0;
+		U32 passes = 0;
+		U32 samples = 0;
+		U64 rays = 0;
+		// Tracing time only, preparing and resolving aren't counted
+		double seconds = 0.0;
+
+		double raysPerSecond() const { return seconds > 0.0 ? rays / seconds : 0.0; }
+		double raysPerSecondPerCore() const { return threads ? raysPerSecond() / threads : 0.0; }
+	};
+
+	// Both have to live as long as the baker, the tree built from the mesh
+	LightmapBaker(const Mesh& mesh, const TriangleBvh& bvh, const Settings& settings);
+
+	// Replaces the mesh's texture coordinates with a lightmap unwrap: every
+	// triangle gets its own corner of a grid cell shared with the next one,
+	// with a texel of padding around it for the given lightmap size. Vertices
+	// are duplicated per triangle. The texel density ignores triangle size so
+	// it suits evenly tessellated meshes.
+	static void unwrap(Mesh& mesh, U32 width, U32 height);
+
+	// One pass of samplesPerPass more samples per texel, false once all
+	// samples are in or there are no texels to bake
+	bool refine();
+	// Refines to the end, progress is called after every pass
+	void bake(const std::function<void(const Stats&)>& progress = nullptr);
+
+	// Averages the samples so far into 8 bit images, ambient occlusion as grey
+	// and light gamma encoded. Texels no triangle covers stay black apart from
+	// the dilated border.
+	void resolve(Image& ambientOcclusion, Image& light) const;
+
+	const Stats& getStats() const { return stats; }
+	const Settings& getSettings() const { return settings; }
+
+private:
+	struct Texel
+	{
+		glm::vec3 position;
+		glm::vec3 normal;
+		U32 pixel;
+	};
+
+	// Running sums for one texel
+	struct Accumulator
+	{
+		glm::vec3 light;
+		float visibility;
+	};
+
+	// Rasterises the triangles in texture space into texels grouped by tile
+	void prepare();
+	// Samples [first, first + count) for the texels of one tile, returns the
+	// rays traced
+	U64 traceTile(U32 tile, U32 first, U32 count);
+	// Sun light reaching a surface, 0 when shadowed
+	glm::vec3 sunLight(const glm::vec3& position, const glm::vec3& normal, U32 pixel, U32 sample, U32 dimension, U64& rays) const;
+
+	const Mesh& mesh;
+	const TriangleBvh& bvh;
+	Settings settings;
+	Stats stats;
+
+	glm::vec3 sun;
+	float aoDistance;
+	// Ray origins are pushed off the surface by this much
+	float bias;
+
+	// Face normal of every triangle, for the surface a bounce ray hits
+	std::vector<glm::vec3> normals;
+	std::vector<Texel> texels;
+	// Texels of tile i are [tileStart[i], tileStart[i + 1])
+	std::vector<U32> tileStart;
+	std::vector<Accumulator> accumulators;
+
+	std::unique_ptr<ThreadPool> workers;
+};
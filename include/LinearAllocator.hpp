@@ -0,0 +1,44 @@
+#pragma once
+
+#include "PCH.hpp"
+
+#include <memory>
+#include <type_traits>
+
+// Bump allocator for data that only lives for a frame. Everything is
+// released at once by reset(), nothing is destructed. When a frame needs more
+// than the block holds the rest comes from overflow blocks, and the next
+// reset grows the block to the high water mark, so a steady workload stops
+// touching the heap after its first frame.
+class LinearAllocator
+{
+public:
+	LinearAllocator(size_t capacity = 64 * 1024);
+
+	LinearAllocator(const LinearAllocator&) = delete;
+	LinearAllocator& operator=(const LinearAllocator&) = delete;
+
+	// Alignment must be a power of two no larger than alignof(std::max_align_t)
+	void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	template<class T>
+	T* allocate(size_t count = 1)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Frame allocations are never destructed");
+		return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	void reset();
+
+	size_t getCapacity() { return capacity; }
+	// Bytes handed out since the last reset, overflow included
+	size_t getUsed() { return offset + overflowBytes; }
+
+private:
+	std::unique_ptr<U8[]> block;
+	size_t capacity;
+	size_t offset = 0;
+
+	std::vector<std::unique_ptr<U8[]>> overflow;
+	size_t overflowBytes = 0;
+};
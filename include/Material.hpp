@@ -0,0 +1,22 @@
+#pragma once
+
+#include "PCH.hpp"
+
+// Everything a draw binds besides its mesh
+struct Material
+{
+	Material() : id(nextId++) {}
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+	// Small and unique, draws are sorted on it
+	U32 id;
+	// Small id of the pipeline, set by the owner. Draws are grouped by it
+	// before anything else.
+	U32 pipelineId = 0;
+
+private:
+	static inline std::atomic<U32> nextId { 0 };
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "Vertex.hpp"
+
+// CPU side mesh data, shared by the runtime (Model) and the offline asset cooker.
+// Has no Vulkan dependencies beyond the vertex layout so it can be used headlessly.
+class Mesh
+{
+public:
+	Mesh() {}
+	~Mesh() {}
+
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+
+	bool loadObj(std::string path);
+
+	// Reorders triangles for post-transform vertex cache reuse and then
+	// vertices in first-use order for linear vertex fetch.
+	void optimise();
+
+	// Axis aligned box of the vertices and a sphere centred on the box, not
+	// the minimal sphere but one pass and tight enough for culling
+	void computeBounds(glm::vec3& minimum, glm::vec3& maximum, glm::vec4& sphere) const;
+
+	bool loadCooked(std::string path);
+	bool saveCooked(std::string path);
+
+	static const U32 cookedMagic = 0x534D4556; // "VEMS"
+	static const U32 cookedVersion = 1;
+
+private:
+	void optimiseVertexCache();
+	void optimiseVertexFetch();
+};
@@ -2,11 +2,13 @@
 
 #include "PCH.hpp"
 #include "Vertex.hpp"
+#include "Mesh.hpp"
+#include "TriangleBvh.hpp"
 
 class Model 
 {
 public:
-    Model() {}
+    Model() : id(nextId++) {}
     //Model(std::string path);
     ~Model() {}
 
@@ -20,13 +22,28 @@ public:
     const VkBuffer& getVertexBuffer() { return vkVertexBuffer; }
     const VkBuffer& getIndexBuffer() { return vkIndexBuffer; }
 
-    const size_t getVerticesSize() { return vertices.size(); }
-    const size_t getIndicesSize() { return indices.size(); }
+    const size_t getVerticesSize() { return mesh.vertices.size(); }
+    const size_t getIndicesSize() { return mesh.indices.size(); }
+    const Mesh& getMesh() const { return mesh; }
+    // Model space triangles for picking. Loaded with a cooked mesh when the
+    // cooker wrote one, otherwise built on first use, which is slow for big
+    // meshes and not thread safe.
+    const TriangleBvh& getTriangleBvh();
+
+    // Small and unique, draws are sorted on it
+    U32 id;
+
+    // Model space, set by load(). The sphere's xyz is its centre and w the radius.
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    glm::vec4 boundingSphere = glm::vec4(0.0f);
 private:
+    static inline std::atomic<U32> nextId { 0 };
+
     std::string modelName;
 
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
+	Mesh mesh;
+	TriangleBvh triangleBvh;
 
     VkBuffer vkVertexBuffer;
 	VkDeviceMemory vkVertexBufferMemory;
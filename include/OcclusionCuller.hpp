@@ -0,0 +1,113 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "Mesh.hpp"
+#include "ThreadPool.hpp"
+
+class Image;
+
+// CPU occlusion culling. A few large occluder meshes are rasterised into a
+// small depth buffer, which is reduced into a hierarchical Z pyramid where
+// each texel holds the farthest depth below it. A box is hidden when its
+// nearest point is behind the farthest occluder over its screen rectangle,
+// read from the pyramid level where that rectangle covers at most 2x2
+// texels.
+//
+// Rasterising is binned: triangles are set up and sorted into screen tiles
+// in parallel chunks, then each tile is filled by one thread, 4 pixels at a
+// time with SSE where available. Tiles never share pixels so no locking is
+// needed, and the result doesn't depend on the thread count.
+//
+// Depth follows the renderer: 0..1 with 0 nearest, cleared to 1.
+class OcclusionCuller
+{
+public:
+	static const U32 tileWidth = 64;
+	static const U32 tileHeight = 32;
+
+	// Sizes are rounded up to whole tiles. 0 threads uses every core.
+	OcclusionCuller(U32 width = 512, U32 height = 256, U32 threadCount = 0);
+
+	// Forgets the occluders
+	void clear();
+	// The mesh is read by rasterise(), it has to live until then
+	void addOccluder(const Mesh& mesh, const glm::mat4& transform);
+	U32 getOccluderCount() const { return U32(occluders.size()); }
+
+	// Renders the occluders seen through viewProjection and builds the pyramid
+	void rasterise(const glm::mat4& viewProjection);
+	void rasterise(const glm::mat4& viewProjection, bool simd, U32 threadCount);
+
+	// World space box. False when it is hidden behind the occluders or entirely
+	// off screen, true when in doubt, e.g. crossing the near plane.
+	bool isVisible(const glm::vec3& minimum, const glm::vec3& maximum) const;
+
+	// Per pixel brute force over every triangle with no binning, tiles or
+	// SIMD. Slow, for validating rasterise().
+	void rasteriseReference(const glm::mat4& viewProjection, std::vector<float>& depth);
+
+	U32 getWidth() const { return width; }
+	U32 getHeight() const { return height; }
+	U32 getLevelCount() const { return U32(levels.size()); }
+	// Row major, level 0 is the full resolution depth buffer
+	const std::vector<float>& getLevel(U32 level) const { return levels[level].depth; }
+	U32 getTriangleCount() const { return triangleCount; }
+
+	// Grey scale, nearest white and far plane black, for Image::save
+	static void toImage(const std::vector<float>& depth, U32 width, U32 height, Image& image);
+
+	static bool hasSimd();
+
+private:
+	struct Occluder
+	{
+		const Mesh* mesh;
+		glm::mat4 transform;
+	};
+
+	// Screen space, edge functions are positive inside
+	struct Triangle
+	{
+		float a[3], b[3], c[3];
+		// Depth plane z = zx * x + zy * y + z0
+		float zx, zy, z0;
+		S32 minX, minY, maxX, maxY;
+	};
+
+	struct Level
+	{
+		U32 width, height;
+		std::vector<float> depth;
+	};
+
+	// Triangles set up by one chunk and their tile bins
+	struct Bins
+	{
+		std::vector<Triangle> triangles;
+		std::vector<std::vector<U32>> tiles;
+	};
+
+	void setup(const glm::mat4& viewProjection, U32 begin, U32 end, Bins& bins);
+	void addTriangle(const glm::vec4 clip[3], std::vector<Triangle>& triangles);
+	void rasteriseTile(U32 tile, bool simd);
+	void fill(const Triangle& triangle, S32 x0, S32 y0, S32 x1, S32 y1, bool simd);
+	void buildPyramid();
+
+	// Runs task(0..count-1), the calling thread takes part
+	void parallel(U32 count, U32 threadCount, const std::function<void(U32)>& task);
+
+	U32 width, height;
+	U32 tilesX, tilesY;
+	std::vector<Level> levels;
+
+	std::vector<Occluder> occluders;
+	// Triangle index each occluder starts at
+	std::vector<U32> firstTriangle;
+	U32 triangleCount = 0;
+
+	std::vector<Bins> chunks;
+	glm::mat4 viewProjection = glm::mat4(1.0f);
+
+	U32 threads;
+	std::unique_ptr<ThreadPool> workers;
+};
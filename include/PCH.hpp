@@ -52,6 +52,8 @@
 #include <functional>
 
 #include <array>
+
+#include <atomic>
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "ThreadPool.hpp"
+
+// VkPipelineCache persisted between runs. The saved blob is only handed back
+// to the driver when its header matches the current vendor, device and
+// pipelineCacheUUID, otherwise the cache starts empty.
+//
+// Pipelines can also be built on worker threads through submit(), so new
+// pipelines don't have to stall the frame loop.
+class PipelineCache
+{
+public:
+	static std::string path;
+	static bool enabled;
+
+	static VkPipelineCache vkPipelineCache;
+
+	// Set when VK_EXT_pipeline_creation_feedback is enabled on the device,
+	// without it cache hits can't be told apart from misses
+	static bool creationFeedback;
+
+	static void init(VkDevice device, const VkPhysicalDeviceProperties& properties);
+	static void save(VkDevice device);
+	static void destroy(VkDevice device);
+
+	// Creates through the cache and records "pipeline create" plus
+	// "pipeline cache hit"/"pipeline cache miss" counters in the Profiler.
+	// Safe to call from any thread.
+	static VkResult createGraphicsPipeline(VkDevice device, const VkGraphicsPipelineCreateInfo& info, VkPipeline& pipeline);
+	// Through the cache too, only records "pipeline create"
+	static VkResult createComputePipeline(VkDevice device, const VkComputePipelineCreateInfo& info, VkPipeline& pipeline);
+
+	// Runs build on a pipeline worker. Everything the create info points to
+	// must be owned by build itself, not by the submitting frame.
+	template<class F>
+	static auto submit(F&& build) -> std::future<decltype(build())>
+	{
+		return workers().submit(std::forward<F>(build));
+	}
+
+	// True when data starts with a pipeline cache header for this device
+	static bool isCompatible(const std::vector<U8>& data, const VkPhysicalDeviceProperties& properties);
+
+private:
+	static ThreadPool& workers();
+};
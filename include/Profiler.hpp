@@ -4,6 +4,8 @@
 #include "Time.hpp"
 #include "Engine.hpp"
 
+#include <mutex>
+
 class Profiler
 {
 public:
@@ -25,8 +27,32 @@ public:
         return times[id].second;
     }
 
-private:
-    static std::unordered_map<std::string, std::pair<Time,Time>> times;
-};
+    struct Counter
+    {
+        U64 count = 0;
+        S64 totalMicroSeconds = 0;
+        S64 maxMicroSeconds = 0;
+    };
+
+    // Unlike start/end this is safe to call from worker threads
+    static void record(const std::string& id, S64 microSeconds = 0)
+    {
+        std::lock_guard<std::mutex> lock(countersMutex);
+        Counter& c = counters[id];
+        ++c.count;
+        c.totalMicroSeconds += microSeconds;
+        c.maxMicroSeconds = std::max(c.maxMicroSeconds, microSeconds);
+    }
 
-std::unordered_map<std::string, std::pair<Time, Time>> Profiler::times;
\ No newline at end of file
+    static Counter getCounter(const std::string& id)
+    {
+        std::lock_guard<std::mutex> lock(countersMutex);
+        auto it = counters.find(id);
+        return it != counters.end() ? it->second : Counter();
+    }
+
+private:
+    static inline std::unordered_map<std::string, std::pair<Time,Time>> times;
+    static inline std::unordered_map<std::string, Counter> counters;
+    static inline std::mutex countersMutex;
+};
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "PCH.hpp"
+
+// LSD radix sort of records on their 64-bit `key` member, 8 bits per pass.
+// Stable. All eight histograms are built in one read of the input, and a
+// pass is skipped when every key has the same digit in it, so keys that only
+// use a few of their bits sort in fewer passes.
+class RadixSort
+{
+public:
+	// scratch must hold count records. The result ends up in data.
+	template<class T>
+	static void sort(T* data, T* scratch, size_t count);
+};
+
+template<class T>
+void RadixSort::sort(T* data, T* scratch, size_t count)
+{
+	if (count < 2)
+		return;
+
+	size_t histograms[8][256] = {};
+	for (size_t i = 0; i < count; ++i)
+	{
+		U64 key = data[i].key;
+		for (int digit = 0; digit < 8; ++digit)
+			++histograms[digit][(key >> (digit * 8)) & 0xFF];
+	}
+
+	T* from = data;
+	T* to = scratch;
+	for (int digit = 0; digit < 8; ++digit)
+	{
+		size_t* histogram = histograms[digit];
+		if (histogram[(from[0].key >> (digit * 8)) & 0xFF] == count)
+			continue;
+
+		size_t offset = 0;
+		for (int bucket = 0; bucket < 256; ++bucket)
+		{
+			size_t n = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += n;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+			to[histogram[(from[i].key >> (digit * 8)) & 0xFF]++] = from[i];
+		std::swap(from, to);
+	}
+
+	if (from != data)
+		std::copy(from, from + count, data);
+}
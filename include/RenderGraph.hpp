@@ -0,0 +1,205 @@
+#pragma once
+
+#include "PCH.hpp"
+
+// Frame graph of passes and the images and buffers they use. Passes declare
+// how they access each resource; compile() then works out, on the CPU only:
+//   - which passes can be culled because nothing uses what they write
+//   - the pass order, and which passes are independent of each other
+//   - one merged vkCmdPipelineBarrier per pass with exact stages, accesses
+//     and layout transitions
+//   - a memory plan placing transient resources whose lifetimes don't
+//     overlap at the same offset of a single allocation
+// Passes see resources in declaration order: a read observes the latest
+// write declared before it.
+//
+// compile() needs no device, resource sizes come from the descriptions.
+// realize() creates and binds the transient resources, execute() records.
+class RenderGraph
+{
+public:
+	typedef U32 Resource;
+	typedef U32 Pass;
+
+	static constexpr U32 invalid = ~0u;
+
+	enum Access
+	{
+		None,
+		ColorAttachment,		// write
+		DepthAttachment,		// write
+		DepthRead,
+		FragmentSampled,
+		ComputeSampled,
+		ComputeStorageRead,
+		ComputeStorageWrite,	// write
+		IndirectRead,
+		VertexRead,
+		TransferRead,
+		TransferWrite,			// write
+		Present
+	};
+
+	struct AccessInfo
+	{
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		VkImageLayout layout;
+		bool write;
+	};
+
+	static AccessInfo getAccessInfo(Access access);
+
+	struct ImageDesc
+	{
+		VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+		U32 width = 1;
+		U32 height = 1;
+		U32 mipLevels = 1;
+		VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+	};
+
+	struct BufferDesc
+	{
+		VkDeviceSize size = 0;
+	};
+
+	// Transient resources only exist for the graph, their memory may be aliased
+	Resource createImage(const std::string& name, const ImageDesc& desc);
+	Resource createBuffer(const std::string& name, const BufferDesc& desc);
+
+	// Resources owned elsewhere, e.g. the swapchain image. Writes to them are
+	// never culled. If finalAccess is set they are transitioned to it at the
+	// end of the graph.
+	Resource importImage(const std::string& name, VkImage image, const ImageDesc& desc, VkImageLayout currentLayout, Access finalAccess = None);
+	Resource importBuffer(const std::string& name, VkBuffer buffer, VkDeviceSize size, Access finalAccess = None);
+
+	// Imported handles may change between frames without recompiling
+	void setImage(Resource resource, VkImage image);
+	void setBuffer(Resource resource, VkBuffer buffer);
+	// Last access to an imported resource before the graph, e.g. the previous
+	// frame's or a semaphore wait's. Its first barrier waits for it rather
+	// than for nothing.
+	void setInitialAccess(Resource resource, Access access);
+
+	Pass addPass(const std::string& name, std::function<void(VkCommandBuffer)> execute = nullptr);
+	void read(Pass pass, Resource resource, Access access);
+	void write(Pass pass, Resource resource, Access access);
+	// Never culled, for passes with effects the graph can't see
+	void setSideEffect(Pass pass);
+
+	struct Barrier
+	{
+		Resource resource;
+		VkPipelineStageFlags srcStages;
+		VkPipelineStageFlags dstStages;
+		VkAccessFlags srcAccess;
+		VkAccessFlags dstAccess;
+		VkImageLayout oldLayout;
+		VkImageLayout newLayout;
+	};
+
+	// One per surviving pass, in execution order. The barriers are issued
+	// before the pass with a single call using the combined stage masks.
+	struct Step
+	{
+		Pass pass;
+		// Passes with the same level don't depend on each other
+		U32 level;
+		VkPipelineStageFlags srcStages;
+		VkPipelineStageFlags dstStages;
+		std::vector<Barrier> barriers;
+	};
+
+	struct Placement
+	{
+		Resource resource;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+	};
+
+	// Returns false, with a warning, if a pass uses a resource in a way it can't
+	bool compile();
+
+	const std::vector<Step>& getSteps() { return steps; }
+	// Transitions to the imported resources' final accesses
+	const Step& getFinalStep() { return finalStep; }
+	const std::vector<Pass>& getCulledPasses() { return culled; }
+	const std::vector<Placement>& getPlacements() { return placements; }
+	// Size of the aliased allocation and of the transient resources without aliasing
+	VkDeviceSize getHeapSize() { return heapSize; }
+	VkDeviceSize getUnaliasedSize() { return unaliasedSize; }
+
+	const std::string& getName(Pass pass) { return passes[pass].name; }
+	const std::string& getResourceName(Resource resource) { return resources[resource].name; }
+
+	// Creates the transient resources, replans their memory and barriers with
+	// the real requirements and binds them to one allocation. memoryType picks a
+	// device local type index from a memoryTypeBits mask.
+	bool realize(VkDevice device, const std::function<U32(U32)>& memoryType, VkDeviceSize bufferImageGranularity);
+	void execute(VkCommandBuffer commandBuffer);
+	void destroy(VkDevice device);
+
+	VkImage getImage(Resource resource) { return resources[resource].image; }
+	VkBuffer getBuffer(Resource resource) { return resources[resource].buffer; }
+
+	static VkDeviceSize estimateSize(const ImageDesc& desc);
+
+private:
+	struct ResourceData
+	{
+		std::string name;
+		bool isImage;
+		bool imported;
+		ImageDesc desc;
+		VkDeviceSize size;
+		VkDeviceSize alignment = 256;
+		VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		Access initialAccess = None;
+		Access finalAccess = None;
+
+		VkImage image = VK_NULL_HANDLE;
+		VkBuffer buffer = VK_NULL_HANDLE;
+
+		// Filled in by compile(), in step indices
+		U32 firstUse;
+		U32 lastUse;
+		VkImageUsageFlags imageUsage;
+		VkBufferUsageFlags bufferUsage;
+	};
+
+	struct Use
+	{
+		Resource resource;
+		Access access;
+		// Declared through write() rather than read()
+		bool write;
+	};
+
+	struct PassData
+	{
+		std::string name;
+		std::function<void(VkCommandBuffer)> execute;
+		std::vector<Use> uses;
+		bool sideEffect = false;
+	};
+
+	void cull(std::vector<bool>& live);
+	void order(const std::vector<bool>& live);
+	void planMemory();
+	bool scheduleBarriers();
+
+	std::vector<ResourceData> resources;
+	std::vector<PassData> passes;
+
+	std::vector<Step> steps;
+	Step finalStep;
+	std::vector<Pass> culled;
+	std::vector<Placement> placements;
+	VkDeviceSize heapSize = 0;
+	VkDeviceSize unaliasedSize = 0;
+
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	std::vector<VkBufferMemoryBarrier> bufferBarriers;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "LightClusters.hpp"
+#include "Material.hpp"
+#include "Model.hpp"
+
+// Everything the renderer needs to draw one frame, built by the simulation
+// on the main thread and handed to the render thread through a
+// TripleBuffer. Once published it is only read, so the simulation can go on
+// to the next frame while this one is drawn. Models and materials are
+// referenced, they belong to the renderer and outlive every snapshot.
+struct RenderSnapshot
+{
+	struct Draw
+	{
+		Model* model;
+		const Material* material;
+		glm::mat4 transform;
+	};
+
+	struct Occluder
+	{
+		Model* model;
+		glm::mat4 transform;
+	};
+
+	// Counts up from 0, one per simulated frame
+	U64 frame = 0;
+	// Seconds since the engine started, at the simulated moment
+	double time = 0.0;
+
+	// Camera, the projection's aspect ratio comes from the swap chain
+	glm::mat4 view = glm::mat4(1.0f);
+	float fieldOfView = glm::radians(45.0f);
+	float zNear = 0.1f;
+	float zFar = 10.0f;
+
+	std::vector<Draw> draws;
+	std::vector<Occluder> occluders;
+	std::vector<LightClusters::Light> lights;
+
+	// Keeps the allocations, slots are reused every third frame
+	void clear()
+	{
+		draws.clear();
+		occluders.clear();
+		lights.clear();
+	}
+};
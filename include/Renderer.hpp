@@ -4,9 +4,26 @@
 #include "Engine.hpp"
 #include "Vertex.hpp"
 #include "Shader.hpp"
+#include "ShaderPermutations.hpp"
+#include "ShaderHotReload.hpp"
+#include "DescriptorLayoutCache.hpp"
+#include "CommandRecorder.hpp"
+#include "DrawList.hpp"
+#include "InstanceBuffer.hpp"
+#include "GpuCulling.hpp"
+#include "FrustumCuller.hpp"
+#include "OcclusionCuller.hpp"
+#include "LightClusters.hpp"
+#include "LightClusterBuffer.hpp"
+#include "RenderSnapshot.hpp"
+#include "RenderGraph.hpp"
+#include "Material.hpp"
 #include "Image.hpp"
 #include "Model.hpp"
 #include "Texture.hpp"
+#include "AssetScheduler.hpp"
+
+#include <future>
 
 struct UniformBufferObject {
 	glm::mat4 view;
@@ -19,9 +36,14 @@ public:
 	Renderer() {}
 	~Renderer() {}
 
+	static const U32 maxFramesInFlight = 2;
+
 	VkDevice vkLogicalDevice;
 	VkQueue vkGraphicsQueue;
 	VkQueue vkPresentQueue;
+	// May be the graphics queue itself
+	VkQueue vkComputeQueue;
+	U32 computeQueueFamily = 0;
 	VkSwapchainKHR vkSwapChain;
 	VkPipeline vkPipeline;
 	VkPipelineLayout vkPipelineLayout;
@@ -30,7 +52,52 @@ public:
 	VkDescriptorSet vkDescriptorSet;
 	VkRenderPass vkRenderPass;
 	VkCommandPool vkCommandPool;
-	std::vector<VkCommandBuffer> vkCommandBuffers;
+
+	// Per-frame, per-thread command pools, the frame is re-recorded every time
+	CommandRecorder commandRecorder;
+	std::vector<VkCommandBuffer> secondaries;
+	// 0 records on every core
+	static U32 recordThreads;
+
+	// Draws submitted for the frame being built, one list per frame slot
+	std::array<DrawList, maxFramesInFlight> drawLists;
+	// Binds actually issued after redundant ones were skipped
+	std::atomic<U64> bindCount { 0 };
+	std::atomic<U64> drawCount { 0 };
+	std::atomic<U64> drawCallCount { 0 };
+
+	// Instanced pipelines get each draw's transform from here instead of a push constant
+	std::array<InstanceBuffer, maxFramesInFlight> instanceBuffers;
+	bool instanceTransforms = false;
+
+	// Drops draws outside the view before sorting, when the GPU doesn't cull them
+	FrustumCuller frustumCuller;
+	std::vector<U32> visibleDraws;
+	std::atomic<U64> culledDrawCount { 0 };
+
+	// Draws left by the frustum cull that are hidden behind this frame's
+	// occluders are dropped too
+	OcclusionCuller occlusionCuller;
+	std::atomic<U64> occludedDrawCount { 0 };
+
+	// Lights submitted for the next render(), binned into froxels on the CPU
+	// when the fragment shader includes shaders/clusters.glsl
+	std::vector<LightClusters::Light> lights;
+	LightClusters lightClusters;
+	LightClusterBuffer lightClusterBuffer;
+	// The pipeline's set 0 has the cluster storage buffers
+	bool clusteredLights = false;
+
+	// Frustum culls instanced draws on the compute queue and draws them indirectly
+	GpuCulling gpuCulling;
+	// VK_KHR_draw_indirect_count is enabled
+	bool drawIndirectCount = false;
+	// The frame being recorded is drawn from gpuCulling's commands
+	bool gpuCulled = false;
+	// Pipeline declares a vertex stage mat4 push constant at offset 0 for the draw transform
+	bool pushTransform = false;
+	// Stages of the push constant range holding the transform
+	VkShaderStageFlags pushTransformStages = 0;
 	std::vector<VkFramebuffer> vkFramebuffers;
 	std::vector<VkImage> vkSwapChainImages;
 	std::vector<VkImageView> vkSwapChainImageViews;
@@ -38,11 +105,55 @@ public:
 	VkImage depthImage;
 	VkDeviceMemory depthImageMemory;
 	VkImageView depthImageView;
+	// Depth lives only inside the render pass, on tiled GPUs it can stay in
+	// tile memory and never be backed by real pages
+	bool depthImageLazy = false;
+	VkDeviceSize depthImageSize = 0;
 
 	VkFormat swapChainImageFormat;
 	VkExtent2D swapChainExtent;
 
+	// The main pass with the swapchain image, depth and the culled draw
+	// commands it uses, compiled once and given this frame's handles
+	RenderGraph frameGraph;
+	RenderGraph::Resource frameSwapchain;
+	RenderGraph::Resource frameDepth;
+	RenderGraph::Resource frameCullCommands;
+	RenderGraph::Resource frameCullCounts;
+	U32 frameImageIndex = 0;
+
 	Model chalet;
+	Material chaletMaterial;
+
+	ShaderPermutations squareVertex { ShaderModule::Vertex };
+	ShaderPermutations squareFragment { ShaderModule::Fragment };
+	// Variant of both the square shaders are built with
+	ShaderPermutations::Key squareKey = 0;
+	// Tints the square fragments by their cluster's light count
+	static bool debugLightClusters;
+
+	// Interface of the main pipeline, merged across its stages
+	ShaderReflection shaderReflection;
+	DescriptorLayoutCache layoutCache;
+
+	// Everything a pipeline build produces, handed over to the render loop as a whole
+	struct PipelineBuild
+	{
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		VkPipelineLayout layout = VK_NULL_HANDLE;
+		VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+		ShaderReflection reflection;
+		// Vertex shader reads a per-instance transform from the InstanceBuffer
+		bool instanced = false;
+	};
+
+	ShaderHotReload shaderHotReload;
+	std::future<PipelineBuild> pendingPipeline;
+
+	// Objects replaced while frames may still use them, destroyed
+	// once maxFramesInFlight frames have completed
+	std::vector<std::pair<U64, std::function<void()>>> retired;
+	U64 frameIndex = 0;
 
 	VkBuffer vkUniformBuffer;
 	VkDeviceMemory vkUniformBufferMemory;
@@ -67,38 +178,69 @@ public:
 	void loadModel();
 	void init();
 	void render();
+	// Submits everything in the snapshot and renders it
+	void render(const RenderSnapshot& snapshot);
+
+	// Queues a draw for the next render(), valid for that frame only
+	void submit(Model& mesh, const Material& material, const glm::mat4& transform);
+	// Rasterised on the CPU to hide draws behind it, for the next render() only.
+	// Best with a few large, closed, low polygon meshes such as walls and terrain.
+	void submitOccluder(Model& model, const glm::mat4& transform);
+	// World space light for the next render() only
+	void submitLight(const LightClusters::Light& light);
 	void cleanup();
 
 	void initVulkanLogicalDevice();
 	void initVulkanSwapChain();
 	void initVulkanImageViews();
 	void initVulkanRenderPass();
-	void initVulkanDescriptorSetLayout();
-	void initVulkanGraphicsPipeline();
+	PipelineBuild createGraphicsPipeline();
+	void adoptPipeline(const PipelineBuild& build);
+	void updateHotReload();
+	// Takes over a finished hot reload build, or drops it
+	void swapReloadedPipeline(const PipelineBuild& build);
+	void deferDestroy(std::function<void()> destroy);
+	void collectRetired();
+	void logPipelineStats();
 	void initVulkanFramebuffers();
 	void initVulkanCommandPool();
 
 	Texture texture;
-	void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
-	void transitionImageLayout(VkImage image, VkFormat format,VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels);
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+	// Loads assets in the background, its main thread work runs at the start
+	// of each render() since that's where the command pool is used
+	AssetScheduler assets;
+	void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, VkMemoryPropertyFlags preferredProperties = 0);
+	// Into an image already in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+	void recordCopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
 	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
 	void createTextureSampler();
 
 	void initVulkanDepthResources();
+	void destroyVulkanDepthResources();
 	void initVulkanUniformBuffer();
 	void initVulkanDescriptorPool();
 	void initVulkanDescriptorSet();
 	void initVulkanCommandBuffers();
+	VkCommandBuffer recordFrame(U32 imageIndex);
+	void initFrameGraph();
+	void recordMainPass(VkCommandBuffer primary);
+	void recordDraws(VkCommandBuffer commandBuffer, const DrawList& drawList, U32 begin, U32 end);
+	void cullDraws(DrawList& drawList);
+	void binLights();
 	void initVulkanSemaphores();
 	VkShaderModule createShaderModule(const std::vector<char>& code);
 
-	void createVulkanBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags propertyFlags, VkBuffer& buffer, VkDeviceMemory &bufferMemory);
+	// sharedWithCompute buffers are used by both the graphics and compute queue families
+	void createVulkanBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags propertyFlags, VkBuffer& buffer, VkDeviceMemory &bufferMemory, bool sharedWithCompute = false);
 	void copyVulkanBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize size);
 	VkCommandBuffer beginSingleTimeCommands();
 	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+	// Submits without waiting, the fence signals once the commands are done.
+	// Release both after that.
+	VkFence submitSingleTimeCommands(VkCommandBuffer commandBuffer);
+	void releaseSingleTimeCommands(VkCommandBuffer commandBuffer, VkFence fence);
 
-	void updateUniformBuffer();
+	void updateUniformBuffer(const RenderSnapshot& snapshot);
 
 	void cleanupSwapChain();
 	void recreateVulkanSwapChain();
@@ -2,9 +2,9 @@
 
 #include "PCH.hpp"
 #include "File.hpp"
-#include "Engine.hpp"
+#include "ShaderCompiler.hpp"
 
-#include <shaderc\shaderc.hpp>
+#include <shaderc/shaderc.hpp>
 
 class ShaderModule
 {
@@ -14,19 +14,30 @@ public:
 	{
 		Vertex, 
 		Fragment, 
-		Geometry
+		Geometry,
+		Compute
 	};
 	
 	ShaderModule(Stage stage);
 	ShaderModule(Stage stage, std::string path);
 
 	VkShaderModule getVulkanModule() { return vkShaderModule; }
+	VkShaderStageFlagBits getVulkanStage();
+	bool isGLSL() { return language == GLSL; }
+	const std::vector<U32>& getSpirv() { return spvSource; }
+	const std::string& getPath() { return path; }
+
+	// Extra #define passed to the compiler on top of the stage macro
+	void define(const std::string& name, const std::string& value = "");
 
 	void init();
 	void load(std::string path);
 	void compile();
 	void createVulkanModule();
 
+	// Compiles every GLSL module of the batch in parallel on the shared ShaderCompiler
+	static void compileBatch(const std::vector<ShaderModule*>& modules);
+
 	void destroy();
 
 private:
@@ -38,6 +49,7 @@ private:
 	shaderc_shader_kind kind;
 
 	std::string stageMacro;
+	std::vector<std::pair<std::string, std::string>> macros;
 
 	enum Language 
 	{
@@ -50,6 +62,9 @@ private:
 	std::string source;
 	std::vector<U32> spvSource;
 
+	ShaderCompiler::Job makeJob();
+	void applyResult(ShaderCompiler::Result& result);
+
 	std::string infoLog;
 	std::string debugLog;
 };
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "PCH.hpp"
+
+// Persistent on-disk cache of compiled SPIR-V, keyed by a hash of everything
+// that affects the compiler output. Lets ShaderModule skip shaderc entirely
+// on a warm start.
+class ShaderCache
+{
+public:
+	static std::string directory;
+	static bool enabled;
+
+	// Bump when anything about how keys or cache files are built changes
+	static const U32 formatVersion = 1;
+
+	static const U64 hashSeed = 0xcbf29ce484222325ULL;
+
+	// FNV-1a, chainable by passing the previous result as the seed
+	static U64 hash(const void* data, size_t size, U64 seed = hashSeed);
+	static U64 hashString(const std::string& string, U64 seed = hashSeed);
+
+	// Hash of the compiler identity, seeded into every key
+	static U64 compilerKey();
+
+	static bool load(U64 key, std::vector<U32>& spv);
+	static bool store(U64 key, const std::vector<U32>& spv);
+
+	static std::atomic<U32> hits;
+	static std::atomic<U32> misses;
+
+private:
+	static std::string filePath(U64 key);
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "ThreadPool.hpp"
+
+#include <shaderc/shaderc.hpp>
+
+// GLSL -> SPIR-V compile service. Jobs are compiled on a thread pool, each
+// worker thread reusing its own shaderc::Compiler, and go through the
+// on-disk ShaderCache. #include is resolved by ShaderIncluder relative to
+// the job name, which should be the source path.
+class ShaderCompiler
+{
+public:
+	struct Job
+	{
+		// Source path, includes are resolved relative to it
+		std::string name;
+		std::string source;
+		shaderc_shader_kind kind;
+		std::vector<std::pair<std::string, std::string>> macros;
+		// Optimise for performance, the cooker does for shipped shaders
+		bool optimize = false;
+	};
+
+	struct Result
+	{
+		bool success = false;
+		bool fromCache = false;
+		std::vector<U32> spv;
+		std::string log;
+	};
+
+	// 0 uses one thread per hardware core
+	ShaderCompiler(U32 threadCount = 0) : pool(threadCount) {}
+
+	std::future<Result> submit(Job job);
+	std::vector<std::future<Result>> submit(std::vector<Job> jobs);
+
+	U32 threadCount() { return pool.size(); }
+
+	// Compiles on the calling thread
+	static Result compile(const Job& job);
+
+	// Shared service used by ShaderModule
+	static ShaderCompiler& get();
+
+private:
+	ThreadPool pool;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "FileWatcher.hpp"
+#include "ShaderPermutations.hpp"
+
+// Watches the GLSL sources of registered shaders, and every file they
+// #include, and reports which shaders need reloading. Includes are taken
+// from ShaderIncluder's dependency graph. Rebuilding and
+// swapping pipelines is left to the owner so it can happen at a frame
+// boundary.
+class ShaderHotReload
+{
+public:
+	static bool enabled;
+
+	void add(ShaderPermutations* shader, const std::string& sourcePath);
+
+	struct Change
+	{
+		ShaderPermutations* shader;
+		std::string path;
+	};
+
+	// Shaders whose source or includes changed since the last call
+	std::vector<Change> poll();
+
+private:
+	struct Entry
+	{
+		ShaderPermutations* shader;
+		std::string path;
+	};
+
+	void watchDependencies(const Entry& entry);
+
+	std::vector<Entry> entries;
+	FileWatcher watcher;
+};
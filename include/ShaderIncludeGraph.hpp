@@ -0,0 +1,39 @@
+#pragma once
+
+#include "PCH.hpp"
+
+#include <mutex>
+#include <set>
+
+// Which GLSL file includes which. Plain data with no shaderc or file access,
+// the edges are fed in by ShaderIncluder. Include guards can make the graph
+// cyclic, so every query walks it with a visited set.
+class ShaderIncludeGraph
+{
+public:
+	// Records that `file` directly includes `include`
+	void addInclude(const std::string& file, const std::string& include);
+
+	// Drops the direct includes of `file`, before it is rescanned after an edit
+	void clearIncludes(const std::string& file);
+
+	std::set<std::string> getIncludes(const std::string& file);
+
+	// Every file `file` pulls in, directly or through other includes
+	std::set<std::string> getDependencies(const std::string& file);
+
+	// Every file that pulls in `file`, directly or through other includes.
+	// These are the ones to recompile when `file` changes.
+	std::set<std::string> getIncluders(const std::string& file);
+
+	void clear();
+
+private:
+	typedef std::map<std::string, std::set<std::string>> Edges;
+
+	static std::set<std::string> walk(const Edges& edges, const std::string& start);
+
+	Edges includes;
+	Edges includers;
+	std::mutex mutex;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "ShaderIncludeGraph.hpp"
+
+#include <memory>
+#include <mutex>
+#include <shaderc/shaderc.hpp>
+
+// Resolves GLSL #include directives for shaderc. Files are read through the
+// File layer and kept in a content cache shared by every compile, and each
+// include is recorded in the dependency graph so a changed file can be
+// mapped back to the shaders that have to be rebuilt.
+class ShaderIncluder : public shaderc::CompileOptions::IncluderInterface
+{
+public:
+	// Searched for #include <name>, and for #include "name" when the file
+	// isn't next to the one including it
+	static std::vector<std::string> searchPaths;
+
+	// Dependencies of every shader compiled or scanned so far
+	static ShaderIncludeGraph graph;
+
+	// Normalised path of the included file, empty if it can't be found
+	static std::string resolve(const std::string& requested, shaderc_include_type type, const std::string& requesting);
+
+	// Cached contents of a file, null if it can't be read
+	static std::shared_ptr<const std::string> read(const std::string& path);
+
+	// Forgets the cached contents and the recorded includes of a file that
+	// changed on disk
+	static void invalidate(const std::string& path);
+
+	// Records the includes of a file, and of everything it includes, without
+	// compiling it. Line based, #if blocks aren't evaluated so it may find
+	// more includes than a compile would, never fewer.
+	static void scan(const std::string& path);
+
+	// Same for source text that is `path`'s but may not be what's on disk,
+	// replacing its recorded includes. Returns every file it pulls in, not
+	// counting `path` itself.
+	static std::set<std::string> scanSource(const std::string& path, const std::string& source);
+
+	static std::string normalise(const std::string& path);
+
+	// Deeper nesting is reported as an error, it's a cycle without include
+	// guards far more often than a real shader
+	static const size_t maxIncludeDepth = 32;
+
+	shaderc_include_result* GetInclude(const char* requestedSource, shaderc_include_type type, const char* requestingSource, size_t includeDepth) override;
+	void ReleaseInclude(shaderc_include_result* data) override;
+
+private:
+	// Owns the strings shaderc_include_result points into until it is released
+	struct Include
+	{
+		shaderc_include_result result;
+		std::string name;
+		std::shared_ptr<const std::string> content;
+		std::string error;
+	};
+
+	static void scan(const std::string& path, std::set<std::string>& visited);
+	static void scanLines(const std::string& path, const std::string& source, std::set<std::string>& visited);
+
+	static std::mutex cacheMutex;
+	static std::unordered_map<std::string, std::shared_ptr<const std::string>> cache;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "PCH.hpp"
+
+#include <mutex>
+
+// Feature keywords of one shader and the bitmask keys made of them, one bit
+// per keyword. Plain data with no shaderc or device access, ShaderPermutations
+// compiles and caches the variants the keys select.
+//
+// Compile keywords are #defines, the bits of a key that are compile keywords
+// pick the variant. Specialization keywords are boolean specialization
+// constants, their bits only pick the VkSpecializationInfo, so keys differing
+// in them alone share one compiled variant.
+class ShaderKeywords
+{
+public:
+	typedef U64 Key;
+
+	static const U32 maxKeywords = 64;
+
+	// Both return the keyword's bit, 0 once there are maxKeywords
+	Key addKeyword(const std::string& name);
+	Key addSpecializationKeyword(const std::string& name, U32 constantId);
+
+	// Key with the named keywords enabled, unknown names are ignored with a warning
+	Key getKey(const std::vector<std::string>& enabled);
+
+	// The compile keyword bits of key, which variant it needs
+	Key getVariantKey(Key key);
+	// The #defines of the variant key selects
+	std::vector<std::string> getDefines(Key key);
+
+	// Built on first use for each combination of specialization keywords,
+	// nullptr when there are none. Valid until clearSpecializations().
+	const VkSpecializationInfo* getSpecializationInfo(Key key);
+	U32 getSpecializationCount();
+	void clearSpecializations();
+
+private:
+	struct Keyword
+	{
+		std::string name;
+		bool specialization;
+		U32 constantId;
+	};
+
+	struct Specialization
+	{
+		std::vector<VkSpecializationMapEntry> entries;
+		std::vector<VkBool32> values;
+		VkSpecializationInfo info;
+	};
+
+	Key addKeyword(const std::string& name, bool specialization, U32 constantId);
+
+	std::mutex mutex;
+	std::vector<Keyword> keywords;
+	Key compileMask = 0;
+	Key specializationMask = 0;
+	// A key was handed out, keywords declared after that miss earlier variants
+	bool used = false;
+	std::unordered_map<Key, Specialization> specializations;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "Shader.hpp"
+#include "ShaderKeywords.hpp"
+#include "ShaderReflection.hpp"
+
+#include <mutex>
+
+// One shader source with a set of feature keywords. A variant is selected by
+// a bitmask key with one bit per keyword, see ShaderKeywords.
+//
+// Compile keywords are passed as #defines, so each combination of them is its
+// own SPIR-V module, compiled on first use and kept by key. Specialization
+// keywords map to a boolean specialization constant instead:
+//
+//     layout(constant_id = 0) const bool USE_FOG = false;
+//
+// so toggling them only changes the VkSpecializationInfo handed to pipeline
+// creation and never recompiles. Use them for cheap branches, and compile
+// keywords for code that should be stripped from hot shaders entirely.
+class ShaderPermutations
+{
+public:
+	typedef ShaderKeywords::Key Key;
+
+	ShaderPermutations(ShaderModule::Stage stage) : base(stage) {}
+	ShaderPermutations(ShaderModule::Stage stage, std::string path) : base(stage, path) {}
+
+	void load(std::string path) { base.load(path); }
+
+	// Loads new source from path and recompiles every variant built so far.
+	// On a compile error the previous variants are kept and false is returned.
+	bool reload(const std::string& path);
+
+	// Both return the keyword's bit. Declare every keyword before requesting variants.
+	Key addKeyword(const std::string& name) { return keywords.addKeyword(name); }
+	Key addSpecializationKeyword(const std::string& name, U32 constantId) { return keywords.addSpecializationKeyword(name, constantId); }
+
+	// Key with the named keywords enabled, unknown names are ignored with a warning
+	Key getKey(const std::vector<std::string>& enabled) { return keywords.getKey(enabled); }
+
+	// Compiles the variant on first use
+	VkShaderModule getModule(Key key);
+
+	// nullptr when the shader has no specialization keywords. The pointer
+	// stays valid until destroy().
+	const VkSpecializationInfo* getSpecializationInfo(Key key) { return keywords.getSpecializationInfo(key); }
+
+	VkPipelineShaderStageCreateInfo getStageInfo(Key key);
+
+	// Reflects the variant's SPIR-V, compiling it first if needed
+	bool reflect(Key key, ShaderReflection& reflection);
+
+	// Compile every missing variant in parallel
+	void prewarm(const std::vector<Key>& keys);
+	static void prewarm(const std::vector<std::pair<ShaderPermutations*, Key>>& requests);
+
+	U32 getVariantCount() { return U32(variants.size()); }
+
+	void destroy();
+
+private:
+	Key compileKey(Key key);
+	ShaderModule makeVariant(const ShaderModule& source, Key key);
+
+	ShaderModule base;
+	ShaderKeywords keywords;
+
+	std::mutex mutex;
+	std::unordered_map<Key, ShaderModule> variants;
+};
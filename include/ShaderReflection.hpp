@@ -0,0 +1,55 @@
+#pragma once
+
+#include "PCH.hpp"
+
+// Resource interface of a SPIR-V module: descriptor bindings, push constant
+// ranges and vertex inputs. Works on the raw words only, no device or
+// shaderc needed, so it can run on any SPIR-V blob.
+class ShaderReflection
+{
+public:
+	struct DescriptorBinding
+	{
+		U32 set;
+		U32 binding;
+		VkDescriptorType type;
+		U32 count;
+		VkShaderStageFlags stages;
+		// Byte size of uniform/storage blocks, 0 for everything else
+		U32 blockSize;
+		std::string name;
+	};
+
+	struct VertexInput
+	{
+		U32 location;
+		VkFormat format;
+		std::string name;
+	};
+
+	VkShaderStageFlags stages = 0;
+
+	// Sorted by set then binding
+	std::vector<DescriptorBinding> bindings;
+	std::vector<VkPushConstantRange> pushConstants;
+	// Vertex stage only, sorted by location. Matrices take one entry per column.
+	std::vector<VertexInput> vertexInputs;
+
+	bool parse(const U32* words, size_t wordCount);
+	bool parse(const std::vector<U32>& spv) { return parse(spv.data(), spv.size()); }
+
+	// Adds another stage. Bindings shared between stages get their stage flags
+	// combined; returns false if the stages disagree on a binding's type.
+	bool merge(const ShaderReflection& other);
+
+	// Highest set index + 1, sets in between may be empty
+	U32 getSetCount();
+	std::vector<VkDescriptorSetLayoutBinding> getSetLayoutBindings(U32 set);
+	// nullptr if the module has no such binding
+	const DescriptorBinding* findBinding(U32 set, U32 binding) const;
+
+	// Exact pool sizes for allocating every set `copies` times
+	std::vector<VkDescriptorPoolSize> getPoolSizes(U32 copies = 1);
+
+	void clear();
+};
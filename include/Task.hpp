@@ -0,0 +1,120 @@
+#pragma once
+
+#include "PCH.hpp"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+// Where a Task keeps what its coroutine returned or threw
+template<class T>
+struct TaskResult
+{
+	std::optional<T> value;
+	std::exception_ptr error;
+
+	template<class U>
+	void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+
+	T get()
+	{
+		if (error)
+			std::rethrow_exception(error);
+		return std::move(*value);
+	}
+};
+
+template<>
+struct TaskResult<void>
+{
+	std::exception_ptr error;
+
+	void return_void() {}
+
+	void get()
+	{
+		if (error)
+			std::rethrow_exception(error);
+	}
+};
+
+// Lazily started coroutine returning a T. Nothing runs until the task is
+// co_awaited, the awaiting coroutine then goes on right where the task
+// finishes, on whichever thread that is, without going through a
+// scheduler. Owns its frame, a task must outlive the await on it.
+//
+// A task finishing without ever suspending hands back by returning, not by
+// resuming its awaiter, so long chains of those don't grow the stack even
+// where symmetric transfer isn't a tail call, as in unoptimised builds.
+template<class T = void>
+class Task
+{
+public:
+	struct promise_type : TaskResult<T>
+	{
+		std::coroutine_handle<> continuation;
+		// Set first by whichever of the task finishing and its awaiter
+		// suspending comes second, that one resumes the awaiter
+		std::atomic<bool> handoff { false };
+
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		void unhandled_exception() { this->error = std::current_exception(); }
+
+		struct FinalAwaiter
+		{
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+			{
+				promise_type& promise = handle.promise();
+				if (promise.continuation && promise.handoff.exchange(true, std::memory_order_acq_rel))
+					return promise.continuation;
+				return std::noop_coroutine();
+			}
+			void await_resume() noexcept {}
+		};
+		FinalAwaiter final_suspend() noexcept { return {}; }
+	};
+
+	Task() {}
+	Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+	~Task() { destroy(); }
+
+	Task& operator=(Task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			destroy();
+			handle = std::exchange(other.handle, nullptr);
+		}
+		return *this;
+	}
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	bool valid() const { return bool(handle); }
+
+	bool await_ready() const noexcept { return !handle || handle.done(); }
+	bool await_suspend(std::coroutine_handle<> awaiting)
+	{
+		handle.promise().continuation = awaiting;
+		handle.resume();
+		// False when the task is done already, the awaiter goes on in place
+		return !handle.promise().handoff.exchange(true, std::memory_order_acq_rel);
+	}
+	T await_resume() { return handle.promise().get(); }
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> pHandle) : handle(pHandle) {}
+
+	void destroy()
+	{
+		if (handle)
+			handle.destroy();
+		handle = nullptr;
+	}
+
+	std::coroutine_handle<promise_type> handle;
+};
@@ -2,6 +2,8 @@
 
 #include "PCH.hpp"
 #include "Image.hpp"
+#include "CookedTexture.hpp"
+#include "AssetScheduler.hpp"
 
 class Texture
 {
@@ -16,10 +18,20 @@ public:
     int maxMipLevel;
 
     void loadFile(std::string path, bool genMipmaps = true);
+    // Same as loadFile, read and decoded off main with the upload left to
+    // the GPU. Usable once the task has finished.
+    Task<void> loadFileAsync(AssetScheduler& assets, std::string path);
     void loadImage(Image *image, bool genMipmaps = true);
+    void loadCooked(CookedTexture *cooked);
     void destroy();
 
 private:
+    // Creates the staging buffer and the image, and records the copy and the
+    // mips into a single time command buffer for the caller to submit
+    VkCommandBuffer recordUpload(const Image& image, VkBuffer& stagingBuffer, VkDeviceMemory& stagingBufferMemory);
+    // Once that has completed, frees the staging buffer and creates the view
+    void finishUpload(U32 mipLevels, VkBuffer stagingBuffer, VkDeviceMemory stagingBufferMemory);
+
     int width, height;
 	VkImage vkImage;
 	VkDeviceMemory vkMemory;
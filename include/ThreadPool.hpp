@@ -0,0 +1,48 @@
+#pragma once
+
+#include "PCH.hpp"
+
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+
+// Fixed size pool of worker threads consuming a shared FIFO of tasks
+class ThreadPool
+{
+public:
+	// 0 uses one thread per hardware core
+	ThreadPool(U32 threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	template<class F>
+	auto submit(F&& f) -> std::future<decltype(f())>;
+
+	U32 size() { return U32(workers.size()); }
+
+private:
+	void workerLoop();
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping;
+};
+
+template<class F>
+auto ThreadPool::submit(F&& f) -> std::future<decltype(f())>
+{
+	// std::function needs a copyable callable, packaged_task isn't
+	auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::forward<F>(f));
+	auto future = task->get_future();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.emplace([task]() { (*task)(); });
+	}
+	condition.notify_one();
+	return future;
+}
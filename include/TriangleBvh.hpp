@@ -0,0 +1,85 @@
+#pragma once
+
+#include "PCH.hpp"
+#include "Bvh.hpp"
+#include "Mesh.hpp"
+
+// Triangle level BVH over one Mesh, for picking and line of sight checks
+// against the actual geometry rather than its bounds. Everything is in model
+// space, rays have to be moved there by the inverse of the draw transform.
+//
+// Built with Bvh's binned SAH into 32 byte binary nodes with at most 4
+// triangles per leaf. A leaf's triangles are stored together as one block,
+// first vertex and two edges as structure of arrays, so one ray is tested
+// against the whole leaf with SSE. Packets of 4 rays are traced down the tree
+// together instead, each leaf triangle tested against all 4 rays at once,
+// which pays off when the rays are coherent such as a grid from a camera.
+//
+// The asset cooker writes the tree next to the cooked mesh, see saveCooked().
+class TriangleBvh
+{
+public:
+	struct Ray
+	{
+		glm::vec3 origin;
+		glm::vec3 direction;
+		float maxDistance;
+	};
+
+	struct Hit
+	{
+		// Index of the triangle's first index / 3, ~0u on a miss
+		U32 triangle;
+		float distance;
+		// Barycentric weights of the triangle's second and third vertex
+		float u, v;
+	};
+
+	static const U32 leafSize = 4;
+	static const U32 packetSize = 4;
+
+	static const U32 cookedMagic = 0x56424556; // "VEBV"
+	static const U32 cookedVersion = 1;
+
+	void build(const Mesh& mesh);
+	void clear();
+	bool empty() const { return nodes.empty(); }
+	// Built from a mesh with these vertex and index counts, to tell whether a
+	// cached tree still belongs to the mesh
+	bool matches(const Mesh& mesh) const;
+
+	// Nearest hit on either side of a triangle
+	bool raycast(const Ray& ray, Hit& hit) const;
+	// Stops at the first hit found, for line of sight
+	bool occluded(const Ray& ray) const;
+	// Traces the rays packetSize at a time
+	void raycast(const Ray* rays, U32 count, Hit* hits) const;
+
+	U32 getTriangleCount() const { return indexCount / 3; }
+	U32 getNodeCount() const { return U32(nodes.size()); }
+
+	bool loadCooked(std::string path);
+	bool saveCooked(std::string path);
+
+private:
+	// Triangle lanes past a leaf's count have zero edges and never hit
+	struct Block
+	{
+		float v0x[4], v0y[4], v0z[4];
+		float e1x[4], e1y[4], e1z[4];
+		float e2x[4], e2y[4], e2z[4];
+		U32 triangle[4];
+	};
+
+	// Nearest lane of the block hit closer than hit.distance, updates hit
+	static bool intersect(const Block& block, const Ray& ray, Hit& hit);
+	template<bool any>
+	bool trace(const Ray& ray, Hit& hit) const;
+	void tracePacket(const Ray* rays, U32 count, Hit* hits) const;
+
+	// Leaves point at blocks rather than index list entries
+	std::vector<Bvh::Node> nodes;
+	std::vector<Block> blocks;
+	U32 vertexCount = 0;
+	U32 indexCount = 0;
+};
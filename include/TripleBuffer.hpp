@@ -0,0 +1,117 @@
+#pragma once
+
+#include "PCH.hpp"
+
+#include <atomic>
+
+// Lock-free handoff of the newest value from one producer thread to one
+// consumer thread. There are three slots: the producer fills one, the
+// consumer reads another, and the third sits between them holding the last
+// published value. publish() and acquire() each swap their slot with the
+// middle one in a single atomic exchange, so neither side ever blocks or
+// sees a slot while the other is using it. A value the consumer didn't
+// acquire in time is replaced by the next one, the consumer always gets the
+// newest and memory stays at three values however far apart the two run.
+// Either side can also block for the other, waiting on the same atomic.
+template<class T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : middle(1) {}
+
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	// Producer: the slot the next publish() hands over. It still holds
+	// whatever was written to it three publishes ago.
+	T& writeSlot() { return slots[back]; }
+
+	// Producer: hands over the write slot. Returns false when that replaced a
+	// value the consumer never acquired.
+	bool publish()
+	{
+		U32 previous = middle.exchange(back | fresh, std::memory_order_acq_rel);
+		middle.notify_one();
+		back = previous & indexMask;
+		if (previous & fresh)
+		{
+			++dropped;
+			return false;
+		}
+		return true;
+	}
+
+	// Producer: true while the last published value is waiting for acquire()
+	bool pending() const { return (middle.load(std::memory_order_acquire) & fresh) != 0; }
+
+	// Producer: blocks until the last published value has been acquired
+	void waitAcquired()
+	{
+		U32 value = middle.load(std::memory_order_acquire);
+		while (value & fresh)
+		{
+			middle.wait(value, std::memory_order_acquire);
+			value = middle.load(std::memory_order_acquire);
+		}
+	}
+
+	// Producer: no more values. Waits for the last one to be acquired, then
+	// wakes the consumer, whose waitAcquire() returns nullptr from then on.
+	void close()
+	{
+		waitAcquired();
+		back = middle.exchange(back | fresh | closed, std::memory_order_acq_rel) & indexMask;
+		middle.notify_one();
+	}
+
+	// Producer: published values replaced before they were acquired
+	U64 getDropped() const { return dropped; }
+
+	// Consumer: the newest value when one was published since the last call,
+	// nullptr otherwise. It isn't touched by the producer until the next
+	// acquire().
+	const T* acquire()
+	{
+		// Only the consumer clears the flag, so once seen it can't go away.
+		// Nothing is published after close(), its flag stays set for good.
+		U32 value = middle.load(std::memory_order_relaxed);
+		if (!(value & fresh) || (value & closed))
+			return nullptr;
+		front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+		middle.notify_one();
+		acquired = true;
+		return &slots[front];
+	}
+
+	// Consumer: blocks until a value is published and acquires it, nullptr
+	// once the producer has closed
+	const T* waitAcquire()
+	{
+		U32 value = middle.load(std::memory_order_acquire);
+		while (!(value & fresh))
+		{
+			middle.wait(value, std::memory_order_acquire);
+			value = middle.load(std::memory_order_acquire);
+		}
+		return acquire();
+	}
+
+	// Consumer: what the last successful acquire() returned, nullptr before it
+	const T* current() const { return acquired ? &slots[front] : nullptr; }
+
+private:
+	static const U32 indexMask = 3;
+	static const U32 fresh = 4;
+	static const U32 closed = 8;
+
+	T slots[3];
+
+	// Slot index of the middle value, with fresh set until it's acquired and
+	// closed once the producer is done
+	std::atomic<U32> middle;
+	// Each side's own slot, never read by the other thread
+	alignas(64) U32 back = 0;
+	U64 dropped = 0;
+	alignas(64) U32 front = 2;
+	bool acquired = false;
+};
@@ -28,4 +28,5 @@ struct PhysicalDeviceDetails
 	VkPhysicalDeviceMemoryProperties memoryProperties;
 
 	U32 getMemoryType(U32 typeFilter, VkMemoryPropertyFlags properties);
+	bool hasMemoryType(U32 typeFilter, VkMemoryPropertyFlags properties) const;
 };
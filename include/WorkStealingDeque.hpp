@@ -0,0 +1,77 @@
+#pragma once
+
+#include "PCH.hpp"
+
+// Fixed size Chase-Lev work stealing deque, the C11 formulation of Lê et
+// al. 2013. The owning thread pushes and pops at the bottom without
+// locking, any other thread steals from the top.
+template<class T, U32 capacity = 4096>
+class WorkStealingDeque
+{
+	static_assert((capacity & (capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+	// Owner only, false when full
+	bool push(T* item)
+	{
+		S64 b = bottom.load(std::memory_order_relaxed);
+		S64 t = top.load(std::memory_order_acquire);
+		if (b - t >= S64(capacity))
+			return false;
+
+		buffer[b & (capacity - 1)].store(item, std::memory_order_relaxed);
+		// Thieves that see the new bottom see the item in the buffer
+		bottom.store(b + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Owner only, newest first
+	T* pop()
+	{
+		// Claim the bottom item before looking at top, thieves claim from the
+		// other end in the opposite order so they can't both miss each other
+		S64 b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_seq_cst);
+		S64 t = top.load(std::memory_order_seq_cst);
+
+		if (t > b)
+		{
+			// Was empty
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		T* item = buffer[b & (capacity - 1)].load(std::memory_order_relaxed);
+		if (t == b)
+		{
+			// The last item, race the thieves for it
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				item = nullptr;
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return item;
+	}
+
+	// Any thread, oldest first. nullptr when empty or another thief won.
+	T* steal()
+	{
+		S64 t = top.load(std::memory_order_seq_cst);
+		S64 b = bottom.load(std::memory_order_seq_cst);
+		if (t >= b)
+			return nullptr;
+
+		// Read before claiming, once top moves on the owner may reuse the slot
+		T* item = buffer[t & (capacity - 1)].load(std::memory_order_acquire);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return nullptr;
+		return item;
+	}
+
+	// Owner only, exact for the owner's own pushes and pops
+	bool empty() const { return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed); }
+
+private:
+	alignas(64) std::atomic<S64> top { 0 };
+	alignas(64) std::atomic<S64> bottom { 0 };
+	std::atomic<T*> buffer[capacity] = {};
+};
@@ -0,0 +1,67 @@
+// Clustered forward lighting, #include from a fragment stage after #version.
+// The buffers are filled by LightClusterBuffer from LightClusters' bins, the
+// layouts must stay in step with LightClusters::Light and ::Header.
+//
+//   vec3 light = ambient + clusteredLighting(gl_FragCoord, worldPosition, normalize(worldNormal));
+
+struct Light
+{
+	vec3 position;
+	float range;
+	vec3 colour;
+	// Cosine and sine of the cone's half angle, -1 and 0 for point lights
+	float cosAngle;
+	vec3 direction;
+	float sinAngle;
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer ClusterLights { Light lights[]; };
+
+layout(std430, set = 0, binding = 4) readonly buffer Clusters
+{
+	// Tiles across, down, depth slices and the frame's light count
+	uvec4 clusterGrid;
+	vec2 clusterTileSize;
+	float clusterSliceScale;
+	float clusterSliceBias;
+	float clusterNear;
+	float clusterFar;
+	uvec2 clusterPad;
+	// Offset into clusterLightIndices and light count of each froxel
+	uvec2 clusterRanges[];
+};
+
+layout(std430, set = 0, binding = 5) readonly buffer ClusterIndices { uint clusterLightIndices[]; };
+
+// Froxel of a fragment, from its window position and 0..1 depth
+uint clusterIndex(vec4 fragCoord)
+{
+	float depth = clusterNear * clusterFar / (clusterFar - fragCoord.z * (clusterFar - clusterNear));
+	uint slice = min(uint(max(log(depth) * clusterSliceScale + clusterSliceBias, 0.0)), clusterGrid.z - 1u);
+	uint x = min(uint(fragCoord.x / clusterTileSize.x), clusterGrid.x - 1u);
+	uint y = min(uint(fragCoord.y / clusterTileSize.y), clusterGrid.y - 1u);
+	return (slice * clusterGrid.y + y) * clusterGrid.x + x;
+}
+
+// Diffuse light from the froxel's lights, world space position and normal
+vec3 clusteredLighting(vec4 fragCoord, vec3 position, vec3 normal)
+{
+	uvec2 range = clusterRanges[clusterIndex(fragCoord)];
+	vec3 result = vec3(0.0);
+	for (uint i = 0u; i < range.y; ++i)
+	{
+		Light light = lights[clusterLightIndices[range.x + i]];
+		vec3 toLight = light.position - position;
+		float distance = length(toLight);
+		vec3 direction = toLight / max(distance, 1e-4);
+
+		// Reaches 0 at the range the light was binned with
+		float falloff = clamp(1.0 - distance / light.range, 0.0, 1.0);
+		falloff *= falloff;
+		if (light.cosAngle > 0.0)
+			falloff *= smoothstep(light.cosAngle, mix(light.cosAngle, 1.0, 0.1), dot(-direction, light.direction));
+
+		result += light.colour * (max(dot(normal, direction), 0.0) * falloff);
+	}
+	return result;
+}
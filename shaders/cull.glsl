@@ -0,0 +1,81 @@
+#version 450
+
+// Frustum culling for GpuCulling, one invocation per draw of the sorted list.
+// The test must stay in step with GpuCulling::isVisible.
+
+#ifdef COMPUTE
+
+layout(local_size_x = 64) in;
+
+struct Object
+{
+	vec4 sphere;
+	uint indexCount;
+	uint batch;
+	uint batchFirst;
+	uint pad;
+};
+
+struct DrawCommand
+{
+	uint indexCount;
+	uint instanceCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint firstInstance;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Objects { Object objects[]; };
+layout(std430, set = 0, binding = 1) readonly buffer Transforms { mat4 transforms[]; };
+layout(std430, set = 0, binding = 2) writeonly buffer Commands { DrawCommand commands[]; };
+layout(std430, set = 0, binding = 3) buffer Counts { uint counts[]; };
+
+layout(push_constant) uniform Constants
+{
+	vec4 planes[6];
+	uint objectCount;
+	uint compact;
+} cull;
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= cull.objectCount)
+		return;
+
+	Object object = objects[i];
+	mat4 transform = transforms[i];
+
+	vec3 centre = (transform * vec4(object.sphere.xyz, 1.0)).xyz;
+	float scale2 = max(max(dot(transform[0].xyz, transform[0].xyz), dot(transform[1].xyz, transform[1].xyz)), dot(transform[2].xyz, transform[2].xyz));
+	float radius = object.sphere.w * sqrt(scale2);
+
+	bool visible = true;
+	for (int p = 0; p < 6; ++p)
+		visible = visible && dot(cull.planes[p].xyz, centre) + cull.planes[p].w >= -radius;
+
+	// Instance i reads transform i from the instance buffer
+	DrawCommand command;
+	command.indexCount = object.indexCount;
+	command.instanceCount = 1;
+	command.firstIndex = 0;
+	command.vertexOffset = 0;
+	command.firstInstance = i;
+
+	if (cull.compact != 0)
+	{
+		if (!visible)
+			return;
+		uint slot = atomicAdd(counts[object.batch], 1);
+		commands[object.batchFirst + slot] = command;
+	}
+	else
+	{
+		command.instanceCount = visible ? 1 : 0;
+		commands[i] = command;
+		if (visible)
+			atomicAdd(counts[object.batch], 1);
+	}
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "AssetScheduler.hpp"
+#include "File.hpp"
+
+namespace
+{
+	// Owns a spawned task's frame, and itself, until the task is done
+	struct Detached
+	{
+		struct promise_type
+		{
+			Detached get_return_object() { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
+	};
+
+	Detached runDetached(Task<void> task, std::atomic<U32>& inFlight)
+	{
+		co_await task;
+		inFlight.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+AssetScheduler::AssetScheduler(U32 ioThreads, U32 workerThreads) : io(std::max(1u, ioThreads)), workers(workerThreads)
+{
+}
+
+AssetScheduler::~AssetScheduler()
+{
+	if (pending() > 0)
+		LOG_WARN(pending() << " asset tasks were still loading at shutdown");
+}
+
+void AssetScheduler::spawn(Task<void> task)
+{
+	inFlight.fetch_add(1, std::memory_order_relaxed);
+	runDetached(std::move(task), inFlight);
+}
+
+void AssetScheduler::pumpMain()
+{
+	std::vector<std::coroutine_handle<>> ready;
+	std::vector<std::pair<std::function<bool()>, std::coroutine_handle<>>> waiting;
+	{
+		std::lock_guard<std::mutex> lock(mainMutex);
+		ready.swap(mainQueue);
+		waiting.swap(polls);
+	}
+
+	// Resumed coroutines may queue new waits, those are kept for the next pump
+	std::vector<std::pair<std::function<bool()>, std::coroutine_handle<>>> stillWaiting;
+	for (auto& poll : waiting)
+	{
+		if (poll.first())
+			ready.push_back(poll.second);
+		else
+			stillWaiting.push_back(std::move(poll));
+	}
+	if (!stillWaiting.empty())
+	{
+		std::lock_guard<std::mutex> lock(mainMutex);
+		for (auto& poll : stillWaiting)
+			polls.push_back(std::move(poll));
+	}
+
+	for (std::coroutine_handle<> handle : ready)
+		handle.resume();
+}
+
+void AssetScheduler::waitIdle()
+{
+	while (pending() > 0)
+	{
+		pumpMain();
+		std::this_thread::yield();
+	}
+}
+
+void AssetScheduler::postWorker(std::coroutine_handle<> handle)
+{
+	workers.submit([handle]() { handle.resume(); });
+}
+
+void AssetScheduler::postMain(std::coroutine_handle<> handle)
+{
+	std::lock_guard<std::mutex> lock(mainMutex);
+	mainQueue.push_back(handle);
+}
+
+void AssetScheduler::postPoll(std::function<bool()> ready, std::coroutine_handle<> handle)
+{
+	std::lock_guard<std::mutex> lock(mainMutex);
+	polls.emplace_back(std::move(ready), handle);
+}
+
+void AssetScheduler::ReadFile::await_suspend(std::coroutine_handle<> handle)
+{
+	scheduler->io.submit([this, handle]()
+	{
+		File file;
+		if (file.open(path, File::Mode(File::binary | File::in)))
+		{
+			bytes.resize(size_t(file.getSize()));
+			file.readFile(bytes.data());
+		}
+		else
+			LOG_WARN("Failed to read asset: " << path);
+		file.close();
+
+		// Frees the I/O thread for the next read straight away
+		scheduler->postWorker(handle);
+	});
+}
@@ -0,0 +1,869 @@
+#include "Bvh.hpp"
+#include "FrustumCuller.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BVH_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+void Bvh::Bounds::grow(const glm::vec3& point)
+{
+	minimum = glm::min(minimum, point);
+	maximum = glm::max(maximum, point);
+}
+
+void Bvh::Bounds::grow(const Bounds& bounds)
+{
+	minimum = glm::min(minimum, bounds.minimum);
+	maximum = glm::max(maximum, bounds.maximum);
+}
+
+float Bvh::Bounds::area() const
+{
+	glm::vec3 size = maximum - minimum;
+	if (size.x < 0.0f || size.y < 0.0f || size.z < 0.0f)
+		return 0.0f;
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+Bvh::Bounds Bvh::Bounds::transformed(const glm::mat4& transform) const
+{
+	glm::vec3 centre = this->centre();
+	glm::vec3 extent = (maximum - minimum) * 0.5f;
+
+	glm::vec3 worldCentre = glm::vec3(transform * glm::vec4(centre, 1.0f));
+	glm::vec3 worldExtent;
+	for (int row = 0; row < 3; ++row)
+		worldExtent[row] = std::abs(transform[0][row]) * extent.x + std::abs(transform[1][row]) * extent.y + std::abs(transform[2][row]) * extent.z;
+
+	Bounds result;
+	result.minimum = worldCentre - worldExtent;
+	result.maximum = worldCentre + worldExtent;
+	return result;
+}
+
+Bvh::Bvh(U32 width)
+{
+	bool avx2 = FrustumCuller::detectIsa() == FrustumCuller::Avx2;
+	this->width = (width == 8 || width == 0) && avx2 ? 8 : 4;
+}
+
+void Bvh::buildNodes(const std::vector<Bounds>& bounds, std::vector<Node>& nodes, std::vector<U32>& indices, U32 leafSize)
+{
+	U32 count = U32(bounds.size());
+	indices.resize(count);
+	for (U32 i = 0; i < count; ++i)
+		indices[i] = i;
+
+	nodes.clear();
+	if (count == 0)
+		return;
+	// A binary tree with one primitive per leaf has 2n - 1 nodes
+	nodes.reserve(std::max(1u, 2 * count));
+	nodes.emplace_back();
+
+	std::vector<glm::vec3> centres(count);
+	for (U32 i = 0; i < count; ++i)
+		centres[i] = bounds[i].centre();
+	buildRange(bounds, centres, nodes, indices, 0, 0, count, leafSize);
+}
+
+void Bvh::buildRange(const std::vector<Bounds>& bounds, const std::vector<glm::vec3>& centres, std::vector<Node>& nodes, std::vector<U32>& indices, U32 root, U32 first, U32 count, U32 leafSize)
+{
+	struct Task
+	{
+		U32 node, first, count;
+	};
+
+	struct Bin
+	{
+		Bounds bounds;
+		U32 count = 0;
+	};
+
+	std::vector<Task> tasks = { { root, first, count } };
+	while (!tasks.empty())
+	{
+		Task task = tasks.back();
+		tasks.pop_back();
+
+		Bounds box, centreBox;
+		for (U32 i = task.first; i < task.first + task.count; ++i)
+		{
+			box.grow(bounds[indices[i]]);
+			centreBox.grow(centres[indices[i]]);
+		}
+		nodes[task.node].minimum = box.minimum;
+		nodes[task.node].maximum = box.maximum;
+		nodes[task.node].first = task.first;
+		nodes[task.node].count = task.count;
+
+		if (task.count <= 1)
+			continue;
+
+		// Bins on every axis filled in one pass over the primitives
+		Bin bins[3][binCount];
+		glm::vec3 lowest = centreBox.minimum;
+		glm::vec3 extent = centreBox.maximum - lowest;
+		glm::vec3 scale;
+		for (S32 axis = 0; axis < 3; ++axis)
+			scale[axis] = extent[axis] > 0.0f ? float(binCount) / extent[axis] : 0.0f;
+
+		for (U32 i = task.first; i < task.first + task.count; ++i)
+		{
+			U32 index = indices[i];
+			for (S32 axis = 0; axis < 3; ++axis)
+			{
+				Bin& bin = bins[axis][std::min(binCount - 1, U32((centres[index][axis] - lowest[axis]) * scale[axis]))];
+				bin.bounds.grow(bounds[index]);
+				++bin.count;
+			}
+		}
+
+		// Cheapest split plane between bins, right side costs swept in from
+		// the end and the left side on the way up
+		float bestCost = std::numeric_limits<float>::max();
+		S32 bestAxis = -1;
+		U32 bestSplit = 0;
+		for (S32 axis = 0; axis < 3; ++axis)
+		{
+			if (extent[axis] <= 0.0f)
+				continue;
+
+			float rightCost[binCount];
+			Bounds right;
+			U32 rightCount = 0;
+			for (U32 b = binCount - 1; b > 0; --b)
+			{
+				right.grow(bins[axis][b].bounds);
+				rightCount += bins[axis][b].count;
+				rightCost[b] = rightCount ? right.area() * float(rightCount) : 0.0f;
+			}
+
+			Bounds left;
+			U32 leftCount = 0;
+			for (U32 b = 0; b + 1 < binCount; ++b)
+			{
+				left.grow(bins[axis][b].bounds);
+				leftCount += bins[axis][b].count;
+				if (leftCount == 0 || leftCount == task.count)
+					continue;
+				float cost = left.area() * float(leftCount) + rightCost[b + 1];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b + 1;
+				}
+			}
+		}
+
+		U32 middle;
+		if (bestAxis < 0)
+		{
+			// Every centre in one spot, halve when there are too many to share a leaf
+			if (task.count <= leafSize)
+				continue;
+			middle = task.first + task.count / 2;
+		}
+		else
+		{
+			// Traversing costs about as much as testing one primitive
+			float area = box.area();
+			if (task.count <= leafSize && (area <= 0.0f || 1.0f + bestCost / area >= float(task.count)))
+				continue;
+
+			U32* begin = indices.data() + task.first;
+			U32* split = std::partition(begin, begin + task.count, [&](U32 index)
+			{
+				return std::min(binCount - 1, U32((centres[index][bestAxis] - lowest[bestAxis]) * scale[bestAxis])) < bestSplit;
+			});
+			middle = U32(split - indices.data());
+		}
+
+		U32 left = U32(nodes.size());
+		nodes[task.node].first = left;
+		nodes[task.node].count = 0;
+		nodes.emplace_back();
+		nodes.emplace_back();
+		tasks.push_back({ left, task.first, middle - task.first });
+		tasks.push_back({ left + 1, middle, task.first + task.count - middle });
+	}
+}
+
+void Bvh::build(const std::vector<Bounds>& bounds)
+{
+	primitives = bounds;
+	buildNodes(primitives, nodes, indices);
+	deadNodes = 0;
+
+	builtArea.resize(nodes.size());
+	for (size_t i = 0; i < nodes.size(); ++i)
+		builtArea[i] = Bounds{ nodes[i].minimum, nodes[i].maximum }.area();
+
+	collapse();
+}
+
+void Bvh::refit(const std::vector<Bounds>& bounds)
+{
+	if (bounds.size() != primitives.size())
+	{
+		LOG_WARN("Bvh refit with " << bounds.size() << " primitives, built with " << primitives.size() << ", rebuilding");
+		build(bounds);
+		return;
+	}
+	primitives = bounds;
+
+	// Children always come after their parent
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		Node& node = nodes[i];
+		Bounds box;
+		if (node.isLeaf())
+		{
+			for (U32 p = node.first; p < node.first + node.count; ++p)
+				box.grow(primitives[indices[p]]);
+		}
+		else
+		{
+			box.grow(Bounds{ nodes[node.first].minimum, nodes[node.first].maximum });
+			box.grow(Bounds{ nodes[node.first + 1].minimum, nodes[node.first + 1].maximum });
+		}
+		node.minimum = box.minimum;
+		node.maximum = box.maximum;
+	}
+
+	refitWide();
+}
+
+U32 Bvh::update(const std::vector<Bounds>& bounds, float threshold)
+{
+	refit(bounds);
+	if (nodes.empty())
+		return 0;
+
+	U32 rebuilt = 0;
+	std::vector<glm::vec3> centres;
+	std::vector<U32> stack = { 0 };
+	while (!stack.empty())
+	{
+		U32 n = stack.back();
+		stack.pop_back();
+		if (nodes[n].isLeaf())
+			continue;
+
+		float area = Bounds{ nodes[n].minimum, nodes[n].maximum }.area();
+		if (area <= threshold * builtArea[n])
+		{
+			stack.push_back(nodes[n].first);
+			stack.push_back(nodes[n].first + 1);
+			continue;
+		}
+
+		// The old subtree is left in place but unreachable
+		U32 first, count;
+		getRange(n, first, count);
+		deadNodes += countNodes(n) - 1;
+
+		if (centres.empty())
+		{
+			centres.resize(primitives.size());
+			for (size_t i = 0; i < primitives.size(); ++i)
+				centres[i] = primitives[i].centre();
+		}
+
+		size_t oldSize = nodes.size();
+		buildRange(primitives, centres, nodes, indices, n, first, count, maxLeafSize);
+		builtArea.resize(nodes.size());
+		builtArea[n] = Bounds{ nodes[n].minimum, nodes[n].maximum }.area();
+		for (size_t i = oldSize; i < nodes.size(); ++i)
+			builtArea[i] = Bounds{ nodes[i].minimum, nodes[i].maximum }.area();
+		++rebuilt;
+	}
+
+	if (rebuilt)
+	{
+		if (deadNodes > nodes.size() / 2)
+			build(bounds);
+		else
+			collapse();
+	}
+	return rebuilt;
+}
+
+void Bvh::getRange(U32 node, U32& first, U32& count) const
+{
+	U32 leftmost = node;
+	while (!nodes[leftmost].isLeaf())
+		leftmost = nodes[leftmost].first;
+	U32 rightmost = node;
+	while (!nodes[rightmost].isLeaf())
+		rightmost = nodes[rightmost].first + 1;
+
+	first = nodes[leftmost].first;
+	count = nodes[rightmost].first + nodes[rightmost].count - first;
+}
+
+U32 Bvh::countNodes(U32 node) const
+{
+	U32 count = 0;
+	std::vector<U32> stack = { node };
+	while (!stack.empty())
+	{
+		U32 n = stack.back();
+		stack.pop_back();
+		++count;
+		if (!nodes[n].isLeaf())
+		{
+			stack.push_back(nodes[n].first);
+			stack.push_back(nodes[n].first + 1);
+		}
+	}
+	return count;
+}
+
+float Bvh::getCost() const
+{
+	if (nodes.empty())
+		return 0.0f;
+
+	float cost = 0.0f;
+	std::vector<U32> stack = { 0 };
+	while (!stack.empty())
+	{
+		U32 n = stack.back();
+		stack.pop_back();
+		float area = Bounds{ nodes[n].minimum, nodes[n].maximum }.area();
+		if (nodes[n].isLeaf())
+		{
+			cost += area * float(nodes[n].count);
+		}
+		else
+		{
+			cost += area;
+			stack.push_back(nodes[n].first);
+			stack.push_back(nodes[n].first + 1);
+		}
+	}
+
+	float root = Bounds{ nodes[0].minimum, nodes[0].maximum }.area();
+	return root > 0.0f ? cost / root : cost;
+}
+
+void Bvh::collapse()
+{
+	nodes4.clear();
+	nodes8.clear();
+	if (width == 8)
+		collapse(nodes8);
+	else
+		collapse(nodes4);
+}
+
+// Each wide node opens up its largest inner children until it has W of them
+template<U32 W>
+void Bvh::collapse(std::vector<WideNode<W>>& wide)
+{
+	laneSources.clear();
+	if (nodes.empty() || primitives.empty())
+		return;
+
+	struct Task
+	{
+		U32 binary, wide;
+	};
+
+	wide.emplace_back();
+	laneSources.resize(W);
+	std::vector<Task> tasks = { { 0, 0 } };
+	while (!tasks.empty())
+	{
+		Task task = tasks.back();
+		tasks.pop_back();
+
+		U32 lanes[W];
+		U32 used = 0;
+		if (nodes[task.binary].isLeaf())
+		{
+			lanes[used++] = task.binary;
+		}
+		else
+		{
+			lanes[used++] = nodes[task.binary].first;
+			lanes[used++] = nodes[task.binary].first + 1;
+		}
+
+		while (used < W)
+		{
+			S32 largest = -1;
+			float largestArea = -1.0f;
+			for (U32 i = 0; i < used; ++i)
+			{
+				const Node& node = nodes[lanes[i]];
+				float area = Bounds{ node.minimum, node.maximum }.area();
+				if (!node.isLeaf() && area > largestArea)
+				{
+					largest = S32(i);
+					largestArea = area;
+				}
+			}
+			if (largest < 0)
+				break;
+
+			U32 opened = lanes[largest];
+			lanes[largest] = nodes[opened].first;
+			lanes[used++] = nodes[opened].first + 1;
+		}
+
+		for (U32 i = 0; i < used; ++i)
+		{
+			const Node& node = nodes[lanes[i]];
+			U32 child = node.first;
+			if (!node.isLeaf())
+			{
+				child = U32(wide.size());
+				wide.emplace_back();
+				laneSources.resize(wide.size() * W);
+				tasks.push_back({ lanes[i], child });
+			}
+
+			WideNode<W>& target = wide[task.wide];
+			target.child[i] = child;
+			target.count[i] = node.count;
+			laneSources[task.wide * W + i] = lanes[i];
+		}
+
+		WideNode<W>& target = wide[task.wide];
+		target.used = used;
+		// Lanes past used are masked off by every query
+		for (U32 i = used; i < W; ++i)
+		{
+			target.child[i] = 0;
+			target.count[i] = 0;
+			laneSources[task.wide * W + i] = 0;
+		}
+	}
+
+	refitWide();
+}
+
+void Bvh::refitWide()
+{
+	auto refitLanes = [this](auto& wide, U32 w)
+	{
+		for (size_t n = 0; n < wide.size(); ++n)
+		{
+			auto& node = wide[n];
+			for (U32 i = 0; i < w; ++i)
+			{
+				const Node& source = nodes[laneSources[n * w + i]];
+				bool used = i < node.used;
+				node.minX[i] = used ? source.minimum.x : 0.0f;
+				node.minY[i] = used ? source.minimum.y : 0.0f;
+				node.minZ[i] = used ? source.minimum.z : 0.0f;
+				node.maxX[i] = used ? source.maximum.x : 0.0f;
+				node.maxY[i] = used ? source.maximum.y : 0.0f;
+				node.maxZ[i] = used ? source.maximum.z : 0.0f;
+			}
+		}
+	};
+
+	if (width == 8)
+		refitLanes(nodes8, 8);
+	else
+		refitLanes(nodes4, 4);
+}
+
+namespace
+{
+	struct FrustumQuery
+	{
+		glm::vec4 planes[6];
+	};
+
+	struct SphereQuery
+	{
+		glm::vec3 centre;
+		float radiusSquared;
+	};
+
+	struct BoxQuery
+	{
+		Bvh::Bounds box;
+	};
+
+	struct RayQuery
+	{
+		glm::vec3 origin;
+		glm::vec3 inverseDirection;
+		float maxDistance;
+	};
+
+	// Scalar tests, for primitives in leaves and CPUs without SSE
+
+	bool testFrustum(const FrustumQuery& query, const glm::vec3& minimum, const glm::vec3& maximum)
+	{
+		for (U32 p = 0; p < 6; ++p)
+		{
+			const glm::vec4& plane = query.planes[p];
+			// The corner furthest along the plane normal
+			glm::vec3 corner(plane.x >= 0.0f ? maximum.x : minimum.x, plane.y >= 0.0f ? maximum.y : minimum.y, plane.z >= 0.0f ? maximum.z : minimum.z);
+			if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	bool testSphere(const SphereQuery& query, const glm::vec3& minimum, const glm::vec3& maximum)
+	{
+		glm::vec3 offset = glm::max(glm::max(minimum - query.centre, query.centre - maximum), glm::vec3(0.0f));
+		return glm::dot(offset, offset) <= query.radiusSquared;
+	}
+
+	bool testBox(const BoxQuery& query, const glm::vec3& minimum, const glm::vec3& maximum)
+	{
+		return minimum.x <= query.box.maximum.x && maximum.x >= query.box.minimum.x
+			&& minimum.y <= query.box.maximum.y && maximum.y >= query.box.minimum.y
+			&& minimum.z <= query.box.maximum.z && maximum.z >= query.box.minimum.z;
+	}
+
+#ifdef BVH_X86
+
+	U32 frustumMask(const Bvh::WideNode<4>& node, const FrustumQuery& query)
+	{
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (U32 p = 0; p < 6; ++p)
+		{
+			const glm::vec4& plane = query.planes[p];
+			__m128 x = _mm_loadu_ps(plane.x >= 0.0f ? node.maxX : node.minX);
+			__m128 y = _mm_loadu_ps(plane.y >= 0.0f ? node.maxY : node.minY);
+			__m128 z = _mm_loadu_ps(plane.z >= 0.0f ? node.maxZ : node.minZ);
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), x), _mm_mul_ps(_mm_set1_ps(plane.y), y)), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), z), _mm_set1_ps(plane.w)));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+		}
+		return U32(_mm_movemask_ps(inside));
+	}
+
+	U32 sphereMask(const Bvh::WideNode<4>& node, const SphereQuery& query)
+	{
+		__m128 zero = _mm_setzero_ps();
+		__m128 cx = _mm_set1_ps(query.centre.x), cy = _mm_set1_ps(query.centre.y), cz = _mm_set1_ps(query.centre.z);
+		__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), cx), _mm_sub_ps(cx, _mm_loadu_ps(node.maxX))), zero);
+		__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), cy), _mm_sub_ps(cy, _mm_loadu_ps(node.maxY))), zero);
+		__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), cz), _mm_sub_ps(cz, _mm_loadu_ps(node.maxZ))), zero);
+		__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		return U32(_mm_movemask_ps(_mm_cmple_ps(distance, _mm_set1_ps(query.radiusSquared))));
+	}
+
+	U32 boxMask(const Bvh::WideNode<4>& node, const BoxQuery& query)
+	{
+		__m128 overlap = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.minX), _mm_set1_ps(query.box.maximum.x)), _mm_cmpge_ps(_mm_loadu_ps(node.maxX), _mm_set1_ps(query.box.minimum.x)));
+		overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.minY), _mm_set1_ps(query.box.maximum.y)), _mm_cmpge_ps(_mm_loadu_ps(node.maxY), _mm_set1_ps(query.box.minimum.y))));
+		overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(node.minZ), _mm_set1_ps(query.box.maximum.z)), _mm_cmpge_ps(_mm_loadu_ps(node.maxZ), _mm_set1_ps(query.box.minimum.z))));
+		return U32(_mm_movemask_ps(overlap));
+	}
+
+	U32 rayMask(const Bvh::WideNode<4>& node, const RayQuery& query, float* distances)
+	{
+		__m128 ox = _mm_set1_ps(query.origin.x), oy = _mm_set1_ps(query.origin.y), oz = _mm_set1_ps(query.origin.z);
+		__m128 ix = _mm_set1_ps(query.inverseDirection.x), iy = _mm_set1_ps(query.inverseDirection.y), iz = _mm_set1_ps(query.inverseDirection.z);
+		__m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), ox), ix), x1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), ox), ix);
+		__m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), oy), iy), y1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), oy), iy);
+		__m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), oz), iz), z1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), oz), iz);
+		__m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_max_ps(_mm_min_ps(z0, z1), _mm_setzero_ps()));
+		__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_min_ps(_mm_max_ps(z0, z1), _mm_set1_ps(query.maxDistance)));
+		_mm_storeu_ps(distances, entry);
+		return U32(_mm_movemask_ps(_mm_cmple_ps(entry, exit)));
+	}
+
+	TARGET_AVX2 U32 frustumMask(const Bvh::WideNode<8>& node, const FrustumQuery& query)
+	{
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (U32 p = 0; p < 6; ++p)
+		{
+			const glm::vec4& plane = query.planes[p];
+			__m256 x = _mm256_loadu_ps(plane.x >= 0.0f ? node.maxX : node.minX);
+			__m256 y = _mm256_loadu_ps(plane.y >= 0.0f ? node.maxY : node.minY);
+			__m256 z = _mm256_loadu_ps(plane.z >= 0.0f ? node.maxZ : node.minZ);
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), x), _mm256_mul_ps(_mm256_set1_ps(plane.y), y)), _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), z), _mm256_set1_ps(plane.w)));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+		}
+		return U32(_mm256_movemask_ps(inside));
+	}
+
+	TARGET_AVX2 U32 sphereMask(const Bvh::WideNode<8>& node, const SphereQuery& query)
+	{
+		__m256 zero = _mm256_setzero_ps();
+		__m256 cx = _mm256_set1_ps(query.centre.x), cy = _mm256_set1_ps(query.centre.y), cz = _mm256_set1_ps(query.centre.z);
+		__m256 dx = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minX), cx), _mm256_sub_ps(cx, _mm256_loadu_ps(node.maxX))), zero);
+		__m256 dy = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minY), cy), _mm256_sub_ps(cy, _mm256_loadu_ps(node.maxY))), zero);
+		__m256 dz = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minZ), cz), _mm256_sub_ps(cz, _mm256_loadu_ps(node.maxZ))), zero);
+		__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+		return U32(_mm256_movemask_ps(_mm256_cmp_ps(distance, _mm256_set1_ps(query.radiusSquared), _CMP_LE_OQ)));
+	}
+
+	TARGET_AVX2 U32 boxMask(const Bvh::WideNode<8>& node, const BoxQuery& query)
+	{
+		__m256 overlap = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(node.minX), _mm256_set1_ps(query.box.maximum.x), _CMP_LE_OQ), _mm256_cmp_ps(_mm256_loadu_ps(node.maxX), _mm256_set1_ps(query.box.minimum.x), _CMP_GE_OQ));
+		overlap = _mm256_and_ps(overlap, _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(node.minY), _mm256_set1_ps(query.box.maximum.y), _CMP_LE_OQ), _mm256_cmp_ps(_mm256_loadu_ps(node.maxY), _mm256_set1_ps(query.box.minimum.y), _CMP_GE_OQ)));
+		overlap = _mm256_and_ps(overlap, _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(node.minZ), _mm256_set1_ps(query.box.maximum.z), _CMP_LE_OQ), _mm256_cmp_ps(_mm256_loadu_ps(node.maxZ), _mm256_set1_ps(query.box.minimum.z), _CMP_GE_OQ)));
+		return U32(_mm256_movemask_ps(overlap));
+	}
+
+	TARGET_AVX2 U32 rayMask(const Bvh::WideNode<8>& node, const RayQuery& query, float* distances)
+	{
+		__m256 ox = _mm256_set1_ps(query.origin.x), oy = _mm256_set1_ps(query.origin.y), oz = _mm256_set1_ps(query.origin.z);
+		__m256 ix = _mm256_set1_ps(query.inverseDirection.x), iy = _mm256_set1_ps(query.inverseDirection.y), iz = _mm256_set1_ps(query.inverseDirection.z);
+		__m256 x0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minX), ox), ix), x1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.maxX), ox), ix);
+		__m256 y0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minY), oy), iy), y1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.maxY), oy), iy);
+		__m256 z0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minZ), oz), iz), z1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.maxZ), oz), iz);
+		__m256 entry = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(x0, x1), _mm256_min_ps(y0, y1)), _mm256_max_ps(_mm256_min_ps(z0, z1), _mm256_setzero_ps()));
+		__m256 exit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(x0, x1), _mm256_max_ps(y0, y1)), _mm256_min_ps(_mm256_max_ps(z0, z1), _mm256_set1_ps(query.maxDistance)));
+		_mm256_storeu_ps(distances, entry);
+		return U32(_mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ)));
+	}
+
+#else
+
+	template<U32 W>
+	U32 frustumMask(const Bvh::WideNode<W>& node, const FrustumQuery& query)
+	{
+		U32 mask = 0;
+		for (U32 i = 0; i < W; ++i)
+			mask |= testFrustum(query, glm::vec3(node.minX[i], node.minY[i], node.minZ[i]), glm::vec3(node.maxX[i], node.maxY[i], node.maxZ[i])) ? 1u << i : 0u;
+		return mask;
+	}
+
+	template<U32 W>
+	U32 sphereMask(const Bvh::WideNode<W>& node, const SphereQuery& query)
+	{
+		U32 mask = 0;
+		for (U32 i = 0; i < W; ++i)
+			mask |= testSphere(query, glm::vec3(node.minX[i], node.minY[i], node.minZ[i]), glm::vec3(node.maxX[i], node.maxY[i], node.maxZ[i])) ? 1u << i : 0u;
+		return mask;
+	}
+
+	template<U32 W>
+	U32 boxMask(const Bvh::WideNode<W>& node, const BoxQuery& query)
+	{
+		U32 mask = 0;
+		for (U32 i = 0; i < W; ++i)
+			mask |= testBox(query, glm::vec3(node.minX[i], node.minY[i], node.minZ[i]), glm::vec3(node.maxX[i], node.maxY[i], node.maxZ[i])) ? 1u << i : 0u;
+		return mask;
+	}
+
+	template<U32 W>
+	U32 rayMask(const Bvh::WideNode<W>& node, const RayQuery& query, float* distances)
+	{
+		U32 mask = 0;
+		for (U32 i = 0; i < W; ++i)
+		{
+			Bvh::Bounds box;
+			box.minimum = glm::vec3(node.minX[i], node.minY[i], node.minZ[i]);
+			box.maximum = glm::vec3(node.maxX[i], node.maxY[i], node.maxZ[i]);
+			distances[i] = Bvh::intersect(box, query.origin, query.inverseDirection, query.maxDistance);
+			mask |= distances[i] >= 0.0f ? 1u << i : 0u;
+		}
+		return mask;
+	}
+
+#endif
+}
+
+float Bvh::intersect(const Bounds& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance)
+{
+	glm::vec3 t0 = (box.minimum - origin) * inverseDirection;
+	glm::vec3 t1 = (box.maximum - origin) * inverseDirection;
+	glm::vec3 lower = glm::min(t0, t1);
+	glm::vec3 upper = glm::max(t0, t1);
+	float entry = std::max(std::max(lower.x, lower.y), std::max(lower.z, 0.0f));
+	float exit = std::min(std::min(upper.x, upper.y), std::min(upper.z, maxDistance));
+	return entry <= exit ? entry : -1.0f;
+}
+
+template<U32 W, class Mask, class Leaf>
+void Bvh::traverse(const std::vector<WideNode<W>>& wide, const Mask& mask, const Leaf& leaf) const
+{
+	if (wide.empty())
+		return;
+
+	// Reused so queries don't allocate
+	thread_local std::vector<U32> stack;
+	stack.clear();
+	stack.push_back(0);
+	while (!stack.empty())
+	{
+		const WideNode<W>& node = wide[stack.back()];
+		stack.pop_back();
+
+		U32 hits = mask(node) & ((1u << node.used) - 1);
+		for (U32 i = 0; i < W; ++i)
+		{
+			if (!(hits & (1u << i)))
+				continue;
+			if (node.count[i])
+				leaf(node.child[i], node.count[i]);
+			else
+				stack.push_back(node.child[i]);
+		}
+	}
+}
+
+void Bvh::queryFrustum(const glm::mat4& viewProjection, std::vector<U32>& results) const
+{
+	FrustumQuery query;
+	FrustumCuller::getFrustumPlanes(viewProjection, query.planes);
+
+	auto leaf = [&](U32 first, U32 count)
+	{
+		for (U32 i = first; i < first + count; ++i)
+		{
+			const Bounds& box = primitives[indices[i]];
+			if (testFrustum(query, box.minimum, box.maximum))
+				results.push_back(indices[i]);
+		}
+	};
+
+	if (width == 8)
+		traverse(nodes8, [&](const WideNode<8>& node) { return frustumMask(node, query); }, leaf);
+	else
+		traverse(nodes4, [&](const WideNode<4>& node) { return frustumMask(node, query); }, leaf);
+}
+
+void Bvh::querySphere(const glm::vec3& centre, float radius, std::vector<U32>& results) const
+{
+	SphereQuery query = { centre, radius * radius };
+
+	auto leaf = [&](U32 first, U32 count)
+	{
+		for (U32 i = first; i < first + count; ++i)
+		{
+			const Bounds& box = primitives[indices[i]];
+			if (testSphere(query, box.minimum, box.maximum))
+				results.push_back(indices[i]);
+		}
+	};
+
+	if (width == 8)
+		traverse(nodes8, [&](const WideNode<8>& node) { return sphereMask(node, query); }, leaf);
+	else
+		traverse(nodes4, [&](const WideNode<4>& node) { return sphereMask(node, query); }, leaf);
+}
+
+void Bvh::queryBox(const Bounds& box, std::vector<U32>& results) const
+{
+	BoxQuery query = { box };
+
+	auto leaf = [&](U32 first, U32 count)
+	{
+		for (U32 i = first; i < first + count; ++i)
+		{
+			const Bounds& primitive = primitives[indices[i]];
+			if (testBox(query, primitive.minimum, primitive.maximum))
+				results.push_back(indices[i]);
+		}
+	};
+
+	if (width == 8)
+		traverse(nodes8, [&](const WideNode<8>& node) { return boxMask(node, query); }, leaf);
+	else
+		traverse(nodes4, [&](const WideNode<4>& node) { return boxMask(node, query); }, leaf);
+}
+
+bool Bvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Hit& hit, const std::function<bool(U32, float&)>& exact) const
+{
+	hit.primitive = ~0u;
+	hit.distance = maxDistance;
+	if (width == 8)
+		return raycast(nodes8, origin, direction, hit, exact);
+	return raycast(nodes4, origin, direction, hit, exact);
+}
+
+// Nearest first: children are pushed furthest first, and anything entered
+// beyond the nearest hit so far is skipped when popped
+template<U32 W>
+bool Bvh::raycast(const std::vector<WideNode<W>>& wide, const glm::vec3& origin, const glm::vec3& direction, Hit& hit, const std::function<bool(U32, float&)>& exact) const
+{
+	if (wide.empty())
+		return false;
+
+	RayQuery query;
+	query.origin = origin;
+	query.inverseDirection = 1.0f / direction;
+
+	struct Entry
+	{
+		U32 node;
+		float distance;
+	};
+
+	thread_local std::vector<Entry> stack;
+	stack.clear();
+	stack.push_back({ 0, 0.0f });
+	while (!stack.empty())
+	{
+		Entry entry = stack.back();
+		stack.pop_back();
+		if (entry.distance > hit.distance)
+			continue;
+
+		const WideNode<W>& node = wide[entry.node];
+		query.maxDistance = hit.distance;
+		float distances[W];
+		U32 hits = rayMask(node, query, distances) & ((1u << node.used) - 1);
+
+		// Insertion sort of the few children hit, furthest first
+		Entry children[W];
+		U32 childCount = 0;
+		for (U32 i = 0; i < W; ++i)
+		{
+			if (!(hits & (1u << i)))
+				continue;
+
+			if (node.count[i])
+			{
+				for (U32 p = node.child[i]; p < node.child[i] + node.count[i]; ++p)
+				{
+					U32 primitive = indices[p];
+					float distance = intersect(primitives[primitive], origin, query.inverseDirection, hit.distance);
+					if (distance < 0.0f)
+						continue;
+
+					if (exact)
+					{
+						float nearest = hit.distance;
+						if (exact(primitive, nearest) && nearest < hit.distance)
+						{
+							hit.distance = nearest;
+							hit.primitive = primitive;
+						}
+					}
+					else if (distance < hit.distance || hit.primitive == ~0u)
+					{
+						hit.distance = distance;
+						hit.primitive = primitive;
+					}
+				}
+				continue;
+			}
+
+			U32 slot = childCount++;
+			while (slot > 0 && children[slot - 1].distance < distances[i])
+			{
+				children[slot] = children[slot - 1];
+				--slot;
+			}
+			children[slot] = { node.child[i], distances[i] };
+		}
+
+		for (U32 i = 0; i < childCount; ++i)
+			stack.push_back(children[i]);
+	}
+
+	return hit.primitive != ~0u;
+}
@@ -0,0 +1,131 @@
+#include "CommandRecorder.hpp"
+
+void CommandRecorder::init(VkDevice pDevice, U32 queueFamily, U32 frameCount, U32 threadCount)
+{
+	device = pDevice;
+	threads = threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+	if (threads > 1)
+		workers.reset(new ThreadPool(U32(threads - 1)));
+
+	VkCommandPoolCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	info.queueFamilyIndex = queueFamily;
+
+	frames.resize(frameCount);
+	for (auto& frame : frames)
+	{
+		frame.threads.resize(threads);
+		for (auto& thread : frame.threads)
+		{
+			if (vkCreateCommandPool(device, &info, nullptr, &thread.pool) != VK_SUCCESS)
+			{
+				LOG_FATAL("Failed to create recording command pool");
+			}
+		}
+
+		// The primary comes from the first thread's pool, which is only
+		// recorded into by the calling thread
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = frame.threads[0].pool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+		if (vkAllocateCommandBuffers(device, &allocInfo, &frame.primary) != VK_SUCCESS)
+		{
+			LOG_FATAL("Failed to allocate primary command buffer");
+		}
+	}
+
+	LOG_INFO("Recording command buffers on " << threads << " threads, " << frameCount << " frames in flight");
+}
+
+void CommandRecorder::destroy()
+{
+	workers.reset();
+
+	// Destroying a pool frees its command buffers
+	for (auto& frame : frames)
+	{
+		for (auto& thread : frame.threads)
+			vkDestroyCommandPool(device, thread.pool, nullptr);
+	}
+	frames.clear();
+}
+
+VkCommandBuffer CommandRecorder::beginFrame(U32 frame)
+{
+	currentFrame = frame % U32(frames.size());
+	Frame& slot = frames[currentFrame];
+
+	for (auto& thread : slot.threads)
+	{
+		vkResetCommandPool(device, thread.pool, 0);
+		thread.used = 0;
+	}
+	return slot.primary;
+}
+
+VkCommandBuffer CommandRecorder::ThreadPools::nextSecondary(VkDevice device)
+{
+	if (used == secondaries.size())
+	{
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = pool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+
+		VkCommandBuffer buffer;
+		if (vkAllocateCommandBuffers(device, &allocInfo, &buffer) != VK_SUCCESS)
+		{
+			LOG_FATAL("Failed to allocate secondary command buffer");
+		}
+		secondaries.push_back(buffer);
+	}
+	return secondaries[used++];
+}
+
+void CommandRecorder::record(const VkCommandBufferInheritanceInfo& inheritance, U32 drawCount, const RecordRange& recordRange, std::vector<VkCommandBuffer>& secondaries)
+{
+	if (drawCount == 0)
+		return;
+
+	Frame& slot = frames[currentFrame];
+	U32 rangeCount = U32(std::min<size_t>(threads, (drawCount + minDrawsPerThread - 1) / minDrawsPerThread));
+	U32 perRange = (drawCount + rangeCount - 1) / rangeCount;
+
+	// Range i is recorded with thread i's pool, so no two ranges share a pool
+	// whichever worker ends up running them
+	size_t first = secondaries.size();
+	secondaries.resize(first + rangeCount);
+
+	auto recordOne = [&, first](U32 range)
+	{
+		VkCommandBuffer buffer = slot.threads[range].nextSecondary(device);
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		beginInfo.pInheritanceInfo = &inheritance;
+		vkBeginCommandBuffer(buffer, &beginInfo);
+
+		U32 begin = range * perRange;
+		recordRange(buffer, begin, std::min(drawCount, begin + perRange));
+
+		if (vkEndCommandBuffer(buffer) != VK_SUCCESS)
+		{
+			LOG_FATAL("Failed to record secondary command buffer");
+		}
+		secondaries[first + range] = buffer;
+	};
+
+	std::vector<std::future<void>> pending;
+	pending.reserve(rangeCount);
+	for (U32 range = 1; range < rangeCount; ++range)
+		pending.push_back(workers->submit([&recordOne, range]() { recordOne(range); }));
+
+	recordOne(0);
+	for (auto& f : pending)
+		f.get();
+}
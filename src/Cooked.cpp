@@ -0,0 +1,33 @@
+#include "Cooked.hpp"
+
+#include <filesystem>
+
+std::string Cooked::directory = "cooked/";
+
+std::string Cooked::path(std::string source, std::string extension)
+{
+	size_t slash = source.find_last_of("/\\");
+	size_t dot = source.find_last_of('.');
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+		source.erase(dot);
+
+	return directory + source + extension;
+}
+
+std::string Cooked::resolve(std::string source, std::string extension)
+{
+	namespace fs = std::filesystem;
+
+	std::string cooked = path(source, extension);
+	std::error_code ec;
+	if (!fs::exists(cooked, ec))
+		return source;
+
+	if (fs::exists(source, ec) && fs::last_write_time(cooked, ec) < fs::last_write_time(source, ec))
+	{
+		LOG_WARN("Cooked asset is stale, loading source instead: " << source);
+		return source;
+	}
+
+	return cooked;
+}
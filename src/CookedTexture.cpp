@@ -0,0 +1,242 @@
+#include "CookedTexture.hpp"
+#include "File.hpp"
+
+#include <cstring>
+
+void CookedTexture::build(Image& image, Format pFormat)
+{
+	format = pFormat;
+	width = U32(image.width);
+	height = U32(image.height);
+	levels.clear();
+
+	std::vector<Pixel> current = image.data;
+	U32 mipWidth = width;
+	U32 mipHeight = height;
+
+	while (true)
+	{
+		Level level;
+		level.width = mipWidth;
+		level.height = mipHeight;
+
+		if (format == BC1)
+		{
+			compressBC1(current, mipWidth, mipHeight, level.data);
+		}
+		else
+		{
+			level.data.resize(current.size() * sizeof(Pixel));
+			memcpy(level.data.data(), current.data(), level.data.size());
+		}
+		levels.push_back(std::move(level));
+
+		if (mipWidth == 1 && mipHeight == 1)
+			break;
+
+		U32 nextWidth = std::max(mipWidth / 2, 1u);
+		U32 nextHeight = std::max(mipHeight / 2, 1u);
+		std::vector<Pixel> next;
+		downsample(current, mipWidth, mipHeight, next, nextWidth, nextHeight);
+		current.swap(next);
+		mipWidth = nextWidth;
+		mipHeight = nextHeight;
+	}
+}
+
+void CookedTexture::downsample(const std::vector<Pixel>& src, U32 srcWidth, U32 srcHeight, std::vector<Pixel>& dst, U32 dstWidth, U32 dstHeight)
+{
+	dst.resize(dstWidth * dstHeight);
+
+	for (U32 y = 0; y < dstHeight; ++y)
+	{
+		U32 y0 = std::min(y * 2, srcHeight - 1);
+		U32 y1 = std::min(y * 2 + 1, srcHeight - 1);
+		for (U32 x = 0; x < dstWidth; ++x)
+		{
+			U32 x0 = std::min(x * 2, srcWidth - 1);
+			U32 x1 = std::min(x * 2 + 1, srcWidth - 1);
+			const U8* p[4] = {
+				(const U8*)&src[y0 * srcWidth + x0], (const U8*)&src[y0 * srcWidth + x1],
+				(const U8*)&src[y1 * srcWidth + x0], (const U8*)&src[y1 * srcWidth + x1]
+			};
+
+			U8* out = (U8*)&dst[y * dstWidth + x];
+			for (int c = 0; c < 4; ++c)
+				out[c] = U8((p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) / 4);
+		}
+	}
+}
+
+static U16 packRGB565(const U8* c)
+{
+	return U16(((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3));
+}
+
+static void unpackRGB565(U16 v, int* c)
+{
+	c[0] = ((v >> 11) & 31) * 255 / 31;
+	c[1] = ((v >> 5) & 63) * 255 / 63;
+	c[2] = (v & 31) * 255 / 31;
+}
+
+// Bounding box endpoint BC1 encoder, fast enough to cook large textures in parallel
+void CookedTexture::compressBC1(const std::vector<Pixel>& src, U32 srcWidth, U32 srcHeight, std::vector<U8>& dst)
+{
+	U32 blocksX = (srcWidth + 3) / 4;
+	U32 blocksY = (srcHeight + 3) / 4;
+	dst.resize(blocksX * blocksY * 8);
+
+	for (U32 by = 0; by < blocksY; ++by)
+	{
+		for (U32 bx = 0; bx < blocksX; ++bx)
+		{
+			U8 block[16][4];
+			for (U32 i = 0; i < 16; ++i)
+			{
+				U32 x = std::min(bx * 4 + (i & 3), srcWidth - 1);
+				U32 y = std::min(by * 4 + (i >> 2), srcHeight - 1);
+				memcpy(block[i], &src[y * srcWidth + x], 4);
+			}
+
+			U8 lo[3] = { 255, 255, 255 };
+			U8 hi[3] = { 0, 0, 0 };
+			for (U32 i = 0; i < 16; ++i)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					lo[c] = std::min(lo[c], block[i][c]);
+					hi[c] = std::max(hi[c], block[i][c]);
+				}
+			}
+
+			// Inset the box slightly to reduce the error introduced by the extremes
+			for (int c = 0; c < 3; ++c)
+			{
+				U8 inset = U8((hi[c] - lo[c]) >> 4);
+				lo[c] = U8(lo[c] + inset);
+				hi[c] = U8(hi[c] - inset);
+			}
+
+			U16 c0 = packRGB565(hi);
+			U16 c1 = packRGB565(lo);
+			U32 indices = 0;
+
+			if (c0 < c1)
+				std::swap(c0, c1);
+
+			if (c0 != c1)
+			{
+				int palette[4][3];
+				unpackRGB565(c0, palette[0]);
+				unpackRGB565(c1, palette[1]);
+				for (int c = 0; c < 3; ++c)
+				{
+					palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+					palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+				}
+
+				for (U32 i = 0; i < 16; ++i)
+				{
+					int bestIndex = 0;
+					int bestError = std::numeric_limits<int>::max();
+					for (int p = 0; p < 4; ++p)
+					{
+						int dr = palette[p][0] - block[i][0];
+						int dg = palette[p][1] - block[i][1];
+						int db = palette[p][2] - block[i][2];
+						int error = dr * dr + dg * dg + db * db;
+						if (error < bestError)
+						{
+							bestError = error;
+							bestIndex = p;
+						}
+					}
+					indices |= U32(bestIndex) << (i * 2);
+				}
+			}
+
+			U8* out = &dst[(by * blocksX + bx) * 8];
+			memcpy(out, &c0, 2);
+			memcpy(out + 2, &c1, 2);
+			memcpy(out + 4, &indices, 4);
+		}
+	}
+}
+
+VkFormat CookedTexture::getVulkanFormat()
+{
+	switch (format)
+	{
+	case BC1:
+		return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	case RGBA8:
+	default:
+		return VK_FORMAT_R8G8B8A8_UNORM;
+	}
+}
+
+bool CookedTexture::load(std::string path)
+{
+	File file;
+	if (!file.open(path, File::Mode(File::binary | File::in)))
+	{
+		LOG_WARN("Can't open cooked texture: " << path);
+		return false;
+	}
+
+	U32 magic, version, levelCount;
+	file.read(magic);
+	file.read(version);
+	if (magic != cookedMagic || version != cookedVersion)
+	{
+		LOG_WARN("Cooked texture has bad header or version: " << path);
+		return false;
+	}
+
+	file.read(format);
+	file.read(width);
+	file.read(height);
+	file.read(levelCount);
+
+	levels.resize(levelCount);
+	for (auto& level : levels)
+	{
+		U32 size;
+		file.read(level.width);
+		file.read(level.height);
+		file.read(size);
+		level.data.resize(size);
+		file.readArray(level.data.data(), size);
+	}
+
+	if (!file.fstream().good())
+	{
+		LOG_WARN("Cooked texture is truncated: " << path);
+		return false;
+	}
+	return true;
+}
+
+bool CookedTexture::save(std::string path)
+{
+	File file;
+	if (!file.create(std::move(path), File::Mode(File::binary | File::out | File::trunc)))
+		return false;
+
+	file.write(cookedMagic);
+	file.write(cookedVersion);
+	file.write(format);
+	file.write(width);
+	file.write(height);
+	file.write(U32(levels.size()));
+
+	for (auto& level : levels)
+	{
+		file.write(level.width);
+		file.write(level.height);
+		file.write(U32(level.data.size()));
+		file.writeArray(level.data.data(), U32(level.data.size()));
+	}
+	return file.fstream().good();
+}
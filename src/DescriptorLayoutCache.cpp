@@ -0,0 +1,97 @@
+#include "DescriptorLayoutCache.hpp"
+
+VkDescriptorSetLayout DescriptorLayoutCache::getSetLayout(VkDevice device, const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+	std::vector<VkDescriptorSetLayoutBinding> sorted = bindings;
+	std::sort(sorted.begin(), sorted.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+
+	// Immutable samplers aren't part of the key, layouts using them shouldn't come through here
+	std::vector<U64> key;
+	for (const auto& b : sorted)
+	{
+		key.push_back(b.binding);
+		key.push_back(U64(b.descriptorType));
+		key.push_back(b.descriptorCount);
+		key.push_back(b.stageFlags);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = setLayouts.find(key);
+	if (it != setLayouts.end())
+		return it->second;
+
+	VkDescriptorSetLayoutCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	info.bindingCount = U32(sorted.size());
+	info.pBindings = sorted.data();
+
+	VkDescriptorSetLayout layout;
+	if (vkCreateDescriptorSetLayout(device, &info, nullptr, &layout) != VK_SUCCESS)
+	{
+		LOG_FATAL("Failed to create descriptor set layout");
+		return VK_NULL_HANDLE;
+	}
+
+	setLayouts[key] = layout;
+	return layout;
+}
+
+VkPipelineLayout DescriptorLayoutCache::getPipelineLayout(VkDevice device, const std::vector<VkDescriptorSetLayout>& layouts, const std::vector<VkPushConstantRange>& pushConstants)
+{
+	std::vector<U64> key;
+	key.push_back(layouts.size());
+	for (auto layout : layouts)
+		key.push_back(U64(uintptr_t(layout)));
+	for (const auto& range : pushConstants)
+	{
+		key.push_back(range.stageFlags);
+		key.push_back(range.offset);
+		key.push_back(range.size);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = pipelineLayouts.find(key);
+	if (it != pipelineLayouts.end())
+		return it->second;
+
+	VkPipelineLayoutCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	info.setLayoutCount = U32(layouts.size());
+	info.pSetLayouts = layouts.data();
+	info.pushConstantRangeCount = U32(pushConstants.size());
+	info.pPushConstantRanges = pushConstants.data();
+
+	VkPipelineLayout layout;
+	if (vkCreatePipelineLayout(device, &info, nullptr, &layout) != VK_SUCCESS)
+	{
+		LOG_FATAL("Failed to create pipeline layout");
+		return VK_NULL_HANDLE;
+	}
+
+	pipelineLayouts[key] = layout;
+	return layout;
+}
+
+VkPipelineLayout DescriptorLayoutCache::getPipelineLayout(VkDevice device, ShaderReflection& reflection, std::vector<VkDescriptorSetLayout>* setLayouts)
+{
+	std::vector<VkDescriptorSetLayout> layouts;
+	for (U32 set = 0; set < reflection.getSetCount(); ++set)
+		layouts.push_back(getSetLayout(device, reflection.getSetLayoutBindings(set)));
+
+	VkPipelineLayout layout = getPipelineLayout(device, layouts, reflection.pushConstants);
+	if (setLayouts)
+		*setLayouts = std::move(layouts);
+	return layout;
+}
+
+void DescriptorLayoutCache::destroy(VkDevice device)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (auto& layout : pipelineLayouts)
+		vkDestroyPipelineLayout(device, layout.second, nullptr);
+	for (auto& layout : setLayouts)
+		vkDestroyDescriptorSetLayout(device, layout.second, nullptr);
+	pipelineLayouts.clear();
+	setLayouts.clear();
+}
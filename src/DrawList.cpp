@@ -0,0 +1,72 @@
+#include "DrawList.hpp"
+#include "Model.hpp"
+#include "RadixSort.hpp"
+
+void DrawList::setCamera(const glm::vec3& position, float farDistance)
+{
+	cameraPosition = position;
+	inverseFarDistance = 1.0f / farDistance;
+}
+
+void DrawList::submit(Model* mesh, const Material* material, const glm::mat4& transform, U32 layer)
+{
+	Draw* draw = allocator.allocate<Draw>();
+	draw->mesh = mesh;
+	draw->material = material;
+	draw->transform = transform;
+
+	float depth = glm::length(glm::vec3(transform[3]) - cameraPosition) * inverseFarDistance;
+	entries.push_back({ makeKey(layer, material, mesh, depth), draw });
+}
+
+U64 DrawList::makeKey(U32 layer, const Material* material, const Model* mesh, float depth)
+{
+	U64 quantisedDepth = U64(std::min(std::max(depth, 0.0f), 1.0f) * float((1 << 20) - 1));
+	return (U64(layer & 0xF) << 60)
+		| (U64(material->pipelineId & 0x3FF) << 50)
+		| (U64(material->id & 0x3FFF) << 36)
+		| (U64(mesh->id & 0xFFFF) << 20)
+		| quantisedDepth;
+}
+
+void DrawList::retain(const std::vector<U32>& keep)
+{
+	// Indices ascend, so entries only ever move towards the front
+	for (U32 i = 0; i < keep.size(); ++i)
+		entries[i] = entries[keep[i]];
+	entries.resize(keep.size());
+}
+
+void DrawList::sort()
+{
+	// resize() only allocates until the capacity has caught up
+	scratch.resize(entries.size());
+	RadixSort::sort(entries.data(), scratch.data(), entries.size());
+}
+
+void DrawList::buildBatches(bool merge)
+{
+	batches.clear();
+	for (U32 i = 0; i < entries.size(); ++i)
+	{
+		const Draw* draw = entries[i].draw;
+		if (merge && !batches.empty())
+		{
+			const Draw* previous = entries[i - 1].draw;
+			if (previous->mesh == draw->mesh && previous->material == draw->material)
+			{
+				++batches.back().count;
+				continue;
+			}
+		}
+		batches.push_back({ i, 1 });
+	}
+}
+
+void DrawList::reset()
+{
+	// clear() keeps the capacity
+	entries.clear();
+	batches.clear();
+	allocator.reset();
+}
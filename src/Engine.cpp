@@ -3,6 +3,8 @@
 #include "Window.hpp"
 #include "Renderer.hpp"
 
+#include <thread>
+
 void Engine::start()
 {
 	LOG_INFO("Starting engine");
@@ -27,8 +29,24 @@ void Engine::start()
 	double fpsDisplay = 0.f;
 	int frames = 0;
 
+	// Window messages have to be pumped on the thread that made the window,
+	// so it's the renderer that moves
+	TripleBuffer<RenderSnapshot> snapshots;
+	std::thread renderThread;
+	if (threadedRendering)
+	{
+		LOG_INFO("Rendering on its own thread");
+		renderThread = std::thread(renderLoop, std::ref(snapshots));
+	}
+
+	U64 frame = 0;
 	while (isRunning) 
 	{
+		// Stay one frame ahead of the renderer at most, and sample input as
+		// late as possible for the frame that will be drawn next
+		if (threadedRendering)
+			snapshots.waitAcquired();
+
 		frameTime = clock.time();
 		while (window->processMessages()) {}
 
@@ -48,8 +66,14 @@ void Engine::start()
 			}
 		}
 
-		renderer->updateUniformBuffer();
-		renderer->render();
+		RenderSnapshot& snapshot = snapshots.writeSlot();
+		snapshot.clear();
+		snapshot.frame = frame++;
+		simulate(snapshot);
+		snapshots.publish();
+
+		if (!threadedRendering)
+			renderer->render(*snapshots.acquire());
 		frameTime = clock.time() - frameTime;
 
 		++frames;
@@ -62,9 +86,31 @@ void Engine::start()
 		}
 	}
 
+	if (renderThread.joinable())
+	{
+		snapshots.close();
+		renderThread.join();
+	}
+	if (snapshots.getDropped())
+		LOG_INFO(snapshots.getDropped() << " of " << frame << " simulated frames were never rendered");
+
 	quit();
 }
 
+void Engine::simulate(RenderSnapshot& snapshot)
+{
+	snapshot.time = (clock.time() - engineStartTime).getSeconds();
+	snapshot.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	snapshot.draws.push_back({ &renderer->chalet, &renderer->chaletMaterial, glm::mat4(1.0f) });
+}
+
+void Engine::renderLoop(TripleBuffer<RenderSnapshot>& snapshots)
+{
+	// Sleeps between snapshots, start() closes the buffer on the way out
+	while (const RenderSnapshot* snapshot = snapshots.waitAcquire())
+		renderer->render(*snapshot);
+}
+
 void Engine::createWindow()
 {
 	LOG_INFO("Creating window");
@@ -220,5 +266,6 @@ VkPhysicalDevice Engine::vkPhysicalDevice = VK_NULL_HANDLE;
 std::vector<PhysicalDeviceDetails> Engine::physicalDevicesDetails;
 int Engine::physicalDeviceIndex;
 
-bool Engine::isRunning = true;
+std::atomic<bool> Engine::isRunning { true };
+bool Engine::threadedRendering = true;
 Time Engine::engineStartTime;
\ No newline at end of file
@@ -0,0 +1,387 @@
+#include "FiberScheduler.hpp"
+
+#include <cstdlib>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	thread_local void* currentScheduler = nullptr;
+	thread_local U32 currentIndex = 0;
+
+	void pinThread(std::thread& thread, U32 core)
+	{
+#ifdef _WIN32
+		SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (core % 64));
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core % CPU_SETSIZE, &set);
+		pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+	}
+}
+
+FiberScheduler::FiberScheduler(U32 threadCount, U32 fiberCount, U32 stackSize, bool pinThreads)
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	fiberCount = std::max(1u, fiberCount);
+
+#ifdef _WIN32
+	this->stackSize = stackSize;
+#else
+	size_t page = size_t(sysconf(_SC_PAGESIZE));
+	this->stackSize = (std::max<size_t>(stackSize, 4 * page) + page - 1) / page * page;
+	stackStride = this->stackSize + page;
+	stackMemorySize = stackStride * fiberCount;
+	void* memory = mmap(nullptr, stackMemorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+		// Headless tools link this too, LOG_FATAL needs DebugBreak
+		LOG_WARN("Failed to map " << stackMemorySize / 1024 << " KiB of fiber stacks");
+		std::abort();
+	}
+	stackMemory = static_cast<U8*>(memory);
+#endif
+
+	fibers.reserve(fiberCount);
+	for (U32 i = 0; i < fiberCount; ++i)
+	{
+		fibers.push_back(std::make_unique<Fiber>());
+		Fiber* fiber = fibers.back().get();
+		fiber->scheduler = this;
+		fiber->index = i;
+
+#ifdef _WIN32
+		fiber->handle = CreateFiberEx(this->stackSize, this->stackSize, FIBER_FLAG_FLOAT_SWITCH, fiberMain, fiber);
+		if (!fiber->handle)
+		{
+			LOG_WARN("Failed to create fiber");
+			std::abort();
+		}
+#else
+		// Stacks grow down into the guard page at the bottom of their stride
+		U8* base = stackMemory + stackStride * i;
+		mprotect(base, page, PROT_NONE);
+
+		getcontext(&fiber->context);
+		fiber->context.uc_stack.ss_sp = base + page;
+		fiber->context.uc_stack.ss_size = this->stackSize;
+		fiber->context.uc_link = nullptr;
+		// makecontext only passes ints
+		uintptr_t address = reinterpret_cast<uintptr_t>(fiber);
+		makecontext(&fiber->context, reinterpret_cast<void (*)()>(fiberMain), 2, U32(address), U32(U64(address) >> 32));
+#endif
+	}
+	for (U32 i = fiberCount; i-- > 0;)
+		pushFreeFiber(fibers[i].get());
+
+	workers.reserve(threadCount);
+	for (U32 i = 0; i < threadCount; ++i)
+	{
+		workers.push_back(std::make_unique<Worker>());
+		workers.back()->victim = i + 1;
+	}
+
+	// Every deque exists before any thread can steal from it
+	for (U32 i = 0; i < threadCount; ++i)
+	{
+		workers[i]->thread = std::thread(&FiberScheduler::workerLoop, this, i);
+		if (pinThreads)
+			pinThread(workers[i]->thread, i);
+	}
+}
+
+FiberScheduler::~FiberScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (auto& worker : workers)
+		worker->thread.join();
+
+	// Idle fibers sit at their switch back, they are never resumed
+#ifdef _WIN32
+	for (auto& fiber : fibers)
+		DeleteFiber(fiber->handle);
+#else
+	munmap(stackMemory, stackMemorySize);
+#endif
+}
+
+U64 FiberScheduler::getSwitchCount() const
+{
+	U64 count = 0;
+	for (const auto& worker : workers)
+		count += worker->switches.load(std::memory_order_relaxed);
+	return count;
+}
+
+FiberScheduler::Worker* FiberScheduler::currentWorker()
+{
+	return currentScheduler == this ? workers[currentIndex].get() : nullptr;
+}
+
+void FiberScheduler::submit(Worker& self, Job* job)
+{
+	if (!self.deque.push(job))
+	{
+		job->execute();
+		return;
+	}
+	notify();
+}
+
+void FiberScheduler::notify()
+{
+	// Pairs with the sleeping worker raising sleeping before checking queued,
+	// one of the two sees the other
+	queued.fetch_add(1, std::memory_order_seq_cst);
+	if (sleeping.load(std::memory_order_seq_cst) > 0)
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		wake.notify_one();
+	}
+}
+
+Job* FiberScheduler::take(Worker& self)
+{
+	Job* job = self.deque.pop();
+	if (!job)
+	{
+		U32 count = U32(workers.size());
+		for (U32 i = 0; i < count && !job; ++i)
+		{
+			Worker& victim = *workers[(self.victim + i) % count];
+			if (&victim != &self)
+				job = victim.deque.steal();
+		}
+		++self.victim;
+	}
+
+	if (!job && queued.load(std::memory_order_relaxed) > 0)
+	{
+		std::lock_guard<std::mutex> lock(externalMutex);
+		if (!external.empty())
+		{
+			job = external.front();
+			external.pop_front();
+		}
+	}
+
+	if (job)
+		queued.fetch_sub(1, std::memory_order_relaxed);
+	return job;
+}
+
+bool FiberScheduler::runOne(Worker& self)
+{
+	// Fibers whose wait is over go first, they hold on to work in progress
+	for (size_t i = 0; i < self.parked.size(); ++i)
+	{
+		Fiber* fiber = self.parked[i];
+		if (fiber->waitingOn && fiber->waitingOn->isDone())
+		{
+			self.parked.erase(self.parked.begin() + i);
+			switchToFiber(self, fiber);
+			return true;
+		}
+	}
+
+	if (Job* job = take(self))
+	{
+		Fiber* fiber = popFreeFiber();
+		if (!fiber)
+		{
+			// Every fiber is parked or running, this one goes on the worker's
+			// stack and waits there by running other work
+			fiberless.fetch_add(1, std::memory_order_relaxed);
+			job->execute();
+			return true;
+		}
+		fiber->job = job;
+		fiber->waitingOn = nullptr;
+		switchToFiber(self, fiber);
+		return true;
+	}
+
+	// Then fibers that only yielded, oldest first
+	for (size_t i = 0; i < self.parked.size(); ++i)
+	{
+		Fiber* fiber = self.parked[i];
+		if (!fiber->waitingOn)
+		{
+			self.parked.erase(self.parked.begin() + i);
+			switchToFiber(self, fiber);
+			return true;
+		}
+	}
+	return false;
+}
+
+void FiberScheduler::switchToFiber(Worker& self, Fiber* fiber)
+{
+	fiber->worker = &self;
+	self.current = fiber;
+	self.switches.store(self.switches.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+#ifdef _WIN32
+	SwitchToFiber(fiber->handle);
+#else
+	swapcontext(&self.schedulerContext, &fiber->context);
+#endif
+	self.current = nullptr;
+
+	// Only now is the fiber off its stack, it can be handed on
+	if (fiber->job)
+		self.parked.push_back(fiber);
+	else
+		pushFreeFiber(fiber);
+}
+
+void FiberScheduler::switchToScheduler(Fiber* fiber)
+{
+	Worker& worker = *fiber->worker;
+#ifdef _WIN32
+	SwitchToFiber(worker.schedulerFiber);
+#else
+	swapcontext(&fiber->context, &worker.schedulerContext);
+#endif
+}
+
+#ifdef _WIN32
+void WINAPI FiberScheduler::fiberMain(LPVOID parameter)
+{
+	Fiber* fiber = static_cast<Fiber*>(parameter);
+#else
+void FiberScheduler::fiberMain(U32 low, U32 high)
+{
+	Fiber* fiber = reinterpret_cast<Fiber*>(uintptr_t(U64(high) << 32 | low));
+#endif
+	// Each pass runs one job, the fiber may be on another worker every time
+	while (true)
+	{
+		fiber->job->execute();
+		fiber->job = nullptr;
+		fiber->scheduler->switchToScheduler(fiber);
+	}
+}
+
+void FiberScheduler::wait(Counter& counter)
+{
+	if (counter.isDone())
+		return;
+
+	Worker* self = currentWorker();
+	if (!self)
+	{
+		while (!counter.isDone())
+			std::this_thread::yield();
+		return;
+	}
+
+	if (Fiber* fiber = self->current)
+	{
+		// Resumed by this worker once the counter is done
+		fiber->waitingOn = &counter;
+		switchToScheduler(fiber);
+		return;
+	}
+
+	while (!counter.isDone())
+	{
+		if (!runOne(*self))
+			std::this_thread::yield();
+	}
+}
+
+void FiberScheduler::yield()
+{
+	Worker* self = currentWorker();
+	if (!self)
+	{
+		std::this_thread::yield();
+		return;
+	}
+
+	if (Fiber* fiber = self->current)
+	{
+		fiber->waitingOn = nullptr;
+		switchToScheduler(fiber);
+	}
+	else
+		runOne(*self);
+}
+
+FiberScheduler::Fiber* FiberScheduler::popFreeFiber()
+{
+	U64 head = freeFibers.load(std::memory_order_acquire);
+	while (true)
+	{
+		U32 index = U32(head);
+		if (index == 0)
+			return nullptr;
+
+		// The tag changes on every swap, a head popped and pushed back in
+		// between fails the exchange
+		Fiber* fiber = fibers[index - 1].get();
+		U64 next = (((head >> 32) + 1) << 32) | fiber->nextFree.load(std::memory_order_relaxed);
+		if (freeFibers.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+			return fiber;
+	}
+}
+
+void FiberScheduler::pushFreeFiber(Fiber* fiber)
+{
+	U64 head = freeFibers.load(std::memory_order_relaxed);
+	U64 next;
+	do
+	{
+		fiber->nextFree.store(U32(head), std::memory_order_relaxed);
+		next = (((head >> 32) + 1) << 32) | (fiber->index + 1);
+	} while (!freeFibers.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void FiberScheduler::workerLoop(U32 index)
+{
+	currentScheduler = this;
+	currentIndex = index;
+	Worker& self = *workers[index];
+#ifdef _WIN32
+	self.schedulerFiber = ConvertThreadToFiber(nullptr);
+#endif
+
+	while (!stopping.load(std::memory_order_relaxed))
+	{
+		// Work comes in bursts, look around a little before sleeping
+		bool busy = false;
+		for (U32 attempt = 0; attempt < 64 && !busy; ++attempt)
+		{
+			busy = runOne(self);
+			if (!busy)
+				std::this_thread::yield();
+		}
+
+		// Parked fibers are polled, only a worker without any may sleep
+		if (busy || !self.parked.empty())
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleeping.fetch_add(1, std::memory_order_seq_cst);
+		wake.wait(lock, [this]() { return stopping.load(std::memory_order_relaxed) || queued.load(std::memory_order_seq_cst) > 0; });
+		sleeping.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+#ifdef _WIN32
+	ConvertFiberToThread();
+#endif
+}
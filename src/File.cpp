@@ -19,6 +19,7 @@ bool File::create(Mode pFileMode)
 	meta.fileMode = pFileMode;
 
 	file.open(meta.path.c_str(), (std::_Ios_Openmode)meta.fileMode);
+	return file.is_open();
 }
 
 bool File::open(std::string && pPath, Mode pFileMode)
@@ -0,0 +1,133 @@
+#include "FileWatcher.hpp"
+#include "Clock.hpp"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+std::string FileWatcher::normalise(const std::string& path)
+{
+	return fs::path(path).lexically_normal().generic_string();
+}
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher()
+{
+	inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyFd < 0)
+		LOG_WARN("inotify unavailable, file changes won't be detected");
+}
+
+FileWatcher::~FileWatcher()
+{
+	if (inotifyFd >= 0)
+		close(inotifyFd);
+}
+
+void FileWatcher::watch(const std::string& path)
+{
+	std::string file = normalise(path);
+	if (!files.insert(file).second || inotifyFd < 0)
+		return;
+
+	std::string directory = fs::path(file).parent_path().generic_string();
+	if (directory.empty())
+		directory = ".";
+
+	for (const auto& d : directories)
+	{
+		if (d.second == directory)
+			return;
+	}
+
+	int wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (wd < 0)
+	{
+		LOG_WARN("Can't watch directory: " << directory);
+		return;
+	}
+	directories[wd] = directory;
+}
+
+std::vector<std::string> FileWatcher::poll()
+{
+	std::set<std::string> changed;
+	if (inotifyFd < 0)
+		return {};
+
+	alignas(inotify_event) char buffer[4096];
+	while (true)
+	{
+		ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+		if (length <= 0)
+			break;
+
+		for (ssize_t offset = 0; offset < length;)
+		{
+			const inotify_event* event = (const inotify_event*)(buffer + offset);
+			offset += sizeof(inotify_event) + event->len;
+
+			auto directory = directories.find(event->wd);
+			if (directory == directories.end() || event->len == 0)
+				continue;
+
+			std::string file = normalise(directory->second + "/" + event->name);
+			if (files.count(file))
+				changed.insert(file);
+		}
+	}
+	return std::vector<std::string>(changed.begin(), changed.end());
+}
+
+#else
+
+FileWatcher::FileWatcher() : lastPoll(0)
+{
+}
+
+FileWatcher::~FileWatcher()
+{
+}
+
+void FileWatcher::watch(const std::string& path)
+{
+	std::string file = normalise(path);
+	if (!files.insert(file).second)
+		return;
+
+	std::error_code ec;
+	modified[file] = fs::last_write_time(file, ec);
+}
+
+std::vector<std::string> FileWatcher::poll()
+{
+	std::vector<std::string> changed;
+
+	Clock clock;
+	U64 now = clock.now();
+	if (now - lastPoll < pollIntervalMicroSeconds)
+		return changed;
+	lastPoll = now;
+
+	for (const auto& file : files)
+	{
+		std::error_code ec;
+		auto time = fs::last_write_time(file, ec);
+		if (ec)
+			continue;
+
+		auto& previous = modified[file];
+		if (time != previous)
+		{
+			previous = time;
+			changed.push_back(file);
+		}
+	}
+	return changed;
+}
+
+#endif
@@ -0,0 +1,332 @@
+#include "FrustumCuller.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FRUSTUM_CULLER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC emits any intrinsic without per function targets
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+FrustumCuller::FrustumCuller(U32 threadCount) : isa(detectIsa())
+{
+	threads = threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+	if (threads > 1)
+		workers = std::make_unique<ThreadPool>(threads - 1);
+}
+
+FrustumCuller::Isa FrustumCuller::detectIsa()
+{
+#ifdef FRUSTUM_CULLER_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] >= 7)
+	{
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		__cpuidex(info, 7, 0);
+		bool avx2 = (info[1] & (1 << 5)) != 0;
+		// The OS has to save the YMM registers too
+		if (osxsave && avx && avx2 && (_xgetbv(0) & 6) == 6)
+			return Avx2;
+	}
+	return Sse;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return Avx2;
+	return Sse;
+#endif
+#else
+	return Scalar;
+#endif
+}
+
+const char* FrustumCuller::getIsaName(Isa isa)
+{
+	switch (isa)
+	{
+	case Sse:
+		return "SSE";
+	case Avx2:
+		return "AVX2";
+	case Scalar:
+	default:
+		return "scalar";
+	}
+}
+
+void FrustumCuller::clear()
+{
+	centreX.clear();
+	centreY.clear();
+	centreZ.clear();
+	extentX.clear();
+	extentY.clear();
+	extentZ.clear();
+}
+
+void FrustumCuller::reserve(U32 count)
+{
+	centreX.reserve(count);
+	centreY.reserve(count);
+	centreZ.reserve(count);
+	extentX.reserve(count);
+	extentY.reserve(count);
+	extentZ.reserve(count);
+}
+
+U32 FrustumCuller::add(const glm::vec3& minimum, const glm::vec3& maximum)
+{
+	glm::vec3 centre = (minimum + maximum) * 0.5f;
+	glm::vec3 extent = (maximum - minimum) * 0.5f;
+	centreX.push_back(centre.x);
+	centreY.push_back(centre.y);
+	centreZ.push_back(centre.z);
+	extentX.push_back(extent.x);
+	extentY.push_back(extent.y);
+	extentZ.push_back(extent.z);
+	return size() - 1;
+}
+
+U32 FrustumCuller::add(const glm::vec3& minimum, const glm::vec3& maximum, const glm::mat4& transform)
+{
+	glm::vec3 centre = (minimum + maximum) * 0.5f;
+	glm::vec3 extent = (maximum - minimum) * 0.5f;
+
+	// The box around the transformed box, extents go through |rotation scale|
+	glm::vec3 worldCentre = glm::vec3(transform * glm::vec4(centre, 1.0f));
+	glm::vec3 worldExtent;
+	for (int row = 0; row < 3; ++row)
+		worldExtent[row] = std::abs(transform[0][row]) * extent.x + std::abs(transform[1][row]) * extent.y + std::abs(transform[2][row]) * extent.z;
+
+	return add(worldCentre - worldExtent, worldCentre + worldExtent);
+}
+
+void FrustumCuller::getBounds(U32 index, glm::vec3& minimum, glm::vec3& maximum) const
+{
+	glm::vec3 centre(centreX[index], centreY[index], centreZ[index]);
+	glm::vec3 extent(extentX[index], extentY[index], extentZ[index]);
+	minimum = centre - extent;
+	maximum = centre + extent;
+}
+
+void FrustumCuller::getFrustumPlanes(const glm::mat4& m, glm::vec4 planes[6])
+{
+	glm::vec4 rows[4];
+	for (U32 i = 0; i < 4; ++i)
+		rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+	planes[0] = rows[3] + rows[0];	// left
+	planes[1] = rows[3] - rows[0];	// right
+	planes[2] = rows[3] + rows[1];	// bottom
+	planes[3] = rows[3] - rows[1];	// top
+	planes[4] = rows[2];			// near, depth is 0..1
+	planes[5] = rows[3] - rows[2];	// far
+
+	for (U32 i = 0; i < 6; ++i)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+void FrustumCuller::cull(const glm::mat4& viewProjection, std::vector<U32>& visible)
+{
+	cull(viewProjection, visible, isa, threads);
+}
+
+void FrustumCuller::cull(const glm::mat4& viewProjection, std::vector<U32>& visible, Isa useIsa, U32 threadCount)
+{
+	U32 count = size();
+	// resize() only allocates until the capacity has caught up
+	visible.resize(count);
+	if (count == 0)
+		return;
+
+	glm::vec4 planes[6];
+	getFrustumPlanes(viewProjection, planes);
+
+	threadCount = std::max(1u, std::min(threadCount, workers ? workers->size() + 1 : 1u));
+	U32 chunkCount = std::min(threadCount, (count + minObjectsPerThread - 1) / minObjectsPerThread);
+	U32 perChunk = (count + chunkCount - 1) / chunkCount;
+	// Keep chunk edges on a whole AVX2 block
+	perChunk = (perChunk + 7) & ~7u;
+	chunkCount = (count + perChunk - 1) / perChunk;
+
+	// Chunk i writes its results from visible[i * perChunk]
+	std::vector<U32> found(chunkCount);
+	U32* out = visible.data();
+	auto cullChunk = [&, out](U32 chunk)
+	{
+		U32 begin = chunk * perChunk;
+		found[chunk] = cullRange(planes, begin, std::min(count, begin + perChunk), out + begin, useIsa);
+	};
+
+	std::vector<std::future<void>> pending;
+	pending.reserve(chunkCount);
+	for (U32 chunk = 1; chunk < chunkCount; ++chunk)
+		pending.push_back(workers->submit([&cullChunk, chunk]() { cullChunk(chunk); }));
+
+	cullChunk(0);
+	for (auto& f : pending)
+		f.get();
+
+	// Pack the chunks, each one only moves towards the front so a forward
+	// copy is safe over the overlap
+	U32 total = found[0];
+	for (U32 chunk = 1; chunk < chunkCount; ++chunk)
+	{
+		const U32* chunkBegin = out + chunk * perChunk;
+		std::copy(chunkBegin, chunkBegin + found[chunk], out + total);
+		total += found[chunk];
+	}
+	visible.resize(total);
+}
+
+U32 FrustumCuller::cullRange(const glm::vec4 planes[6], U32 begin, U32 end, U32* out, Isa useIsa) const
+{
+#ifdef FRUSTUM_CULLER_X86
+	if (useIsa == Avx2)
+		return cullAvx2(planes, begin, end, out);
+	if (useIsa == Sse)
+		return cullSse(planes, begin, end, out);
+#endif
+	return cullScalar(planes, begin, end, out);
+}
+
+// A box is outside when its centre is further behind a plane than its
+// projected radius |n| . extent
+U32 FrustumCuller::cullScalar(const glm::vec4 planes[6], U32 begin, U32 end, U32* out) const
+{
+	U32 found = 0;
+	for (U32 i = begin; i < end; ++i)
+	{
+		bool inside = true;
+		for (U32 p = 0; p < 6 && inside; ++p)
+		{
+			const glm::vec4& plane = planes[p];
+			// Same association as the SIMD kernels so every path agrees exactly
+			float distance = (plane.x * centreX[i] + plane.y * centreY[i]) + (plane.z * centreZ[i] + plane.w);
+			float radius = (std::abs(plane.x) * extentX[i] + std::abs(plane.y) * extentY[i]) + std::abs(plane.z) * extentZ[i];
+			inside = distance + radius >= 0.0f;
+		}
+		out[found] = i;
+		found += inside ? 1 : 0;
+	}
+	return found;
+}
+
+#ifdef FRUSTUM_CULLER_X86
+
+U32 FrustumCuller::cullSse(const glm::vec4 planes[6], U32 begin, U32 end, U32* out) const
+{
+	__m128 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+	for (U32 p = 0; p < 6; ++p)
+	{
+		nx[p] = _mm_set1_ps(planes[p].x);
+		ny[p] = _mm_set1_ps(planes[p].y);
+		nz[p] = _mm_set1_ps(planes[p].z);
+		nw[p] = _mm_set1_ps(planes[p].w);
+		ax[p] = _mm_set1_ps(std::abs(planes[p].x));
+		ay[p] = _mm_set1_ps(std::abs(planes[p].y));
+		az[p] = _mm_set1_ps(std::abs(planes[p].z));
+	}
+	const __m128 zero = _mm_setzero_ps();
+
+	U32 found = 0;
+	U32 i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&centreX[i]);
+		__m128 cy = _mm_loadu_ps(&centreY[i]);
+		__m128 cz = _mm_loadu_ps(&centreZ[i]);
+		__m128 ex = _mm_loadu_ps(&extentX[i]);
+		__m128 ey = _mm_loadu_ps(&extentY[i]);
+		__m128 ez = _mm_loadu_ps(&extentZ[i]);
+
+		// Lanes stay set while the box is inside every plane so far
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (U32 p = 0; p < 6; ++p)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)), _mm_add_ps(_mm_mul_ps(nz[p], cz), nw[p]));
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)), _mm_mul_ps(az[p], ez));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+		}
+
+		// Branchless compaction: every lane is written, only visible ones advance
+		int mask = _mm_movemask_ps(inside);
+		for (U32 lane = 0; lane < 4; ++lane)
+		{
+			out[found] = i + lane;
+			found += (mask >> lane) & 1;
+		}
+	}
+
+	return found + cullScalar(planes, i, end, out + found);
+}
+
+TARGET_AVX2 U32 FrustumCuller::cullAvx2(const glm::vec4 planes[6], U32 begin, U32 end, U32* out) const
+{
+	__m256 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+	for (U32 p = 0; p < 6; ++p)
+	{
+		nx[p] = _mm256_set1_ps(planes[p].x);
+		ny[p] = _mm256_set1_ps(planes[p].y);
+		nz[p] = _mm256_set1_ps(planes[p].z);
+		nw[p] = _mm256_set1_ps(planes[p].w);
+		ax[p] = _mm256_set1_ps(std::abs(planes[p].x));
+		ay[p] = _mm256_set1_ps(std::abs(planes[p].y));
+		az[p] = _mm256_set1_ps(std::abs(planes[p].z));
+	}
+	const __m256 zero = _mm256_setzero_ps();
+
+	U32 found = 0;
+	U32 i = begin;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(&centreX[i]);
+		__m256 cy = _mm256_loadu_ps(&centreY[i]);
+		__m256 cz = _mm256_loadu_ps(&centreZ[i]);
+		__m256 ex = _mm256_loadu_ps(&extentX[i]);
+		__m256 ey = _mm256_loadu_ps(&extentY[i]);
+		__m256 ez = _mm256_loadu_ps(&extentZ[i]);
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (U32 p = 0; p < 6; ++p)
+		{
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx[p], cx), _mm256_mul_ps(ny[p], cy)), _mm256_add_ps(_mm256_mul_ps(nz[p], cz), nw[p]));
+			__m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax[p], ex), _mm256_mul_ps(ay[p], ey)), _mm256_mul_ps(az[p], ez));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		// Whole blocks are usually all in or all out
+		if (mask == 0)
+			continue;
+		for (U32 lane = 0; lane < 8; ++lane)
+		{
+			out[found] = i + lane;
+			found += (mask >> lane) & 1;
+		}
+	}
+
+	return found + cullScalar(planes, i, end, out + found);
+}
+
+#else
+
+U32 FrustumCuller::cullSse(const glm::vec4 planes[6], U32 begin, U32 end, U32* out) const
+{
+	return cullScalar(planes, begin, end, out);
+}
+
+U32 FrustumCuller::cullAvx2(const glm::vec4 planes[6], U32 begin, U32 end, U32* out) const
+{
+	return cullScalar(planes, begin, end, out);
+}
+
+#endif
@@ -0,0 +1,380 @@
+#include "GpuCulling.hpp"
+#include "Engine.hpp"
+#include "Cooked.hpp"
+#include "FrustumCuller.hpp"
+#include "Model.hpp"
+#include "PipelineCache.hpp"
+
+bool GpuCulling::enabled = true;
+bool GpuCulling::verify = false;
+
+bool GpuCulling::init(VkDevice pDevice, U32 queueFamily, VkQueue pQueue, U32 frameCount, DescriptorLayoutCache& layoutCache, bool indirectCount)
+{
+	device = pDevice;
+	queue = pQueue;
+
+	const auto& details = Engine::getPhysicalDeviceDetails();
+	if (!details.deviceFeatures.drawIndirectFirstInstance)
+	{
+		LOG_WARN("GPU culling needs drawIndirectFirstInstance, culling on the CPU instead");
+		return false;
+	}
+
+	// Without multiDrawIndirect every command is its own call, still correct
+	// but the recording cost goes back to one call per object
+	if (details.deviceFeatures.multiDrawIndirect)
+	{
+		maxDrawIndirectCount = details.deviceProperties.limits.maxDrawIndirectCount;
+		if (indirectCount)
+			drawIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+	}
+	else
+	{
+		LOG_WARN("No multiDrawIndirect, GPU culled batches are drawn one command per call");
+	}
+
+	shader.load(Cooked::resolve("shaders/cull.glsl", ".comp.spv"));
+
+	ShaderReflection reflection;
+	if (!shader.reflect(0, reflection))
+	{
+		LOG_WARN("Failed to build the culling shader, culling on the CPU instead");
+		return false;
+	}
+
+	std::vector<VkDescriptorSetLayout> setLayouts;
+	layout = layoutCache.getPipelineLayout(device, reflection, &setLayouts);
+	setLayout = setLayouts[0];
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = shader.getStageInfo(0);
+	pipelineInfo.layout = layout;
+
+	if (PipelineCache::createComputePipeline(device, pipelineInfo, pipeline) != VK_SUCCESS)
+	{
+		LOG_WARN("Failed to create the culling pipeline, culling on the CPU instead");
+		pipeline = VK_NULL_HANDLE;
+		return false;
+	}
+
+	std::vector<VkDescriptorPoolSize> poolSizes = reflection.getPoolSizes(frameCount);
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = U32(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = frameCount;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+	{
+		LOG_FATAL("Failed to create culling descriptor pool");
+	}
+
+	VkCommandPoolCreateInfo commandPoolInfo = {};
+	commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	commandPoolInfo.queueFamilyIndex = queueFamily;
+
+	if (vkCreateCommandPool(device, &commandPoolInfo, nullptr, &commandPool) != VK_SUCCESS)
+	{
+		LOG_FATAL("Failed to create culling command pool");
+	}
+
+	frames.resize(frameCount);
+	for (auto& frame : frames)
+	{
+		VkDescriptorSetAllocateInfo setInfo = {};
+		setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		setInfo.descriptorPool = descriptorPool;
+		setInfo.descriptorSetCount = 1;
+		setInfo.pSetLayouts = &setLayout;
+		if (vkAllocateDescriptorSets(device, &setInfo, &frame.descriptorSet) != VK_SUCCESS)
+		{
+			LOG_FATAL("Failed to allocate culling descriptor set");
+		}
+
+		VkCommandBufferAllocateInfo commandInfo = {};
+		commandInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		commandInfo.commandPool = commandPool;
+		commandInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		commandInfo.commandBufferCount = 1;
+		vkAllocateCommandBuffers(device, &commandInfo, &frame.commandBuffer);
+
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.finished);
+	}
+
+	LOG_INFO("GPU culling on queue family " << queueFamily << (drawIndirectCount ? ", compacted with draw indirect count" : ""));
+	return true;
+}
+
+void GpuCulling::destroy()
+{
+	if (device == VK_NULL_HANDLE)
+		return;
+
+	if (verify && checkedFrames)
+		LOG_INFO("GPU culling checked against the CPU on " << checkedFrames << " frames, " << mismatches << " mismatched");
+
+	for (auto& frame : frames)
+	{
+		release(frame);
+		vkDestroySemaphore(device, frame.finished, nullptr);
+	}
+	frames.clear();
+
+	if (commandPool != VK_NULL_HANDLE)
+		vkDestroyCommandPool(device, commandPool, nullptr);
+	if (descriptorPool != VK_NULL_HANDLE)
+		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	if (pipeline != VK_NULL_HANDLE)
+		vkDestroyPipeline(device, pipeline, nullptr);
+	shader.destroy();
+
+	commandPool = VK_NULL_HANDLE;
+	descriptorPool = VK_NULL_HANDLE;
+	pipeline = VK_NULL_HANDLE;
+	device = VK_NULL_HANDLE;
+}
+
+void GpuCulling::prepare(U32 frameIndex, const DrawList& drawList, VkBuffer transforms, const glm::mat4& viewProjection)
+{
+	Frame& frame = frames[frameIndex];
+	const auto& batches = drawList.getBatches();
+
+	reserve(frame, drawList.size(), U32(batches.size()));
+
+	// Compaction needs every batch to fit in one count draw
+	bool compact = drawIndirectCount != nullptr;
+
+	Object* objects = frame.mappedObjects;
+	for (U32 b = 0; b < batches.size(); ++b)
+	{
+		const DrawList::Batch& batch = batches[b];
+		Model* mesh = drawList[batch.first].mesh;
+		Object object = { mesh->boundingSphere, U32(mesh->getIndicesSize()), b, batch.first, 0 };
+		for (U32 i = batch.first; i < batch.first + batch.count; ++i)
+			objects[i] = object;
+		compact = compact && batch.count <= maxDrawIndirectCount;
+	}
+
+	FrustumCuller::getFrustumPlanes(viewProjection, frame.constants.planes);
+	frame.constants.objectCount = drawList.size();
+	frame.constants.compact = compact ? 1 : 0;
+	frame.batchCount = U32(batches.size());
+
+	if (transforms != frame.transforms)
+	{
+		frame.transforms = transforms;
+		updateDescriptors(frame);
+	}
+
+	if (verify)
+	{
+		frame.expected.assign(batches.size(), 0);
+		for (U32 b = 0; b < batches.size(); ++b)
+		{
+			for (U32 i = batches[b].first; i < batches[b].first + batches[b].count; ++i)
+			{
+				if (isVisible(frame.constants.planes, objects[i].sphere, drawList[i].transform))
+					++frame.expected[b];
+			}
+		}
+	}
+}
+
+VkSemaphore GpuCulling::dispatch(U32 frameIndex)
+{
+	Frame& frame = frames[frameIndex];
+	VkCommandBuffer commandBuffer = frame.commandBuffer;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	if (frame.constants.objectCount)
+	{
+		// The shader only ever adds to the counts
+		vkCmdFillBuffer(commandBuffer, frame.counts, 0, VkDeviceSize(frame.batchCount) * sizeof(U32), 0);
+
+		VkMemoryBarrier clear = {};
+		clear.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		clear.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		clear.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clear, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &frame.descriptorSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Constants), &frame.constants);
+		vkCmdDispatch(commandBuffer, (frame.constants.objectCount + groupSize - 1) / groupSize, 1, 1);
+
+		if (verify)
+		{
+			VkMemoryBarrier readback = {};
+			readback.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			readback.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			readback.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &readback, 0, nullptr, 0, nullptr);
+		}
+	}
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		LOG_FATAL("Failed to record culling command buffer");
+	}
+
+	// The semaphore makes the shader writes visible to the graphics submit
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &frame.finished;
+
+	if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+	{
+		LOG_FATAL("Failed to submit culling command buffer");
+	}
+
+	return frame.finished;
+}
+
+void GpuCulling::draw(VkCommandBuffer commandBuffer, U32 frameIndex, U32 batch, const DrawList::Batch& range)
+{
+	Frame& frame = frames[frameIndex];
+	const U32 stride = sizeof(VkDrawIndexedIndirectCommand);
+
+	if (frame.constants.compact)
+	{
+		drawIndirectCount(commandBuffer, frame.commands, VkDeviceSize(range.first) * stride, frame.counts, VkDeviceSize(batch) * sizeof(U32), range.count, stride);
+		return;
+	}
+
+	// Uncompacted, culled commands in the range draw nothing
+	for (U32 first = 0; first < range.count; first += maxDrawIndirectCount)
+	{
+		U32 count = std::min(maxDrawIndirectCount, range.count - first);
+		vkCmdDrawIndexedIndirect(commandBuffer, frame.commands, VkDeviceSize(range.first + first) * stride, count, stride);
+	}
+}
+
+void GpuCulling::check(U32 frameIndex)
+{
+	if (!verify)
+		return;
+
+	Frame& frame = frames[frameIndex];
+	if (frame.constants.objectCount == 0)
+		return;
+
+	U32 wrong = 0;
+	for (U32 b = 0; b < frame.batchCount; ++b)
+	{
+		if (frame.mappedCounts[b] != frame.expected[b])
+			++wrong;
+	}
+
+	++checkedFrames;
+	if (wrong)
+	{
+		++mismatches;
+		LOG_WARN("GPU culling disagrees with the CPU on " << wrong << " of " << frame.batchCount << " batches");
+	}
+}
+
+// Same test as shaders/cull.glsl
+bool GpuCulling::isVisible(const glm::vec4 planes[6], const glm::vec4& sphere, const glm::mat4& transform)
+{
+	glm::vec3 centre = glm::vec3(transform * glm::vec4(glm::vec3(sphere), 1.0f));
+	float scale2 = std::max(std::max(glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])), glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1]))), glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2])));
+	float radius = sphere.w * std::sqrt(scale2);
+
+	for (U32 i = 0; i < 6; ++i)
+	{
+		if (glm::dot(glm::vec3(planes[i]), centre) + planes[i].w < -radius)
+			return false;
+	}
+	return true;
+}
+
+// Grows the slot's buffers. Only called while the slot's previous frame has
+// finished, so the old buffers can go straight away.
+void GpuCulling::reserve(Frame& frame, U32 objectCount, U32 batchCount)
+{
+	if (objectCount <= frame.objectCapacity && batchCount <= frame.batchCapacity)
+		return;
+
+	release(frame);
+
+	frame.objectCapacity = std::max(objectCount + objectCount / 2, 1024u);
+	frame.batchCapacity = std::max(batchCount + batchCount / 2, 256u);
+
+	Renderer* renderer = Engine::renderer;
+	VkDeviceSize objectsSize = VkDeviceSize(frame.objectCapacity) * sizeof(Object);
+	VkDeviceSize commandsSize = VkDeviceSize(frame.objectCapacity) * sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize countsSize = VkDeviceSize(frame.batchCapacity) * sizeof(U32);
+
+	renderer->createVulkanBuffer(objectsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.objects, frame.objectsMemory, true);
+	renderer->createVulkanBuffer(commandsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.commands, frame.commandsMemory, true);
+	// Host visible so check() can read it back
+	renderer->createVulkanBuffer(countsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frame.counts, frame.countsMemory, true);
+
+	void* data;
+	vkMapMemory(device, frame.objectsMemory, 0, objectsSize, 0, &data);
+	frame.mappedObjects = static_cast<Object*>(data);
+	vkMapMemory(device, frame.countsMemory, 0, countsSize, 0, &data);
+	frame.mappedCounts = static_cast<U32*>(data);
+
+	// New buffers, the set has to be rewritten
+	frame.transforms = VK_NULL_HANDLE;
+}
+
+void GpuCulling::release(Frame& frame)
+{
+	if (frame.objects == VK_NULL_HANDLE)
+		return;
+
+	vkUnmapMemory(device, frame.objectsMemory);
+	vkUnmapMemory(device, frame.countsMemory);
+	vkDestroyBuffer(device, frame.objects, nullptr);
+	vkFreeMemory(device, frame.objectsMemory, nullptr);
+	vkDestroyBuffer(device, frame.commands, nullptr);
+	vkFreeMemory(device, frame.commandsMemory, nullptr);
+	vkDestroyBuffer(device, frame.counts, nullptr);
+	vkFreeMemory(device, frame.countsMemory, nullptr);
+
+	frame.objects = VK_NULL_HANDLE;
+	frame.commands = VK_NULL_HANDLE;
+	frame.counts = VK_NULL_HANDLE;
+	frame.mappedObjects = nullptr;
+	frame.mappedCounts = nullptr;
+	frame.objectCapacity = 0;
+	frame.batchCapacity = 0;
+}
+
+void GpuCulling::updateDescriptors(Frame& frame)
+{
+	VkDescriptorBufferInfo buffers[4] = {};
+	buffers[0].buffer = frame.objects;
+	buffers[1].buffer = frame.transforms;
+	buffers[2].buffer = frame.commands;
+	buffers[3].buffer = frame.counts;
+
+	std::array<VkWriteDescriptorSet, 4> writes = {};
+	for (U32 i = 0; i < 4; ++i)
+	{
+		buffers[i].range = VK_WHOLE_SIZE;
+
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = frame.descriptorSet;
+		writes[i].dstBinding = i;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[i].descriptorCount = 1;
+		writes[i].pBufferInfo = &buffers[i];
+	}
+
+	vkUpdateDescriptorSets(device, U32(writes.size()), writes.data(), 0, nullptr);
+}
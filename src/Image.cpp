@@ -1,6 +1,9 @@
 #include "Image.hpp"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
+// Images are decoded on several threads at once, and this stb_image keeps
+// the failure reason in a plain global. Without the strings it's never set.
+#define STBI_NO_FAILURE_STRINGS
 #include "stb_image.h"
 #include "stb_image_write.h"
 
@@ -18,6 +21,21 @@ void Image::load(std::string path)
 	stbi_image_free(loadedData);
 }
 
+void Image::loadMemory(const U8* bytes, size_t size)
+{
+	int bpp;
+	unsigned char* loadedData = stbi_load_from_memory(bytes, int(size), &width, &height, &bpp, 4);
+	if (!loadedData) {
+		LOG_WARN("Failed to decode image of " << size << " bytes");
+		data.clear();
+		return;
+	}
+	mipLevels = static_cast<U32>(std::floor(std::log2(std::max(width, height)))) + 1;
+	data.resize(width*height);
+	memcpy(&data[0], loadedData, width * height * sizeof(Pixel));
+	stbi_image_free(loadedData);
+}
+
 void Image::save(std::string path)
 {
 	int result = stbi_write_png(path.c_str(), width, height, 4, &data[0], 0);
@@ -0,0 +1,56 @@
+#include "InstanceBuffer.hpp"
+#include "Engine.hpp"
+
+void InstanceBuffer::reserve(U32 instanceCount)
+{
+	if (instanceCount <= capacity)
+		return;
+
+	// The slot's previous frame has finished, the old buffer can go right away
+	destroy();
+
+	capacity = std::max(instanceCount + instanceCount / 2, 1024u);
+	VkDeviceSize size = VkDeviceSize(capacity) * sizeof(glm::mat4);
+	// Also read by the GPU culling pass, possibly on another queue family
+	Engine::renderer->createVulkanBuffer(size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, memory, true);
+
+	void* data;
+	vkMapMemory(Engine::renderer->vkLogicalDevice, memory, 0, size, 0, &data);
+	mapped = static_cast<glm::mat4*>(data);
+}
+
+void InstanceBuffer::destroy()
+{
+	if (buffer == VK_NULL_HANDLE)
+		return;
+
+	vkUnmapMemory(Engine::renderer->vkLogicalDevice, memory);
+	vkDestroyBuffer(Engine::renderer->vkLogicalDevice, buffer, nullptr);
+	vkFreeMemory(Engine::renderer->vkLogicalDevice, memory, nullptr);
+	buffer = VK_NULL_HANDLE;
+	memory = VK_NULL_HANDLE;
+	mapped = nullptr;
+	capacity = 0;
+}
+
+VkVertexInputBindingDescription InstanceBuffer::getBindingDescription()
+{
+	VkVertexInputBindingDescription desc = {};
+	desc.binding = binding;
+	desc.stride = sizeof(glm::mat4);
+	desc.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+	return desc;
+}
+
+std::array<VkVertexInputAttributeDescription, 4> InstanceBuffer::getAttributeDescriptions()
+{
+	std::array<VkVertexInputAttributeDescription, 4> desc;
+	for (U32 column = 0; column < 4; ++column)
+	{
+		desc[column].binding = binding;
+		desc[column].location = firstLocation + column;
+		desc[column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		desc[column].offset = column * sizeof(glm::vec4);
+	}
+	return desc;
+}
@@ -0,0 +1,146 @@
+#include "JobSystem.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+namespace
+{
+	thread_local void* currentSystem = nullptr;
+	thread_local U32 currentIndex = 0;
+
+	void pinThread(std::thread& thread, U32 core)
+	{
+#ifdef _WIN32
+		SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << (core % 64));
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core % CPU_SETSIZE, &set);
+		pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+	}
+}
+
+JobSystem::JobSystem(U32 threadCount, bool pinThreads) : ownerThread(std::this_thread::get_id())
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	workers.reserve(threadCount);
+	for (U32 i = 0; i < threadCount; ++i)
+	{
+		workers.push_back(std::make_unique<Worker>());
+		workers.back()->victim = i + 1;
+	}
+
+	// Every deque exists before any thread can steal from it
+	for (U32 i = 1; i < threadCount; ++i)
+	{
+		workers[i]->thread = std::thread(&JobSystem::workerLoop, this, i);
+		if (pinThreads)
+			pinThread(workers[i]->thread, i);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (U32 i = 1; i < workers.size(); ++i)
+		workers[i]->thread.join();
+}
+
+JobSystem::Worker* JobSystem::currentWorker()
+{
+	if (currentSystem == this)
+		return workers[currentIndex].get();
+	if (std::this_thread::get_id() == ownerThread)
+		return workers[0].get();
+	return nullptr;
+}
+
+void JobSystem::submit(Worker& self, Job* job)
+{
+	if (!self.deque.push(job))
+	{
+		job->execute();
+		return;
+	}
+
+	// Pairs with the sleeping worker raising sleeping before checking queued,
+	// one of the two sees the other
+	queued.fetch_add(1, std::memory_order_seq_cst);
+	if (sleeping.load(std::memory_order_seq_cst) > 0)
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		wake.notify_one();
+	}
+}
+
+Job* JobSystem::take(Worker& self)
+{
+	Job* job = self.deque.pop();
+	if (!job)
+	{
+		U32 count = U32(workers.size());
+		for (U32 i = 0; i < count && !job; ++i)
+		{
+			Worker& victim = *workers[(self.victim + i) % count];
+			if (&victim != &self)
+				job = victim.deque.steal();
+		}
+		++self.victim;
+	}
+
+	if (job)
+		queued.fetch_sub(1, std::memory_order_relaxed);
+	return job;
+}
+
+void JobSystem::wait(Counter& counter)
+{
+	Worker* self = currentWorker();
+	while (!counter.isDone())
+	{
+		Job* job = self ? take(*self) : nullptr;
+		if (job)
+			job->execute();
+		else
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::workerLoop(U32 index)
+{
+	currentSystem = this;
+	currentIndex = index;
+	Worker& self = *workers[index];
+
+	while (!stopping.load(std::memory_order_relaxed))
+	{
+		// Work comes in bursts, look around a little before sleeping
+		Job* job = nullptr;
+		for (U32 attempt = 0; attempt < 64 && !job; ++attempt)
+		{
+			job = take(self);
+			if (!job)
+				std::this_thread::yield();
+		}
+
+		if (job)
+		{
+			job->execute();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleeping.fetch_add(1, std::memory_order_seq_cst);
+		wake.wait(lock, [this]() { return stopping.load(std::memory_order_relaxed) || queued.load(std::memory_order_seq_cst) > 0; });
+		sleeping.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
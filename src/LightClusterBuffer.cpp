@@ -0,0 +1,91 @@
+#include "LightClusterBuffer.hpp"
+#include "Engine.hpp"
+
+#include <cstring>
+
+bool LightClusterBuffer::reserve(Buffer& buffer, VkDeviceSize size)
+{
+	// Created even when nothing is needed yet, the descriptors always need a buffer
+	if (buffer.buffer != VK_NULL_HANDLE && size <= buffer.capacity)
+		return false;
+
+	// The previous frame has finished, the old buffer can go right away
+	release(buffer);
+
+	buffer.capacity = std::max<VkDeviceSize>(size + size / 2, 4096);
+	Engine::renderer->createVulkanBuffer(buffer.capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer.buffer, buffer.memory);
+
+	void* data;
+	vkMapMemory(Engine::renderer->vkLogicalDevice, buffer.memory, 0, buffer.capacity, 0, &data);
+	buffer.mapped = static_cast<U8*>(data);
+	return true;
+}
+
+void LightClusterBuffer::release(Buffer& buffer)
+{
+	if (buffer.buffer == VK_NULL_HANDLE)
+		return;
+
+	vkUnmapMemory(Engine::renderer->vkLogicalDevice, buffer.memory);
+	vkDestroyBuffer(Engine::renderer->vkLogicalDevice, buffer.buffer, nullptr);
+	vkFreeMemory(Engine::renderer->vkLogicalDevice, buffer.memory, nullptr);
+	buffer = Buffer();
+}
+
+bool LightClusterBuffer::upload(const LightClusters& clusters, const LightClusters::Light* lights, U32 lightCount)
+{
+	const std::vector<LightClusters::Cluster>& ranges = clusters.getClusters();
+	const std::vector<U32>& list = clusters.getIndices();
+
+	VkDeviceSize lightsSize = VkDeviceSize(lightCount) * sizeof(LightClusters::Light);
+	VkDeviceSize clustersSize = sizeof(LightClusters::Header) + VkDeviceSize(ranges.size()) * sizeof(LightClusters::Cluster);
+	VkDeviceSize indicesSize = VkDeviceSize(list.size()) * sizeof(U32);
+
+	// Non-short-circuiting, every buffer has to be checked
+	bool replaced = reserve(lightBuffer, lightsSize);
+	replaced |= reserve(clusterBuffer, clustersSize);
+	replaced |= reserve(indexBuffer, indicesSize);
+
+	if (lightCount)
+		memcpy(lightBuffer.mapped, lights, size_t(lightsSize));
+	memcpy(clusterBuffer.mapped, &clusters.getHeader(), sizeof(LightClusters::Header));
+	if (!ranges.empty())
+		memcpy(clusterBuffer.mapped + sizeof(LightClusters::Header), ranges.data(), size_t(clustersSize - sizeof(LightClusters::Header)));
+	if (!list.empty())
+		memcpy(indexBuffer.mapped, list.data(), size_t(indicesSize));
+
+	uploadSize = lightsSize + clustersSize + indicesSize;
+	return replaced;
+}
+
+void LightClusterBuffer::writeDescriptors(VkDescriptorSet descriptorSet)
+{
+	VkDescriptorBufferInfo buffers[3] = {};
+	buffers[0].buffer = lightBuffer.buffer;
+	buffers[1].buffer = clusterBuffer.buffer;
+	buffers[2].buffer = indexBuffer.buffer;
+	const U32 bindings[3] = { lightsBinding, clustersBinding, indicesBinding };
+
+	std::array<VkWriteDescriptorSet, 3> writes = {};
+	for (U32 i = 0; i < 3; ++i)
+	{
+		buffers[i].range = VK_WHOLE_SIZE;
+
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = descriptorSet;
+		writes[i].dstBinding = bindings[i];
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[i].descriptorCount = 1;
+		writes[i].pBufferInfo = &buffers[i];
+	}
+
+	vkUpdateDescriptorSets(Engine::renderer->vkLogicalDevice, U32(writes.size()), writes.data(), 0, nullptr);
+}
+
+void LightClusterBuffer::destroy()
+{
+	release(lightBuffer);
+	release(clusterBuffer);
+	release(indexBuffer);
+	uploadSize = 0;
+}
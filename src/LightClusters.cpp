@@ -0,0 +1,460 @@
+#include "LightClusters.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define LIGHT_CLUSTERS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+// MSVC emits any intrinsic without per function targets
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+	// Squared distance from a point to a box is within r2. Written out per axis
+	// in the same order as the SIMD kernels so every path agrees exactly.
+	inline bool sphereBox(float cx, float cy, float cz, float r2, float minX, float minY, float minZ, float maxX, float maxY, float maxZ)
+	{
+		float dx = std::max(std::max(minX - cx, cx - maxX), 0.0f);
+		float dy = std::max(std::max(minY - cy, cy - maxY), 0.0f);
+		float dz = std::max(std::max(minZ - cz, cz - maxZ), 0.0f);
+		return (dx * dx + dy * dy) + dz * dz <= r2;
+	}
+
+	// Cone against a sphere, the sphere is outside when it is further from the
+	// cone's side than its radius, behind the apex or past the range
+	inline bool coneSphere(const glm::vec3& apex, const glm::vec3& direction, float range, float cosAngle, float sinAngle, float sx, float sy, float sz, float radius)
+	{
+		float vx = sx - apex.x, vy = sy - apex.y, vz = sz - apex.z;
+		float along = (vx * direction.x + vy * direction.y) + vz * direction.z;
+		float lengthSq = (vx * vx + vy * vy) + vz * vz;
+		float side = cosAngle * std::sqrt(std::max(lengthSq - along * along, 0.0f)) - along * sinAngle;
+		return side <= radius && along <= radius + range && along >= -radius;
+	}
+}
+
+LightClusters::Light LightClusters::Light::point(const glm::vec3& position, float range, const glm::vec3& colour)
+{
+	return { position, range, colour, -1.0f, glm::vec3(0.0f, 0.0f, -1.0f), 0.0f };
+}
+
+LightClusters::Light LightClusters::Light::spot(const glm::vec3& position, const glm::vec3& direction, float range, float angle, const glm::vec3& colour)
+{
+	return { position, range, colour, std::cos(angle), direction, std::sin(angle) };
+}
+
+LightClusters::LightClusters(U32 gridX, U32 gridY, U32 gridZ, U32 threadCount) : isa(FrustumCuller::detectIsa())
+{
+	// A row's hits come back as a 32 bit mask
+	this->gridX = std::max(1u, std::min(gridX, 32u));
+	this->gridY = std::max(1u, gridY);
+	this->gridZ = std::max(1u, gridZ);
+	rowStride = (this->gridX + 7) & ~7u;
+
+	threads = threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+	if (threads > 1)
+		workers = std::make_unique<ThreadPool>(threads - 1);
+}
+
+void LightClusters::setProjection(const glm::mat4& projection, U32 width, U32 height)
+{
+	if (projection == this->projection && width == this->width && height == this->height)
+		return;
+	this->projection = projection;
+	this->width = std::max(1u, width);
+	this->height = std::max(1u, height);
+
+	// Back out of the perspective matrix with 0..1 depth
+	float zNear = projection[3][2] / projection[2][2];
+	float zFar = projection[3][2] / (projection[2][2] + 1.0f);
+	float logRatio = std::log(zFar / zNear);
+
+	header.gridX = gridX;
+	header.gridY = gridY;
+	header.gridZ = gridZ;
+	header.tileSize = glm::vec2(float((this->width + gridX - 1) / gridX), float((this->height + gridY - 1) / gridY));
+	header.sliceScale = gridZ / logRatio;
+	header.sliceBias = -float(gridZ) * std::log(zNear) / logRatio;
+	header.zNear = zNear;
+	header.zFar = zFar;
+
+	U32 rows = gridY * gridZ;
+	U32 lanes = rows * rowStride;
+	const float infinity = std::numeric_limits<float>::infinity();
+	for (auto* v : { &minX, &minY, &minZ })
+		v->assign(lanes, infinity);
+	for (auto* v : { &maxX, &maxY, &maxZ })
+		v->assign(lanes, -infinity);
+	for (auto* v : { &sphereX, &sphereY, &sphereZ, &sphereRadius })
+		v->assign(lanes, 0.0f);
+	rowMin.assign(rows, glm::vec3(infinity));
+	rowMax.assign(rows, glm::vec3(-infinity));
+	sliceMinZ.assign(gridZ, infinity);
+	sliceMaxZ.assign(gridZ, -infinity);
+
+	// View space direction through each tile corner, scaled to a depth below
+	glm::mat4 inverse = glm::inverse(projection);
+	std::vector<glm::vec3> corners((gridX + 1) * (gridY + 1));
+	for (U32 y = 0; y <= gridY; ++y)
+	{
+		for (U32 x = 0; x <= gridX; ++x)
+		{
+			float px = std::min(x * header.tileSize.x, float(this->width));
+			float py = std::min(y * header.tileSize.y, float(this->height));
+			glm::vec4 point = inverse * glm::vec4(px / this->width * 2.0f - 1.0f, py / this->height * 2.0f - 1.0f, 1.0f, 1.0f);
+			glm::vec3 ray = glm::vec3(point) / point.w;
+			corners[y * (gridX + 1) + x] = ray / -ray.z;
+		}
+	}
+
+	for (U32 z = 0; z < gridZ; ++z)
+	{
+		float depths[2] = { zNear * std::pow(zFar / zNear, float(z) / gridZ), zNear * std::pow(zFar / zNear, float(z + 1) / gridZ) };
+		for (U32 y = 0; y < gridY; ++y)
+		{
+			U32 row = z * gridY + y;
+			for (U32 x = 0; x < gridX; ++x)
+			{
+				glm::vec3 low(infinity), high(-infinity);
+				for (U32 corner = 0; corner < 4; ++corner)
+				{
+					const glm::vec3& ray = corners[(y + (corner >> 1)) * (gridX + 1) + x + (corner & 1)];
+					for (float depth : depths)
+					{
+						low = glm::min(low, ray * depth);
+						high = glm::max(high, ray * depth);
+					}
+				}
+
+				U32 lane = row * rowStride + x;
+				minX[lane] = low.x;
+				minY[lane] = low.y;
+				minZ[lane] = low.z;
+				maxX[lane] = high.x;
+				maxY[lane] = high.y;
+				maxZ[lane] = high.z;
+
+				glm::vec3 centre = (low + high) * 0.5f;
+				sphereX[lane] = centre.x;
+				sphereY[lane] = centre.y;
+				sphereZ[lane] = centre.z;
+				sphereRadius[lane] = glm::length(high - centre);
+
+				rowMin[row] = glm::min(rowMin[row], low);
+				rowMax[row] = glm::max(rowMax[row], high);
+			}
+			sliceMinZ[z] = std::min(sliceMinZ[z], rowMin[row].z);
+			sliceMaxZ[z] = std::max(sliceMaxZ[z], rowMax[row].z);
+		}
+	}
+}
+
+void LightClusters::getBounds(U32 x, U32 y, U32 z, glm::vec3& minimum, glm::vec3& maximum) const
+{
+	U32 lane = (z * gridY + y) * rowStride + x;
+	minimum = glm::vec3(minX[lane], minY[lane], minZ[lane]);
+	maximum = glm::vec3(maxX[lane], maxY[lane], maxZ[lane]);
+}
+
+LightClusters::ViewLight LightClusters::toView(const glm::mat4& view, const Light& light)
+{
+	ViewLight result;
+	result.apex = glm::vec3(view * glm::vec4(light.position, 1.0f));
+	result.range = light.range;
+	result.spot = light.cosAngle > 0.0f;
+	result.cosAngle = light.cosAngle;
+	result.sinAngle = light.sinAngle;
+	result.direction = glm::normalize(glm::mat3(view) * light.direction);
+
+	// Tightest sphere around the lit part of the cone, a spherical sector
+	result.centre = result.apex;
+	result.radius = light.range;
+	if (result.spot && light.cosAngle > 0.70710678f)
+	{
+		float radius = light.range / (2.0f * light.cosAngle);
+		result.centre = result.apex + result.direction * radius;
+		result.radius = radius;
+	}
+	else if (result.spot)
+	{
+		result.centre = result.apex + result.direction * (light.range * light.cosAngle);
+		result.radius = light.range * light.sinAngle;
+	}
+	return result;
+}
+
+U32 LightClusters::testRow(const ViewLight& light, U32 row, FrustumCuller::Isa useIsa) const
+{
+#ifdef LIGHT_CLUSTERS_X86
+	if (useIsa == FrustumCuller::Avx2)
+		return testRowAvx2(light, row);
+	if (useIsa == FrustumCuller::Sse)
+		return testRowSse(light, row);
+#endif
+	return testRowScalar(light, row);
+}
+
+U32 LightClusters::testRowScalar(const ViewLight& light, U32 row) const
+{
+	float r2 = light.radius * light.radius;
+	U32 mask = 0;
+	for (U32 x = 0; x < gridX; ++x)
+	{
+		U32 lane = row * rowStride + x;
+		bool hit = sphereBox(light.centre.x, light.centre.y, light.centre.z, r2, minX[lane], minY[lane], minZ[lane], maxX[lane], maxY[lane], maxZ[lane]);
+		if (hit && light.spot)
+			hit = coneSphere(light.apex, light.direction, light.range, light.cosAngle, light.sinAngle, sphereX[lane], sphereY[lane], sphereZ[lane], sphereRadius[lane]);
+		mask |= hit ? 1u << x : 0u;
+	}
+	return mask;
+}
+
+#ifdef LIGHT_CLUSTERS_X86
+
+U32 LightClusters::testRowSse(const ViewLight& light, U32 row) const
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 cx = _mm_set1_ps(light.centre.x), cy = _mm_set1_ps(light.centre.y), cz = _mm_set1_ps(light.centre.z);
+	const __m128 r2 = _mm_set1_ps(light.radius * light.radius);
+	const __m128 ax = _mm_set1_ps(light.apex.x), ay = _mm_set1_ps(light.apex.y), az = _mm_set1_ps(light.apex.z);
+	const __m128 dx = _mm_set1_ps(light.direction.x), dy = _mm_set1_ps(light.direction.y), dz = _mm_set1_ps(light.direction.z);
+	const __m128 range = _mm_set1_ps(light.range);
+	const __m128 cosAngle = _mm_set1_ps(light.cosAngle), sinAngle = _mm_set1_ps(light.sinAngle);
+
+	U32 mask = 0;
+	U32 base = row * rowStride;
+	for (U32 x = 0; x < gridX; x += 4)
+	{
+		U32 lane = base + x;
+		__m128 ex = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[lane]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&maxX[lane]))), zero);
+		__m128 ey = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[lane]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&maxY[lane]))), zero);
+		__m128 ez = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[lane]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&maxZ[lane]))), zero);
+		__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)), _mm_mul_ps(ez, ez));
+		__m128 hit = _mm_cmple_ps(distance, r2);
+
+		if (light.spot && _mm_movemask_ps(hit))
+		{
+			__m128 radius = _mm_loadu_ps(&sphereRadius[lane]);
+			__m128 vx = _mm_sub_ps(_mm_loadu_ps(&sphereX[lane]), ax);
+			__m128 vy = _mm_sub_ps(_mm_loadu_ps(&sphereY[lane]), ay);
+			__m128 vz = _mm_sub_ps(_mm_loadu_ps(&sphereZ[lane]), az);
+			__m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, dx), _mm_mul_ps(vy, dy)), _mm_mul_ps(vz, dz));
+			__m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+			__m128 side = _mm_sub_ps(_mm_mul_ps(cosAngle, _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(lengthSq, _mm_mul_ps(along, along)), zero))), _mm_mul_ps(along, sinAngle));
+			hit = _mm_and_ps(hit, _mm_cmple_ps(side, radius));
+			hit = _mm_and_ps(hit, _mm_cmple_ps(along, _mm_add_ps(radius, range)));
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(along, _mm_sub_ps(zero, radius)));
+		}
+
+		mask |= U32(_mm_movemask_ps(hit)) << x;
+	}
+	// Padding lanes never hit, but keep the mask to real tiles regardless
+	return gridX == 32 ? mask : mask & ((1u << gridX) - 1);
+}
+
+TARGET_AVX2 U32 LightClusters::testRowAvx2(const ViewLight& light, U32 row) const
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 cx = _mm256_set1_ps(light.centre.x), cy = _mm256_set1_ps(light.centre.y), cz = _mm256_set1_ps(light.centre.z);
+	const __m256 r2 = _mm256_set1_ps(light.radius * light.radius);
+	const __m256 ax = _mm256_set1_ps(light.apex.x), ay = _mm256_set1_ps(light.apex.y), az = _mm256_set1_ps(light.apex.z);
+	const __m256 dx = _mm256_set1_ps(light.direction.x), dy = _mm256_set1_ps(light.direction.y), dz = _mm256_set1_ps(light.direction.z);
+	const __m256 range = _mm256_set1_ps(light.range);
+	const __m256 cosAngle = _mm256_set1_ps(light.cosAngle), sinAngle = _mm256_set1_ps(light.sinAngle);
+
+	U32 mask = 0;
+	U32 base = row * rowStride;
+	for (U32 x = 0; x < gridX; x += 8)
+	{
+		U32 lane = base + x;
+		__m256 ex = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&minX[lane]), cx), _mm256_sub_ps(cx, _mm256_loadu_ps(&maxX[lane]))), zero);
+		__m256 ey = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&minY[lane]), cy), _mm256_sub_ps(cy, _mm256_loadu_ps(&maxY[lane]))), zero);
+		__m256 ez = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&minZ[lane]), cz), _mm256_sub_ps(cz, _mm256_loadu_ps(&maxZ[lane]))), zero);
+		__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey)), _mm256_mul_ps(ez, ez));
+		__m256 hit = _mm256_cmp_ps(distance, r2, _CMP_LE_OQ);
+
+		if (light.spot && _mm256_movemask_ps(hit))
+		{
+			__m256 radius = _mm256_loadu_ps(&sphereRadius[lane]);
+			__m256 vx = _mm256_sub_ps(_mm256_loadu_ps(&sphereX[lane]), ax);
+			__m256 vy = _mm256_sub_ps(_mm256_loadu_ps(&sphereY[lane]), ay);
+			__m256 vz = _mm256_sub_ps(_mm256_loadu_ps(&sphereZ[lane]), az);
+			__m256 along = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, dx), _mm256_mul_ps(vy, dy)), _mm256_mul_ps(vz, dz));
+			__m256 lengthSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+			__m256 side = _mm256_sub_ps(_mm256_mul_ps(cosAngle, _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(lengthSq, _mm256_mul_ps(along, along)), zero))), _mm256_mul_ps(along, sinAngle));
+			hit = _mm256_and_ps(hit, _mm256_cmp_ps(side, radius, _CMP_LE_OQ));
+			hit = _mm256_and_ps(hit, _mm256_cmp_ps(along, _mm256_add_ps(radius, range), _CMP_LE_OQ));
+			hit = _mm256_and_ps(hit, _mm256_cmp_ps(along, _mm256_sub_ps(zero, radius), _CMP_GE_OQ));
+		}
+
+		mask |= U32(_mm256_movemask_ps(hit)) << x;
+	}
+	return gridX == 32 ? mask : mask & ((1u << gridX) - 1);
+}
+
+#else
+
+U32 LightClusters::testRowSse(const ViewLight& light, U32 row) const
+{
+	return testRowScalar(light, row);
+}
+
+U32 LightClusters::testRowAvx2(const ViewLight& light, U32 row) const
+{
+	return testRowScalar(light, row);
+}
+
+#endif
+
+void LightClusters::binSlice(U32 slice, const std::vector<ViewLight>& lights, FrustumCuller::Isa useIsa, std::vector<U32>& pairs) const
+{
+	pairs.clear();
+	for (U32 i = 0; i < lights.size(); ++i)
+	{
+		const ViewLight& light = lights[i];
+		float r2 = light.radius * light.radius;
+
+		// The slice's depth range, then each row's box, are never further from
+		// the sphere than any froxel inside them, so skipping on them is exact
+		float dz = std::max(std::max(sliceMinZ[slice] - light.centre.z, light.centre.z - sliceMaxZ[slice]), 0.0f);
+		if (dz * dz > r2)
+			continue;
+
+		for (U32 y = 0; y < gridY; ++y)
+		{
+			U32 row = slice * gridY + y;
+			if (!sphereBox(light.centre.x, light.centre.y, light.centre.z, r2, rowMin[row].x, rowMin[row].y, rowMin[row].z, rowMax[row].x, rowMax[row].y, rowMax[row].z))
+				continue;
+
+			U32 mask = testRow(light, row, useIsa);
+			for (U32 x = 0; mask; ++x, mask >>= 1)
+			{
+				if (mask & 1)
+				{
+					pairs.push_back(y * gridX + x);
+					pairs.push_back(i);
+				}
+			}
+		}
+	}
+}
+
+void LightClusters::parallel(U32 count, U32 threadCount, const std::function<void(U32)>& task)
+{
+	std::vector<std::future<void>> pending;
+	if (threadCount > 1 && workers)
+	{
+		pending.reserve(count);
+		for (U32 i = 1; i < count; ++i)
+			pending.push_back(workers->submit([&task, i]() { task(i); }));
+	}
+	else
+	{
+		for (U32 i = 1; i < count; ++i)
+			task(i);
+	}
+
+	if (count)
+		task(0);
+	for (auto& f : pending)
+		f.get();
+}
+
+void LightClusters::bin(const glm::mat4& view, const Light* lights, U32 count)
+{
+	bin(view, lights, count, isa, threads);
+}
+
+void LightClusters::bin(const glm::mat4& view, const Light* lights, U32 count, FrustumCuller::Isa useIsa, U32 threadCount)
+{
+	header.lightCount = count;
+	clusters.assign(getClusterCount(), { 0, 0 });
+	indices.clear();
+	if (width == 0)
+		return;
+
+	viewLights.resize(count);
+	for (U32 i = 0; i < count; ++i)
+		viewLights[i] = toView(view, lights[i]);
+
+	// Slices are taken in turn, their costs vary with the lights' depths
+	threadCount = std::max(1u, std::min(threadCount, workers ? workers->size() + 1 : 1u));
+	threadCount = std::min(threadCount, gridZ);
+	slicePairs.resize(gridZ);
+	std::atomic<U32> next(0);
+	parallel(threadCount, threadCount, [&](U32)
+	{
+		for (U32 slice = next++; slice < gridZ; slice = next++)
+			binSlice(slice, viewLights, useIsa, slicePairs[slice]);
+	});
+
+	// Each slice owns a contiguous run of the index list
+	std::vector<U32> sliceOffsets(gridZ + 1, 0);
+	for (U32 slice = 0; slice < gridZ; ++slice)
+		sliceOffsets[slice + 1] = sliceOffsets[slice] + U32(slicePairs[slice].size() / 2);
+	indices.resize(sliceOffsets[gridZ]);
+
+	// Stable counting sort by froxel, lights stay in ascending order
+	const U32 perSlice = gridX * gridY;
+	next = 0;
+	parallel(threadCount, threadCount, [&](U32)
+	{
+		for (U32 slice = next++; slice < gridZ; slice = next++)
+		{
+			const std::vector<U32>& pairs = slicePairs[slice];
+			Cluster* sliceClusters = &clusters[slice * perSlice];
+			for (size_t p = 0; p < pairs.size(); p += 2)
+				++sliceClusters[pairs[p]].count;
+
+			U32 offset = sliceOffsets[slice];
+			for (U32 c = 0; c < perSlice; ++c)
+			{
+				sliceClusters[c].offset = offset;
+				offset += sliceClusters[c].count;
+			}
+
+			std::vector<U32> cursor(perSlice);
+			for (U32 c = 0; c < perSlice; ++c)
+				cursor[c] = sliceClusters[c].offset;
+			for (size_t p = 0; p < pairs.size(); p += 2)
+				indices[cursor[pairs[p]]++] = pairs[p + 1];
+		}
+	});
+}
+
+void LightClusters::binReference(const glm::mat4& view, const Light* lights, U32 count, std::vector<Cluster>& clusters, std::vector<U32>& indices) const
+{
+	clusters.assign(getClusterCount(), { 0, 0 });
+	indices.clear();
+	if (width == 0)
+		return;
+
+	std::vector<ViewLight> moved(count);
+	for (U32 i = 0; i < count; ++i)
+		moved[i] = toView(view, lights[i]);
+
+	for (U32 z = 0; z < gridZ; ++z)
+	{
+		for (U32 y = 0; y < gridY; ++y)
+		{
+			for (U32 x = 0; x < gridX; ++x)
+			{
+				Cluster& cluster = clusters[(z * gridY + y) * gridX + x];
+				cluster.offset = U32(indices.size());
+				U32 lane = (z * gridY + y) * rowStride + x;
+				for (U32 i = 0; i < count; ++i)
+				{
+					const ViewLight& light = moved[i];
+					bool hit = sphereBox(light.centre.x, light.centre.y, light.centre.z, light.radius * light.radius, minX[lane], minY[lane], minZ[lane], maxX[lane], maxY[lane], maxZ[lane]);
+					if (hit && light.spot)
+						hit = coneSphere(light.apex, light.direction, light.range, light.cosAngle, light.sinAngle, sphereX[lane], sphereY[lane], sphereZ[lane], sphereRadius[lane]);
+					if (hit)
+						indices.push_back(i);
+				}
+				cluster.count = U32(indices.size()) - cluster.offset;
+			}
+		}
+	}
+}
@@ -0,0 +1,412 @@
+#include "LightmapBaker.hpp"
+#include "Clock.hpp"
+#include "Image.hpp"
+
+namespace
+{
+	// Integer hash with good avalanche, see Chris Wellons' hash prospector
+	U32 hash(U32 x)
+	{
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	// Uniform in [0, 1), the same for the same arguments on every run
+	float random(U32 seed, U32 pixel, U32 sample, U32 dimension)
+	{
+		U32 h = hash(seed ^ hash(pixel ^ hash(sample * 8 + dimension)));
+		return float(h >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// Orthonormal basis around a unit vector without branches on its
+	// direction, Duff et al. 2017
+	void basis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent)
+	{
+		float sign = std::copysign(1.0f, n.z);
+		float a = -1.0f / (sign + n.z);
+		float b = n.x * n.y * a;
+		tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+		bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+	}
+
+	glm::vec3 cosineHemisphere(const glm::vec3& normal, float u1, float u2)
+	{
+		glm::vec3 tangent, bitangent;
+		basis(normal, tangent, bitangent);
+		float r = std::sqrt(u1);
+		float phi = 2.0f * glm::pi<float>() * u2;
+		return glm::normalize(tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + normal * std::sqrt(std::max(0.0f, 1.0f - u1)));
+	}
+
+	// Gamma 2.2 for 8 bit storage, clamped to [0, 1]
+	float encode(float value)
+	{
+		return std::pow(std::min(1.0f, std::max(0.0f, value)), 1.0f / 2.2f);
+	}
+
+	U8 toByte(float value)
+	{
+		return U8(std::min(255.0f, std::max(0.0f, value * 255.0f + 0.5f)));
+	}
+}
+
+LightmapBaker::LightmapBaker(const Mesh& mesh, const TriangleBvh& bvh, const Settings& settings) : mesh(mesh), bvh(bvh), settings(settings)
+{
+	this->settings.width = std::max(1u, settings.width);
+	this->settings.height = std::max(1u, settings.height);
+	this->settings.samplesPerPass = std::max(1u, settings.samplesPerPass);
+	this->settings.tileSize = std::max(1u, settings.tileSize);
+
+	glm::vec3 minimum, maximum;
+	glm::vec4 sphere(0.0f);
+	if (!mesh.vertices.empty())
+		mesh.computeBounds(minimum, maximum, sphere);
+	float radius = std::max(sphere.w, 1e-3f);
+
+	aoDistance = settings.aoDistance > 0.0f ? settings.aoDistance : radius * 0.25f;
+	bias = radius * 1e-4f;
+	sun = glm::length(settings.sunDirection) > 0.0f ? glm::normalize(settings.sunDirection) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+	stats.threads = settings.threads ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+	if (stats.threads > 1)
+		workers = std::make_unique<ThreadPool>(stats.threads - 1);
+
+	prepare();
+}
+
+void LightmapBaker::unwrap(Mesh& mesh, U32 width, U32 height)
+{
+	U32 triangleCount = U32(mesh.indices.size() / 3);
+	U32 cells = (triangleCount + 1) / 2;
+	U32 grid = std::max(1u, U32(std::ceil(std::sqrt(double(cells)))));
+
+	if (std::min(width, height) / grid < 4)
+		LOG_WARN("Lightmap of " << width << "x" << height << " is too small to unwrap " << triangleCount << " triangles, they get less than 4 texels across");
+
+	glm::vec2 cell(1.0f / grid);
+	glm::vec2 texel(1.0f / width, 1.0f / height);
+
+	std::vector<Vertex> vertices;
+	vertices.reserve(triangleCount * 3);
+	for (U32 i = 0; i < triangleCount; ++i)
+	{
+		U32 index = i / 2;
+		glm::vec2 origin = glm::vec2(float(index % grid), float(index / grid)) * cell;
+
+		// Two triangles share a cell along its diagonal with a texel between
+		// them and around the cell
+		glm::vec2 corners[3];
+		if (i % 2 == 0)
+		{
+			corners[0] = origin + texel;
+			corners[1] = origin + glm::vec2(cell.x - 2.0f * texel.x, texel.y);
+			corners[2] = origin + glm::vec2(texel.x, cell.y - 2.0f * texel.y);
+		}
+		else
+		{
+			corners[0] = origin + cell - texel;
+			corners[1] = origin + glm::vec2(2.0f * texel.x, cell.y - texel.y);
+			corners[2] = origin + glm::vec2(cell.x - texel.x, 2.0f * texel.y);
+		}
+
+		for (U32 k = 0; k < 3; ++k)
+		{
+			Vertex vertex = mesh.vertices[mesh.indices[i * 3 + k]];
+			vertex.texCoord = corners[k];
+			vertices.push_back(vertex);
+		}
+	}
+
+	mesh.vertices = std::move(vertices);
+	mesh.indices.resize(mesh.vertices.size());
+	for (U32 i = 0; i < mesh.indices.size(); ++i)
+		mesh.indices[i] = i;
+}
+
+void LightmapBaker::prepare()
+{
+	const U32 width = settings.width;
+	const U32 height = settings.height;
+	const U32 triangleCount = U32(mesh.indices.size() / 3);
+
+	// Texel claimed by each pixel, in the order triangles are rasterised
+	std::vector<Texel> claimed;
+	std::vector<U32> owner(width * height, ~0u);
+	normals.resize(triangleCount);
+
+	for (U32 t = 0; t < triangleCount; ++t)
+	{
+		const Vertex& a = mesh.vertices[mesh.indices[t * 3 + 0]];
+		const Vertex& b = mesh.vertices[mesh.indices[t * 3 + 1]];
+		const Vertex& c = mesh.vertices[mesh.indices[t * 3 + 2]];
+
+		// Counter clockwise faces out, the same as the renderer's front face
+		glm::vec3 normal = glm::cross(b.position - a.position, c.position - a.position);
+		float length = glm::length(normal);
+		normals[t] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+		if (length == 0.0f)
+			continue;
+
+		glm::vec2 scale = glm::vec2(float(width), float(height));
+		glm::vec2 q0 = a.texCoord * scale, q1 = b.texCoord * scale, q2 = c.texCoord * scale;
+		glm::vec2 e1 = q1 - q0, e2 = q2 - q0;
+		float area = e1.x * e2.y - e1.y * e2.x;
+		if (std::abs(area) < 1e-8f)
+			continue;
+
+		// Clamped in float first, texture coordinates can be anything
+		glm::vec2 low = glm::min(q0, glm::min(q1, q2));
+		glm::vec2 high = glm::max(q0, glm::max(q1, q2));
+		S32 x0 = S32(std::max(0.0f, std::floor(low.x)));
+		S32 y0 = S32(std::max(0.0f, std::floor(low.y)));
+		S32 x1 = S32(std::min(float(width - 1), std::floor(high.x)));
+		S32 y1 = S32(std::min(float(height - 1), std::floor(high.y)));
+
+		for (S32 y = y0; y <= y1; ++y)
+		{
+			for (S32 x = x0; x <= x1; ++x)
+			{
+				// Barycentric weights of the texel centre
+				glm::vec2 p = glm::vec2(x + 0.5f, y + 0.5f) - q0;
+				float u = (p.x * e2.y - p.y * e2.x) / area;
+				float v = (e1.x * p.y - e1.y * p.x) / area;
+				float w = 1.0f - u - v;
+				const float epsilon = -1e-5f;
+				if (u < epsilon || v < epsilon || w < epsilon)
+					continue;
+
+				U32 pixel = U32(y) * width + U32(x);
+				if (owner[pixel] != ~0u)
+				{
+					// Centres on a shared edge are expected, well inside isn't
+					if (std::min(u, std::min(v, w)) > 1e-3f)
+						++stats.overlaps;
+					continue;
+				}
+
+				owner[pixel] = U32(claimed.size());
+				claimed.push_back({ a.position * w + b.position * u + c.position * v, normals[t], pixel });
+			}
+		}
+	}
+
+	// Counting sort by tile, pixel order within a tile
+	const U32 tileSize = settings.tileSize;
+	const U32 tilesX = (width + tileSize - 1) / tileSize;
+	const U32 tilesY = (height + tileSize - 1) / tileSize;
+	tileStart.assign(tilesX * tilesY + 1, 0);
+
+	auto tileOf = [&](U32 pixel) { return (pixel / width / tileSize) * tilesX + (pixel % width) / tileSize; };
+	for (const Texel& texel : claimed)
+		++tileStart[tileOf(texel.pixel) + 1];
+	for (U32 i = 1; i < tileStart.size(); ++i)
+		tileStart[i] += tileStart[i - 1];
+
+	std::vector<U32> cursor(tileStart.begin(), tileStart.end() - 1);
+	texels.resize(claimed.size());
+	for (U32 pixel = 0; pixel < owner.size(); ++pixel)
+	{
+		if (owner[pixel] != ~0u)
+			texels[cursor[tileOf(pixel)]++] = claimed[owner[pixel]];
+	}
+
+	accumulators.assign(texels.size(), { glm::vec3(0.0f), 0.0f });
+	stats.texels = U32(texels.size());
+
+	if (texels.empty())
+		LOG_WARN("No lightmap texels are covered, the mesh has no usable texture coordinates");
+	if (stats.overlaps)
+		LOG_WARN(stats.overlaps << " lightmap texels are covered by more than one triangle, texture coordinates overlap");
+}
+
+glm::vec3 LightmapBaker::sunLight(const glm::vec3& position, const glm::vec3& normal, U32 pixel, U32 sample, U32 dimension, U64& rays) const
+{
+	float cosine = glm::dot(normal, sun);
+	if (cosine <= 0.0f)
+		return glm::vec3(0.0f);
+
+	// Uniform point on the sun's disc
+	glm::vec3 tangent, bitangent;
+	basis(sun, tangent, bitangent);
+	float r = std::tan(settings.sunRadius) * std::sqrt(random(settings.seed, pixel, sample, dimension));
+	float phi = 2.0f * glm::pi<float>() * random(settings.seed, pixel, sample, dimension + 1);
+	glm::vec3 direction = glm::normalize(sun + tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)));
+	if (glm::dot(normal, direction) <= 0.0f)
+		return glm::vec3(0.0f);
+
+	++rays;
+	TriangleBvh::Ray ray = { position + normal * bias, direction, std::numeric_limits<float>::max() };
+	return bvh.occluded(ray) ? glm::vec3(0.0f) : settings.sunColour * cosine;
+}
+
+U64 LightmapBaker::traceTile(U32 tile, U32 first, U32 count)
+{
+	U64 rays = 0;
+	for (U32 i = tileStart[tile]; i < tileStart[tile + 1]; ++i)
+	{
+		const Texel& texel = texels[i];
+		Accumulator& accumulator = accumulators[i];
+		glm::vec3 origin = texel.position + texel.normal * bias;
+
+		for (U32 sample = first; sample < first + count; ++sample)
+		{
+			glm::vec3 direction = cosineHemisphere(texel.normal, random(settings.seed, texel.pixel, sample, 0), random(settings.seed, texel.pixel, sample, 1));
+			++rays;
+
+			if (!settings.light)
+			{
+				TriangleBvh::Ray ray = { origin, direction, aoDistance };
+				accumulator.visibility += bvh.occluded(ray) ? 0.0f : 1.0f;
+				continue;
+			}
+
+			// One ray serves both: occlusion only counts hits within aoDistance
+			TriangleBvh::Ray ray = { origin, direction, std::numeric_limits<float>::max() };
+			TriangleBvh::Hit hit;
+			if (bvh.raycast(ray, hit))
+			{
+				accumulator.visibility += hit.distance < aoDistance ? 0.0f : 1.0f;
+
+				// Back faces bounce too, turned towards the ray
+				glm::vec3 normal = normals[hit.triangle];
+				if (glm::dot(normal, direction) > 0.0f)
+					normal = -normal;
+				accumulator.light += settings.albedo * sunLight(origin + direction * hit.distance, normal, texel.pixel, sample, 4, rays);
+			}
+			else
+			{
+				accumulator.visibility += 1.0f;
+				accumulator.light += settings.skyColour;
+			}
+
+			accumulator.light += sunLight(texel.position, texel.normal, texel.pixel, sample, 2, rays);
+		}
+	}
+	return rays;
+}
+
+bool LightmapBaker::refine()
+{
+	if (texels.empty() || stats.samples >= settings.samples)
+		return false;
+
+	U32 first = stats.samples;
+	U32 count = std::min(settings.samplesPerPass, settings.samples - first);
+	U32 tileCount = U32(tileStart.size() - 1);
+
+	std::atomic<U32> next(0);
+	std::atomic<U64> rays(0);
+	auto worker = [&]()
+	{
+		U64 traced = 0;
+		for (U32 tile = next++; tile < tileCount; tile = next++)
+			traced += traceTile(tile, first, count);
+		rays += traced;
+	};
+
+	Clock clock;
+	Time start = clock.time();
+
+	std::vector<std::future<void>> pending;
+	if (workers)
+	{
+		for (U32 i = 1; i < stats.threads; ++i)
+			pending.push_back(workers->submit(worker));
+	}
+	worker();
+	for (auto& f : pending)
+		f.get();
+
+	stats.seconds += (clock.time() - start).getSeconds();
+	stats.rays += rays;
+	stats.samples += count;
+	++stats.passes;
+	return true;
+}
+
+void LightmapBaker::bake(const std::function<void(const Stats&)>& progress)
+{
+	while (refine())
+	{
+		if (progress)
+			progress(stats);
+	}
+}
+
+void LightmapBaker::resolve(Image& ambientOcclusion, Image& light) const
+{
+	const U32 width = settings.width;
+	const U32 height = settings.height;
+	const float scale = stats.samples ? 1.0f / stats.samples : 0.0f;
+
+	// Occlusion in w, light in xyz, covered texels have weight 1
+	std::vector<glm::vec4> values(width * height, glm::vec4(0.0f));
+	std::vector<float> weights(width * height, 0.0f);
+	for (U32 i = 0; i < texels.size(); ++i)
+	{
+		values[texels[i].pixel] = glm::vec4(accumulators[i].light * scale, accumulators[i].visibility * scale);
+		weights[texels[i].pixel] = 1.0f;
+	}
+
+	// Each round fills the empty texels next to filled ones with their average
+	for (U32 round = 0; round < settings.dilation; ++round)
+	{
+		std::vector<glm::vec4> grown = values;
+		std::vector<float> grownWeights = weights;
+		for (U32 y = 0; y < height; ++y)
+		{
+			for (U32 x = 0; x < width; ++x)
+			{
+				U32 pixel = y * width + x;
+				if (weights[pixel] > 0.0f)
+					continue;
+
+				glm::vec4 sum(0.0f);
+				float count = 0.0f;
+				for (S32 dy = -1; dy <= 1; ++dy)
+				{
+					for (S32 dx = -1; dx <= 1; ++dx)
+					{
+						S32 nx = S32(x) + dx, ny = S32(y) + dy;
+						if (nx < 0 || ny < 0 || nx >= S32(width) || ny >= S32(height))
+							continue;
+						U32 neighbour = U32(ny) * width + U32(nx);
+						if (weights[neighbour] > 0.0f)
+						{
+							sum += values[neighbour];
+							count += 1.0f;
+						}
+					}
+				}
+				if (count > 0.0f)
+				{
+					grown[pixel] = sum / count;
+					grownWeights[pixel] = 1.0f;
+				}
+			}
+		}
+		values = std::move(grown);
+		weights = std::move(grownWeights);
+	}
+
+	for (Image* image : { &ambientOcclusion, &light })
+	{
+		image->width = int(width);
+		image->height = int(height);
+		image->mipLevels = 1;
+		image->data.assign(width * height, Pixel{ 0, 0, 0, char(255) });
+	}
+
+	for (U32 pixel = 0; pixel < values.size(); ++pixel)
+	{
+		char occlusion = char(toByte(values[pixel].w));
+		ambientOcclusion.data[pixel] = Pixel{ occlusion, occlusion, occlusion, char(255) };
+
+		glm::vec3 colour = glm::vec3(values[pixel]);
+		light.data[pixel] = Pixel{ char(toByte(encode(colour.x))), char(toByte(encode(colour.y))), char(toByte(encode(colour.z))), char(255) };
+	}
+}
@@ -0,0 +1,36 @@
+#include "LinearAllocator.hpp"
+
+LinearAllocator::LinearAllocator(size_t pCapacity) : block(new U8[pCapacity]), capacity(pCapacity)
+{
+}
+
+void* LinearAllocator::allocate(size_t size, size_t alignment)
+{
+	uintptr_t base = uintptr_t(block.get());
+	uintptr_t aligned = (base + offset + alignment - 1) & ~uintptr_t(alignment - 1);
+	size_t end = size_t(aligned - base) + size;
+
+	if (end <= capacity)
+	{
+		offset = end;
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	// new[] already aligns to max_align_t
+	overflow.emplace_back(new U8[size]);
+	overflowBytes += size + alignment;
+	return overflow.back().get();
+}
+
+void LinearAllocator::reset()
+{
+	if (overflowBytes)
+	{
+		// Room for everything the last frame used, plus some slack
+		capacity = (offset + overflowBytes) * 3 / 2;
+		block.reset(new U8[capacity]);
+		overflow.clear();
+		overflowBytes = 0;
+	}
+	offset = 0;
+}
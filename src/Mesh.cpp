@@ -0,0 +1,302 @@
+#include "Mesh.hpp"
+#include "File.hpp"
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+
+bool Mesh::loadObj(std::string path)
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string err;
+
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str()))
+	{
+		LOG_WARN("Failed to load OBJ: " << path << " " << err);
+		return false;
+	}
+
+	vertices.clear();
+	indices.clear();
+
+	std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
+
+	for (const auto& shape : shapes)
+	{
+		for (const auto& index : shape.mesh.indices)
+		{
+			Vertex vertex = {};
+
+			vertex.position =
+			{
+				attrib.vertices[3 * index.vertex_index + 0],
+				attrib.vertices[3 * index.vertex_index + 1],
+				attrib.vertices[3 * index.vertex_index + 2]
+			};
+
+			vertex.texCoord =
+			{
+				attrib.texcoords[2 * index.texcoord_index + 0],
+				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+			};
+
+			vertex.color = {1.0f, 1.0f, 1.0f};
+
+			if (uniqueVertices.count(vertex) == 0)
+			{
+				uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
+				vertices.push_back(vertex);
+			}
+
+			indices.push_back(uniqueVertices[vertex]);
+		}
+	}
+
+	return true;
+}
+
+void Mesh::optimise()
+{
+	optimiseVertexCache();
+	optimiseVertexFetch();
+}
+
+void Mesh::computeBounds(glm::vec3& minimum, glm::vec3& maximum, glm::vec4& sphere) const
+{
+	if (vertices.empty())
+	{
+		minimum = maximum = glm::vec3(0.0f);
+		sphere = glm::vec4(0.0f);
+		return;
+	}
+
+	minimum = maximum = vertices[0].position;
+	for (const auto& vertex : vertices)
+	{
+		minimum = glm::min(minimum, vertex.position);
+		maximum = glm::max(maximum, vertex.position);
+	}
+
+	glm::vec3 centre = (minimum + maximum) * 0.5f;
+	float radius2 = 0.0f;
+	for (const auto& vertex : vertices)
+		radius2 = std::max(radius2, glm::dot(vertex.position - centre, vertex.position - centre));
+	sphere = glm::vec4(centre, std::sqrt(radius2));
+}
+
+// Tom Forsyth's linear-speed vertex cache optimisation
+namespace
+{
+	const int cacheSize = 32;
+	const float cacheDecayPower = 1.5f;
+	const float lastTriScore = 0.75f;
+	const float valenceBoostScale = 2.0f;
+	const float valenceBoostPower = 0.5f;
+
+	float vertexScore(int cachePosition, U32 remainingTriangles)
+	{
+		if (remainingTriangles == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			if (cachePosition < 3)
+			{
+				score = lastTriScore;
+			}
+			else
+			{
+				const float scaler = 1.0f / (cacheSize - 3);
+				score = std::pow(1.0f - (cachePosition - 3) * scaler, cacheDecayPower);
+			}
+		}
+
+		score += valenceBoostScale * std::pow(float(remainingTriangles), -valenceBoostPower);
+		return score;
+	}
+}
+
+void Mesh::optimiseVertexCache()
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	std::vector<U32> remaining(vertices.size(), 0);
+	for (auto index : indices)
+		++remaining[index];
+
+	std::vector<U32> adjacencyOffset(vertices.size() + 1, 0);
+	for (size_t v = 0; v < vertices.size(); ++v)
+		adjacencyOffset[v + 1] = adjacencyOffset[v] + remaining[v];
+
+	std::vector<U32> adjacency(indices.size());
+	{
+		std::vector<U32> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+		for (size_t t = 0; t < triangleCount; ++t)
+			for (int k = 0; k < 3; ++k)
+				adjacency[fill[indices[t * 3 + k]]++] = U32(t);
+	}
+
+	std::vector<int> cachePosition(vertices.size(), -1);
+	std::vector<float> score(vertices.size());
+	for (size_t v = 0; v < vertices.size(); ++v)
+		score[v] = vertexScore(-1, remaining[v]);
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (size_t t = 0; t < triangleCount; ++t)
+		triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+
+	std::vector<U32> cache;
+	cache.reserve(cacheSize + 3);
+
+	size_t scanPosition = 0;
+	S64 best = 0;
+
+	for (size_t t = 1; t < triangleCount; ++t)
+		if (triangleScore[t] > triangleScore[best])
+			best = S64(t);
+
+	while (best >= 0)
+	{
+		emitted[best] = true;
+
+		std::vector<U32> newCache;
+		newCache.reserve(cacheSize + 3);
+		for (int k = 0; k < 3; ++k)
+		{
+			U32 v = indices[best * 3 + k];
+			output.push_back(v);
+			newCache.push_back(v);
+			--remaining[v];
+
+			// Drop the emitted triangle from this vertex's live adjacency
+			U32* begin = &adjacency[adjacencyOffset[v]];
+			U32* end = begin + remaining[v] + 1;
+			U32* found = std::find(begin, end, U32(best));
+			if (found != end)
+				std::iter_swap(found, end - 1);
+		}
+		for (auto v : cache)
+		{
+			if (std::find(newCache.begin(), newCache.begin() + 3, v) == newCache.begin() + 3)
+				newCache.push_back(v);
+		}
+
+		for (size_t i = cacheSize; i < newCache.size(); ++i)
+		{
+			cachePosition[newCache[i]] = -1;
+			score[newCache[i]] = vertexScore(-1, remaining[newCache[i]]);
+		}
+		if (newCache.size() > size_t(cacheSize))
+			newCache.resize(cacheSize);
+		cache.swap(newCache);
+
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			cachePosition[cache[i]] = int(i);
+			score[cache[i]] = vertexScore(int(i), remaining[cache[i]]);
+		}
+
+		// Candidate triangles are those touching the cache
+		best = -1;
+		float bestScore = -1.0f;
+		for (auto v : cache)
+		{
+			for (U32 a = adjacencyOffset[v]; a < adjacencyOffset[v] + remaining[v]; ++a)
+			{
+				U32 t = adjacency[a];
+				float s = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+				triangleScore[t] = s;
+				if (s > bestScore)
+				{
+					bestScore = s;
+					best = S64(t);
+				}
+			}
+		}
+
+		if (best < 0)
+		{
+			while (scanPosition < triangleCount && emitted[scanPosition])
+				++scanPosition;
+			if (scanPosition < triangleCount)
+				best = S64(scanPosition);
+		}
+	}
+
+	indices.swap(output);
+}
+
+void Mesh::optimiseVertexFetch()
+{
+	std::vector<uint32_t> remap(vertices.size(), std::numeric_limits<uint32_t>::max());
+	std::vector<Vertex> reordered;
+	reordered.reserve(vertices.size());
+
+	for (auto& index : indices)
+	{
+		if (remap[index] == std::numeric_limits<uint32_t>::max())
+		{
+			remap[index] = static_cast<uint32_t>(reordered.size());
+			reordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	vertices.swap(reordered);
+}
+
+bool Mesh::loadCooked(std::string path)
+{
+	File file;
+	if (!file.open(path, File::Mode(File::binary | File::in)))
+	{
+		LOG_WARN("Can't open cooked mesh: " << path);
+		return false;
+	}
+
+	U32 magic, version, vertexCount, indexCount;
+	file.read(magic);
+	file.read(version);
+	if (magic != cookedMagic || version != cookedVersion)
+	{
+		LOG_WARN("Cooked mesh has bad header or version: " << path);
+		return false;
+	}
+
+	file.read(vertexCount);
+	file.read(indexCount);
+	if (file.getSize() != S64(sizeof(U32) * 4 + sizeof(Vertex) * vertexCount + sizeof(uint32_t) * indexCount))
+	{
+		LOG_WARN("Cooked mesh is truncated: " << path);
+		return false;
+	}
+
+	vertices.resize(vertexCount);
+	indices.resize(indexCount);
+	file.readArray(vertices.data(), vertexCount);
+	file.readArray(indices.data(), indexCount);
+	return true;
+}
+
+bool Mesh::saveCooked(std::string path)
+{
+	File file;
+	if (!file.create(std::move(path), File::Mode(File::binary | File::out | File::trunc)))
+		return false;
+
+	file.write(cookedMagic);
+	file.write(cookedVersion);
+	file.write(U32(vertices.size()));
+	file.write(U32(indices.size()));
+	file.writeArray(vertices.data(), U32(vertices.size()));
+	file.writeArray(indices.data(), U32(indices.size()));
+	return file.fstream().good();
+}
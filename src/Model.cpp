@@ -1,71 +1,56 @@
 #include "Model.hpp"
 #include "Engine.hpp"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
+#include <cstring>
+#include <filesystem>
 
 void Model::load(std::string path) {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string err;
+	bool cooked = path.size() > 5 && path.compare(path.size() - 5, 5, ".mesh") == 0;
 
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str())) 
+	if (!(cooked ? mesh.loadCooked(path) : mesh.loadObj(path)))
 	{
-        LOG_FATAL(err);
-    }
+		LOG_FATAL("Failed to load model: " << path);
+	}
 
     modelName = path;
 
-	std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
+    mesh.computeBounds(boundsMin, boundsMax, boundingSphere);
 
-	for (const auto& shape : shapes) 
-	{
-		for (const auto& index : shape.mesh.indices) 
-		{
-			Vertex vertex = {};
-
-			vertex.position = 
-			{
-				attrib.vertices[3 * index.vertex_index + 0],
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]
-			};
-
-			vertex.texCoord = 
-			{
-				attrib.texcoords[2 * index.texcoord_index + 0],
-				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-			};
-
-			vertex.color = {1.0f, 1.0f, 1.0f};
-
-			if (uniqueVertices.count(vertex) == 0) 
-			{
-				uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-				vertices.push_back(vertex);
-			}
-
-			indices.push_back(uniqueVertices[vertex]);
-		}
-	}
+    // The cooker writes the triangle BVH next to the cooked mesh
+    triangleBvh.clear();
+    std::error_code ec;
+    std::string bvhPath = cooked ? path.substr(0, path.size() - 5) + ".bvh" : "";
+    if (cooked && std::filesystem::exists(bvhPath, ec) && triangleBvh.loadCooked(bvhPath) && !triangleBvh.matches(mesh))
+    {
+        LOG_WARN("Cooked BVH doesn't match its mesh, it will be rebuilt: " << bvhPath);
+        triangleBvh.clear();
+    }
 
     initVulkanVertexBuffer();
     initVulkanIndexBuffer();
-	
 }
 
 
+const TriangleBvh& Model::getTriangleBvh()
+{
+	if (triangleBvh.empty() && !mesh.indices.empty())
+	{
+		LOG_INFO("<" << modelName << "> Building triangle BVH");
+		triangleBvh.build(mesh);
+	}
+	return triangleBvh;
+}
+
 void Model::initVulkanVertexBuffer()
 {
 	LOG_INFO("<" << modelName << "> Creating vertex buffer");
-	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+	VkDeviceSize bufferSize = sizeof(mesh.vertices[0]) * mesh.vertices.size();
 
 	Engine::renderer->createVulkanBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, Engine::renderer->vkStagingBuffer, Engine::renderer->vkStagingBufferMemory);
 
 	void* data;
 	vkMapMemory(Engine::renderer->vkLogicalDevice, Engine::renderer->vkStagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, vertices.data(), (size_t)bufferSize);
+	memcpy(data, mesh.vertices.data(), (size_t)bufferSize);
 	vkUnmapMemory(Engine::renderer->vkLogicalDevice, Engine::renderer->vkStagingBufferMemory);
 
 	Engine::renderer->createVulkanBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vkVertexBuffer, vkVertexBufferMemory);
@@ -80,14 +65,14 @@ void Model::initVulkanVertexBuffer()
 void Model::initVulkanIndexBuffer()
 {
 	LOG_INFO("<" << modelName << "> Creating index buffer");
-	VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+	VkDeviceSize bufferSize = sizeof(mesh.indices[0]) * mesh.indices.size();
 
 	Engine::renderer->createVulkanBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, Engine::renderer->vkStagingBuffer, Engine::renderer->vkStagingBufferMemory);
 
 	void* data;
 	vkMapMemory(Engine::renderer->vkLogicalDevice, Engine::renderer->vkStagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices.data(), (size_t)bufferSize);
+	memcpy(data, mesh.indices.data(), (size_t)bufferSize);
 	vkUnmapMemory(Engine::renderer->vkLogicalDevice, Engine::renderer->vkStagingBufferMemory);
 
 	Engine::renderer->createVulkanBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
@@ -0,0 +1,431 @@
+#include "OcclusionCuller.hpp"
+#include "Image.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define OCCLUSION_CULLER_SSE
+#include <immintrin.h>
+#endif
+
+OcclusionCuller::OcclusionCuller(U32 width, U32 height, U32 threadCount)
+{
+	tilesX = std::max(1u, (width + tileWidth - 1) / tileWidth);
+	tilesY = std::max(1u, (height + tileHeight - 1) / tileHeight);
+	this->width = tilesX * tileWidth;
+	this->height = tilesY * tileHeight;
+
+	// Each level halves, rounding up, down to a single texel
+	U32 levelWidth = this->width;
+	U32 levelHeight = this->height;
+	while (true)
+	{
+		levels.push_back({ levelWidth, levelHeight, std::vector<float>(levelWidth * levelHeight, 1.0f) });
+		if (levelWidth == 1 && levelHeight == 1)
+			break;
+		levelWidth = (levelWidth + 1) / 2;
+		levelHeight = (levelHeight + 1) / 2;
+	}
+
+	threads = threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+	if (threads > 1)
+		workers = std::make_unique<ThreadPool>(threads - 1);
+}
+
+bool OcclusionCuller::hasSimd()
+{
+#ifdef OCCLUSION_CULLER_SSE
+	return true;
+#else
+	return false;
+#endif
+}
+
+void OcclusionCuller::clear()
+{
+	occluders.clear();
+	firstTriangle.clear();
+	triangleCount = 0;
+}
+
+void OcclusionCuller::addOccluder(const Mesh& mesh, const glm::mat4& transform)
+{
+	occluders.push_back({ &mesh, transform });
+	firstTriangle.push_back(triangleCount);
+	triangleCount += U32(mesh.indices.size() / 3);
+}
+
+void OcclusionCuller::parallel(U32 count, U32 threadCount, const std::function<void(U32)>& task)
+{
+	std::vector<std::future<void>> pending;
+	if (threadCount > 1 && workers)
+	{
+		pending.reserve(count);
+		for (U32 i = 1; i < count; ++i)
+			pending.push_back(workers->submit([&task, i]() { task(i); }));
+	}
+	else
+	{
+		for (U32 i = 1; i < count; ++i)
+			task(i);
+	}
+
+	if (count)
+		task(0);
+	for (auto& f : pending)
+		f.get();
+}
+
+void OcclusionCuller::rasterise(const glm::mat4& viewProjection)
+{
+	rasterise(viewProjection, hasSimd(), threads);
+}
+
+void OcclusionCuller::rasterise(const glm::mat4& viewProjection, bool simd, U32 threadCount)
+{
+	this->viewProjection = viewProjection;
+	threadCount = std::max(1u, std::min(threadCount, workers ? workers->size() + 1 : 1u));
+
+	std::fill(levels[0].depth.begin(), levels[0].depth.end(), 1.0f);
+
+	// Set up and bin in one chunk of triangles per thread. The bins keep their
+	// capacity from frame to frame.
+	U32 chunkCount = std::max(1u, std::min(threadCount, triangleCount));
+	if (chunks.size() < chunkCount)
+		chunks.resize(chunkCount);
+	for (Bins& bins : chunks)
+	{
+		bins.triangles.clear();
+		bins.tiles.resize(tilesX * tilesY);
+		for (auto& tile : bins.tiles)
+			tile.clear();
+	}
+
+	U32 perChunk = (triangleCount + chunkCount - 1) / chunkCount;
+	parallel(chunkCount, threadCount, [&](U32 chunk)
+	{
+		U32 begin = chunk * perChunk;
+		setup(viewProjection, begin, std::min(triangleCount, begin + perChunk), chunks[chunk]);
+	});
+
+	// Interleaved tiles, the middle of the screen is usually busier
+	U32 tileCount = tilesX * tilesY;
+	U32 tasks = std::min(threadCount, tileCount);
+	parallel(tasks, threadCount, [&](U32 task)
+	{
+		for (U32 tile = task; tile < tileCount; tile += tasks)
+			rasteriseTile(tile, simd);
+	});
+
+	buildPyramid();
+}
+
+void OcclusionCuller::setup(const glm::mat4& viewProjection, U32 begin, U32 end, Bins& bins)
+{
+	if (begin >= end)
+		return;
+
+	// Occluder holding triangle begin
+	U32 occluder = U32(std::upper_bound(firstTriangle.begin(), firstTriangle.end(), begin) - firstTriangle.begin()) - 1;
+
+	for (U32 t = begin; t < end; ++t)
+	{
+		while (occluder + 1 < occluders.size() && t >= firstTriangle[occluder + 1])
+			++occluder;
+
+		const Mesh& mesh = *occluders[occluder].mesh;
+		glm::mat4 transform = viewProjection * occluders[occluder].transform;
+		const U32* index = &mesh.indices[(t - firstTriangle[occluder]) * 3];
+
+		glm::vec4 clip[3];
+		for (U32 v = 0; v < 3; ++v)
+			clip[v] = transform * glm::vec4(mesh.vertices[index[v]].position, 1.0f);
+
+		U32 first = U32(bins.triangles.size());
+		addTriangle(clip, bins.triangles);
+
+		for (U32 i = first; i < bins.triangles.size(); ++i)
+		{
+			const Triangle& triangle = bins.triangles[i];
+			for (S32 y = triangle.minY / S32(tileHeight); y <= triangle.maxY / S32(tileHeight); ++y)
+				for (S32 x = triangle.minX / S32(tileWidth); x <= triangle.maxX / S32(tileWidth); ++x)
+					bins.tiles[y * tilesX + x].push_back(i);
+		}
+	}
+}
+
+// Clips against the near plane, z >= 0, then sets up the 1 or 2 resulting
+// triangles. The other planes are handled by clamping the pixel bounds.
+void OcclusionCuller::addTriangle(const glm::vec4 clip[3], std::vector<Triangle>& triangles)
+{
+	glm::vec4 polygon[4];
+	U32 count = 0;
+	for (U32 i = 0; i < 3; ++i)
+	{
+		const glm::vec4& a = clip[i];
+		const glm::vec4& b = clip[(i + 1) % 3];
+		if (a.z >= 0.0f)
+			polygon[count++] = a;
+		if ((a.z >= 0.0f) != (b.z >= 0.0f))
+			polygon[count++] = a + (b - a) * (a.z / (a.z - b.z));
+	}
+
+	for (U32 i = 1; i + 1 < count; ++i)
+	{
+		const glm::vec4* corners[3] = { &polygon[0], &polygon[i], &polygon[i + 1] };
+
+		float x[3], y[3], z[3];
+		for (U32 v = 0; v < 3; ++v)
+		{
+			const glm::vec4& c = *corners[v];
+			x[v] = (c.x / c.w * 0.5f + 0.5f) * float(width);
+			y[v] = (c.y / c.w * 0.5f + 0.5f) * float(height);
+			z[v] = c.z / c.w;
+		}
+
+		// Occluders are solid so both windings are rasterised
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if (std::abs(area) < 1e-6f)
+			continue;
+		if (area < 0.0f)
+		{
+			std::swap(x[1], x[2]);
+			std::swap(y[1], y[2]);
+			std::swap(z[1], z[2]);
+			area = -area;
+		}
+
+		float minX = std::min({ x[0], x[1], x[2] });
+		float maxX = std::max({ x[0], x[1], x[2] });
+		float minY = std::min({ y[0], y[1], y[2] });
+		float maxY = std::max({ y[0], y[1], y[2] });
+		if (maxX < 0.0f || maxY < 0.0f || minX >= float(width) || minY >= float(height))
+			continue;
+
+		Triangle triangle;
+		// Pixels whose centre could be inside
+		triangle.minX = S32(std::max(0.0f, minX));
+		triangle.minY = S32(std::max(0.0f, minY));
+		triangle.maxX = S32(std::min(float(width - 1), maxX));
+		triangle.maxY = S32(std::min(float(height - 1), maxY));
+
+		for (U32 e = 0; e < 3; ++e)
+		{
+			U32 i0 = e;
+			U32 i1 = (e + 1) % 3;
+			triangle.a[e] = y[i0] - y[i1];
+			triangle.b[e] = x[i1] - x[i0];
+			triangle.c[e] = (y[i1] - y[i0]) * x[i0] - (x[i1] - x[i0]) * y[i0];
+		}
+
+		triangle.zx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+		triangle.zy = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+		triangle.z0 = z[0] - triangle.zx * x[0] - triangle.zy * y[0];
+
+		triangles.push_back(triangle);
+	}
+}
+
+void OcclusionCuller::rasteriseTile(U32 tile, bool simd)
+{
+	S32 tileX = S32(tile % tilesX) * tileWidth;
+	S32 tileY = S32(tile / tilesX) * tileHeight;
+
+	for (const Bins& bins : chunks)
+	{
+		for (U32 index : bins.tiles[tile])
+		{
+			const Triangle& triangle = bins.triangles[index];
+			S32 x0 = std::max(triangle.minX, tileX);
+			S32 y0 = std::max(triangle.minY, tileY);
+			S32 x1 = std::min(triangle.maxX, tileX + S32(tileWidth) - 1);
+			S32 y1 = std::min(triangle.maxY, tileY + S32(tileHeight) - 1);
+			fill(triangle, x0, y0, x1, y1, simd);
+		}
+	}
+}
+
+// Keeps the nearest depth at every covered pixel centre. Both paths evaluate
+// the same expressions in the same order so their results match exactly.
+void OcclusionCuller::fill(const Triangle& t, S32 x0, S32 y0, S32 x1, S32 y1, bool simd)
+{
+	float* depth = levels[0].depth.data();
+
+#ifdef OCCLUSION_CULLER_SSE
+	if (simd)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 laneOffset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+		__m128 a0 = _mm_set1_ps(t.a[0]), a1 = _mm_set1_ps(t.a[1]), a2 = _mm_set1_ps(t.a[2]);
+		__m128 zx = _mm_set1_ps(t.zx);
+
+		// Blocks of 4 start on a multiple of 4, which stays inside the tile
+		S32 startX = x0 & ~3;
+		for (S32 y = y0; y <= y1; ++y)
+		{
+			float py = float(y) + 0.5f;
+			__m128 r0 = _mm_set1_ps(t.b[0] * py + t.c[0]);
+			__m128 r1 = _mm_set1_ps(t.b[1] * py + t.c[1]);
+			__m128 r2 = _mm_set1_ps(t.b[2] * py + t.c[2]);
+			__m128 rz = _mm_set1_ps(t.zy * py + t.z0);
+			float* row = depth + y * S32(width);
+
+			for (S32 x = startX; x <= x1; x += 4)
+			{
+				__m128 px = _mm_add_ps(_mm_set1_ps(float(x)), laneOffset);
+				__m128 inside = _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), r0), zero), _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), r1), zero));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), r2), zero));
+
+				// Drop the lanes left of x0 or right of x1
+				__m128i lane = _mm_add_epi32(_mm_set1_epi32(x), lanes);
+				__m128i inRange = _mm_andnot_si128(_mm_cmplt_epi32(lane, _mm_set1_epi32(x0)), _mm_cmplt_epi32(lane, _mm_set1_epi32(x1 + 1)));
+				inside = _mm_and_ps(inside, _mm_castsi128_ps(inRange));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+
+				__m128 z = _mm_add_ps(_mm_mul_ps(zx, px), rz);
+				__m128 old = _mm_loadu_ps(row + x);
+				__m128 nearest = _mm_min_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+			}
+		}
+		return;
+	}
+#endif
+
+	for (S32 y = y0; y <= y1; ++y)
+	{
+		float py = float(y) + 0.5f;
+		float r0 = t.b[0] * py + t.c[0];
+		float r1 = t.b[1] * py + t.c[1];
+		float r2 = t.b[2] * py + t.c[2];
+		float rz = t.zy * py + t.z0;
+		float* row = depth + y * S32(width);
+
+		for (S32 x = x0; x <= x1; ++x)
+		{
+			float px = float(x) + 0.5f;
+			if (t.a[0] * px + r0 >= 0.0f && t.a[1] * px + r1 >= 0.0f && t.a[2] * px + r2 >= 0.0f)
+				row[x] = std::min(row[x], t.zx * px + rz);
+		}
+	}
+}
+
+void OcclusionCuller::rasteriseReference(const glm::mat4& viewProjection, std::vector<float>& depth)
+{
+	std::vector<Triangle> triangles;
+	for (const Occluder& occluder : occluders)
+	{
+		glm::mat4 transform = viewProjection * occluder.transform;
+		for (size_t i = 0; i + 2 < occluder.mesh->indices.size(); i += 3)
+		{
+			glm::vec4 clip[3];
+			for (U32 v = 0; v < 3; ++v)
+				clip[v] = transform * glm::vec4(occluder.mesh->vertices[occluder.mesh->indices[i + v]].position, 1.0f);
+			addTriangle(clip, triangles);
+		}
+	}
+
+	depth.assign(width * height, 1.0f);
+	for (U32 y = 0; y < height; ++y)
+	{
+		float py = float(y) + 0.5f;
+		for (U32 x = 0; x < width; ++x)
+		{
+			float px = float(x) + 0.5f;
+			for (const Triangle& t : triangles)
+			{
+				if (t.a[0] * px + (t.b[0] * py + t.c[0]) >= 0.0f && t.a[1] * px + (t.b[1] * py + t.c[1]) >= 0.0f && t.a[2] * px + (t.b[2] * py + t.c[2]) >= 0.0f)
+					depth[y * width + x] = std::min(depth[y * width + x], t.zx * px + (t.zy * py + t.z0));
+			}
+		}
+	}
+}
+
+void OcclusionCuller::buildPyramid()
+{
+	for (size_t l = 1; l < levels.size(); ++l)
+	{
+		const Level& source = levels[l - 1];
+		Level& level = levels[l];
+		for (U32 y = 0; y < level.height; ++y)
+		{
+			// Odd sizes repeat the last row or column
+			U32 y0 = y * 2;
+			U32 y1 = std::min(y0 + 1, source.height - 1);
+			for (U32 x = 0; x < level.width; ++x)
+			{
+				U32 x0 = x * 2;
+				U32 x1 = std::min(x0 + 1, source.width - 1);
+				level.depth[y * level.width + x] = std::max(
+					std::max(source.depth[y0 * source.width + x0], source.depth[y0 * source.width + x1]),
+					std::max(source.depth[y1 * source.width + x0], source.depth[y1 * source.width + x1]));
+			}
+		}
+	}
+}
+
+bool OcclusionCuller::isVisible(const glm::vec3& minimum, const glm::vec3& maximum) const
+{
+	const float infinity = std::numeric_limits<float>::max();
+	float minX = infinity, minY = infinity, maxX = -infinity, maxY = -infinity;
+	float nearest = infinity;
+	for (U32 corner = 0; corner < 8; ++corner)
+	{
+		glm::vec3 point((corner & 1) ? maximum.x : minimum.x, (corner & 2) ? maximum.y : minimum.y, (corner & 4) ? maximum.z : minimum.z);
+		glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+		// Reaches behind the near plane, the projection isn't bounded
+		if (clip.z < 0.0f || clip.w <= 0.0f)
+			return true;
+
+		float x = (clip.x / clip.w * 0.5f + 0.5f) * float(width);
+		float y = (clip.y / clip.w * 0.5f + 0.5f) * float(height);
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		nearest = std::min(nearest, clip.z / clip.w);
+	}
+
+	if (maxX < 0.0f || maxY < 0.0f || minX >= float(width) || minY >= float(height) || nearest > 1.0f)
+		return false;
+
+	// Clamped before converting, far off screen corners don't fit an S32
+	S32 x0 = S32(std::max(0.0f, minX));
+	S32 y0 = S32(std::max(0.0f, minY));
+	S32 x1 = S32(std::min(float(width - 1), maxX));
+	S32 y1 = S32(std::min(float(height - 1), maxY));
+
+	// Coarsest level where the rectangle still touches at most 2x2 texels
+	U32 l = 0;
+	while (l + 1 < levels.size() && ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1))
+		++l;
+
+	const Level& level = levels[l];
+	for (S32 y = y0 >> l; y <= (y1 >> l); ++y)
+		for (S32 x = x0 >> l; x <= (x1 >> l); ++x)
+			if (nearest <= level.depth[y * level.width + x])
+				return true;
+	return false;
+}
+
+void OcclusionCuller::toImage(const std::vector<float>& depth, U32 width, U32 height, Image& image)
+{
+	image.width = int(width);
+	image.height = int(height);
+	image.mipLevels = 1;
+	image.data.resize(width * height);
+
+	// Perspective depth crowds up near 1, stretch the range actually used
+	float nearest = 1.0f;
+	for (float z : depth)
+		nearest = std::min(nearest, std::max(0.0f, z));
+	float scale = nearest < 1.0f ? 1.0f / (1.0f - nearest) : 0.0f;
+
+	// Row 0 is y = -1 in clip space, the top of the screen in Vulkan
+	for (U32 i = 0; i < width * height; ++i)
+	{
+		float z = std::min(1.0f, std::max(nearest, depth[i]));
+		char value = char(U8(std::lround((1.0f - z) * scale * 255.0f)));
+		image.data[i] = { value, value, value, char(255) };
+	}
+}
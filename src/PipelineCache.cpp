@@ -0,0 +1,165 @@
+#include "PipelineCache.hpp"
+#include "Clock.hpp"
+#include "File.hpp"
+#include "Profiler.hpp"
+
+#include <cstring>
+#include <filesystem>
+
+std::string PipelineCache::path = "cache/pipelines.bin";
+bool PipelineCache::enabled = true;
+VkPipelineCache PipelineCache::vkPipelineCache = VK_NULL_HANDLE;
+bool PipelineCache::creationFeedback = false;
+
+bool PipelineCache::isCompatible(const std::vector<U8>& data, const VkPhysicalDeviceProperties& properties)
+{
+	// VkPipelineCacheHeaderVersionOne
+	const size_t headerSize = sizeof(U32) * 4 + VK_UUID_SIZE;
+	if (data.size() < headerSize)
+		return false;
+
+	U32 header[4];
+	memcpy(header, data.data(), sizeof(header));
+
+	return header[0] >= headerSize && header[0] <= data.size()
+		&& header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& header[2] == properties.vendorID
+		&& header[3] == properties.deviceID
+		&& memcmp(data.data() + sizeof(header), properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::init(VkDevice device, const VkPhysicalDeviceProperties& properties)
+{
+	std::vector<U8> data;
+
+	File file;
+	if (enabled && file.open(path, File::Mode(File::binary | File::in)))
+	{
+		data.resize(size_t(file.getSize()));
+		if (!data.empty())
+			file.readArray(data.data(), U32(data.size()));
+
+		if (!file.fstream().good() || !isCompatible(data, properties))
+		{
+			LOG_INFO("Pipeline cache was written by another driver or device, starting empty");
+			data.clear();
+		}
+	}
+
+	VkPipelineCacheCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	info.initialDataSize = data.size();
+	info.pInitialData = data.empty() ? nullptr : data.data();
+
+	if (vkCreatePipelineCache(device, &info, nullptr, &vkPipelineCache) != VK_SUCCESS)
+	{
+		// A driver rejecting the blob is not fatal, retry empty
+		info.initialDataSize = 0;
+		info.pInitialData = nullptr;
+		if (vkCreatePipelineCache(device, &info, nullptr, &vkPipelineCache) != VK_SUCCESS)
+		{
+			LOG_WARN("Failed to create pipeline cache, pipelines will be created uncached");
+			vkPipelineCache = VK_NULL_HANDLE;
+			return;
+		}
+	}
+
+	LOG_INFO("Pipeline cache created (" << data.size() << " bytes loaded)");
+}
+
+void PipelineCache::save(VkDevice device)
+{
+	if (!enabled || vkPipelineCache == VK_NULL_HANDLE)
+		return;
+
+	size_t size = 0;
+	if (vkGetPipelineCacheData(device, vkPipelineCache, &size, nullptr) != VK_SUCCESS || size == 0)
+		return;
+
+	std::vector<U8> data(size);
+	if (vkGetPipelineCacheData(device, vkPipelineCache, &size, data.data()) != VK_SUCCESS)
+		return;
+	data.resize(size);
+
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+
+	// Same temporary + rename scheme as the shader cache, a crash mid-write
+	// must not leave a truncated blob behind
+	std::string tmp = path + ".tmp";
+	{
+		File file;
+		if (!file.create(std::string(tmp), File::Mode(File::binary | File::out | File::trunc)))
+		{
+			LOG_WARN("Can't write pipeline cache: " << tmp);
+			return;
+		}
+		file.writeArray(data.data(), U32(data.size()));
+		if (!file.fstream().good())
+			return;
+	}
+
+	std::filesystem::rename(tmp, path, ec);
+	if (ec)
+	{
+		std::filesystem::remove(tmp, ec);
+		LOG_WARN("Can't write pipeline cache: " << path);
+		return;
+	}
+
+	LOG_INFO("Pipeline cache saved (" << data.size() << " bytes)");
+}
+
+void PipelineCache::destroy(VkDevice device)
+{
+	if (vkPipelineCache != VK_NULL_HANDLE)
+		vkDestroyPipelineCache(device, vkPipelineCache, nullptr);
+	vkPipelineCache = VK_NULL_HANDLE;
+}
+
+VkResult PipelineCache::createGraphicsPipeline(VkDevice device, const VkGraphicsPipelineCreateInfo& info, VkPipeline& pipeline)
+{
+	VkGraphicsPipelineCreateInfo createInfo = info;
+
+	VkPipelineCreationFeedbackEXT feedback = {};
+	VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo = {};
+	if (creationFeedback)
+	{
+		feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+		feedbackInfo.pNext = createInfo.pNext;
+		feedbackInfo.pPipelineCreationFeedback = &feedback;
+		createInfo.pNext = &feedbackInfo;
+	}
+
+	Clock clock;
+	U64 start = clock.now();
+	VkResult result = vkCreateGraphicsPipelines(device, vkPipelineCache, 1, &createInfo, nullptr, &pipeline);
+	S64 elapsed = S64(clock.now() - start);
+
+	Profiler::record("pipeline create", elapsed);
+	if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)
+	{
+		if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT)
+			Profiler::record("pipeline cache hit", elapsed);
+		else
+			Profiler::record("pipeline cache miss", elapsed);
+	}
+
+	return result;
+}
+
+VkResult PipelineCache::createComputePipeline(VkDevice device, const VkComputePipelineCreateInfo& info, VkPipeline& pipeline)
+{
+	Clock clock;
+	U64 start = clock.now();
+	VkResult result = vkCreateComputePipelines(device, vkPipelineCache, 1, &info, nullptr, &pipeline);
+	Profiler::record("pipeline create", S64(clock.now() - start));
+	return result;
+}
+
+ThreadPool& PipelineCache::workers()
+{
+	// Pipeline compiles are long and rare, a couple of threads is plenty
+	static ThreadPool pool(std::min(2u, std::max(1u, std::thread::hardware_concurrency() / 2)));
+	return pool;
+}
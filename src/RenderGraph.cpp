@@ -0,0 +1,741 @@
+#include "RenderGraph.hpp"
+
+RenderGraph::AccessInfo RenderGraph::getAccessInfo(Access access)
+{
+	switch (access)
+	{
+	case ColorAttachment:
+		return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true };
+	case DepthAttachment:
+		return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true };
+	case DepthRead:
+		return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false };
+	case FragmentSampled:
+		return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false };
+	case ComputeSampled:
+		return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false };
+	case ComputeStorageRead:
+		return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false };
+	case ComputeStorageWrite:
+		return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true };
+	case IndirectRead:
+		return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false };
+	case VertexRead:
+		return { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false };
+	case TransferRead:
+		return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false };
+	case TransferWrite:
+		return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true };
+	case Present:
+		return { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, false };
+	case None:
+	default:
+		return { 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, false };
+	}
+}
+
+static U32 bytesPerPixel(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8_UNORM:
+		return 1;
+	case VK_FORMAT_D16_UNORM:
+		return 2;
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return 8;
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		return 16;
+	default:
+		return 4;
+	}
+}
+
+// Close enough for planning without a device, realize() replaces it with
+// the driver's requirements
+VkDeviceSize RenderGraph::estimateSize(const ImageDesc& desc)
+{
+	VkDeviceSize size = 0;
+	U32 width = desc.width, height = desc.height;
+	for (U32 level = 0; level < desc.mipLevels; ++level)
+	{
+		size += VkDeviceSize(width) * height * bytesPerPixel(desc.format);
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+	return size;
+}
+
+RenderGraph::Resource RenderGraph::createImage(const std::string& name, const ImageDesc& desc)
+{
+	ResourceData resource;
+	resource.name = name;
+	resource.isImage = true;
+	resource.imported = false;
+	resource.desc = desc;
+	resource.size = estimateSize(desc);
+	resources.push_back(resource);
+	return Resource(resources.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::createBuffer(const std::string& name, const BufferDesc& desc)
+{
+	ResourceData resource;
+	resource.name = name;
+	resource.isImage = false;
+	resource.imported = false;
+	resource.size = desc.size;
+	resources.push_back(resource);
+	return Resource(resources.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::importImage(const std::string& name, VkImage image, const ImageDesc& desc, VkImageLayout currentLayout, Access finalAccess)
+{
+	ResourceData resource;
+	resource.name = name;
+	resource.isImage = true;
+	resource.imported = true;
+	resource.desc = desc;
+	resource.size = 0;
+	resource.image = image;
+	resource.initialLayout = currentLayout;
+	resource.finalAccess = finalAccess;
+	resources.push_back(resource);
+	return Resource(resources.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::importBuffer(const std::string& name, VkBuffer buffer, VkDeviceSize size, Access finalAccess)
+{
+	ResourceData resource;
+	resource.name = name;
+	resource.isImage = false;
+	resource.imported = true;
+	resource.size = size;
+	resource.buffer = buffer;
+	resource.finalAccess = finalAccess;
+	resources.push_back(resource);
+	return Resource(resources.size() - 1);
+}
+
+void RenderGraph::setImage(Resource resource, VkImage image)
+{
+	resources[resource].image = image;
+}
+
+void RenderGraph::setBuffer(Resource resource, VkBuffer buffer)
+{
+	resources[resource].buffer = buffer;
+}
+
+void RenderGraph::setInitialAccess(Resource resource, Access access)
+{
+	resources[resource].initialAccess = access;
+}
+
+RenderGraph::Pass RenderGraph::addPass(const std::string& name, std::function<void(VkCommandBuffer)> execute)
+{
+	PassData pass;
+	pass.name = name;
+	pass.execute = std::move(execute);
+	passes.push_back(std::move(pass));
+	return Pass(passes.size() - 1);
+}
+
+void RenderGraph::read(Pass pass, Resource resource, Access access)
+{
+	passes[pass].uses.push_back({ resource, access, false });
+}
+
+void RenderGraph::write(Pass pass, Resource resource, Access access)
+{
+	passes[pass].uses.push_back({ resource, access, true });
+}
+
+void RenderGraph::setSideEffect(Pass pass)
+{
+	passes[pass].sideEffect = true;
+}
+
+bool RenderGraph::compile()
+{
+	for (const auto& pass : passes)
+	{
+		for (const auto& use : pass.uses)
+		{
+			const ResourceData& resource = resources[use.resource];
+			AccessInfo info = getAccessInfo(use.access);
+			if (info.write != use.write)
+			{
+				LOG_WARN("Render graph pass " << pass.name << " declares a " << (use.write ? "write" : "read") << " of " << resource.name << " with a " << (info.write ? "write" : "read") << " access");
+				return false;
+			}
+			if (resource.isImage && info.layout == VK_IMAGE_LAYOUT_UNDEFINED)
+			{
+				LOG_WARN("Render graph pass " << pass.name << " uses image " << resource.name << " with a buffer access");
+				return false;
+			}
+		}
+	}
+
+	std::vector<bool> live;
+	cull(live);
+	order(live);
+	planMemory();
+	return scheduleBarriers();
+}
+
+// Walks the passes backwards keeping the set of resources something still
+// reads. A pass survives if it writes an imported resource, or one of those.
+void RenderGraph::cull(std::vector<bool>& live)
+{
+	live.assign(passes.size(), false);
+	culled.clear();
+
+	std::vector<bool> needed(resources.size(), false);
+	for (size_t p = passes.size(); p-- > 0;)
+	{
+		const PassData& pass = passes[p];
+		bool keep = pass.sideEffect;
+		for (const auto& use : pass.uses)
+		{
+			if (use.write && (resources[use.resource].imported || needed[use.resource]))
+				keep = true;
+		}
+
+		if (!keep)
+		{
+			culled.push_back(Pass(p));
+			continue;
+		}
+
+		// A write doesn't end the need, it may only cover part of the resource
+		live[p] = true;
+		for (const auto& use : pass.uses)
+		{
+			if (!use.write)
+				needed[use.resource] = true;
+		}
+	}
+	std::reverse(culled.begin(), culled.end());
+}
+
+// Topological order over read-after-write, write-after-read and
+// write-after-write dependencies. Ties go to the pass declared first, and
+// each pass gets the length of its longest dependency chain as its level.
+void RenderGraph::order(const std::vector<bool>& live)
+{
+	std::vector<std::vector<Pass>> dependents(passes.size());
+	std::vector<U32> pending(passes.size(), 0);
+
+	std::vector<Pass> lastWriter(resources.size(), invalid);
+	std::vector<std::vector<Pass>> readers(resources.size());
+
+	auto depend = [&](Pass from, Pass to)
+	{
+		if (from == invalid || from == to)
+			return;
+		auto& list = dependents[from];
+		if (std::find(list.begin(), list.end(), to) == list.end())
+		{
+			list.push_back(to);
+			++pending[to];
+		}
+	};
+
+	for (Pass p = 0; p < passes.size(); ++p)
+	{
+		if (!live[p])
+			continue;
+
+		for (const auto& use : passes[p].uses)
+		{
+			depend(lastWriter[use.resource], p);
+			if (use.write)
+			{
+				for (Pass reader : readers[use.resource])
+					depend(reader, p);
+				readers[use.resource].clear();
+			}
+		}
+		// Second loop so a pass reading and writing a resource doesn't depend on itself
+		for (const auto& use : passes[p].uses)
+		{
+			if (use.write)
+				lastWriter[use.resource] = p;
+			else
+				readers[use.resource].push_back(p);
+		}
+	}
+
+	std::vector<U32> level(passes.size(), 0);
+	std::priority_queue<Pass, std::vector<Pass>, std::greater<Pass>> ready;
+	for (Pass p = 0; p < passes.size(); ++p)
+	{
+		if (live[p] && pending[p] == 0)
+			ready.push(p);
+	}
+
+	steps.clear();
+	while (!ready.empty())
+	{
+		Pass p = ready.top();
+		ready.pop();
+
+		Step step;
+		step.pass = p;
+		step.level = level[p];
+		step.srcStages = 0;
+		step.dstStages = 0;
+		steps.push_back(step);
+
+		for (Pass next : dependents[p])
+		{
+			level[next] = std::max(level[next], level[p] + 1);
+			if (--pending[next] == 0)
+				ready.push(next);
+		}
+	}
+
+	for (auto& resource : resources)
+	{
+		resource.firstUse = invalid;
+		resource.lastUse = invalid;
+		resource.imageUsage = 0;
+		resource.bufferUsage = 0;
+	}
+
+	for (U32 s = 0; s < steps.size(); ++s)
+	{
+		for (const auto& use : passes[steps[s].pass].uses)
+		{
+			ResourceData& resource = resources[use.resource];
+			if (resource.firstUse == invalid)
+				resource.firstUse = s;
+			resource.lastUse = s;
+
+			switch (use.access)
+			{
+			case ColorAttachment: resource.imageUsage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; break;
+			case DepthAttachment:
+			case DepthRead: resource.imageUsage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT; break;
+			case FragmentSampled:
+			case ComputeSampled: resource.imageUsage |= VK_IMAGE_USAGE_SAMPLED_BIT; break;
+			case ComputeStorageRead:
+			case ComputeStorageWrite:
+				resource.imageUsage |= VK_IMAGE_USAGE_STORAGE_BIT;
+				resource.bufferUsage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+				break;
+			case IndirectRead: resource.bufferUsage |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT; break;
+			case VertexRead: resource.bufferUsage |= VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT; break;
+			case TransferRead:
+				resource.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+				resource.bufferUsage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+				break;
+			case TransferWrite:
+				resource.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+				resource.bufferUsage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+				break;
+			default: break;
+			}
+		}
+	}
+}
+
+// Greedy first fit, largest resources first. A resource may reuse memory of
+// any other whose lifetime, in steps, doesn't overlap its own.
+void RenderGraph::planMemory()
+{
+	std::vector<Resource> transient;
+	unaliasedSize = 0;
+	for (Resource r = 0; r < resources.size(); ++r)
+	{
+		if (!resources[r].imported && resources[r].firstUse != invalid)
+		{
+			transient.push_back(r);
+			unaliasedSize += resources[r].size;
+		}
+	}
+	std::stable_sort(transient.begin(), transient.end(), [this](Resource a, Resource b) { return resources[a].size > resources[b].size; });
+
+	placements.clear();
+	heapSize = 0;
+	for (Resource r : transient)
+	{
+		const ResourceData& resource = resources[r];
+		auto alignUp = [&](VkDeviceSize offset) { return (offset + resource.alignment - 1) / resource.alignment * resource.alignment; };
+
+		auto overlaps = [&](const Placement& placed)
+		{
+			const ResourceData& other = resources[placed.resource];
+			return resource.firstUse <= other.lastUse && other.firstUse <= resource.lastUse;
+		};
+
+		// Candidates are the start of the heap and the end of every live neighbour
+		std::vector<VkDeviceSize> candidates = { 0 };
+		for (const auto& placed : placements)
+		{
+			if (overlaps(placed))
+				candidates.push_back(alignUp(placed.offset + placed.size));
+		}
+		std::sort(candidates.begin(), candidates.end());
+
+		VkDeviceSize offset = 0;
+		for (VkDeviceSize candidate : candidates)
+		{
+			bool fits = std::none_of(placements.begin(), placements.end(), [&](const Placement& placed)
+			{
+				return overlaps(placed) && candidate < placed.offset + placed.size && placed.offset < candidate + resource.size;
+			});
+			if (fits)
+			{
+				offset = candidate;
+				break;
+			}
+		}
+
+		placements.push_back({ r, offset, resource.size });
+		heapSize = std::max(heapSize, offset + resource.size);
+	}
+}
+
+bool RenderGraph::scheduleBarriers()
+{
+	struct State
+	{
+		bool used = false;
+		// Last write, or the last layout transition
+		VkPipelineStageFlags writeStages = 0;
+		VkAccessFlags writeAccess = 0;
+		// Reads since then, a following write has to wait for them
+		VkPipelineStageFlags readStages = 0;
+		// Where the last write is already visible
+		VkPipelineStageFlags visibleStages = 0;
+		VkAccessFlags visibleAccess = 0;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	};
+	std::vector<State> states(resources.size());
+	for (Resource r = 0; r < resources.size(); ++r)
+		states[r].layout = resources[r].initialLayout;
+
+	// Run again by realize() once the placements change
+	for (auto& step : steps)
+	{
+		step.srcStages = 0;
+		step.dstStages = 0;
+		step.barriers.clear();
+	}
+
+	// A transient resource taking over memory must wait for everything
+	// still using that memory
+	auto aliasSource = [&](Resource r, VkPipelineStageFlags& stages, VkAccessFlags& access)
+	{
+		const Placement* self = nullptr;
+		for (const auto& placed : placements)
+		{
+			if (placed.resource == r)
+				self = &placed;
+		}
+		if (!self)
+			return;
+
+		for (const auto& placed : placements)
+		{
+			const ResourceData& other = resources[placed.resource];
+			bool sharesMemory = placed.offset < self->offset + self->size && self->offset < placed.offset + placed.size;
+			if (placed.resource != r && sharesMemory && other.lastUse < resources[r].firstUse)
+			{
+				stages |= states[placed.resource].writeStages | states[placed.resource].readStages;
+				access |= states[placed.resource].writeAccess & (VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+			}
+		}
+	};
+
+	auto transition = [&](Resource r, const AccessInfo& info, Step& step)
+	{
+		State& state = states[r];
+		const ResourceData& resource = resources[r];
+		VkImageLayout layout = resource.isImage ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+		bool layoutChange = resource.isImage && layout != state.layout;
+
+		Barrier barrier = { r, 0, info.stages, 0, info.access, state.layout, layout };
+		bool needed = false;
+
+		if (!state.used)
+		{
+			if (!resource.imported)
+			{
+				// Transient contents are never kept
+				barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				aliasSource(r, barrier.srcStages, barrier.srcAccess);
+			}
+			else if (resource.initialAccess != None)
+			{
+				AccessInfo last = getAccessInfo(resource.initialAccess);
+				if (last.write || info.write || layoutChange)
+				{
+					barrier.srcStages = last.stages;
+					barrier.srcAccess = last.write ? last.access : 0;
+				}
+			}
+			needed = layoutChange || barrier.srcStages != 0;
+		}
+		else if (info.write || layoutChange)
+		{
+			barrier.srcStages = state.writeStages | state.readStages;
+			barrier.srcAccess = state.writeAccess;
+			needed = true;
+		}
+		else if (state.writeStages && ((info.stages & ~state.visibleStages) || (info.access & ~state.visibleAccess)))
+		{
+			barrier.srcStages = state.writeStages;
+			barrier.srcAccess = state.writeAccess;
+			needed = true;
+		}
+
+		if (needed)
+		{
+			if (barrier.srcStages == 0)
+				barrier.srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			if (barrier.dstStages == 0)
+				barrier.dstStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+			step.srcStages |= barrier.srcStages;
+			step.dstStages |= barrier.dstStages;
+			step.barriers.push_back(barrier);
+		}
+
+		state.used = true;
+		if (info.write)
+		{
+			state.writeStages = info.stages;
+			state.writeAccess = info.access;
+			state.readStages = 0;
+			state.visibleStages = 0;
+			state.visibleAccess = 0;
+		}
+		else if (layoutChange)
+		{
+			// The transition is a write only this access is guaranteed to see
+			state.writeStages = info.stages;
+			state.writeAccess = 0;
+			state.readStages = info.stages;
+			state.visibleStages = info.stages;
+			state.visibleAccess = info.access;
+		}
+		else
+		{
+			state.readStages |= info.stages;
+			if (needed)
+			{
+				state.visibleStages |= info.stages;
+				state.visibleAccess |= info.access;
+			}
+		}
+		state.layout = layout;
+	};
+
+	for (auto& step : steps)
+	{
+		// Uses of the same resource within a pass are combined into one
+		const PassData& pass = passes[step.pass];
+		std::vector<std::pair<Resource, AccessInfo>> combined;
+		for (const auto& use : pass.uses)
+		{
+			AccessInfo info = getAccessInfo(use.access);
+			auto it = std::find_if(combined.begin(), combined.end(), [&](const std::pair<Resource, AccessInfo>& c) { return c.first == use.resource; });
+			if (it == combined.end())
+			{
+				combined.emplace_back(use.resource, info);
+				continue;
+			}
+
+			it->second.stages |= info.stages;
+			it->second.access |= info.access;
+			it->second.write |= info.write;
+			if (it->second.layout != info.layout)
+				it->second.layout = VK_IMAGE_LAYOUT_GENERAL;
+		}
+
+		for (const auto& c : combined)
+			transition(c.first, c.second, step);
+	}
+
+	finalStep = Step();
+	finalStep.pass = invalid;
+	finalStep.level = 0;
+	finalStep.srcStages = 0;
+	finalStep.dstStages = 0;
+	for (Resource r = 0; r < resources.size(); ++r)
+	{
+		if (resources[r].imported && resources[r].finalAccess != None)
+			transition(r, getAccessInfo(resources[r].finalAccess), finalStep);
+	}
+	return true;
+}
+
+bool RenderGraph::realize(VkDevice device, const std::function<U32(U32)>& memoryType, VkDeviceSize bufferImageGranularity)
+{
+	U32 typeBits = ~0u;
+
+	for (const auto& placed : placements)
+	{
+		ResourceData& resource = resources[placed.resource];
+		VkMemoryRequirements requirements = {};
+
+		if (resource.isImage)
+		{
+			VkImageCreateInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			info.imageType = VK_IMAGE_TYPE_2D;
+			info.format = resource.desc.format;
+			info.extent = { resource.desc.width, resource.desc.height, 1 };
+			info.mipLevels = resource.desc.mipLevels;
+			info.arrayLayers = 1;
+			info.samples = VK_SAMPLE_COUNT_1_BIT;
+			info.tiling = VK_IMAGE_TILING_OPTIMAL;
+			info.usage = resource.imageUsage;
+			info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+			if (vkCreateImage(device, &info, nullptr, &resource.image) != VK_SUCCESS)
+			{
+				LOG_WARN("Failed to create render graph image " << resource.name);
+				return false;
+			}
+			vkGetImageMemoryRequirements(device, resource.image, &requirements);
+		}
+		else
+		{
+			VkBufferCreateInfo info = {};
+			info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			info.size = resource.size;
+			info.usage = resource.bufferUsage;
+			info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+			if (vkCreateBuffer(device, &info, nullptr, &resource.buffer) != VK_SUCCESS)
+			{
+				LOG_WARN("Failed to create render graph buffer " << resource.name);
+				return false;
+			}
+			vkGetBufferMemoryRequirements(device, resource.buffer, &requirements);
+		}
+
+		// Images and buffers share the heap, keep them on separate granularity pages
+		resource.size = requirements.size;
+		resource.alignment = std::max(requirements.alignment, bufferImageGranularity);
+		typeBits &= requirements.memoryTypeBits;
+	}
+
+	if (placements.empty())
+		return true;
+
+	if (typeBits == 0)
+	{
+		LOG_WARN("Render graph transient resources have no memory type in common");
+		return false;
+	}
+
+	// The real sizes may put different resources on the same memory, the
+	// aliasing waits have to follow
+	planMemory();
+	scheduleBarriers();
+
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = heapSize;
+	allocInfo.memoryTypeIndex = memoryType(typeBits);
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+	{
+		LOG_WARN("Failed to allocate " << heapSize << " bytes of render graph memory");
+		return false;
+	}
+
+	for (const auto& placed : placements)
+	{
+		ResourceData& resource = resources[placed.resource];
+		if (resource.isImage)
+			vkBindImageMemory(device, resource.image, memory, placed.offset);
+		else
+			vkBindBufferMemory(device, resource.buffer, memory, placed.offset);
+	}
+
+	LOG_INFO("Render graph transient memory: " << heapSize / 1024 << " KiB aliased, " << unaliasedSize / 1024 << " KiB without aliasing");
+	return true;
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer)
+{
+	auto issue = [&](const Step& step)
+	{
+		if (step.barriers.empty())
+			return;
+
+		imageBarriers.clear();
+		bufferBarriers.clear();
+		for (const auto& barrier : step.barriers)
+		{
+			const ResourceData& resource = resources[barrier.resource];
+			if (resource.isImage)
+			{
+				VkImageMemoryBarrier b = {};
+				b.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				b.srcAccessMask = barrier.srcAccess;
+				b.dstAccessMask = barrier.dstAccess;
+				b.oldLayout = barrier.oldLayout;
+				b.newLayout = barrier.newLayout;
+				b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				b.image = resource.image;
+				b.subresourceRange.aspectMask = resource.desc.aspect;
+				b.subresourceRange.baseMipLevel = 0;
+				b.subresourceRange.levelCount = resource.desc.mipLevels;
+				b.subresourceRange.baseArrayLayer = 0;
+				b.subresourceRange.layerCount = 1;
+				imageBarriers.push_back(b);
+			}
+			else
+			{
+				VkBufferMemoryBarrier b = {};
+				b.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+				b.srcAccessMask = barrier.srcAccess;
+				b.dstAccessMask = barrier.dstAccess;
+				b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				b.buffer = resource.buffer;
+				b.offset = 0;
+				b.size = VK_WHOLE_SIZE;
+				bufferBarriers.push_back(b);
+			}
+		}
+
+		vkCmdPipelineBarrier(commandBuffer, step.srcStages, step.dstStages, 0, 0, nullptr,
+			U32(bufferBarriers.size()), bufferBarriers.data(), U32(imageBarriers.size()), imageBarriers.data());
+	};
+
+	for (const auto& step : steps)
+	{
+		issue(step);
+		if (passes[step.pass].execute)
+			passes[step.pass].execute(commandBuffer);
+	}
+	issue(finalStep);
+}
+
+void RenderGraph::destroy(VkDevice device)
+{
+	for (auto& resource : resources)
+	{
+		if (resource.imported)
+			continue;
+		if (resource.image != VK_NULL_HANDLE)
+			vkDestroyImage(device, resource.image, nullptr);
+		if (resource.buffer != VK_NULL_HANDLE)
+			vkDestroyBuffer(device, resource.buffer, nullptr);
+		resource.image = VK_NULL_HANDLE;
+		resource.buffer = VK_NULL_HANDLE;
+	}
+
+	if (memory != VK_NULL_HANDLE)
+		vkFreeMemory(device, memory, nullptr);
+	memory = VK_NULL_HANDLE;
+}
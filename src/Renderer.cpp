@@ -1,6 +1,16 @@
 #include "PCH.hpp"
 #include "Renderer.hpp"
 #include "Image.hpp"
+#include "Cooked.hpp"
+#include "PipelineCache.hpp"
+#include "Profiler.hpp"
+#include "ShaderCache.hpp"
+#include "ShaderHotReload.hpp"
+
+#include <cstring>
+
+U32 Renderer::recordThreads = 0;
+bool Renderer::debugLightClusters = false;
 
 void Renderer::init()
 {
@@ -8,46 +18,85 @@ void Renderer::init()
 	initVulkanSwapChain();
 	initVulkanImageViews();
 	initVulkanRenderPass();
-	initVulkanDescriptorSetLayout();
-	initVulkanGraphicsPipeline();
+	squareVertex.load(Cooked::resolve("shaders/square.glsl", ".vert.spv"));
+	squareFragment.load(Cooked::resolve("shaders/square.glsl", ".frag.spv"));
+	// A specialization constant, so cooked SPIR-V has it too:
+	//     layout(constant_id = 0) const bool DEBUG_LIGHT_CLUSTERS = false;
+	// A shader without it ignores the value
+	squareFragment.addSpecializationKeyword("DEBUG_LIGHT_CLUSTERS", 0);
+	squareKey = squareFragment.getKey(debugLightClusters ? std::vector<std::string>({ "DEBUG_LIGHT_CLUSTERS" }) : std::vector<std::string>());
+
+	// Build the pipeline on a worker while the assets load
+	std::future<PipelineBuild> pipeline = PipelineCache::submit([this]() { return createGraphicsPipeline(); });
+
 	initVulkanCommandPool();
+
+	// Read and decoded in the background while the model loads
+	std::string texturePath = "textures/chalet.jpg";
+	if (Engine::getPhysicalDeviceDetails().deviceFeatures.textureCompressionBC)
+		texturePath = Cooked::resolve(texturePath, ".tex");
+	assets.spawn(texture.loadFileAsync(assets, texturePath));
+
 	initVulkanDepthResources();
 	initVulkanFramebuffers();
-	chalet.load("models/chalet.obj");
+	initFrameGraph();
+	chalet.load(Cooked::resolve("models/chalet.obj", ".mesh"));
 
-	texture.loadFile("textures/chalet.jpg");
+	assets.waitIdle();
 	createTextureSampler();
+
+	adoptPipeline(pipeline.get());
+	logPipelineStats();
 	initVulkanUniformBuffer();
 	initVulkanDescriptorPool();
 	initVulkanDescriptorSet();
+	chaletMaterial.descriptorSet = vkDescriptorSet;
 	initVulkanCommandBuffers();
 	initVulkanSemaphores();
+
+	if (GpuCulling::enabled && !gpuCulling.init(vkLogicalDevice, computeQueueFamily, vkComputeQueue, maxFramesInFlight, layoutCache, drawIndirectCount))
+		gpuCulling.destroy();
+
+	if (ShaderHotReload::enabled)
+	{
+		shaderHotReload.add(&squareVertex, "shaders/square.glsl");
+		shaderHotReload.add(&squareFragment, "shaders/square.glsl");
+	}
 }
 
 void Renderer::render() {
 
+	// Frame boundary: nothing recorded for this frame yet
+	collectRetired();
+	updateHotReload();
+	assets.pumpMain();
+
 	uint32_t imageIndex;
 	VkResult result = vkAcquireNextImageKHR(vkLogicalDevice, vkSwapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
 
 	if (result != VK_SUCCESS)
 	{
-		cleanupSwapChain();
 		recreateVulkanSwapChain();
+		drawLists[frameIndex % maxFramesInFlight].reset();
 		return;
 	}
 
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-	VkSemaphore waitSemaphores[] = { imageAvailableSemaphore };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	submitInfo.commandBufferCount = 1;
+	VkCommandBuffer commandBuffer = recordFrame(imageIndex);
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	// The culling dispatch writes the commands the frame draws from
+	VkSemaphore waitSemaphores[] = { imageAvailableSemaphore, VK_NULL_HANDLE };
+	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT };
 	submitInfo.waitSemaphoreCount = 1;
+	if (gpuCulled)
+		waitSemaphores[submitInfo.waitSemaphoreCount++] = gpuCulling.dispatch(frameIndex % maxFramesInFlight);
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &vkCommandBuffers[imageIndex];
-
 	VkSemaphore signalSemaphores[] = { renderFinishedSemaphore };
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
@@ -72,7 +121,134 @@ void Renderer::render() {
 	vkQueuePresentKHR(vkPresentQueue, &presentInfo);
 
 	vkQueueWaitIdle(vkPresentQueue);
+	if (gpuCulled)
+		gpuCulling.check(frameIndex % maxFramesInFlight);
+	++frameIndex;
+	drawLists[frameIndex % maxFramesInFlight].reset();
+	occlusionCuller.clear();
+	lights.clear();
+}
+
+void Renderer::render(const RenderSnapshot& snapshot)
+{
+	updateUniformBuffer(snapshot);
+	for (const RenderSnapshot::Draw& draw : snapshot.draws)
+		submit(*draw.model, *draw.material, draw.transform);
+	for (const RenderSnapshot::Occluder& occluder : snapshot.occluders)
+		submitOccluder(*occluder.model, occluder.transform);
+	for (const LightClusters::Light& light : snapshot.lights)
+		submitLight(light);
+	render();
+}
 
+void Renderer::submit(Model& mesh, const Material& material, const glm::mat4& transform)
+{
+	drawLists[frameIndex % maxFramesInFlight].submit(&mesh, &material, transform);
+}
+
+void Renderer::submitOccluder(Model& model, const glm::mat4& transform)
+{
+	occlusionCuller.addOccluder(model.getMesh(), transform);
+}
+
+void Renderer::submitLight(const LightClusters::Light& light)
+{
+	lights.push_back(light);
+}
+
+void Renderer::adoptPipeline(const PipelineBuild& build)
+{
+	vkPipeline = build.pipeline;
+	vkPipelineLayout = build.layout;
+	vkDescriptorSetLayout = build.setLayout;
+	shaderReflection = build.reflection;
+	instanceTransforms = build.instanced;
+
+	// Pushes must name every stage of the range they fall in
+	pushTransform = false;
+	pushTransformStages = 0;
+	for (const VkPushConstantRange& range : shaderReflection.pushConstants)
+	{
+		if (range.offset == 0 && range.size >= sizeof(glm::mat4) && (range.stageFlags & VK_SHADER_STAGE_VERTEX_BIT))
+		{
+			pushTransform = true;
+			pushTransformStages = range.stageFlags;
+		}
+	}
+
+	// All three of shaders/clusters.glsl's buffers, or the lights aren't binned
+	U32 clusterBindings = 0;
+	for (const VkDescriptorSetLayoutBinding& binding : shaderReflection.getSetLayoutBindings(0))
+	{
+		bool storage = binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		if (storage && (binding.binding == LightClusterBuffer::lightsBinding || binding.binding == LightClusterBuffer::clustersBinding || binding.binding == LightClusterBuffer::indicesBinding))
+			++clusterBindings;
+	}
+	clusteredLights = clusterBindings == 3;
+
+	chaletMaterial.pipeline = vkPipeline;
+	chaletMaterial.layout = vkPipelineLayout;
+}
+
+// Called at the start of a frame. Recompiling and pipeline creation happen on
+// a PipelineCache worker, the render loop only swaps in the finished pipeline
+// and never stalls the device for it.
+void Renderer::updateHotReload()
+{
+	if (pendingPipeline.valid())
+	{
+		if (pendingPipeline.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+			swapReloadedPipeline(pendingPipeline.get());
+		return;
+	}
+
+	std::vector<ShaderHotReload::Change> changes = shaderHotReload.poll();
+	if (changes.empty())
+		return;
+
+	pendingPipeline = PipelineCache::submit([this, changes]()
+	{
+		for (const auto& change : changes)
+		{
+			if (!change.shader->reload(change.path))
+				return PipelineBuild();
+		}
+		return createGraphicsPipeline();
+	});
+}
+
+void Renderer::swapReloadedPipeline(const PipelineBuild& build)
+{
+	if (build.pipeline == VK_NULL_HANDLE)
+		return; // Compile errors are already logged, the old shaders stay in use
+
+	// Descriptor sets are built against the current layout, a shader
+	// that changes its interface needs a restart
+	if (build.layout != vkPipelineLayout)
+	{
+		LOG_WARN("Reloaded shaders changed the pipeline layout, restart to apply them");
+		vkDestroyPipeline(vkLogicalDevice, build.pipeline, nullptr);
+		return;
+	}
+
+	VkPipeline old = vkPipeline;
+	adoptPipeline(build);
+	deferDestroy([this, old]() { vkDestroyPipeline(vkLogicalDevice, old, nullptr); });
+	LOG_INFO("Swapped in reloaded graphics pipeline");
+}
+
+void Renderer::deferDestroy(std::function<void()> destroy)
+{
+	retired.emplace_back(frameIndex, std::move(destroy));
+}
+
+// Runs destructors for objects no frame in flight can still reference
+void Renderer::collectRetired()
+{
+	auto it = retired.begin();
+	for (; it != retired.end() && it->first + maxFramesInFlight <= frameIndex; ++it)
+		it->second();
+	retired.erase(retired.begin(), it);
 }
 
 void Renderer::initVulkanLogicalDevice()
@@ -88,15 +264,29 @@ void Renderer::initVulkanLogicalDevice()
 	float priority = 1.f;
 	qci.pQueuePriorities = &priority;
 
+	// Compute work goes to the compute family picked for the device, which is
+	// often the graphics family itself
+	std::vector<VkDeviceQueueCreateInfo> queueInfos = { qci };
+	computeQueueFamily = U32(Engine::getPhysicalDeviceDetails().computeQueueFamily);
+	if (computeQueueFamily != qci.queueFamilyIndex)
+	{
+		queueInfos.push_back(qci);
+		queueInfos.back().queueFamilyIndex = computeQueueFamily;
+	}
+
+	const VkPhysicalDeviceFeatures& supported = Engine::getPhysicalDeviceDetails().deviceFeatures;
 	VkPhysicalDeviceFeatures features = {};
 	features.samplerAnisotropy = VK_TRUE;
+	features.textureCompressionBC = supported.textureCompressionBC;
+	features.multiDrawIndirect = supported.multiDrawIndirect;
+	features.drawIndirectFirstInstance = supported.drawIndirectFirstInstance;
 
 	VkDeviceCreateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	info.pNext = nullptr;
 	info.flags = 0;
-	info.queueCreateInfoCount = 1;
-	info.pQueueCreateInfos = &qci;
+	info.queueCreateInfoCount = U32(queueInfos.size());
+	info.pQueueCreateInfos = queueInfos.data();
 
 #ifdef ENABLE_VULKAN_VALIDATION
 	info.enabledLayerCount = 1;
@@ -108,6 +298,25 @@ void Renderer::initVulkanLogicalDevice()
 #endif
 
 	std::vector<const char *> extensions = { "VK_KHR_swapchain" };
+
+	U32 extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(Engine::vkPhysicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(Engine::vkPhysicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+	for (const auto& extension : availableExtensions)
+	{
+		if (strcmp(extension.extensionName, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME) == 0)
+		{
+			extensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+			PipelineCache::creationFeedback = true;
+		}
+		if (strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0)
+		{
+			extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+			drawIndirectCount = true;
+		}
+	}
 	info.enabledExtensionCount = extensions.size();
 	info.ppEnabledExtensionNames = extensions.data();
 	info.pEnabledFeatures = &features;
@@ -123,6 +332,9 @@ void Renderer::initVulkanLogicalDevice()
 
 	vkGetDeviceQueue(vkLogicalDevice, 0, 0, &vkGraphicsQueue);
 	vkGetDeviceQueue(vkLogicalDevice, 0, 0, &vkPresentQueue); 
+	vkGetDeviceQueue(vkLogicalDevice, computeQueueFamily, 0, &vkComputeQueue);
+
+	PipelineCache::init(vkLogicalDevice, Engine::getPhysicalDeviceDetails().deviceProperties);
 }
 
 VkSurfaceFormatKHR Renderer::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& formats)
@@ -301,12 +513,15 @@ void Renderer::initVulkanRenderPass()
 	VkAttachmentDescription colorAttachment = {};
 	colorAttachment.format = swapChainImageFormat;
 	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	// Cleared rather than loaded, nothing from the last frame is kept, and
+	// stored since it's presented
 	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// frameGraph transitions it from and to the swapchain's layouts
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
 	VkAttachmentReference colorAttachmentRef = {};
 	colorAttachmentRef.attachment = 0;
@@ -315,11 +530,13 @@ void Renderer::initVulkanRenderPass()
 	VkAttachmentDescription depthAttachment = {};
 	depthAttachment.format = findDepthFormat();
 	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	// Never read after the pass, so it's never written back, which is what
+	// lets the image be transient. Any stencil is unused.
 	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 	VkAttachmentReference depthAttachmentRef = {};
@@ -351,45 +568,6 @@ void Renderer::initVulkanRenderPass()
 	}
 }
 
-void Renderer::initVulkanDescriptorSetLayout()
-{
-	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-
-	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	uboLayoutBinding.descriptorCount = 1;
-	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-	VkDescriptorSetLayoutBinding transLayoutBinding = {};
-	transLayoutBinding.binding = 1;
-	transLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	transLayoutBinding.descriptorCount = 1;
-	transLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-	VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
-	samplerLayoutBinding.binding = 2;
-	samplerLayoutBinding.descriptorCount = 1;
-	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerLayoutBinding.pImmutableSamplers = nullptr;
-	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-	std::array<VkDescriptorSetLayoutBinding, 3> bindings = {uboLayoutBinding, transLayoutBinding, samplerLayoutBinding};
-
-	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-	layoutInfo.pBindings = bindings.data();
-
-	if (vkCreateDescriptorSetLayout(vkLogicalDevice, &layoutInfo, VK_NULL_HANDLE, &vkDescriptorSetLayout) != VK_SUCCESS) 
-	{
-		LOG_FATAL("Failed to create descriptor set layout!");
-	}
-	else 
-	{
-		LOG_INFO("Descriptor set layout created successfully");
-	}
-}
-
 static std::vector<char> readFile(const std::string& filename)
 {
 	std::ifstream file(filename, std::ios::ate | std::ios::binary);
@@ -409,7 +587,10 @@ static std::vector<char> readFile(const std::string& filename)
 	return buffer;
 }
 
-void Renderer::initVulkanGraphicsPipeline()
+// Runs on a PipelineCache worker. Nothing the render loop reads is touched
+// here, the reflected interface and layouts are returned with the pipeline
+// and the caller decides when to adopt them.
+Renderer::PipelineBuild Renderer::createGraphicsPipeline()
 {
 	LOG_INFO("Creating Vulkan graphics pipeline");
 
@@ -422,62 +603,79 @@ void Renderer::initVulkanGraphicsPipeline()
 	// vertShaderModule = createShaderModule(vertShaderCode);
 	// fragShaderModule = createShaderModule(fragShaderCode);
 
-	ShaderModule sh(ShaderModule::Vertex, "shaders/square.glsl");
-	sh.compile();
-	sh.createVulkanModule();
+	Clock clock;
+	U64 shaderStart = clock.now();
 
-	ShaderModule sh2(ShaderModule::Fragment, "shaders/square.glsl");
-	sh2.compile();
-	sh2.createVulkanModule();
+	// Variants are kept by the permutation sets, a rebuilt pipeline reuses them.
+	// The vertex shader has no keywords, every key is its only variant.
+	ShaderPermutations::Key key = squareKey;
+	ShaderPermutations::prewarm({ { &squareVertex, key }, { &squareFragment, key } });
 
-	VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-	vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderStageInfo.module = sh.getVulkanModule();
-	vertShaderStageInfo.pName = "main";
+	Profiler::record("shaders", S64(clock.now() - shaderStart));
 
-	VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-	fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderStageInfo.module = sh2.getVulkanModule();
-	fragShaderStageInfo.pName = "main";
+	// Layouts come from the shaders themselves rather than being hand written to match them
+	ShaderReflection vertexReflection, fragmentReflection;
+	squareVertex.reflect(key, vertexReflection);
+	squareFragment.reflect(key, fragmentReflection);
+	if (!vertexReflection.merge(fragmentReflection))
+	{
+		LOG_FATAL("Vertex and fragment shader interfaces don't match");
+	}
+
+	PipelineBuild build;
+	build.reflection = vertexReflection;
+
+	std::vector<VkDescriptorSetLayout> setLayouts;
+	build.layout = layoutCache.getPipelineLayout(vkLogicalDevice, build.reflection, &setLayouts);
+	build.setLayout = setLayouts.empty() ? VK_NULL_HANDLE : setLayouts[0];
 
-	VkPipelineShaderStageCreateInfo shaderStagesArray[] = { vertShaderStageInfo, fragShaderStageInfo };
+	VkPipelineShaderStageCreateInfo shaderStagesArray[] = { squareVertex.getStageInfo(key), squareFragment.getStageInfo(key) };
 
 	auto bindingDescription = Vertex::getBindingDescription();
 	auto attributeDescriptions = Vertex::getAttributeDescriptions();
 
+	// A shader taking a mat4 at the instance locations is drawn instanced
+	std::vector<VkVertexInputBindingDescription> bindings = { bindingDescription };
+	std::vector<VkVertexInputAttributeDescription> attributes(attributeDescriptions.begin(), attributeDescriptions.end());
+	auto instanceAttributes = InstanceBuffer::getAttributeDescriptions();
+	build.instanced = std::any_of(build.reflection.vertexInputs.begin(), build.reflection.vertexInputs.end(), [](const ShaderReflection::VertexInput& input) { return input.location == InstanceBuffer::firstLocation; });
+	if (build.instanced)
+	{
+		bindings.push_back(InstanceBuffer::getBindingDescription());
+		attributes.insert(attributes.end(), instanceAttributes.begin(), instanceAttributes.end());
+	}
+
+	for (const auto& input : build.reflection.vertexInputs)
+	{
+		auto it = std::find_if(attributes.begin(), attributes.end(), [&](const VkVertexInputAttributeDescription& a) { return a.location == input.location; });
+		if (it == attributes.end() || it->format != input.format)
+			LOG_WARN("Vertex shader input " << input.name << " (location " << input.location << ") doesn't match the Vertex layout");
+	}
 
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+	vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindings.size());
+	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributes.size());
+	vertexInputInfo.pVertexBindingDescriptions = bindings.data();
+	vertexInputInfo.pVertexAttributeDescriptions = attributes.data();
 
 	VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo = {};
 	inputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
 	inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	inputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
 
-	VkViewport viewport = {};
-	viewport.x = 0.f;
-	viewport.y = 0.f;
-	viewport.width = (float)swapChainExtent.width;
-	viewport.height = (float)swapChainExtent.height;
-	viewport.minDepth = 0.f;
-	viewport.maxDepth = 1.f;
-
-	VkRect2D scissor = {};
-	scissor.offset = { 0, 0 };
-	scissor.extent = swapChainExtent;
-
+	// Viewport and scissor are dynamic so the pipeline survives swap chain resizes
 	VkPipelineViewportStateCreateInfo viewportStateInfo = {};
 	viewportStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportStateInfo.viewportCount = 1;
-	viewportStateInfo.pViewports = &viewport;
 	viewportStateInfo.scissorCount = 1;
-	viewportStateInfo.pScissors = &scissor;
+
+	std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+	dynamicState.pDynamicStates = dynamicStates.data();
 
 	VkPipelineRasterizationStateCreateInfo rasterizer = {};
 	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -509,21 +707,6 @@ void Renderer::initVulkanGraphicsPipeline()
 	colorBlending.blendConstants[2] = 0.0f;
 	colorBlending.blendConstants[3] = 0.0f;
 
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 1;
-	pipelineLayoutInfo.pSetLayouts = &vkDescriptorSetLayout;
-	pipelineLayoutInfo.pushConstantRangeCount = 0;
-
-	if (vkCreatePipelineLayout(vkLogicalDevice, &pipelineLayoutInfo, nullptr, &vkPipelineLayout) != VK_SUCCESS)
-	{
-		LOG_FATAL("Failed to create pipeline layout");
-	}
-	else
-	{
-		LOG_INFO("Pipeline layout created successfully");
-	}
-
 	VkPipelineDepthStencilStateCreateInfo depthStencil = {};
 	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 	depthStencil.depthTestEnable = VK_TRUE;
@@ -546,13 +729,14 @@ void Renderer::initVulkanGraphicsPipeline()
 	pipelineInfo.pRasterizationState = &rasterizer;
 	pipelineInfo.pMultisampleState = &multisampling;
 	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.layout = vkPipelineLayout;
+	pipelineInfo.layout = build.layout;
 	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pDynamicState = &dynamicState;
 
 	pipelineInfo.renderPass = vkRenderPass;
 	pipelineInfo.subpass = 0;
 
-	if (vkCreateGraphicsPipelines(vkLogicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &vkPipeline) != VK_SUCCESS)
+	if (PipelineCache::createGraphicsPipeline(vkLogicalDevice, pipelineInfo, build.pipeline) != VK_SUCCESS)
 	{
 		LOG_FATAL("Failed to create graphics pipeline");
 	}
@@ -564,9 +748,25 @@ void Renderer::initVulkanGraphicsPipeline()
 	// vkDestroyShaderModule(vkLogicalDevice, vertShaderModule, VK_NULL_HANDLE);
 	// vkDestroyShaderModule(vkLogicalDevice, fragShaderModule, VK_NULL_HANDLE);
 
-	sh.destroy();
-	sh2.destroy();
+	return build;
+}
+
+void Renderer::logPipelineStats()
+{
+	auto shaders = Profiler::getCounter("shaders");
+	auto created = Profiler::getCounter("pipeline create");
+	LOG_INFO("Shader modules ready in " << shaders.totalMicroSeconds / 1000.0 << " ms (SPIR-V cache: " << ShaderCache::hits << " hits, " << ShaderCache::misses << " misses)");
 
+	if (PipelineCache::creationFeedback)
+	{
+		auto hits = Profiler::getCounter("pipeline cache hit");
+		auto misses = Profiler::getCounter("pipeline cache miss");
+		LOG_INFO(created.count << " pipelines created in " << created.totalMicroSeconds / 1000.0 << " ms (pipeline cache: " << hits.count << " hits, " << misses.count << " misses)");
+	}
+	else
+	{
+		LOG_INFO(created.count << " pipelines created in " << created.totalMicroSeconds / 1000.0 << " ms");
+	}
 }
 
 void Renderer::initVulkanFramebuffers()
@@ -616,11 +816,31 @@ void Renderer::initVulkanCommandPool()
 void Renderer::initVulkanDepthResources()
 {
 	VkFormat depthFormat = findDepthFormat();
-	createImage(swapChainExtent.width, swapChainExtent.height, 1, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
+	createImage(swapChainExtent.width, swapChainExtent.height, 1, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
 	depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+	// No layout transition here, frameGraph moves it out of UNDEFINED every
+	// frame since the render pass clears it anyway
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(vkLogicalDevice, depthImage, &requirements);
+	depthImageSize = requirements.size;
+	depthImageLazy = Engine::getPhysicalDeviceDetails().hasMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+	LOG_INFO("Depth attachment " << swapChainExtent.width << "x" << swapChainExtent.height << ": " << depthImageSize / 1024 << " KiB " << (depthImageLazy ? "lazily allocated" : "device local, no lazily allocated memory"));
+}
 
-	transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
+void Renderer::destroyVulkanDepthResources()
+{
+	// What the transient image really cost, once it's been rendered to
+	if (depthImageLazy)
+	{
+		VkDeviceSize committed = 0;
+		vkGetDeviceMemoryCommitment(vkLogicalDevice, depthImageMemory, &committed);
+		LOG_INFO("Depth attachment " << swapChainExtent.width << "x" << swapChainExtent.height << ": " << committed / 1024 << " of " << depthImageSize / 1024 << " KiB committed, " << (depthImageSize - std::min(committed, depthImageSize)) / 1024 << " KiB saved");
+	}
 
+	vkDestroyImageView(vkLogicalDevice, depthImageView, nullptr);
+	vkDestroyImage(vkLogicalDevice, depthImage, nullptr);
+	vkFreeMemory(vkLogicalDevice, depthImageMemory, nullptr);
 }
 
 void Renderer::initVulkanUniformBuffer()
@@ -634,19 +854,14 @@ void Renderer::initVulkanUniformBuffer()
 
 void Renderer::initVulkanDescriptorPool()
 {
-	std::array<VkDescriptorPoolSize, 3> poolSizes = {};
-	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = 1;
-	poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[1].descriptorCount = 1;
-	poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	poolSizes[2].descriptorCount = 1;
+	// Sized exactly for one copy of the reflected descriptor sets
+	std::vector<VkDescriptorPoolSize> poolSizes = shaderReflection.getPoolSizes(1);
 
 	VkDescriptorPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = 1;
+	poolInfo.maxSets = std::max(1u, shaderReflection.getSetCount());
 
 	if (vkCreateDescriptorPool(vkLogicalDevice, &poolInfo, VK_NULL_HANDLE, &vkDescriptorPool) != VK_SUCCESS) 
 	{
@@ -692,93 +907,301 @@ void Renderer::initVulkanDescriptorSet() {
 	imageInfo.imageView = texture.getVkImageView();
 	imageInfo.sampler = textureSampler;
 
-	std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
-
-	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[0].dstSet = vkDescriptorSet;
-	descriptorWrites[0].dstBinding = 0;
-	descriptorWrites[0].dstArrayElement = 0;
-	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptorWrites[0].descriptorCount = 1;
-	descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-	descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[1].dstSet = vkDescriptorSet;
-	descriptorWrites[1].dstBinding = 1;
-	descriptorWrites[1].dstArrayElement = 0;
-	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptorWrites[1].descriptorCount = 1;
-	descriptorWrites[1].pBufferInfo = &bufferInfo2;
-
-	descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[2].dstSet = vkDescriptorSet;
-	descriptorWrites[2].dstBinding = 2;
-	descriptorWrites[2].dstArrayElement = 0;
-	descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	descriptorWrites[2].descriptorCount = 1;
-	descriptorWrites[2].pImageInfo = &imageInfo;
+	// What the renderer can bind, matched to the reflected set 0 by name and
+	// type. The cluster buffers are written by lightClusterBuffer below.
+	struct DescriptorResource
+	{
+		const char* name;
+		VkDescriptorType type;
+		const VkDescriptorBufferInfo* buffer;
+		const VkDescriptorImageInfo* image;
+	};
+	const DescriptorResource resources[] = {
+		{ "ubo", VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &bufferInfo, nullptr },
+		{ "transforms", VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &bufferInfo2, nullptr },
+		{ "texSampler", VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, nullptr, &imageInfo },
+		{ "ClusterLights", VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, nullptr },
+		{ "Clusters", VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, nullptr },
+		{ "ClusterIndices", VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, nullptr },
+	};
+
+	std::vector<VkWriteDescriptorSet> descriptorWrites;
+	for (const VkDescriptorSetLayoutBinding& binding : shaderReflection.getSetLayoutBindings(0))
+	{
+		const ShaderReflection::DescriptorBinding* reflected = shaderReflection.findBinding(0, binding.binding);
+		const DescriptorResource* resource = nullptr;
+		for (const DescriptorResource& r : resources)
+		{
+			if (reflected->name == r.name && binding.descriptorType == r.type)
+				resource = &r;
+		}
+
+		if (!resource || binding.descriptorCount != 1)
+		{
+			LOG_FATAL("No resource for descriptor " << reflected->name << " at binding " << binding.binding << " (type " << binding.descriptorType << ", count " << binding.descriptorCount << ")");
+			continue;
+		}
+		if (!resource->buffer && !resource->image)
+			continue;
+
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = vkDescriptorSet;
+		write.dstBinding = binding.binding;
+		write.dstArrayElement = 0;
+		write.descriptorType = binding.descriptorType;
+		write.descriptorCount = 1;
+		write.pBufferInfo = resource->buffer;
+		write.pImageInfo = resource->image;
+		descriptorWrites.push_back(write);
+	}
 
 	vkUpdateDescriptorSets(vkLogicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 
+	// Every binding in the layout needs a buffer before the first frame
+	if (clusteredLights)
+	{
+		lightClusterBuffer.upload(lightClusters, lights.data(), U32(lights.size()));
+		lightClusterBuffer.writeDescriptors(vkDescriptorSet);
+	}
 }
 
 void Renderer::initVulkanCommandBuffers()
 {
-	LOG_INFO("Creating Vulkan command buffers");
+	commandRecorder.init(vkLogicalDevice, 0, maxFramesInFlight, recordThreads);
+}
+
+// Records the frame into the current slot's primary buffer. The draws go into
+// secondary buffers recorded in parallel and executed inside the render pass.
+VkCommandBuffer Renderer::recordFrame(U32 imageIndex)
+{
+	Clock clock;
+	U64 start = clock.now();
+
+	// The slot was last submitted maxFramesInFlight frames ago and
+	// render() waits for the queue to go idle, so its pools are free
+	U32 slot = U32(frameIndex % maxFramesInFlight);
+	VkCommandBuffer primary = commandRecorder.beginFrame(slot);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(primary, &beginInfo);
+
+	DrawList& drawList = drawLists[slot];
+	if (!(instanceTransforms && gpuCulling.isActive()))
+		cullDraws(drawList);
+	drawList.sort();
+	drawList.buildBatches(instanceTransforms);
+	binLights();
+
+	// Transforms go out in sorted order, so a batch's instances start at its first draw
+	gpuCulled = false;
+	if (instanceTransforms && drawList.size())
+	{
+		InstanceBuffer& instances = instanceBuffers[slot];
+		instances.reserve(drawList.size());
+		glm::mat4* transforms = instances.data();
+		for (U32 i = 0; i < drawList.size(); ++i)
+			transforms[i] = drawList[i].transform;
 
-	vkCommandBuffers.resize(vkFramebuffers.size());
+		if (gpuCulling.isActive())
+		{
+			gpuCulling.prepare(slot, drawList, instances.getBuffer(), ubo.proj * ubo.view);
+			gpuCulled = true;
+		}
+	}
 
-	VkCommandBufferAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.commandPool = vkCommandPool;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = (uint32_t)vkCommandBuffers.size();
+	// Only the handles change from frame to frame, the barriers were compiled once
+	frameImageIndex = imageIndex;
+	frameGraph.setImage(frameSwapchain, vkSwapChainImages[imageIndex]);
+	frameGraph.setImage(frameDepth, depthImage);
+	frameGraph.setBuffer(frameCullCommands, gpuCulling.getCommands(slot));
+	frameGraph.setBuffer(frameCullCounts, gpuCulling.getCounts(slot));
+	frameGraph.execute(primary);
 
-	if (vkAllocateCommandBuffers(vkLogicalDevice, &allocInfo, vkCommandBuffers.data()) != VK_SUCCESS) {
-		LOG_FATAL("Failed to allocate Vulkan command buffers");
+	if (vkEndCommandBuffer(primary) != VK_SUCCESS) {
+		LOG_FATAL("Failed to record Vulkan command buffer");
 	}
 
-	for (size_t i = 0; i < vkCommandBuffers.size(); i++) {
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	Profiler::record("record", S64(clock.now() - start));
+	return primary;
+}
 
-		vkBeginCommandBuffer(vkCommandBuffers[i], &beginInfo);
+// The frame as a graph of its one pass, so the swapchain and depth layout
+// transitions come out of the same barrier scheduling as everything else.
+// The culling dispatch is submitted on the compute queue, its buffers are
+// only read here and the semaphore the submit waits on makes them visible.
+void Renderer::initFrameGraph()
+{
+	RenderGraph::ImageDesc color;
+	color.format = swapChainImageFormat;
+	RenderGraph::ImageDesc depth;
+	depth.format = findDepthFormat();
+	depth.aspect = VK_IMAGE_ASPECT_DEPTH_BIT | (hasStencilComponent(depth.format) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+
+	frameSwapchain = frameGraph.importImage("swapchain", VK_NULL_HANDLE, color, VK_IMAGE_LAYOUT_UNDEFINED, RenderGraph::Present);
+	// render() waits for the acquire at color output, the first barrier
+	// chains to that wait
+	frameGraph.setInitialAccess(frameSwapchain, RenderGraph::ColorAttachment);
+	frameDepth = frameGraph.importImage("depth", VK_NULL_HANDLE, depth, VK_IMAGE_LAYOUT_UNDEFINED);
+	frameGraph.setInitialAccess(frameDepth, RenderGraph::DepthAttachment);
+	frameCullCommands = frameGraph.importBuffer("cull commands", VK_NULL_HANDLE, 0);
+	frameCullCounts = frameGraph.importBuffer("cull counts", VK_NULL_HANDLE, 0);
+
+	RenderGraph::Pass main = frameGraph.addPass("main", [this](VkCommandBuffer commandBuffer) { recordMainPass(commandBuffer); });
+	frameGraph.read(main, frameCullCommands, RenderGraph::IndirectRead);
+	frameGraph.read(main, frameCullCounts, RenderGraph::IndirectRead);
+	frameGraph.write(main, frameDepth, RenderGraph::DepthAttachment);
+	frameGraph.write(main, frameSwapchain, RenderGraph::ColorAttachment);
+
+	if (!frameGraph.compile())
+	{
+		LOG_FATAL("Failed to compile the frame graph");
+	}
+}
 
-		VkRenderPassBeginInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = vkRenderPass;
-		renderPassInfo.framebuffer = vkFramebuffers[i];
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = swapChainExtent;
+void Renderer::recordMainPass(VkCommandBuffer primary)
+{
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = vkRenderPass;
+	renderPassInfo.framebuffer = vkFramebuffers[frameImageIndex];
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = swapChainExtent;
 
-		std::array<VkClearValue, 2> clearValues = {};
-		clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
-		clearValues[1].depthStencil = {1.0f, 0};
+	std::array<VkClearValue, 2> clearValues = {};
+	clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
+	clearValues[1].depthStencil = {1.0f, 0};
 
-		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-		renderPassInfo.pClearValues = clearValues.data();
+	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+	renderPassInfo.pClearValues = clearValues.data();
 
-		vkCmdBeginRenderPass(vkCommandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBeginRenderPass(primary, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-		vkCmdBindPipeline(vkCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, vkPipeline);
+	VkCommandBufferInheritanceInfo inheritance = {};
+	inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance.renderPass = vkRenderPass;
+	inheritance.subpass = 0;
+	inheritance.framebuffer = vkFramebuffers[frameImageIndex];
 
-		vkCmdBindDescriptorSets(vkCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, vkPipelineLayout, 0, 1, &vkDescriptorSet, 0, nullptr);
+	DrawList& drawList = drawLists[frameIndex % maxFramesInFlight];
+	secondaries.clear();
+	U32 batchCount = U32(drawList.getBatches().size());
+	commandRecorder.record(inheritance, batchCount, [this, &drawList](VkCommandBuffer commandBuffer, U32 begin, U32 end) { recordDraws(commandBuffer, drawList, begin, end); }, secondaries);
 
-		VkBuffer vertexBuffers[] = { chalet.getVertexBuffer() };
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(vkCommandBuffers[i], 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(vkCommandBuffers[i], chalet.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-		
-		vkCmdDrawIndexed(vkCommandBuffers[i], static_cast<uint32_t>(chalet.getIndicesSize()), 1, 0, 0, 0);
+	if (!secondaries.empty())
+		vkCmdExecuteCommands(primary, U32(secondaries.size()), secondaries.data());
 
-		vkCmdEndRenderPass(vkCommandBuffers[i]);
+	vkCmdEndRenderPass(primary);
+}
 
-		if (vkEndCommandBuffer(vkCommandBuffers[i]) != VK_SUCCESS) {
-			LOG_FATAL("Failed to record Vulkan command buffer");
+void Renderer::cullDraws(DrawList& drawList)
+{
+	frustumCuller.clear();
+	frustumCuller.reserve(drawList.size());
+	for (U32 i = 0; i < drawList.size(); ++i)
+	{
+		const DrawList::Draw& draw = drawList[i];
+		frustumCuller.add(draw.mesh->boundsMin, draw.mesh->boundsMax, draw.transform);
+	}
+
+	frustumCuller.cull(ubo.proj * ubo.view, visibleDraws);
+	culledDrawCount += drawList.size() - U32(visibleDraws.size());
+
+	if (occlusionCuller.getOccluderCount())
+	{
+		Clock clock;
+		U64 start = clock.now();
+		occlusionCuller.rasterise(ubo.proj * ubo.view);
+
+		U32 kept = 0;
+		for (U32 index : visibleDraws)
+		{
+			glm::vec3 minimum, maximum;
+			frustumCuller.getBounds(index, minimum, maximum);
+			visibleDraws[kept] = index;
+			kept += occlusionCuller.isVisible(minimum, maximum) ? 1 : 0;
 		}
+		occludedDrawCount += visibleDraws.size() - kept;
+		visibleDraws.resize(kept);
+		Profiler::record("occlusion", S64(clock.now() - start));
+	}
+	drawList.retain(visibleDraws);
+}
+
+// Runs on a recording thread for batches [begin, end). Secondary buffers
+// inherit nothing but the render pass, so each one sets up its own state.
+void Renderer::recordDraws(VkCommandBuffer commandBuffer, const DrawList& drawList, U32 begin, U32 end)
+{
+	VkViewport viewport = {};
+	viewport.width = (float)swapChainExtent.width;
+	viewport.height = (float)swapChainExtent.height;
+	viewport.maxDepth = 1.f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissor = {};
+	scissor.extent = swapChainExtent;
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	// The list is sorted by state, so only changes need binding
+	VkPipeline boundPipeline = VK_NULL_HANDLE;
+	VkDescriptorSet boundSet = VK_NULL_HANDLE;
+	Model* boundMesh = nullptr;
+	U64 binds = 0;
+	U64 draws = 0;
+
+	if (instanceTransforms)
+	{
+		VkBuffer instanceBuffer = instanceBuffers[frameIndex % maxFramesInFlight].getBuffer();
+		VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(commandBuffer, InstanceBuffer::binding, 1, &instanceBuffer, &offset);
 	}
 
+	const auto& batches = drawList.getBatches();
+	for (U32 b = begin; b < end; ++b)
+	{
+		const DrawList::Batch& batch = batches[b];
+		const DrawList::Draw& draw = drawList[batch.first];
+		const Material& material = *draw.material;
+
+		if (material.pipeline != boundPipeline)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, material.pipeline);
+			boundPipeline = material.pipeline;
+			// Sets stay bound across compatible layouts but don't rely on it
+			boundSet = VK_NULL_HANDLE;
+			++binds;
+		}
+		if (material.descriptorSet != boundSet)
+		{
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, material.layout, 0, 1, &material.descriptorSet, 0, nullptr);
+			boundSet = material.descriptorSet;
+			++binds;
+		}
+		if (draw.mesh != boundMesh)
+		{
+			VkBuffer vertexBuffers[] = { draw.mesh->getVertexBuffer() };
+			VkDeviceSize offsets[] = { 0 };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, draw.mesh->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+			boundMesh = draw.mesh;
+			++binds;
+		}
+
+		if (pushTransform && !instanceTransforms)
+			vkCmdPushConstants(commandBuffer, material.layout, pushTransformStages, 0, sizeof(glm::mat4), &draw.transform);
+
+		if (gpuCulled)
+			gpuCulling.draw(commandBuffer, frameIndex % maxFramesInFlight, b, batch);
+		else
+			vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(draw.mesh->getIndicesSize()), batch.count, 0, 0, instanceTransforms ? batch.first : 0);
+		draws += batch.count;
+	}
+
+	bindCount += binds;
+	drawCount += draws;
+	drawCallCount += end - begin;
 }
 
 
@@ -815,7 +1238,7 @@ VkShaderModule Renderer::createShaderModule(const std::vector<char>& code) {
 
 }
 
-void Renderer::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) 
+void Renderer::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, VkMemoryPropertyFlags preferredProperties) 
 {
 	VkImageCreateInfo imageInfo = {};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -843,7 +1266,11 @@ void Renderer::createImage(uint32_t width, uint32_t height, uint32_t mipLevels,
 	VkMemoryAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = Engine::getPhysicalDeviceDetails().getMemoryType(memRequirements.memoryTypeBits, properties);
+	// Extra properties are a wish, dropped when no memory type the image can use has them
+	PhysicalDeviceDetails& details = Engine::getPhysicalDeviceDetails();
+	if (preferredProperties && details.hasMemoryType(memRequirements.memoryTypeBits, properties | preferredProperties))
+		properties |= preferredProperties;
+	allocInfo.memoryTypeIndex = details.getMemoryType(memRequirements.memoryTypeBits, properties);
 
 	if (vkAllocateMemory(vkLogicalDevice, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
 		throw std::runtime_error("failed to allocate image memory!");
@@ -852,68 +1279,8 @@ void Renderer::createImage(uint32_t width, uint32_t height, uint32_t mipLevels,
 	vkBindImageMemory(vkLogicalDevice, image, imageMemory, 0);
 }
 
-void Renderer::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) 
-{
-	
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-	VkImageMemoryBarrier barrier = {};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = oldLayout;
-	barrier.newLayout = newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = mipLevels;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-
-	VkPipelineStageFlags sourceStage;
-	VkPipelineStageFlags destinationStage;
-
-	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) 
-	{
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-	} else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) 
-	{
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	} else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) 
-	{
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-	} else {
-		LOG_FATAL("unsupported layout transition!");
-	}
-
-	vkCmdPipelineBarrier(
-		commandBuffer,
-		sourceStage, destinationStage,
-		0,
-		0, nullptr,
-		0, nullptr,
-		1, &barrier
-	);
-
-	endSingleTimeCommands(commandBuffer);
-}
-
-void Renderer::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) 
+void Renderer::recordCopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
 {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
 	VkBufferImageCopy region = {};
 	region.bufferOffset = 0;
 	region.bufferRowLength = 0;
@@ -930,8 +1297,6 @@ void Renderer::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
 	};
 
 	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-	endSingleTimeCommands(commandBuffer);
 }
 
 VkImageView Renderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) 
@@ -1014,18 +1379,42 @@ void Renderer::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
     vkFreeCommandBuffers(vkLogicalDevice, vkCommandPool, 1, &commandBuffer);
 }
 
-void Renderer::updateUniformBuffer()
+VkFence Renderer::submitSingleTimeCommands(VkCommandBuffer commandBuffer)
+{
+	vkEndCommandBuffer(commandBuffer);
+
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	VkFence fence;
+	if (vkCreateFence(vkLogicalDevice, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+		LOG_FATAL("Failed to create Vulkan upload fence");
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	if (vkQueueSubmit(vkGraphicsQueue, 1, &submitInfo, fence) != VK_SUCCESS)
+		LOG_FATAL("Failed to submit Vulkan upload command buffer");
+	return fence;
+}
+
+void Renderer::releaseSingleTimeCommands(VkCommandBuffer commandBuffer, VkFence fence)
 {
-	static auto startTime = std::chrono::high_resolution_clock::now();
+	vkDestroyFence(vkLogicalDevice, fence, nullptr);
+	vkFreeCommandBuffers(vkLogicalDevice, vkCommandPool, 1, &commandBuffer);
+}
 
-	auto currentTime = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+void Renderer::updateUniformBuffer(const RenderSnapshot& snapshot)
+{
+	float time = float(snapshot.time);
 
-	//ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
+	ubo.view = snapshot.view;
+	ubo.proj = glm::perspective(snapshot.fieldOfView, swapChainExtent.width / (float)swapChainExtent.height, snapshot.zNear, snapshot.zFar);
 	ubo.proj[1][1] *= -1;
 
+	drawLists[frameIndex % maxFramesInFlight].setCamera(glm::vec3(glm::inverse(ubo.view)[3]), snapshot.zFar);
+
 	void* data;
 	vkMapMemory(vkLogicalDevice, vkUniformBufferMemory, 0, sizeof(ubo), 0, &data);
 	memcpy(data, &ubo, sizeof(ubo));
@@ -1041,7 +1430,7 @@ void Renderer::updateUniformBuffer()
 }
 
 void Renderer::createVulkanBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags propertyFlags,
-	VkBuffer& buffer, VkDeviceMemory &bufferMemory) 
+	VkBuffer& buffer, VkDeviceMemory &bufferMemory, bool sharedWithCompute) 
 {
 
 	VkBufferCreateInfo info = {};
@@ -1050,6 +1439,15 @@ void Renderer::createVulkanBuffer(VkDeviceSize size, VkBufferUsageFlags usage, V
 	info.usage = usage;
 	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+	// Concurrent sharing saves ownership transfers between the two queues
+	U32 queueFamilies[] = { 0, computeQueueFamily };
+	if (sharedWithCompute && computeQueueFamily != 0)
+	{
+		info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		info.queueFamilyIndexCount = 2;
+		info.pQueueFamilyIndices = queueFamilies;
+	}
+
 	if (vkCreateBuffer(vkLogicalDevice, &info, VK_NULL_HANDLE, &buffer) != VK_SUCCESS) 
 	{
 		LOG_FATAL("Failed to create buffer!");
@@ -1083,23 +1481,71 @@ void Renderer::copyVulkanBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize size) {
 
 }
 
+void Renderer::binLights()
+{
+	if (!clusteredLights)
+		return;
+
+	Clock clock;
+	U64 start = clock.now();
+	lightClusters.setProjection(ubo.proj, swapChainExtent.width, swapChainExtent.height);
+	lightClusters.bin(ubo.view, lights.data(), U32(lights.size()));
+
+	// The previous frame has finished with the set, it can be rewritten
+	if (lightClusterBuffer.upload(lightClusters, lights.data(), U32(lights.size())))
+		lightClusterBuffer.writeDescriptors(vkDescriptorSet);
+	Profiler::record("lights", S64(clock.now() - start));
+}
+
 void Renderer::cleanup()
 {
+	// Uploads still in flight own GPU objects, let them finish
+	assets.waitIdle();
+	if (pendingPipeline.valid())
+	{
+		PipelineBuild build = pendingPipeline.get();
+		if (build.pipeline != VK_NULL_HANDLE)
+			vkDestroyPipeline(vkLogicalDevice, build.pipeline, nullptr);
+	}
+	for (auto& entry : retired)
+		entry.second();
+	retired.clear();
+
 	cleanupSwapChain();
-	vkDestroyImageView(vkLogicalDevice, depthImageView, nullptr);
-    vkDestroyImage(vkLogicalDevice, depthImage, nullptr);
-    vkFreeMemory(vkLogicalDevice, depthImageMemory, nullptr);
+	vkDestroyPipeline(vkLogicalDevice, vkPipeline, nullptr);
+	squareVertex.destroy();
+	squareFragment.destroy();
+	PipelineCache::save(vkLogicalDevice);
+	PipelineCache::destroy(vkLogicalDevice);
 	vkDestroySampler(vkLogicalDevice, textureSampler, nullptr);
 	chalet.destroy();
 	texture.destroy();
 	vkDestroyDescriptorPool(vkLogicalDevice, vkDescriptorPool, nullptr);
-	vkDestroyDescriptorSetLayout(vkLogicalDevice, vkDescriptorSetLayout, nullptr);
+	layoutCache.destroy(vkLogicalDevice);
 	vkDestroyBuffer(vkLogicalDevice, vkUniformBuffer, nullptr);
 	vkFreeMemory(vkLogicalDevice, vkUniformBufferMemory, nullptr);
 	vkDestroyBuffer(vkLogicalDevice, vkTransformBuffer, nullptr);
 	vkFreeMemory(vkLogicalDevice, vkTransformBufferMemory, nullptr);
 	vkDestroySemaphore(vkLogicalDevice, renderFinishedSemaphore, 0);
 	vkDestroySemaphore(vkLogicalDevice, imageAvailableSemaphore, 0);
+	auto recording = Profiler::getCounter("record");
+	if (recording.count)
+	{
+		LOG_INFO("Command recording: " << recording.totalMicroSeconds / 1000.0 / recording.count << " ms average, " << recording.maxMicroSeconds / 1000.0 << " ms worst over " << recording.count << " frames on " << commandRecorder.threadCount() << " threads");
+		LOG_INFO("State binds: " << bindCount << " for " << drawCount << " draws in " << drawCallCount << " draw calls");
+		LOG_INFO("Frustum culling: " << culledDrawCount << " draws culled on the CPU with " << FrustumCuller::getIsaName(frustumCuller.getIsa()));
+		auto occlusion = Profiler::getCounter("occlusion");
+		if (occlusion.count)
+			LOG_INFO("Occlusion culling: " << occludedDrawCount << " draws hidden, " << occlusion.totalMicroSeconds / 1000.0 / occlusion.count << " ms average over " << occlusion.count << " frames");
+		auto binning = Profiler::getCounter("lights");
+		if (binning.count)
+			LOG_INFO("Light binning: " << binning.totalMicroSeconds / 1000.0 / binning.count << " ms average, " << binning.maxMicroSeconds / 1000.0 << " ms worst into " << lightClusters.getClusterCount() << " clusters with " << FrustumCuller::getIsaName(lightClusters.getIsa()));
+	}
+	commandRecorder.destroy();
+	gpuCulling.destroy();
+	for (auto& instances : instanceBuffers)
+		instances.destroy();
+	lightClusterBuffer.destroy();
 	vkDestroyCommandPool(vkLogicalDevice, vkCommandPool, 0);
 	vkDestroyDevice(vkLogicalDevice, 0);
 }
@@ -1110,10 +1556,8 @@ void Renderer::cleanupSwapChain()
 	{
 		vkDestroyFramebuffer(vkLogicalDevice, framebuffer, nullptr);
 	}
+	destroyVulkanDepthResources();
 
-	vkFreeCommandBuffers(vkLogicalDevice, vkCommandPool, U32(vkCommandBuffers.size()), vkCommandBuffers.data());
-	vkDestroyPipeline(vkLogicalDevice, vkPipeline, nullptr);
-	vkDestroyPipelineLayout(vkLogicalDevice, vkPipelineLayout, nullptr);
 	vkDestroyRenderPass(vkLogicalDevice, vkRenderPass, nullptr);
 
 	for (auto imageView : vkSwapChainImageViews) {
@@ -1126,13 +1570,26 @@ void Renderer::cleanupSwapChain()
 void Renderer::recreateVulkanSwapChain()
 {
 	vkDeviceWaitIdle(vkLogicalDevice);
+
+	// A reload still building reads vkRenderPass and the shader modules on
+	// its worker, it has to finish before either is replaced
+	if (pendingPipeline.valid())
+		swapReloadedPipeline(pendingPipeline.get());
 	cleanupSwapChain();
-	
+
+	VkFormat oldFormat = swapChainImageFormat;
 	initVulkanSwapChain();
 	initVulkanImageViews();
 	initVulkanRenderPass();
-	initVulkanGraphicsPipeline();
+
+	// The pipeline stays valid with any compatible render pass, only a
+	// surface format change needs a new one
+	if (swapChainImageFormat != oldFormat)
+	{
+		vkDestroyPipeline(vkLogicalDevice, vkPipeline, nullptr);
+		adoptPipeline(createGraphicsPipeline());
+	}
+
 	initVulkanDepthResources();
 	initVulkanFramebuffers();
-	initVulkanCommandBuffers();
 }
\ No newline at end of file
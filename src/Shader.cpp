@@ -1,6 +1,7 @@
 #include "Shader.hpp"
+#include "Engine.hpp"
 
-ShaderModule::ShaderModule(Stage s) : stage(s)
+ShaderModule::ShaderModule(Stage s) : vkShaderModule(VK_NULL_HANDLE), stage(s), language(UNKNOWN)
 {
 	switch (stage)
 	{
@@ -10,6 +11,8 @@ ShaderModule::ShaderModule(Stage s) : stage(s)
 		kind = shaderc_shader_kind::shaderc_glsl_fragment_shader; stageMacro = "FRAGMENT"; return;
 	case Geometry:
 		kind = shaderc_shader_kind::shaderc_glsl_geometry_shader; stageMacro = "GEOMETRY"; return;
+	case Compute:
+		kind = shaderc_shader_kind::shaderc_glsl_compute_shader; stageMacro = "COMPUTE"; return;
 	}
 }
 
@@ -18,19 +21,38 @@ ShaderModule::ShaderModule(Stage s, std::string path) : ShaderModule(s)
 	load(path);
 }
 
-void ShaderModule::load(std::string path)
+VkShaderStageFlagBits ShaderModule::getVulkanStage()
 {
-	int i = 0;
-	while (path[i] != '.')
+	switch (stage)
 	{
-		++i;
-		if (i > path.length())
-		{
-			LOG_WARN("Bad shader file name format: " << path);
-		}
+	case Fragment:
+		return VK_SHADER_STAGE_FRAGMENT_BIT;
+	case Geometry:
+		return VK_SHADER_STAGE_GEOMETRY_BIT;
+	case Compute:
+		return VK_SHADER_STAGE_COMPUTE_BIT;
+	case Vertex:
+	default:
+		return VK_SHADER_STAGE_VERTEX_BIT;
+	}
+}
+
+void ShaderModule::define(const std::string& name, const std::string& value)
+{
+	macros.emplace_back(name, value);
+}
+
+void ShaderModule::load(std::string pPath)
+{
+	path = pPath;
+	size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos)
+	{
+		LOG_WARN("Bad shader file name format: " << path);
+		dot = path.length() - 1;
 	}
 	std::string extension;
-	extension.assign(&path[i + 1]);
+	extension.assign(&path[dot + 1]);
 	if (extension == "glsl" || extension == "GLSL")
 	{
 		language = GLSL;
@@ -58,7 +80,7 @@ void ShaderModule::load(std::string path)
 	}
 	if (language == SPV)
 	{
-		spvSource.resize(file.getSize());
+		spvSource.resize(file.getSize() / sizeof(U32));
 		file.readFile(&spvSource[0]);
 	}
 }
@@ -67,13 +89,48 @@ void ShaderModule::compile()
 {
 	if (language == GLSL)
 	{
-		shaderc::Compiler c;
-		shaderc::CompileOptions o;
-		o.SetAutoBindUniforms(true);
-		o.AddMacroDefinition(stageMacro);
-		auto res = c.CompileGlslToSpv(source, kind, path.c_str(), o);
-		spvSource.assign(res.begin(), res.end());
+		ShaderCompiler::Result result = ShaderCompiler::compile(makeJob());
+		applyResult(result);
+	}
+}
+
+void ShaderModule::compileBatch(const std::vector<ShaderModule*>& modules)
+{
+	std::vector<std::pair<ShaderModule*, std::future<ShaderCompiler::Result>>> pending;
+	for (auto module : modules)
+	{
+		if (module->language == GLSL)
+			pending.emplace_back(module, ShaderCompiler::get().submit(module->makeJob()));
+	}
+
+	for (auto& p : pending)
+	{
+		ShaderCompiler::Result result = p.second.get();
+		p.first->applyResult(result);
+	}
+}
+
+ShaderCompiler::Job ShaderModule::makeJob()
+{
+	ShaderCompiler::Job job;
+	job.name = path;
+	job.source = source;
+	job.kind = kind;
+	job.macros.emplace_back(stageMacro, "");
+	job.macros.insert(job.macros.end(), macros.begin(), macros.end());
+	return job;
+}
+
+void ShaderModule::applyResult(ShaderCompiler::Result& result)
+{
+	if (!result.success)
+	{
+		infoLog = result.log;
+		LOG_WARN("Failed to compile shader: " << path << std::endl << infoLog);
+		spvSource.clear();
+		return;
 	}
+	spvSource = std::move(result.spv);
 }
 
 void ShaderModule::createVulkanModule()
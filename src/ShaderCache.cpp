@@ -0,0 +1,118 @@
+#include "ShaderCache.hpp"
+#include "File.hpp"
+
+#include <shaderc/shaderc.hpp>
+
+#include <filesystem>
+#include <sstream>
+#include <thread>
+
+std::string ShaderCache::directory = "cache/shaders/";
+bool ShaderCache::enabled = true;
+std::atomic<U32> ShaderCache::hits(0);
+std::atomic<U32> ShaderCache::misses(0);
+
+static const U32 cacheMagic = 0x43505345; // "ESPC"
+
+U64 ShaderCache::hash(const void* data, size_t size, U64 seed)
+{
+	const U8* bytes = (const U8*)data;
+	U64 h = seed;
+	for (size_t i = 0; i < size; ++i)
+	{
+		h ^= bytes[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+U64 ShaderCache::hashString(const std::string& string, U64 seed)
+{
+	// Length first so adjacent fields can't alias each other
+	U64 length = string.size();
+	return hash(string.data(), string.size(), hash(&length, sizeof(length), seed));
+}
+
+U64 ShaderCache::compilerKey()
+{
+	// shaderc exposes no build identifier, the SPIR-V version/revision it
+	// targets is the closest thing; formatVersion covers everything else
+	static const U64 key = []()
+	{
+		unsigned int version = 0, revision = 0;
+		shaderc_get_spv_version(&version, &revision);
+		U32 values[3] = { formatVersion, version, revision };
+		return hash(values, sizeof(values));
+	}();
+	return key;
+}
+
+std::string ShaderCache::filePath(U64 key)
+{
+	std::ostringstream name;
+	name << directory << std::hex << key << ".spv";
+	return name.str();
+}
+
+bool ShaderCache::load(U64 key, std::vector<U32>& spv)
+{
+	if (!enabled)
+		return false;
+
+	File file;
+	std::string path = filePath(key);
+	if (!file.open(path, File::Mode(File::binary | File::in)))
+		return false;
+
+	U32 magic, wordCount;
+	U64 storedKey;
+	file.read(magic);
+	file.read(storedKey);
+	file.read(wordCount);
+
+	if (magic != cacheMagic || storedKey != key || file.getSize() != S64(sizeof(U32) * 2 + sizeof(U64) + wordCount * sizeof(U32)))
+	{
+		LOG_WARN("Discarding invalid shader cache entry: " << path);
+		return false;
+	}
+
+	spv.resize(wordCount);
+	file.readArray(spv.data(), wordCount);
+	return file.fstream().good();
+}
+
+bool ShaderCache::store(U64 key, const std::vector<U32>& spv)
+{
+	if (!enabled || spv.empty())
+		return false;
+
+	std::error_code ec;
+	std::filesystem::create_directories(directory, ec);
+
+	// Write to a unique temporary and rename so concurrent writers and
+	// readers never see a partial entry
+	std::string path = filePath(key);
+	std::ostringstream tmp;
+	tmp << path << "." << std::this_thread::get_id() << ".tmp";
+
+	{
+		File file;
+		if (!file.create(tmp.str(), File::Mode(File::binary | File::out | File::trunc)))
+			return false;
+
+		file.write(cacheMagic);
+		file.write(key);
+		file.write(U32(spv.size()));
+		file.writeArray(spv.data(), U32(spv.size()));
+		if (!file.fstream().good())
+			return false;
+	}
+
+	std::filesystem::rename(tmp.str(), path, ec);
+	if (ec)
+	{
+		std::filesystem::remove(tmp.str(), ec);
+		return false;
+	}
+	return true;
+}
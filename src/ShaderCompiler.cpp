@@ -0,0 +1,84 @@
+#include "ShaderCompiler.hpp"
+#include "ShaderCache.hpp"
+#include "ShaderIncluder.hpp"
+
+std::future<ShaderCompiler::Result> ShaderCompiler::submit(Job job)
+{
+	return pool.submit([job = std::move(job)]() { return compile(job); });
+}
+
+std::vector<std::future<ShaderCompiler::Result>> ShaderCompiler::submit(std::vector<Job> jobs)
+{
+	std::vector<std::future<Result>> results;
+	results.reserve(jobs.size());
+	for (auto& job : jobs)
+		results.push_back(submit(std::move(job)));
+	return results;
+}
+
+ShaderCompiler::Result ShaderCompiler::compile(const Job& job)
+{
+	Result result;
+
+	// Every option set below must also be recorded in optionsKey
+	std::string optionsKey = "autobind;";
+	for (auto& macro : job.macros)
+		optionsKey += "define " + macro.first + "=" + macro.second + ";";
+	if (job.optimize)
+		optionsKey += "optimize;";
+
+	U64 key = ShaderCache::compilerKey();
+	key = ShaderCache::hash(&job.kind, sizeof(job.kind), key);
+	key = ShaderCache::hashString(optionsKey, key);
+	key = ShaderCache::hashString(job.source, key);
+
+	// With includes the source alone doesn't identify the result, add the
+	// contents of every file it pulls in. Scanning also records the includes.
+	if (job.source.find("#include") != std::string::npos)
+	{
+		for (const std::string& dependency : ShaderIncluder::scanSource(job.name, job.source))
+		{
+			key = ShaderCache::hashString(dependency, key);
+			if (auto content = ShaderIncluder::read(dependency))
+				key = ShaderCache::hashString(*content, key);
+		}
+	}
+
+	if (ShaderCache::load(key, result.spv))
+	{
+		++ShaderCache::hits;
+		result.success = true;
+		result.fromCache = true;
+		return result;
+	}
+	++ShaderCache::misses;
+
+	// shaderc::Compiler is expensive to construct, keep one per thread and
+	// only make it once a thread actually has to compile
+	thread_local shaderc::Compiler compiler;
+
+	shaderc::CompileOptions o;
+	o.SetAutoBindUniforms(true);
+	for (auto& macro : job.macros)
+		o.AddMacroDefinition(macro.first, macro.second);
+	if (job.optimize)
+		o.SetOptimizationLevel(shaderc_optimization_level_performance);
+	o.SetIncluder(std::make_unique<ShaderIncluder>());
+
+	auto res = compiler.CompileGlslToSpv(job.source, job.kind, job.name.c_str(), o);
+	result.log = res.GetErrorMessage();
+	if (res.GetCompilationStatus() != shaderc_compilation_status_success)
+		return result;
+
+	result.spv.assign(res.begin(), res.end());
+	result.success = true;
+
+	ShaderCache::store(key, result.spv);
+	return result;
+}
+
+ShaderCompiler& ShaderCompiler::get()
+{
+	static ShaderCompiler service;
+	return service;
+}
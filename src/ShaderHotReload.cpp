@@ -0,0 +1,54 @@
+#include "ShaderHotReload.hpp"
+#include "ShaderIncluder.hpp"
+
+bool ShaderHotReload::enabled = true;
+
+void ShaderHotReload::add(ShaderPermutations* shader, const std::string& sourcePath)
+{
+	Entry entry;
+	entry.shader = shader;
+	entry.path = FileWatcher::normalise(sourcePath);
+	ShaderIncluder::scan(entry.path);
+	watchDependencies(entry);
+	entries.push_back(std::move(entry));
+}
+
+void ShaderHotReload::watchDependencies(const Entry& entry)
+{
+	watcher.watch(entry.path);
+	for (const auto& file : ShaderIncluder::graph.getDependencies(entry.path))
+		watcher.watch(file);
+}
+
+std::vector<ShaderHotReload::Change> ShaderHotReload::poll()
+{
+	std::vector<Change> changes;
+
+	std::vector<std::string> changed = watcher.poll();
+	if (changed.empty())
+		return changes;
+
+	std::set<std::string> affected;
+	for (const auto& file : changed)
+	{
+		LOG_INFO("Shader source changed: " << file);
+
+		// The edit may have added or removed includes
+		ShaderIncluder::invalidate(file);
+		ShaderIncluder::scan(file);
+
+		affected.insert(file);
+		for (const auto& includer : ShaderIncluder::graph.getIncluders(file))
+			affected.insert(includer);
+	}
+
+	for (auto& entry : entries)
+	{
+		if (affected.count(entry.path) == 0)
+			continue;
+
+		watchDependencies(entry);
+		changes.push_back({ entry.shader, entry.path });
+	}
+	return changes;
+}
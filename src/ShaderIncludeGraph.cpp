@@ -0,0 +1,75 @@
+#include "ShaderIncludeGraph.hpp"
+
+void ShaderIncludeGraph::addInclude(const std::string& file, const std::string& include)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	includes[file].insert(include);
+	includers[include].insert(file);
+}
+
+void ShaderIncludeGraph::clearIncludes(const std::string& file)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = includes.find(file);
+	if (it == includes.end())
+		return;
+
+	for (const auto& include : it->second)
+	{
+		auto back = includers.find(include);
+		back->second.erase(file);
+		if (back->second.empty())
+			includers.erase(back);
+	}
+	includes.erase(it);
+}
+
+std::set<std::string> ShaderIncludeGraph::getIncludes(const std::string& file)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = includes.find(file);
+	return it == includes.end() ? std::set<std::string>() : it->second;
+}
+
+std::set<std::string> ShaderIncludeGraph::getDependencies(const std::string& file)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return walk(includes, file);
+}
+
+std::set<std::string> ShaderIncludeGraph::getIncluders(const std::string& file)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return walk(includers, file);
+}
+
+void ShaderIncludeGraph::clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	includes.clear();
+	includers.clear();
+}
+
+// Everything reachable from start, not including start itself unless it's on a cycle
+std::set<std::string> ShaderIncludeGraph::walk(const Edges& edges, const std::string& start)
+{
+	std::set<std::string> visited;
+	std::vector<const std::string*> stack = { &start };
+
+	while (!stack.empty())
+	{
+		const std::string* file = stack.back();
+		stack.pop_back();
+
+		auto it = edges.find(*file);
+		if (it == edges.end())
+			continue;
+
+		for (const auto& next : it->second)
+		{
+			if (visited.insert(next).second)
+				stack.push_back(&next);
+		}
+	}
+	return visited;
+}
@@ -0,0 +1,157 @@
+#include "ShaderIncluder.hpp"
+#include "File.hpp"
+
+#include <filesystem>
+#include <sstream>
+
+std::vector<std::string> ShaderIncluder::searchPaths = { "shaders/" };
+ShaderIncludeGraph ShaderIncluder::graph;
+std::mutex ShaderIncluder::cacheMutex;
+std::unordered_map<std::string, std::shared_ptr<const std::string>> ShaderIncluder::cache;
+
+std::string ShaderIncluder::normalise(const std::string& path)
+{
+	return std::filesystem::path(path).lexically_normal().generic_string();
+}
+
+std::string ShaderIncluder::resolve(const std::string& requested, shaderc_include_type type, const std::string& requesting)
+{
+	std::vector<std::string> candidates;
+	if (type == shaderc_include_type_relative)
+		candidates.push_back((std::filesystem::path(requesting).parent_path() / requested).generic_string());
+	for (const auto& directory : searchPaths)
+		candidates.push_back((std::filesystem::path(directory) / requested).generic_string());
+
+	for (const auto& candidate : candidates)
+	{
+		std::string path = normalise(candidate);
+		if (read(path))
+			return path;
+	}
+	return "";
+}
+
+std::shared_ptr<const std::string> ShaderIncluder::read(const std::string& path)
+{
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		auto it = cache.find(path);
+		if (it != cache.end())
+			return it->second;
+	}
+
+	File file;
+	if (!file.open(std::string(path), File::Mode(File::binary | File::in)))
+		return nullptr;
+
+	auto content = std::make_shared<std::string>();
+	content->resize(file.getSize());
+	if (!content->empty())
+		file.readFile(&(*content)[0]);
+
+	// Two threads may read the same file at once, either copy is fine
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	return cache.emplace(path, std::move(content)).first->second;
+}
+
+void ShaderIncluder::invalidate(const std::string& path)
+{
+	std::string file = normalise(path);
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		cache.erase(file);
+	}
+	graph.clearIncludes(file);
+}
+
+void ShaderIncluder::scan(const std::string& path)
+{
+	std::set<std::string> visited;
+	scan(normalise(path), visited);
+}
+
+std::set<std::string> ShaderIncluder::scanSource(const std::string& path, const std::string& source)
+{
+	std::string file = normalise(path);
+	graph.clearIncludes(file);
+
+	std::set<std::string> visited;
+	visited.insert(file);
+	scanLines(file, source, visited);
+	visited.erase(file);
+	return visited;
+}
+
+void ShaderIncluder::scan(const std::string& path, std::set<std::string>& visited)
+{
+	if (!visited.insert(path).second)
+		return;
+
+	auto source = read(path);
+	if (source)
+		scanLines(path, *source, visited);
+}
+
+void ShaderIncluder::scanLines(const std::string& path, const std::string& source, std::set<std::string>& visited)
+{
+	std::istringstream lines(source);
+	std::string line;
+	while (std::getline(lines, line))
+	{
+		size_t hash = line.find_first_not_of(" \t");
+		if (hash == std::string::npos || line.compare(hash, 8, "#include") != 0)
+			continue;
+
+		size_t open = line.find_first_of("\"<", hash + 8);
+		if (open == std::string::npos)
+			continue;
+		bool relative = line[open] == '"';
+		size_t close = line.find(relative ? '"' : '>', open + 1);
+		if (close == std::string::npos)
+			continue;
+
+		std::string include = resolve(line.substr(open + 1, close - open - 1), relative ? shaderc_include_type_relative : shaderc_include_type_standard, path);
+		if (include.empty())
+			continue;
+
+		graph.addInclude(path, include);
+		scan(include, visited);
+	}
+}
+
+shaderc_include_result* ShaderIncluder::GetInclude(const char* requestedSource, shaderc_include_type type, const char* requestingSource, size_t includeDepth)
+{
+	Include* include = new Include();
+	std::string requesting = normalise(requestingSource);
+
+	if (includeDepth <= maxIncludeDepth)
+		include->name = resolve(requestedSource, type, requesting);
+
+	if (!include->name.empty())
+	{
+		include->content = read(include->name);
+		graph.addInclude(requesting, include->name);
+	}
+	else if (includeDepth > maxIncludeDepth)
+	{
+		// shaderc reports an empty source name as a failed include, with the content as the message
+		include->error = std::string("Includes nested more than ") + std::to_string(maxIncludeDepth) + " deep at \"" + requestedSource + "\" from " + requesting + ", missing include guard?";
+	}
+	else
+	{
+		include->error = std::string("Can't find include file \"") + requestedSource + "\" from " + requesting;
+	}
+
+	const std::string& content = include->content ? *include->content : include->error;
+	include->result.source_name = include->name.c_str();
+	include->result.source_name_length = include->name.size();
+	include->result.content = content.c_str();
+	include->result.content_length = content.size();
+	include->result.user_data = include;
+	return &include->result;
+}
+
+void ShaderIncluder::ReleaseInclude(shaderc_include_result* data)
+{
+	delete static_cast<Include*>(data->user_data);
+}
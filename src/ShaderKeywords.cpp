@@ -0,0 +1,123 @@
+#include "ShaderKeywords.hpp"
+
+ShaderKeywords::Key ShaderKeywords::addKeyword(const std::string& name)
+{
+	return addKeyword(name, false, 0);
+}
+
+ShaderKeywords::Key ShaderKeywords::addSpecializationKeyword(const std::string& name, U32 constantId)
+{
+	return addKeyword(name, true, constantId);
+}
+
+ShaderKeywords::Key ShaderKeywords::addKeyword(const std::string& name, bool specialization, U32 constantId)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (size_t i = 0; i < keywords.size(); ++i)
+	{
+		if (keywords[i].name == name)
+			return Key(1) << i;
+	}
+
+	if (keywords.size() == maxKeywords)
+	{
+		LOG_WARN("Too many shader keywords, ignoring " << name);
+		return 0;
+	}
+	if (used)
+		LOG_WARN("Shader keyword " << name << " declared after variants were built");
+
+	Key bit = Key(1) << keywords.size();
+	keywords.push_back({ name, specialization, constantId });
+	if (specialization)
+		specializationMask |= bit;
+	else
+		compileMask |= bit;
+	return bit;
+}
+
+ShaderKeywords::Key ShaderKeywords::getKey(const std::vector<std::string>& enabled)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Key key = 0;
+	for (const auto& name : enabled)
+	{
+		auto it = std::find_if(keywords.begin(), keywords.end(), [&](const Keyword& k) { return k.name == name; });
+		if (it == keywords.end())
+		{
+			LOG_WARN("Unknown shader keyword: " << name);
+			continue;
+		}
+		key |= Key(1) << (it - keywords.begin());
+	}
+	return key;
+}
+
+ShaderKeywords::Key ShaderKeywords::getVariantKey(Key key)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	used = true;
+	return key & compileMask;
+}
+
+std::vector<std::string> ShaderKeywords::getDefines(Key key)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::vector<std::string> defines;
+	for (size_t i = 0; i < keywords.size(); ++i)
+	{
+		if (!keywords[i].specialization && (key & (Key(1) << i)))
+			defines.push_back(keywords[i].name);
+	}
+	return defines;
+}
+
+const VkSpecializationInfo* ShaderKeywords::getSpecializationInfo(Key key)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	used = true;
+
+	if (specializationMask == 0)
+		return nullptr;
+
+	key &= specializationMask;
+	auto it = specializations.find(key);
+	if (it != specializations.end())
+		return &it->second.info;
+
+	// Every specialization keyword gets a value, disabled ones explicitly false
+	Specialization& s = specializations[key];
+	for (size_t i = 0; i < keywords.size(); ++i)
+	{
+		if (!keywords[i].specialization)
+			continue;
+
+		VkSpecializationMapEntry entry = {};
+		entry.constantID = keywords[i].constantId;
+		entry.offset = U32(s.values.size() * sizeof(VkBool32));
+		entry.size = sizeof(VkBool32);
+		s.entries.push_back(entry);
+		s.values.push_back((key & (Key(1) << i)) ? VK_TRUE : VK_FALSE);
+	}
+
+	s.info.mapEntryCount = U32(s.entries.size());
+	s.info.pMapEntries = s.entries.data();
+	s.info.dataSize = s.values.size() * sizeof(VkBool32);
+	s.info.pData = s.values.data();
+	return &s.info;
+}
+
+U32 ShaderKeywords::getSpecializationCount()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return U32(specializations.size());
+}
+
+void ShaderKeywords::clearSpecializations()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	specializations.clear();
+}
@@ -0,0 +1,148 @@
+#include "ShaderPermutations.hpp"
+
+bool ShaderPermutations::reload(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	ShaderModule source = base;
+	source.load(path);
+
+	std::vector<std::pair<Key, ShaderModule>> rebuilt;
+	for (auto& variant : variants)
+		rebuilt.emplace_back(variant.first, makeVariant(source, variant.first));
+
+	std::vector<ShaderModule*> modules;
+	for (auto& r : rebuilt)
+		modules.push_back(&r.second);
+	ShaderModule::compileBatch(modules);
+
+	for (auto& r : rebuilt)
+	{
+		if (r.second.getSpirv().empty())
+			return false;
+	}
+
+	// Pipelines don't need their shader modules once created, the old ones can go right away
+	for (auto& variant : variants)
+		variant.second.destroy();
+	variants.clear();
+
+	for (auto& r : rebuilt)
+	{
+		r.second.createVulkanModule();
+		variants.emplace(r.first, r.second);
+	}
+	base = source;
+	return true;
+}
+
+ShaderPermutations::Key ShaderPermutations::compileKey(Key key)
+{
+	key = keywords.getVariantKey(key);
+
+	// Precompiled SPIR-V can't be re-preprocessed, every key maps to it
+	if (key != 0 && !base.isGLSL())
+	{
+		LOG_WARN("Shader has no GLSL source, compile keywords ignored");
+		return 0;
+	}
+	return key;
+}
+
+ShaderModule ShaderPermutations::makeVariant(const ShaderModule& source, Key key)
+{
+	ShaderModule variant = source;
+	for (const std::string& name : keywords.getDefines(key))
+		variant.define(name);
+	return variant;
+}
+
+VkShaderModule ShaderPermutations::getModule(Key key)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	key = compileKey(key);
+	auto it = variants.find(key);
+	if (it != variants.end())
+		return it->second.getVulkanModule();
+
+	ShaderModule variant = makeVariant(base, key);
+	variant.compile();
+	variant.createVulkanModule();
+	return variants.emplace(key, variant).first->second.getVulkanModule();
+}
+
+VkPipelineShaderStageCreateInfo ShaderPermutations::getStageInfo(Key key)
+{
+	VkPipelineShaderStageCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	info.stage = base.getVulkanStage();
+	info.module = getModule(key);
+	info.pName = "main";
+	info.pSpecializationInfo = getSpecializationInfo(key);
+	return info;
+}
+
+bool ShaderPermutations::reflect(Key key, ShaderReflection& reflection)
+{
+	getModule(key);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	return reflection.parse(variants.at(compileKey(key)).getSpirv());
+}
+
+void ShaderPermutations::prewarm(const std::vector<Key>& keys)
+{
+	std::vector<std::pair<ShaderPermutations*, Key>> requests;
+	for (Key key : keys)
+		requests.emplace_back(this, key);
+	prewarm(requests);
+}
+
+void ShaderPermutations::prewarm(const std::vector<std::pair<ShaderPermutations*, Key>>& requests)
+{
+	struct Pending
+	{
+		ShaderPermutations* shader;
+		Key key;
+		ShaderModule module;
+	};
+
+	std::vector<Pending> pending;
+	for (const auto& request : requests)
+	{
+		ShaderPermutations* shader = request.first;
+		std::lock_guard<std::mutex> lock(shader->mutex);
+
+		Key key = shader->compileKey(request.second);
+		bool queued = std::any_of(pending.begin(), pending.end(), [&](const Pending& p) { return p.shader == shader && p.key == key; });
+		if (!queued && shader->variants.find(key) == shader->variants.end())
+			pending.push_back({ shader, key, shader->makeVariant(shader->base, key) });
+	}
+
+	// Compile without holding any lock so getModule on other variants isn't blocked
+	std::vector<ShaderModule*> modules;
+	for (auto& p : pending)
+		modules.push_back(&p.module);
+	ShaderModule::compileBatch(modules);
+
+	for (auto& p : pending)
+	{
+		std::lock_guard<std::mutex> lock(p.shader->mutex);
+		if (p.shader->variants.find(p.key) != p.shader->variants.end())
+			continue;
+
+		p.module.createVulkanModule();
+		p.shader->variants.emplace(p.key, p.module);
+	}
+}
+
+void ShaderPermutations::destroy()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (auto& variant : variants)
+		variant.second.destroy();
+	variants.clear();
+	keywords.clearSpecializations();
+}
@@ -0,0 +1,606 @@
+#include "ShaderReflection.hpp"
+
+// The subset of the SPIR-V spec the reflection needs
+namespace spv
+{
+	const U32 magic = 0x07230203;
+	const U32 headerWords = 5;
+
+	enum Op : U32
+	{
+		OpName = 5,
+		OpMemberName = 6,
+		OpEntryPoint = 15,
+		OpTypeBool = 20,
+		OpTypeInt = 21,
+		OpTypeFloat = 22,
+		OpTypeVector = 23,
+		OpTypeMatrix = 24,
+		OpTypeImage = 25,
+		OpTypeSampler = 26,
+		OpTypeSampledImage = 27,
+		OpTypeArray = 28,
+		OpTypeRuntimeArray = 29,
+		OpTypeStruct = 30,
+		OpTypePointer = 32,
+		OpConstant = 43,
+		OpVariable = 59,
+		OpDecorate = 71,
+		OpMemberDecorate = 72
+	};
+
+	enum Decoration : U32
+	{
+		Block = 2,
+		BufferBlock = 3,
+		ArrayStride = 6,
+		MatrixStride = 7,
+		BuiltIn = 11,
+		Location = 30,
+		Binding = 33,
+		DescriptorSet = 34,
+		Offset = 35
+	};
+
+	enum StorageClass : U32
+	{
+		UniformConstant = 0,
+		Input = 1,
+		Uniform = 2,
+		PushConstant = 9,
+		StorageBuffer = 12
+	};
+
+	enum Dim : U32
+	{
+		DimBuffer = 5,
+		DimSubpassData = 6
+	};
+
+	enum ExecutionModel : U32
+	{
+		Vertex = 0,
+		TessellationControl = 1,
+		TessellationEvaluation = 2,
+		Geometry = 3,
+		Fragment = 4,
+		GLCompute = 5
+	};
+}
+
+namespace
+{
+	struct Id
+	{
+		U32 op = 0;
+		// Type operands, meaning depends on op
+		U32 type = 0;
+		U32 width = 0;
+		U32 count = 0;
+		U32 storage = 0;
+		U32 sampled = 0;
+		U32 dim = 0;
+		bool signedness = false;
+		std::vector<U32> members;
+
+		// Constant value, or variable type
+		U32 value = 0;
+
+		// Decorations
+		U32 set = 0;
+		U32 binding = ~0u;
+		U32 location = ~0u;
+		U32 arrayStride = 0;
+		bool block = false;
+		bool bufferBlock = false;
+		bool builtIn = false;
+		std::vector<U32> memberOffsets;
+		std::vector<U32> memberMatrixStrides;
+
+		std::string name;
+	};
+
+	std::string readString(const U32* words, size_t wordCount)
+	{
+		const char* chars = (const char*)words;
+		size_t length = 0;
+		while (length < wordCount * 4 && chars[length] != 0)
+			++length;
+		return std::string(chars, length);
+	}
+
+	VkShaderStageFlags stageFlag(U32 model)
+	{
+		switch (model)
+		{
+		case spv::Vertex: return VK_SHADER_STAGE_VERTEX_BIT;
+		case spv::TessellationControl: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+		case spv::TessellationEvaluation: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+		case spv::Geometry: return VK_SHADER_STAGE_GEOMETRY_BIT;
+		case spv::Fragment: return VK_SHADER_STAGE_FRAGMENT_BIT;
+		case spv::GLCompute: return VK_SHADER_STAGE_COMPUTE_BIT;
+		default: return 0;
+		}
+	}
+
+	class Parser
+	{
+	public:
+		std::vector<Id> ids;
+		std::unordered_map<U32, U32> structSizes;
+
+		// Byte size of a type as laid out in a block. Types may only refer to
+		// earlier ids, recursing into smaller ids only also rules out cycles
+		// in malformed modules.
+		U32 typeSize(U32 id, U32 matrixStride = 0, U32 parent = ~0u)
+		{
+			if (id >= ids.size() || id >= parent)
+				return 0;
+
+			const Id& t = ids[id];
+			switch (t.op)
+			{
+			case spv::OpTypeBool:
+				return 4;
+			case spv::OpTypeInt:
+			case spv::OpTypeFloat:
+				return t.width / 8;
+			case spv::OpTypeVector:
+				return typeSize(t.type, 0, id) * t.count;
+			case spv::OpTypeMatrix:
+				return (matrixStride ? matrixStride : typeSize(t.type, 0, id)) * t.count;
+			case spv::OpTypeArray:
+				return (t.arrayStride ? t.arrayStride : typeSize(t.type, matrixStride, id)) * arrayLength(id);
+			case spv::OpTypeStruct:
+			{
+				// Memoised, nested structs shared by many members would otherwise be revisited
+				auto cached = structSizes.find(id);
+				if (cached != structSizes.end())
+					return cached->second;
+
+				U32 size = 0;
+				for (size_t m = 0; m < t.members.size(); ++m)
+				{
+					U32 offset = m < t.memberOffsets.size() ? t.memberOffsets[m] : size;
+					U32 stride = m < t.memberMatrixStrides.size() ? t.memberMatrixStrides[m] : 0;
+					size = std::max(size, offset + typeSize(t.members[m], stride, id));
+				}
+				structSizes[id] = size;
+				return size;
+			}
+			default:
+				return 0;
+			}
+		}
+
+		U32 arrayLength(U32 id)
+		{
+			const Id& t = ids[id];
+			return t.count < ids.size() && ids[t.count].op == spv::OpConstant ? ids[t.count].value : 1;
+		}
+
+		// Strips arrays off a type, multiplying up the descriptor count
+		U32 elementType(U32 id, U32& count)
+		{
+			count = 1;
+			for (int depth = 0; depth < 8 && id < ids.size(); ++depth)
+			{
+				if (ids[id].op == spv::OpTypeArray)
+					count *= arrayLength(id);
+				else if (ids[id].op != spv::OpTypeRuntimeArray)
+					break;
+				// Runtime arrays need descriptor indexing, size them as one
+				id = ids[id].type;
+			}
+			return id;
+		}
+
+		bool descriptorType(U32 storage, U32 type, VkDescriptorType& out)
+		{
+			if (type >= ids.size())
+				return false;
+
+			const Id& t = ids[type];
+			if (storage == spv::UniformConstant)
+			{
+				switch (t.op)
+				{
+				case spv::OpTypeSampler:
+					out = VK_DESCRIPTOR_TYPE_SAMPLER;
+					return true;
+				case spv::OpTypeSampledImage:
+					out = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+					return true;
+				case spv::OpTypeImage:
+					if (t.dim == spv::DimSubpassData)
+						out = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+					else if (t.dim == spv::DimBuffer)
+						out = t.sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+					else
+						out = t.sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+					return true;
+				default:
+					return false;
+				}
+			}
+			if (storage == spv::Uniform && t.op == spv::OpTypeStruct)
+			{
+				out = t.bufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				return true;
+			}
+			if (storage == spv::StorageBuffer && t.op == spv::OpTypeStruct)
+			{
+				out = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				return true;
+			}
+			return false;
+		}
+
+		VkFormat vertexFormat(U32 type)
+		{
+			if (type >= ids.size())
+				return VK_FORMAT_UNDEFINED;
+
+			const Id& t = ids[type];
+			U32 components = 1;
+			const Id* scalar = &t;
+			if (t.op == spv::OpTypeVector && t.type < ids.size())
+			{
+				components = t.count;
+				scalar = &ids[t.type];
+			}
+			if (scalar->width != 32 || components < 1 || components > 4)
+				return VK_FORMAT_UNDEFINED;
+
+			static const VkFormat floats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+			static const VkFormat sints[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+			static const VkFormat uints[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+
+			if (scalar->op == spv::OpTypeFloat)
+				return floats[components - 1];
+			if (scalar->op == spv::OpTypeInt)
+				return scalar->signedness ? sints[components - 1] : uints[components - 1];
+			return VK_FORMAT_UNDEFINED;
+		}
+	};
+}
+
+bool ShaderReflection::parse(const U32* words, size_t wordCount)
+{
+	clear();
+
+	if (wordCount < spv::headerWords || words[0] != spv::magic)
+	{
+		LOG_WARN("Not a SPIR-V module");
+		return false;
+	}
+
+	U32 bound = words[3];
+	if (bound > 4 * 1024 * 1024)
+	{
+		LOG_WARN("SPIR-V id bound is implausibly large: " << bound);
+		return false;
+	}
+
+	Parser p;
+	p.ids.resize(bound);
+	std::vector<U32> variables;
+
+	size_t i = spv::headerWords;
+	while (i < wordCount)
+	{
+		U32 count = words[i] >> 16;
+		U32 op = words[i] & 0xFFFF;
+		if (count == 0 || i + count > wordCount)
+		{
+			LOG_WARN("Truncated SPIR-V instruction at word " << i);
+			return false;
+		}
+
+		const U32* w = &words[i];
+		// Every id operand read below is bounds checked against the id bound
+		auto id = [&](U32 operand) -> Id* { return operand < count && w[operand] < bound ? &p.ids[w[operand]] : nullptr; };
+
+		switch (op)
+		{
+		case spv::OpName:
+			if (Id* t = id(1))
+				t->name = readString(w + 2, count - 2);
+			break;
+		case spv::OpEntryPoint:
+			if (count > 1)
+				stages |= stageFlag(w[1]);
+			break;
+		case spv::OpTypeBool:
+		case spv::OpTypeSampler:
+			if (Id* t = id(1))
+				t->op = op;
+			break;
+		case spv::OpTypeInt:
+		case spv::OpTypeFloat:
+			if (Id* t = id(1))
+			{
+				t->op = op;
+				t->width = count > 2 ? w[2] : 0;
+				t->signedness = op == spv::OpTypeInt && count > 3 && w[3] != 0;
+			}
+			break;
+		case spv::OpTypeVector:
+		case spv::OpTypeMatrix:
+		case spv::OpTypeArray:
+			// Array "count" is the id of the length constant
+			if (Id* t = id(1))
+			{
+				t->op = op;
+				t->type = count > 2 ? w[2] : 0;
+				t->count = count > 3 ? w[3] : 0;
+			}
+			break;
+		case spv::OpTypeRuntimeArray:
+		case spv::OpTypeSampledImage:
+			if (Id* t = id(1))
+			{
+				t->op = op;
+				t->type = count > 2 ? w[2] : 0;
+			}
+			break;
+		case spv::OpTypeImage:
+			if (Id* t = id(1))
+			{
+				t->op = op;
+				t->dim = count > 3 ? w[3] : 0;
+				t->sampled = count > 7 ? w[7] : 0;
+			}
+			break;
+		case spv::OpTypeStruct:
+			if (Id* t = id(1))
+			{
+				t->op = op;
+				t->members.assign(w + 2, w + count);
+			}
+			break;
+		case spv::OpTypePointer:
+			if (Id* t = id(1))
+			{
+				t->op = op;
+				t->storage = count > 2 ? w[2] : 0;
+				t->type = count > 3 ? w[3] : 0;
+			}
+			break;
+		case spv::OpConstant:
+			if (Id* t = id(2))
+			{
+				t->op = op;
+				t->value = count > 3 ? w[3] : 0;
+			}
+			break;
+		case spv::OpVariable:
+			if (Id* t = id(2))
+			{
+				t->op = op;
+				t->type = w[1];
+				t->storage = count > 3 ? w[3] : 0;
+				variables.push_back(w[2]);
+			}
+			break;
+		case spv::OpDecorate:
+			if (Id* t = id(1))
+			{
+				U32 value = count > 3 ? w[3] : 0;
+				switch (count > 2 ? w[2] : ~0u)
+				{
+				case spv::Block: t->block = true; break;
+				case spv::BufferBlock: t->bufferBlock = true; break;
+				case spv::ArrayStride: t->arrayStride = value; break;
+				case spv::BuiltIn: t->builtIn = true; break;
+				case spv::Location: t->location = value; break;
+				case spv::Binding: t->binding = value; break;
+				case spv::DescriptorSet: t->set = value; break;
+				}
+			}
+			break;
+		case spv::OpMemberDecorate:
+			if (Id* t = id(1))
+			{
+				if (count < 5 || w[2] > 4096)
+					break;
+				U32 member = w[2];
+				if (w[3] == spv::Offset)
+				{
+					if (t->memberOffsets.size() <= member)
+						t->memberOffsets.resize(member + 1, 0);
+					t->memberOffsets[member] = w[4];
+				}
+				else if (w[3] == spv::MatrixStride)
+				{
+					if (t->memberMatrixStrides.size() <= member)
+						t->memberMatrixStrides.resize(member + 1, 0);
+					t->memberMatrixStrides[member] = w[4];
+				}
+				else if (w[3] == spv::BuiltIn)
+				{
+					t->builtIn = true;
+				}
+			}
+			break;
+		}
+
+		i += count;
+	}
+
+	for (U32 v : variables)
+	{
+		const Id& var = p.ids[v];
+		if (var.type >= bound || p.ids[var.type].op != spv::OpTypePointer)
+			continue;
+
+		U32 pointee = p.ids[var.type].type;
+		if (pointee >= bound)
+			continue;
+
+		switch (var.storage)
+		{
+		case spv::UniformConstant:
+		case spv::Uniform:
+		case spv::StorageBuffer:
+		{
+			DescriptorBinding b;
+			U32 type = p.elementType(pointee, b.count);
+			if (var.binding == ~0u || !p.descriptorType(var.storage, type, b.type))
+				break;
+
+			b.set = var.set;
+			b.binding = var.binding;
+			b.stages = stages;
+			b.blockSize = p.ids[type].op == spv::OpTypeStruct ? p.typeSize(type) : 0;
+			// Blocks are usually named through their type, the instance name is often empty
+			b.name = !var.name.empty() ? var.name : p.ids[type].name;
+			bindings.push_back(b);
+			break;
+		}
+		case spv::PushConstant:
+		{
+			const Id& block = p.ids[pointee];
+			U32 size = p.typeSize(pointee);
+			U32 offset = block.memberOffsets.empty() ? 0 : *std::min_element(block.memberOffsets.begin(), block.memberOffsets.end());
+			if (size > offset)
+			{
+				VkPushConstantRange range = {};
+				range.stageFlags = stages;
+				range.offset = offset;
+				range.size = size - offset;
+				pushConstants.push_back(range);
+			}
+			break;
+		}
+		case spv::Input:
+		{
+			if (!(stages & VK_SHADER_STAGE_VERTEX_BIT) || var.builtIn || var.location == ~0u || p.ids[pointee].builtIn)
+				break;
+
+			U32 columns = 1;
+			U32 type = pointee;
+			if (p.ids[type].op == spv::OpTypeMatrix)
+			{
+				columns = std::min(p.ids[type].count, 4u);
+				type = p.ids[type].type;
+			}
+			for (U32 c = 0; c < columns; ++c)
+				vertexInputs.push_back({ var.location + c, p.vertexFormat(type), var.name });
+			break;
+		}
+		}
+	}
+
+	std::sort(bindings.begin(), bindings.end(), [](const DescriptorBinding& a, const DescriptorBinding& b)
+	{
+		return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+	});
+	std::sort(vertexInputs.begin(), vertexInputs.end(), [](const VertexInput& a, const VertexInput& b) { return a.location < b.location; });
+	return true;
+}
+
+bool ShaderReflection::merge(const ShaderReflection& other)
+{
+	bool ok = true;
+	stages |= other.stages;
+
+	for (const auto& b : other.bindings)
+	{
+		auto it = std::find_if(bindings.begin(), bindings.end(), [&](const DescriptorBinding& e) { return e.set == b.set && e.binding == b.binding; });
+		if (it == bindings.end())
+		{
+			bindings.push_back(b);
+			continue;
+		}
+
+		if (it->type != b.type || it->count != b.count)
+		{
+			LOG_WARN("Shader stages disagree on set " << b.set << " binding " << b.binding << " (" << it->name << " / " << b.name << ")");
+			ok = false;
+		}
+		it->stages |= b.stages;
+		it->blockSize = std::max(it->blockSize, b.blockSize);
+	}
+
+	std::sort(bindings.begin(), bindings.end(), [](const DescriptorBinding& a, const DescriptorBinding& b)
+	{
+		return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+	});
+
+	// A stage may only appear in one range, so overlapping stages share one
+	// range covering all of them
+	for (const auto& range : other.pushConstants)
+	{
+		if (pushConstants.empty())
+		{
+			pushConstants.push_back(range);
+			continue;
+		}
+		VkPushConstantRange& merged = pushConstants[0];
+		U32 end = std::max(merged.offset + merged.size, range.offset + range.size);
+		merged.offset = std::min(merged.offset, range.offset);
+		merged.size = end - merged.offset;
+		merged.stageFlags |= range.stageFlags;
+	}
+
+	if (vertexInputs.empty())
+		vertexInputs = other.vertexInputs;
+
+	return ok;
+}
+
+U32 ShaderReflection::getSetCount()
+{
+	return bindings.empty() ? 0 : bindings.back().set + 1;
+}
+
+std::vector<VkDescriptorSetLayoutBinding> ShaderReflection::getSetLayoutBindings(U32 set)
+{
+	std::vector<VkDescriptorSetLayoutBinding> result;
+	for (const auto& b : bindings)
+	{
+		if (b.set != set)
+			continue;
+
+		VkDescriptorSetLayoutBinding binding = {};
+		binding.binding = b.binding;
+		binding.descriptorType = b.type;
+		binding.descriptorCount = b.count;
+		binding.stageFlags = b.stages;
+		result.push_back(binding);
+	}
+	return result;
+}
+
+const ShaderReflection::DescriptorBinding* ShaderReflection::findBinding(U32 set, U32 binding) const
+{
+	for (const auto& b : bindings)
+	{
+		if (b.set == set && b.binding == binding)
+			return &b;
+	}
+	return nullptr;
+}
+
+std::vector<VkDescriptorPoolSize> ShaderReflection::getPoolSizes(U32 copies)
+{
+	std::vector<VkDescriptorPoolSize> sizes;
+	for (const auto& b : bindings)
+	{
+		auto it = std::find_if(sizes.begin(), sizes.end(), [&](const VkDescriptorPoolSize& s) { return s.type == b.type; });
+		if (it == sizes.end())
+			sizes.push_back({ b.type, b.count * copies });
+		else
+			it->descriptorCount += b.count * copies;
+	}
+	return sizes;
+}
+
+void ShaderReflection::clear()
+{
+	stages = 0;
+	bindings.clear();
+	pushConstants.clear();
+	vertexInputs.clear();
+}
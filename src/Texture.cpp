@@ -1,9 +1,10 @@
 #include "Texture.hpp"
 #include "Engine.hpp"
+#include "RenderGraph.hpp"
 
-void generateMipmaps(VkImage image, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
-	VkCommandBuffer commandBuffer = Engine::renderer->beginSingleTimeCommands();
+#include <cstring>
 
+void recordMipmaps(VkCommandBuffer commandBuffer, VkImage image, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
 	VkImageMemoryBarrier barrier = {};
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 	barrier.image = image;
@@ -76,17 +77,67 @@ void generateMipmaps(VkImage image, int32_t texWidth, int32_t texHeight, uint32_
 		0, nullptr,
 		0, nullptr,
 		1, &barrier);
-
-	Engine::renderer->endSingleTimeCommands(commandBuffer);
 }
 
 void Texture::loadFile(std::string path, bool genMipmaps)
 {
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".tex") == 0)
+    {
+        CookedTexture cooked;
+        if (!cooked.load(path))
+        {
+            LOG_FATAL("Failed to load texture: " << path);
+        }
+        loadCooked(&cooked);
+        return;
+    }
+
     Image img;
     img.load(path);
     loadImage(&img, true);
 }
 
+Task<void> Texture::loadFileAsync(AssetScheduler& assets, std::string path)
+{
+	if (path.size() > 4 && path.compare(path.size() - 4, 4, ".tex") == 0)
+	{
+		// Cooked mips need no decoding, only the upload is left for main
+		std::unique_ptr<CookedTexture> cooked = co_await assets.run([path]()
+		{
+			auto cooked = std::make_unique<CookedTexture>();
+			if (!cooked->load(path))
+				cooked.reset();
+			return cooked;
+		});
+		if (!cooked)
+			LOG_FATAL("Failed to load texture: " << path);
+
+		co_await assets.resumeOnMain();
+		loadCooked(cooked.get());
+		co_return;
+	}
+
+	std::vector<U8> bytes = co_await assets.readFile(path);
+	Image image;
+	image.loadMemory(bytes.data(), bytes.size());
+	if (image.data.empty())
+		LOG_FATAL("Failed to load texture: " << path);
+	bytes = std::vector<U8>();
+
+	co_await assets.resumeOnMain();
+	const auto r = Engine::renderer;
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	VkCommandBuffer commandBuffer = recordUpload(image, stagingBuffer, stagingBufferMemory);
+
+	// Main goes on rendering while the GPU works through the upload
+	VkFence fence = r->submitSingleTimeCommands(commandBuffer);
+	co_await assets.gpuComplete(r->vkLogicalDevice, fence);
+	r->releaseSingleTimeCommands(commandBuffer, fence);
+
+	finishUpload(image.mipLevels, stagingBuffer, stagingBufferMemory);
+}
+
 void Texture::loadImage(Image *image, bool genMipmaps)
 {
     const auto r = Engine::renderer;
@@ -95,29 +146,138 @@ void Texture::loadImage(Image *image, bool genMipmaps)
 	else
 		maxMipLevel = 0;
 
-	VkDeviceSize textureSize = image->data.size() * sizeof(Pixel);
-
 	VkBuffer stagingBuffer;
 	VkDeviceMemory stagingBufferMemory;
+	VkCommandBuffer commandBuffer = recordUpload(*image, stagingBuffer, stagingBufferMemory);
+	r->endSingleTimeCommands(commandBuffer);
+
+	finishUpload(image->mipLevels, stagingBuffer, stagingBufferMemory);
+}
+
+VkCommandBuffer Texture::recordUpload(const Image& image, VkBuffer& stagingBuffer, VkDeviceMemory& stagingBufferMemory)
+{
+	const auto r = Engine::renderer;
+	width = image.width;
+	height = image.height;
+
+	VkDeviceSize textureSize = image.data.size() * sizeof(Pixel);
 	r->createVulkanBuffer(textureSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
 	void* data;
 	vkMapMemory(r->vkLogicalDevice, stagingBufferMemory, 0, textureSize, 0, &data);
-	memcpy(data, &(image->data[0]), static_cast<size_t>(textureSize));
+	memcpy(data, image.data.data(), size_t(textureSize));
 	vkUnmapMemory(r->vkLogicalDevice, stagingBufferMemory);
-    r->createImage(image->width, image->height, image->mipLevels, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vkImage, vkMemory);
-	
-	r->transitionImageLayout(vkImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, image->mipLevels);
-	r->copyBufferToImage(stagingBuffer, vkImage, static_cast<uint32_t>(image->width), static_cast<uint32_t>(image->height));
+	r->createImage(image.width, image.height, image.mipLevels, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vkImage, vkMemory);
+
+	RenderGraph graph;
+	RenderGraph::ImageDesc desc;
+	desc.width = U32(image.width);
+	desc.height = U32(image.height);
+	desc.mipLevels = U32(image.mipLevels);
+	RenderGraph::Resource target = graph.importImage("texture", vkImage, desc, VK_IMAGE_LAYOUT_UNDEFINED);
+	RenderGraph::Resource staging = graph.importBuffer("staging", stagingBuffer, textureSize);
 
+	RenderGraph::Pass copy = graph.addPass("copy", [&](VkCommandBuffer commandBuffer)
+	{
+		r->recordCopyBufferToImage(commandBuffer, stagingBuffer, vkImage, U32(image.width), U32(image.height));
+	});
+	graph.read(copy, staging, RenderGraph::TransferRead);
+	graph.write(copy, target, RenderGraph::TransferWrite);
+
+	// Barriers between levels are the pass's own, it leaves them all shader
+	// readable so the graph has no final access to transition to
+	RenderGraph::Pass mips = graph.addPass("mips", [&](VkCommandBuffer commandBuffer)
+	{
+		recordMipmaps(commandBuffer, vkImage, image.width, image.height, image.mipLevels);
+	});
+	graph.write(mips, target, RenderGraph::TransferWrite);
+	graph.compile();
+
+	// One submission for the copy and every mip
+	VkCommandBuffer commandBuffer = r->beginSingleTimeCommands();
+	graph.execute(commandBuffer);
+	return commandBuffer;
+}
+
+void Texture::finishUpload(U32 mipLevels, VkBuffer stagingBuffer, VkDeviceMemory stagingBufferMemory)
+{
+	const auto r = Engine::renderer;
 	vkDestroyBuffer(r->vkLogicalDevice, stagingBuffer, nullptr);
 	vkFreeMemory(r->vkLogicalDevice, stagingBufferMemory, nullptr);
 
-	generateMipmaps(vkImage, image->width, image->height, image->mipLevels);
+	vkImageView = r->createImageView(vkImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+	maxMipLevel = mipLevels;
+}
+
+void Texture::loadCooked(CookedTexture *cooked)
+{
+    const auto r = Engine::renderer;
+    const U32 mipLevels = U32(cooked->levels.size());
+    const VkFormat format = cooked->getVulkanFormat();
+
+    width = cooked->width;
+    height = cooked->height;
+
+    VkDeviceSize textureSize = 0;
+    for (auto& level : cooked->levels)
+        textureSize += level.data.size();
+
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    r->createVulkanBuffer(textureSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+    std::vector<VkBufferImageCopy> regions(mipLevels);
+
+    U8* data;
+    vkMapMemory(r->vkLogicalDevice, stagingBufferMemory, 0, textureSize, 0, (void**)&data);
+    VkDeviceSize offset = 0;
+    for (U32 i = 0; i < mipLevels; ++i)
+    {
+        auto& level = cooked->levels[i];
+        memcpy(data + offset, level.data.data(), level.data.size());
+
+        regions[i] = {};
+        regions[i].bufferOffset = offset;
+        regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[i].imageSubresource.mipLevel = i;
+        regions[i].imageSubresource.baseArrayLayer = 0;
+        regions[i].imageSubresource.layerCount = 1;
+        regions[i].imageExtent = { level.width, level.height, 1 };
+
+        offset += level.data.size();
+    }
+    vkUnmapMemory(r->vkLogicalDevice, stagingBufferMemory);
+
+    r->createImage(cooked->width, cooked->height, mipLevels, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vkImage, vkMemory);
+
+    RenderGraph graph;
+    RenderGraph::ImageDesc desc;
+    desc.format = format;
+    desc.width = cooked->width;
+    desc.height = cooked->height;
+    desc.mipLevels = mipLevels;
+    RenderGraph::Resource target = graph.importImage("texture", vkImage, desc, VK_IMAGE_LAYOUT_UNDEFINED, RenderGraph::FragmentSampled);
+    RenderGraph::Resource staging = graph.importBuffer("staging", stagingBuffer, textureSize);
+
+    RenderGraph::Pass copy = graph.addPass("copy", [&](VkCommandBuffer commandBuffer)
+    {
+        vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, vkImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, regions.data());
+    });
+    graph.read(copy, staging, RenderGraph::TransferRead);
+    graph.write(copy, target, RenderGraph::TransferWrite);
+    graph.compile();
+
+    // Both transitions and the copy in one submission
+    VkCommandBuffer commandBuffer = r->beginSingleTimeCommands();
+    graph.execute(commandBuffer);
+    r->endSingleTimeCommands(commandBuffer);
+
+    vkDestroyBuffer(r->vkLogicalDevice, stagingBuffer, nullptr);
+    vkFreeMemory(r->vkLogicalDevice, stagingBufferMemory, nullptr);
 
-    vkImageView = r->createImageView(vkImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, image->mipLevels);
+    vkImageView = r->createImageView(vkImage, format, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
 
-    maxMipLevel = image->mipLevels;
+    maxMipLevel = mipLevels;
 }
 
 void Texture::destroy()
@@ -0,0 +1,41 @@
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(U32 threadCount) : stopping(false)
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	workers.reserve(threadCount);
+	for (U32 i = 0; i < threadCount; ++i)
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (stopping && tasks.empty())
+				return;
+
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+		task();
+	}
+}
@@ -0,0 +1,427 @@
+#include "TriangleBvh.hpp"
+#include "File.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TRIANGLE_BVH_SSE
+#include <immintrin.h>
+#endif
+
+void TriangleBvh::clear()
+{
+	nodes.clear();
+	blocks.clear();
+	vertexCount = 0;
+	indexCount = 0;
+}
+
+bool TriangleBvh::matches(const Mesh& mesh) const
+{
+	return !empty() && vertexCount == mesh.vertices.size() && indexCount == mesh.indices.size();
+}
+
+void TriangleBvh::build(const Mesh& mesh)
+{
+	clear();
+	U32 triangleCount = U32(mesh.indices.size() / 3);
+	vertexCount = U32(mesh.vertices.size());
+	indexCount = triangleCount * 3;
+	if (triangleCount == 0)
+		return;
+
+	std::vector<Bvh::Bounds> bounds(triangleCount);
+	for (U32 t = 0; t < triangleCount; ++t)
+	{
+		for (U32 v = 0; v < 3; ++v)
+			bounds[t].grow(mesh.vertices[mesh.indices[t * 3 + v]].position);
+	}
+
+	std::vector<U32> order;
+	Bvh::buildNodes(bounds, nodes, order, leafSize);
+
+	// One block per leaf, in node order so a walk down the tree reads them
+	// roughly front to back
+	blocks.reserve(nodes.size() / 2 + 1);
+	for (Bvh::Node& node : nodes)
+	{
+		if (!node.isLeaf())
+			continue;
+
+		Block block = {};
+		for (U32 lane = 0; lane < node.count; ++lane)
+		{
+			U32 t = order[node.first + lane];
+			glm::vec3 v0 = mesh.vertices[mesh.indices[t * 3]].position;
+			glm::vec3 e1 = mesh.vertices[mesh.indices[t * 3 + 1]].position - v0;
+			glm::vec3 e2 = mesh.vertices[mesh.indices[t * 3 + 2]].position - v0;
+			block.v0x[lane] = v0.x;
+			block.v0y[lane] = v0.y;
+			block.v0z[lane] = v0.z;
+			block.e1x[lane] = e1.x;
+			block.e1y[lane] = e1.y;
+			block.e1z[lane] = e1.z;
+			block.e2x[lane] = e2.x;
+			block.e2y[lane] = e2.y;
+			block.e2z[lane] = e2.z;
+			block.triangle[lane] = t;
+		}
+
+		node.first = U32(blocks.size());
+		blocks.push_back(block);
+	}
+}
+
+// Moller-Trumbore against the 4 lanes. Every path evaluates the same
+// expressions so single rays and packets find the same hits.
+bool TriangleBvh::intersect(const Block& b, const Ray& ray, Hit& hit)
+{
+	float distances[4], us[4], vs[4];
+	int mask = 0;
+
+#ifdef TRIANGLE_BVH_SSE
+	__m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+	__m128 e1x = _mm_loadu_ps(b.e1x), e1y = _mm_loadu_ps(b.e1y), e1z = _mm_loadu_ps(b.e1z);
+	__m128 e2x = _mm_loadu_ps(b.e2x), e2y = _mm_loadu_ps(b.e2y), e2z = _mm_loadu_ps(b.e2z);
+
+	__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	__m128 inverse = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	__m128 tx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_loadu_ps(b.v0x));
+	__m128 ty = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_loadu_ps(b.v0y));
+	__m128 tz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_loadu_ps(b.v0z));
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inverse);
+
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverse);
+	__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverse);
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 valid = _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+	valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, _mm_set1_ps(hit.distance))));
+	mask = _mm_movemask_ps(valid);
+	if (mask == 0)
+		return false;
+
+	_mm_storeu_ps(distances, t);
+	_mm_storeu_ps(us, u);
+	_mm_storeu_ps(vs, v);
+#else
+	const glm::vec3& d = ray.direction;
+	for (U32 lane = 0; lane < 4; ++lane)
+	{
+		float px = d.y * b.e2z[lane] - d.z * b.e2y[lane];
+		float py = d.z * b.e2x[lane] - d.x * b.e2z[lane];
+		float pz = d.x * b.e2y[lane] - d.y * b.e2x[lane];
+		float det = (b.e1x[lane] * px + b.e1y[lane] * py) + b.e1z[lane] * pz;
+		float inverse = 1.0f / det;
+
+		float tx = ray.origin.x - b.v0x[lane];
+		float ty = ray.origin.y - b.v0y[lane];
+		float tz = ray.origin.z - b.v0z[lane];
+		float u = ((tx * px + ty * py) + tz * pz) * inverse;
+
+		float qx = ty * b.e1z[lane] - tz * b.e1y[lane];
+		float qy = tz * b.e1x[lane] - tx * b.e1z[lane];
+		float qz = tx * b.e1y[lane] - ty * b.e1x[lane];
+		float v = ((d.x * qx + d.y * qy) + d.z * qz) * inverse;
+		float t = ((b.e2x[lane] * qx + b.e2y[lane] * qy) + b.e2z[lane] * qz) * inverse;
+
+		distances[lane] = t;
+		us[lane] = u;
+		vs[lane] = v;
+		if (det != 0.0f && u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < hit.distance)
+			mask |= 1 << lane;
+	}
+	if (mask == 0)
+		return false;
+#endif
+
+	for (U32 lane = 0; lane < 4; ++lane)
+	{
+		if ((mask & (1 << lane)) && distances[lane] < hit.distance)
+		{
+			hit.distance = distances[lane];
+			hit.u = us[lane];
+			hit.v = vs[lane];
+			hit.triangle = b.triangle[lane];
+		}
+	}
+	return true;
+}
+
+template<bool any>
+bool TriangleBvh::trace(const Ray& ray, Hit& hit) const
+{
+	hit.triangle = ~0u;
+	hit.distance = ray.maxDistance;
+	if (empty())
+		return false;
+
+	glm::vec3 inverse = 1.0f / ray.direction;
+
+	struct Entry
+	{
+		U32 node;
+		float distance;
+	};
+
+	// Reused so tracing doesn't allocate
+	thread_local std::vector<Entry> stack;
+	stack.clear();
+
+	float rootDistance = Bvh::intersect({ nodes[0].minimum, nodes[0].maximum }, ray.origin, inverse, hit.distance);
+	if (rootDistance >= 0.0f)
+		stack.push_back({ 0, rootDistance });
+
+	bool found = false;
+	while (!stack.empty())
+	{
+		Entry entry = stack.back();
+		stack.pop_back();
+		if (entry.distance > hit.distance)
+			continue;
+
+		const Bvh::Node& node = nodes[entry.node];
+		if (node.isLeaf())
+		{
+			if (intersect(blocks[node.first], ray, hit))
+			{
+				found = true;
+				if (any)
+					return true;
+			}
+			continue;
+		}
+
+		// Nearer child goes on top
+		const Bvh::Node& left = nodes[node.first];
+		const Bvh::Node& right = nodes[node.first + 1];
+		float leftDistance = Bvh::intersect({ left.minimum, left.maximum }, ray.origin, inverse, hit.distance);
+		float rightDistance = Bvh::intersect({ right.minimum, right.maximum }, ray.origin, inverse, hit.distance);
+		if (leftDistance >= 0.0f && rightDistance >= 0.0f)
+		{
+			bool leftFirst = leftDistance <= rightDistance;
+			stack.push_back(leftFirst ? Entry{ node.first + 1, rightDistance } : Entry{ node.first, leftDistance });
+			stack.push_back(leftFirst ? Entry{ node.first, leftDistance } : Entry{ node.first + 1, rightDistance });
+		}
+		else if (leftDistance >= 0.0f)
+		{
+			stack.push_back({ node.first, leftDistance });
+		}
+		else if (rightDistance >= 0.0f)
+		{
+			stack.push_back({ node.first + 1, rightDistance });
+		}
+	}
+	return found;
+}
+
+bool TriangleBvh::raycast(const Ray& ray, Hit& hit) const
+{
+	return trace<false>(ray, hit);
+}
+
+bool TriangleBvh::occluded(const Ray& ray) const
+{
+	Hit hit;
+	return trace<true>(ray, hit);
+}
+
+void TriangleBvh::raycast(const Ray* rays, U32 count, Hit* hits) const
+{
+	for (U32 i = 0; i < count; i += packetSize)
+		tracePacket(rays + i, count - i < packetSize ? count - i : packetSize, hits + i);
+}
+
+#ifdef TRIANGLE_BVH_SSE
+
+// The rays go down the tree together while any of them is still inside the
+// node. Leaves broadcast one triangle at a time against the 4 rays.
+void TriangleBvh::tracePacket(const Ray* rays, U32 count, Hit* hits) const
+{
+	alignas(16) float ox[4], oy[4], oz[4], dx[4], dy[4], dz[4], ix[4], iy[4], iz[4], best[4];
+	for (U32 lane = 0; lane < 4; ++lane)
+	{
+		// Missing lanes repeat the first ray with nothing left to find
+		const Ray& ray = rays[lane < count ? lane : 0];
+		ox[lane] = ray.origin.x;
+		oy[lane] = ray.origin.y;
+		oz[lane] = ray.origin.z;
+		dx[lane] = ray.direction.x;
+		dy[lane] = ray.direction.y;
+		dz[lane] = ray.direction.z;
+		ix[lane] = 1.0f / ray.direction.x;
+		iy[lane] = 1.0f / ray.direction.y;
+		iz[lane] = 1.0f / ray.direction.z;
+		best[lane] = lane < count ? ray.maxDistance : -1.0f;
+	}
+	for (U32 lane = 0; lane < count; ++lane)
+	{
+		hits[lane].triangle = ~0u;
+		hits[lane].distance = rays[lane].maxDistance;
+	}
+	if (empty())
+		return;
+
+	__m128 Ox = _mm_load_ps(ox), Oy = _mm_load_ps(oy), Oz = _mm_load_ps(oz);
+	__m128 Dx = _mm_load_ps(dx), Dy = _mm_load_ps(dy), Dz = _mm_load_ps(dz);
+	__m128 Ix = _mm_load_ps(ix), Iy = _mm_load_ps(iy), Iz = _mm_load_ps(iz);
+	__m128 Best = _mm_load_ps(best);
+	__m128 U = _mm_setzero_ps(), V = _mm_setzero_ps();
+	__m128i Triangle = _mm_set1_epi32(-1);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	thread_local std::vector<U32> stack;
+	stack.clear();
+	stack.push_back(0);
+	while (!stack.empty())
+	{
+		const Bvh::Node& node = nodes[stack.back()];
+		stack.pop_back();
+
+		// Slabs, lanes whose nearest hit is before the box drop out
+		__m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.minimum.x), Ox), Ix), x1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.maximum.x), Ox), Ix);
+		__m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.minimum.y), Oy), Iy), y1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.maximum.y), Oy), Iy);
+		__m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.minimum.z), Oz), Iz), z1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.maximum.z), Oz), Iz);
+		__m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_max_ps(_mm_min_ps(z0, z1), zero));
+		__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_min_ps(_mm_max_ps(z0, z1), Best));
+		if (_mm_movemask_ps(_mm_cmple_ps(entry, exit)) == 0)
+			continue;
+
+		if (!node.isLeaf())
+		{
+			// Far child first so the near one is popped next, judged along the
+			// first ray
+			const Bvh::Node& left = nodes[node.first];
+			const Bvh::Node& right = nodes[node.first + 1];
+			glm::vec3 axis = (right.minimum + right.maximum) - (left.minimum + left.maximum);
+			bool leftFirst = axis.x * dx[0] + axis.y * dy[0] + axis.z * dz[0] >= 0.0f;
+			stack.push_back(leftFirst ? node.first + 1 : node.first);
+			stack.push_back(leftFirst ? node.first : node.first + 1);
+			continue;
+		}
+
+		const Block& b = blocks[node.first];
+		for (U32 lane = 0; lane < node.count; ++lane)
+		{
+			__m128 e1x = _mm_set1_ps(b.e1x[lane]), e1y = _mm_set1_ps(b.e1y[lane]), e1z = _mm_set1_ps(b.e1z[lane]);
+			__m128 e2x = _mm_set1_ps(b.e2x[lane]), e2y = _mm_set1_ps(b.e2y[lane]), e2z = _mm_set1_ps(b.e2z[lane]);
+
+			__m128 px = _mm_sub_ps(_mm_mul_ps(Dy, e2z), _mm_mul_ps(Dz, e2y));
+			__m128 py = _mm_sub_ps(_mm_mul_ps(Dz, e2x), _mm_mul_ps(Dx, e2z));
+			__m128 pz = _mm_sub_ps(_mm_mul_ps(Dx, e2y), _mm_mul_ps(Dy, e2x));
+			__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			__m128 inverse = _mm_div_ps(one, det);
+
+			__m128 tx = _mm_sub_ps(Ox, _mm_set1_ps(b.v0x[lane]));
+			__m128 ty = _mm_sub_ps(Oy, _mm_set1_ps(b.v0y[lane]));
+			__m128 tz = _mm_sub_ps(Oz, _mm_set1_ps(b.v0z[lane]));
+			__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inverse);
+
+			__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+			__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+			__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+			__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(Dx, qx), _mm_mul_ps(Dy, qy)), _mm_mul_ps(Dz, qz)), inverse);
+			__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverse);
+
+			__m128 valid = _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+			valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+			valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, Best)));
+			if (_mm_movemask_ps(valid) == 0)
+				continue;
+
+			Best = _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, Best));
+			U = _mm_or_ps(_mm_and_ps(valid, u), _mm_andnot_ps(valid, U));
+			V = _mm_or_ps(_mm_and_ps(valid, v), _mm_andnot_ps(valid, V));
+			__m128i validInt = _mm_castps_si128(valid);
+			Triangle = _mm_or_si128(_mm_and_si128(validInt, _mm_set1_epi32(S32(b.triangle[lane]))), _mm_andnot_si128(validInt, Triangle));
+		}
+	}
+
+	alignas(16) float distances[4], us[4], vs[4];
+	alignas(16) U32 triangles[4];
+	_mm_store_ps(distances, Best);
+	_mm_store_ps(us, U);
+	_mm_store_ps(vs, V);
+	_mm_store_si128(reinterpret_cast<__m128i*>(triangles), Triangle);
+	for (U32 lane = 0; lane < count; ++lane)
+	{
+		hits[lane].triangle = triangles[lane];
+		if (triangles[lane] != ~0u)
+		{
+			hits[lane].distance = distances[lane];
+			hits[lane].u = us[lane];
+			hits[lane].v = vs[lane];
+		}
+	}
+}
+
+#else
+
+void TriangleBvh::tracePacket(const Ray* rays, U32 count, Hit* hits) const
+{
+	for (U32 i = 0; i < count; ++i)
+		raycast(rays[i], hits[i]);
+}
+
+#endif
+
+bool TriangleBvh::loadCooked(std::string path)
+{
+	File file;
+	if (!file.open(path, File::Mode(File::binary | File::in)))
+	{
+		LOG_WARN("Can't open cooked BVH: " << path);
+		return false;
+	}
+
+	U32 magic, version, vertices, indices, nodeCount, blockCount;
+	file.read(magic);
+	file.read(version);
+	if (magic != cookedMagic || version != cookedVersion)
+	{
+		LOG_WARN("Cooked BVH has bad header or version: " << path);
+		return false;
+	}
+
+	file.read(vertices);
+	file.read(indices);
+	file.read(nodeCount);
+	file.read(blockCount);
+	if (file.getSize() != S64(sizeof(U32) * 6 + sizeof(Bvh::Node) * nodeCount + sizeof(Block) * blockCount))
+	{
+		LOG_WARN("Cooked BVH is truncated: " << path);
+		return false;
+	}
+
+	vertexCount = vertices;
+	indexCount = indices;
+	nodes.resize(nodeCount);
+	blocks.resize(blockCount);
+	file.readArray(nodes.data(), nodeCount);
+	file.readArray(blocks.data(), blockCount);
+	return true;
+}
+
+bool TriangleBvh::saveCooked(std::string path)
+{
+	File file;
+	if (!file.create(std::move(path), File::Mode(File::binary | File::out | File::trunc)))
+		return false;
+
+	file.write(cookedMagic);
+	file.write(cookedVersion);
+	file.write(vertexCount);
+	file.write(indexCount);
+	file.write(U32(nodes.size()));
+	file.write(U32(blocks.size()));
+	file.writeArray(nodes.data(), U32(nodes.size()));
+	file.writeArray(blocks.data(), U32(blocks.size()));
+	return file.fstream().good();
+}
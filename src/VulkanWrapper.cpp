@@ -101,4 +101,14 @@ U32 PhysicalDeviceDetails::getMemoryType(U32 typeFilter, VkMemoryPropertyFlags p
 		}
 	}
 	LOG_FATAL("Suitable memory type not found");
+}
+
+bool PhysicalDeviceDetails::hasMemoryType(U32 typeFilter, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return true;
+		}
+	}
+	return false;
 }
\ No newline at end of file
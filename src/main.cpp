@@ -1,8 +1,31 @@
 #include "PCH.hpp"
 #include "Engine.hpp"
+#include "PipelineCache.hpp"
+#include "ShaderCache.hpp"
+#include "ShaderHotReload.hpp"
 
 int main(int argc, char **argv)
 {
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::string(argv[i]) == "--no-shader-cache")
+			ShaderCache::enabled = false;
+		else if (std::string(argv[i]) == "--no-pipeline-cache")
+			PipelineCache::enabled = false;
+		else if (std::string(argv[i]) == "--no-hot-reload")
+			ShaderHotReload::enabled = false;
+		else if (std::string(argv[i]) == "--record-threads" && i + 1 < argc)
+			Renderer::recordThreads = U32(std::max(1, std::atoi(argv[++i])));
+		else if (std::string(argv[i]) == "--no-gpu-culling")
+			GpuCulling::enabled = false;
+		else if (std::string(argv[i]) == "--verify-gpu-culling")
+			GpuCulling::verify = true;
+		else if (std::string(argv[i]) == "--no-render-thread")
+			Engine::threadedRendering = false;
+		else if (std::string(argv[i]) == "--debug-light-clusters")
+			Renderer::debugLightClusters = true;
+	}
+
 	LOG_INFO("Engine started");
 	Engine::start();
 }
\ No newline at end of file
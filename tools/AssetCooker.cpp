@@ -0,0 +1,357 @@
+// Offline asset cooker
+//
+// Walks a source asset tree and converts everything the runtime would otherwise
+// convert in Renderer::init into the cooked directory:
+//   *.obj                      -> cooked/<path>.mesh      (deduplicated, vertex cache optimised)
+//                                 cooked/<path>.bvh       (triangle BVH of the cooked mesh for picking)
+//   *.png, *.jpg, *.tga, *.bmp -> cooked/<path>.tex       (full mip chain, BC1 unless --uncompressed)
+//   *.glsl                     -> cooked/<path>.vert.spv  (one SPIR-V module per stage macro used)
+//
+// Runs headlessly: no window, Vulkan instance or device is created.
+
+#include "PCH.hpp"
+#include "Clock.hpp"
+#include "Cooked.hpp"
+#include "CookedTexture.hpp"
+#include "File.hpp"
+#include "Image.hpp"
+#include "Mesh.hpp"
+#include "ShaderCache.hpp"
+#include "ShaderCompiler.hpp"
+#include "ShaderIncluder.hpp"
+#include "TriangleBvh.hpp"
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+static std::mutex logMutex;
+
+#define COOK_LOG(m) { std::lock_guard<std::mutex> lock(logMutex); std::cout << m << std::endl; }
+
+struct CookOptions
+{
+	fs::path root = ".";
+	bool compress = true;
+	bool force = false;
+	U32 jobs = 0;
+};
+
+struct CookJob
+{
+	enum Type { MeshJob, TextureJob, ShaderJob } type;
+	fs::path source;
+	std::string relative;
+};
+
+struct ShaderStageInfo
+{
+	const char* macro;
+	const char* extension;
+	shaderc_shader_kind kind;
+};
+
+static const ShaderStageInfo shaderStages[] =
+{
+	{ "VERTEX", ".vert.spv", shaderc_glsl_vertex_shader },
+	{ "FRAGMENT", ".frag.spv", shaderc_glsl_fragment_shader },
+	{ "GEOMETRY", ".geom.spv", shaderc_glsl_geometry_shader },
+	{ "COMPUTE", ".comp.spv", shaderc_glsl_compute_shader },
+};
+
+static bool isUpToDate(const fs::path& source, const std::string& cooked, const CookOptions& options)
+{
+	if (options.force)
+		return false;
+
+	std::error_code ec;
+	if (!fs::exists(cooked, ec))
+		return false;
+	return fs::last_write_time(cooked, ec) >= fs::last_write_time(source, ec);
+}
+
+static bool prepareOutput(const std::string& cooked)
+{
+	std::error_code ec;
+	fs::create_directories(fs::path(cooked).parent_path(), ec);
+	return !ec;
+}
+
+static bool cookMesh(const CookJob& job, const CookOptions& options)
+{
+	std::string out = Cooked::path(job.relative, ".mesh");
+	std::string bvhOut = Cooked::path(job.relative, ".bvh");
+	if (isUpToDate(job.source, out, options) && isUpToDate(job.source, bvhOut, options))
+		return true;
+
+	Mesh mesh;
+	if (!mesh.loadObj(job.source.string()))
+		return false;
+
+	size_t sourceIndices = mesh.indices.size();
+	mesh.optimise();
+
+	if (!prepareOutput(out) || !mesh.saveCooked(out))
+	{
+		COOK_LOG("FAILED: " << job.relative << " - can't write " << out);
+		return false;
+	}
+
+	// Built after optimise(), the tree refers to the cooked triangle order
+	TriangleBvh bvh;
+	bvh.build(mesh);
+	if (!bvh.saveCooked(bvhOut))
+	{
+		COOK_LOG("FAILED: " << job.relative << " - can't write " << bvhOut);
+		return false;
+	}
+
+	COOK_LOG("mesh    " << job.relative << " -> " << out << " (" << mesh.vertices.size() << " vertices, " << sourceIndices / 3 << " triangles)");
+	return true;
+}
+
+static bool cookTexture(const CookJob& job, const CookOptions& options)
+{
+	std::string out = Cooked::path(job.relative, ".tex");
+	if (isUpToDate(job.source, out, options))
+		return true;
+
+	Image image;
+	image.load(job.source.string());
+	if (image.data.empty())
+		return false;
+
+	CookedTexture texture;
+	texture.build(image, options.compress ? CookedTexture::BC1 : CookedTexture::RGBA8);
+
+	if (!prepareOutput(out) || !texture.save(out))
+	{
+		COOK_LOG("FAILED: " << job.relative << " - can't write " << out);
+		return false;
+	}
+
+	COOK_LOG("texture " << job.relative << " -> " << out << " (" << texture.width << "x" << texture.height << ", " << texture.levels.size() << " mips)");
+	return true;
+}
+
+static bool cookShader(const CookJob& job, const CookOptions& options)
+{
+	File file;
+	std::string sourcePath = job.source.string();
+	if (!file.open(sourcePath, File::Mode(File::binary | File::in)))
+	{
+		COOK_LOG("FAILED: " << job.relative << " - can't open");
+		return false;
+	}
+
+	std::string source;
+	source.resize(file.getSize());
+	if (!source.empty())
+		file.readFile(&source[0]);
+
+	// A stage is stale when the shader or anything it includes is newer
+	ShaderIncluder::scan(job.relative);
+	std::set<std::string> dependencies = ShaderIncluder::graph.getDependencies(ShaderIncluder::normalise(job.relative));
+	auto upToDate = [&](const std::string& out)
+	{
+		if (!isUpToDate(job.source, out, options))
+			return false;
+		for (const std::string& dependency : dependencies)
+		{
+			if (!isUpToDate(dependency, out, options))
+				return false;
+		}
+		return true;
+	};
+
+	bool anyStage = false;
+	bool ok = true;
+	for (const auto& stage : shaderStages)
+	{
+		if (source.find(stage.macro) == std::string::npos)
+			continue;
+		anyStage = true;
+
+		std::string out = Cooked::path(job.relative, stage.extension);
+		if (upToDate(out))
+			continue;
+
+		// Same compile path and options as the runtime, includes resolve
+		// the same way from the asset root
+		ShaderCompiler::Job compileJob;
+		compileJob.name = job.relative;
+		compileJob.source = source;
+		compileJob.kind = stage.kind;
+		compileJob.macros.emplace_back(stage.macro, "");
+		compileJob.optimize = true;
+
+		ShaderCompiler::Result result = ShaderCompiler::compile(compileJob);
+		if (!result.success)
+		{
+			COOK_LOG("FAILED: " << job.relative << " (" << stage.macro << ")" << std::endl << result.log);
+			ok = false;
+			continue;
+		}
+
+		std::vector<U32>& spv = result.spv;
+		File output;
+		if (!prepareOutput(out) || !output.create(std::move(out), File::Mode(File::binary | File::out | File::trunc)))
+		{
+			COOK_LOG("FAILED: " << job.relative << " - can't write " << Cooked::path(job.relative, stage.extension));
+			ok = false;
+			continue;
+		}
+		output.writeArray(spv.data(), U32(spv.size()));
+
+		COOK_LOG("shader  " << job.relative << " -> " << output.meta.path << " (" << stage.macro << ", " << spv.size() * sizeof(U32) << " bytes)");
+	}
+
+	if (!anyStage)
+		COOK_LOG("WARN: " << job.relative << " uses no known stage macro, skipped");
+
+	return ok;
+}
+
+static bool hasExtension(const fs::path& path, std::initializer_list<const char*> extensions)
+{
+	std::string ext = path.extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+	for (auto e : extensions)
+		if (ext == e)
+			return true;
+	return false;
+}
+
+static std::vector<CookJob> gatherJobs(const CookOptions& options)
+{
+	std::vector<CookJob> jobs;
+	fs::path cookedDir = fs::weakly_canonical(options.root / fs::path(Cooked::directory).parent_path());
+
+	std::error_code ec;
+	for (auto it = fs::recursive_directory_iterator(options.root, ec); it != fs::recursive_directory_iterator(); it.increment(ec))
+	{
+		if (ec)
+			break;
+
+		const fs::path& path = it->path();
+		if (it->is_directory())
+		{
+			std::string name = path.filename().string();
+			if ((!name.empty() && name[0] == '.') || fs::weakly_canonical(path) == cookedDir)
+				it.disable_recursion_pending();
+			continue;
+		}
+
+		CookJob job;
+		job.source = path;
+		job.relative = fs::relative(path, options.root).generic_string();
+
+		if (hasExtension(path, { ".obj" }))
+			job.type = CookJob::MeshJob;
+		else if (hasExtension(path, { ".png", ".jpg", ".jpeg", ".tga", ".bmp" }))
+			job.type = CookJob::TextureJob;
+		else if (hasExtension(path, { ".glsl" }))
+			job.type = CookJob::ShaderJob;
+		else
+			continue;
+
+		jobs.push_back(job);
+	}
+
+	return jobs;
+}
+
+static void printUsage()
+{
+	std::cout << "Usage: AssetCooker [options] [asset root]" << std::endl
+		<< "  --out <dir>       cooked output directory relative to the root (default: cooked/)" << std::endl
+		<< "  --jobs <n>        worker threads (default: all cores)" << std::endl
+		<< "  --uncompressed    keep textures as RGBA8 instead of BC1" << std::endl
+		<< "  --force           recook assets even when the output is up to date" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	CookOptions options;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--uncompressed")
+			options.compress = false;
+		else if (arg == "--force")
+			options.force = true;
+		else if (arg == "--jobs" && i + 1 < argc)
+			options.jobs = U32(std::max(1, std::atoi(argv[++i])));
+		else if (arg == "--out" && i + 1 < argc)
+		{
+			Cooked::directory = argv[++i];
+			if (Cooked::directory.back() != '/')
+				Cooked::directory += '/';
+		}
+		else if (arg == "--help" || arg == "-h")
+		{
+			printUsage();
+			return 0;
+		}
+		else
+			options.root = arg;
+	}
+
+	if (!fs::is_directory(options.root))
+	{
+		std::cout << "Asset root is not a directory: " << options.root << std::endl;
+		printUsage();
+		return 1;
+	}
+
+	// Cooked paths are relative to the asset root, same as the runtime working directory
+	fs::current_path(options.root);
+	// The cooker has its own up to date check, don't fill the runtime's cache
+	ShaderCache::enabled = false;
+	options.root = ".";
+
+	if (options.jobs == 0)
+		options.jobs = std::max(1u, std::thread::hardware_concurrency());
+
+	Clock clock;
+	Time start = clock.time();
+
+	std::vector<CookJob> jobs = gatherJobs(options);
+	LOG_INFO("Cooking " << jobs.size() << " assets on " << options.jobs << " threads into " << Cooked::directory);
+
+	std::atomic<size_t> next(0);
+	std::atomic<U32> failed(0);
+
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < jobs.size(); i = next++)
+		{
+			const CookJob& job = jobs[i];
+			bool ok = false;
+			switch (job.type)
+			{
+			case CookJob::MeshJob: ok = cookMesh(job, options); break;
+			case CookJob::TextureJob: ok = cookTexture(job, options); break;
+			case CookJob::ShaderJob: ok = cookShader(job, options); break;
+			}
+			if (!ok)
+				++failed;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (U32 i = 1; i < options.jobs; ++i)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& thread : threads)
+		thread.join();
+
+	Time elapsed = clock.time() - start;
+	LOG_INFO("Cooked " << jobs.size() - failed << "/" << jobs.size() << " assets in " << elapsed.getSecondsf() << " seconds");
+
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,2330 @@
+// Engine micro benchmarks
+//
+// Headless, CPU only. Each suite is selected by name on the command line:
+//   EngineBench shaders [--features <n>] [--threads <max>]
+//   EngineBench reflection
+//   EngineBench includes
+//   EngineBench keywords
+//   EngineBench graph
+//   EngineBench draws [--draws <max>]
+//   EngineBench cull [--objects <max>] [--threads <max>]
+//   EngineBench occlusion [--occluders <n>] [--threads <max>] [--save <prefix>]
+//   EngineBench bvh [--objects <max>]
+//   EngineBench rays [--model <path>] [--threads <max>]
+//   EngineBench bake [--model <path>] [--threads <max>] [--save <prefix>]
+//   EngineBench lights [--lights <max>] [--threads <max>]
+//   EngineBench handoff
+//   EngineBench jobs [--threads <n>]
+//   EngineBench fibers [--threads <n>]
+//   EngineBench assets [--assets <n>] [--threads <n>]
+//
+//   shaders   compile throughput of ShaderCompiler versus worker thread count
+//             on a generated corpus of shader permutations
+//   reflection SPIR-V reflection checked on hand assembled modules: vertex
+//             inputs, push constants, uniform, storage, image and sampler
+//             bindings, arrays and runtime arrays, merging and bad input
+//   includes  shader include graph queries checked on diamonds and cycles,
+//             and ShaderIncluder scans of generated files before and after
+//             an edit
+//   keywords  shader keyword keys checked: key bits, which variant a key
+//             compiles to, and the specialization constants it sets, built
+//             once per combination
+//   graph     render graph compiles checked on small frames: culling of
+//             unread passes, dependency levels, barrier stages, accesses and
+//             layouts, and transient memory aliasing
+//   draws     draw key sort throughput, radix versus std::sort, and the state
+//             binds and instanced draw calls left after sorting, from 10k
+//             draws up
+//   cull      frustum culling throughput per instruction set, single threaded
+//             and across threads, from 100k boxes up
+//   occlusion CPU occluder rasterising and Hi-Z box tests on a generated city,
+//             checked pixel for pixel against a brute force reference
+//             rasteriser, optionally saving both depth images as PNG
+//   bvh       scene BVH build, refit and update times and frustum, sphere,
+//             box and ray query throughput for 4 and 8 wide nodes, checked
+//             against brute force, from 100k boxes up
+//   rays      triangle BVH build time and rays per second against a model,
+//             single rays and packets, coherent camera rays and random ones,
+//             checked against brute force on a sample
+//   bake      lightmap baking throughput in rays per second per core, ambient
+//             occlusion alone and with light, on one thread and all of them,
+//             checking both give the same images
+//   lights    clustered light binning per instruction set, single threaded
+//             and across threads, on a 1080p froxel grid from 1k lights up,
+//             checked against brute force binning
+//   handoff   render snapshot triple buffer between a simulation and a render
+//             thread, stress tested for torn or stale snapshots, and frame
+//             times of serial versus threaded rendering with stand-in costs
+//   jobs      work stealing job system against a mutex queue thread pool and
+//             std::async: small task overhead, even and uneven parallel
+//             loops, and nested fork-join
+//   fibers    fiber scheduler context switch cost, and jobs that wait on
+//             other jobs on fibers versus the job system
+//   assets    coroutine asset loading, reads, PNG decodes and stand-in GPU
+//             uploads overlapped by AssetScheduler versus loading one after
+//             the other, and the cost of awaiting a Task
+
+#include "PCH.hpp"
+#include "AssetScheduler.hpp"
+#include "Bvh.hpp"
+#include "Clock.hpp"
+#include "DrawList.hpp"
+#include "File.hpp"
+#include "FiberScheduler.hpp"
+#include "FrustumCuller.hpp"
+#include "Image.hpp"
+#include "JobSystem.hpp"
+#include "LightClusters.hpp"
+#include "LightmapBaker.hpp"
+#include "Model.hpp"
+#include "OcclusionCuller.hpp"
+#include "RadixSort.hpp"
+#include "RenderGraph.hpp"
+#include "RenderSnapshot.hpp"
+#include "ShaderReflection.hpp"
+#include "ShaderCache.hpp"
+#include "ShaderCompiler.hpp"
+#include "ShaderIncluder.hpp"
+#include "ShaderKeywords.hpp"
+#include "ThreadPool.hpp"
+#include "TripleBuffer.hpp"
+#include "TriangleBvh.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <sstream>
+#include <thread>
+
+struct BenchOptions
+{
+	U32 features = 6;
+	U32 threads = 0;
+	U32 draws = 1000000;
+	U32 objects = 1000000;
+	U32 occluders = 400;
+	U32 lights = 10000;
+	U32 assets = 32;
+	std::string save;
+	std::string model = "models/chalet.obj";
+};
+
+// Correctness suites count what they find wrong and fail if anything was
+static U32 failures = 0;
+
+static void expect(bool condition, const std::string& what)
+{
+	if (condition)
+		return;
+	LOG_WARN("FAILED: " << what);
+	++failures;
+}
+
+// Fragment shader with one #ifdef block per feature, every subset of the
+// features is a distinct permutation so the corpus has 2^features jobs
+static std::string permutationSource(U32 features)
+{
+	std::ostringstream s;
+	s << "#version 450\n"
+		<< "layout(binding = 0) uniform sampler2D texSampler;\n"
+		<< "layout(location = 0) in vec3 fragColor;\n"
+		<< "layout(location = 1) in vec2 fragTexCoord;\n"
+		<< "layout(location = 0) out vec4 outColor;\n"
+		<< "void main()\n"
+		<< "{\n"
+		<< "\tvec4 c = texture(texSampler, fragTexCoord) * vec4(fragColor, 1.0);\n";
+
+	for (U32 f = 0; f < features; ++f)
+	{
+		s << "#ifdef FEATURE_" << f << "\n"
+			<< "\tfor (int i = 0; i < " << 4 + f << "; ++i)\n"
+			<< "\t\tc.rgb = mix(c.rgb, texture(texSampler, fragTexCoord * " << f + 2 << ".0 + float(i)).rgb, 0." << f + 1 << ");\n"
+			<< "#endif\n";
+	}
+
+	s << "\toutColor = c;\n"
+		<< "}\n";
+	return s.str();
+}
+
+static std::vector<ShaderCompiler::Job> permutationJobs(U32 features)
+{
+	std::string source = permutationSource(features);
+
+	std::vector<ShaderCompiler::Job> jobs;
+	for (U32 mask = 0; mask < (1u << features); ++mask)
+	{
+		ShaderCompiler::Job job;
+		job.name = "permutation_" + std::to_string(mask);
+		job.source = source;
+		job.kind = shaderc_glsl_fragment_shader;
+		for (U32 f = 0; f < features; ++f)
+		{
+			if (mask & (1u << f))
+				job.macros.emplace_back("FEATURE_" + std::to_string(f), "1");
+		}
+		jobs.push_back(std::move(job));
+	}
+	return jobs;
+}
+
+static int benchShaders(const BenchOptions& options)
+{
+	// Measure the compiler, not the disk cache
+	ShaderCache::enabled = false;
+
+	U32 maxThreads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+	std::vector<ShaderCompiler::Job> corpus = permutationJobs(options.features);
+	LOG_INFO("Compiling " << corpus.size() << " permutations, up to " << maxThreads << " threads");
+
+	// Powers of two up to, and always including, maxThreads
+	std::vector<U32> threadCounts;
+	for (U32 threads = 1; threads < maxThreads; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(maxThreads);
+
+	Clock clock;
+	double baseline = 0.0;
+
+	for (U32 threads : threadCounts)
+	{
+		ShaderCompiler compiler(threads);
+
+		// Warm up so every worker has constructed its shaderc::Compiler
+		std::vector<ShaderCompiler::Job> warmup(corpus.begin(), corpus.begin() + std::min<size_t>(threads, corpus.size()));
+		for (auto& f : compiler.submit(warmup))
+			f.get();
+
+		Time start = clock.time();
+		U32 failed = 0;
+		for (auto& f : compiler.submit(corpus))
+		{
+			if (!f.get().success)
+				++failed;
+		}
+		Time elapsed = clock.time() - start;
+
+		double perSecond = corpus.size() / std::max(elapsed.getSeconds(), 1e-6);
+		if (threads == 1)
+			baseline = perSecond;
+
+		LOG_INFO(threads << " threads: " << elapsed.getMilliSecondsf() << " ms, " << perSecond << " shaders/s, speedup " << perSecond / baseline << "x" << (failed ? " (" + std::to_string(failed) + " failed)" : ""));
+	}
+	return 0;
+}
+
+// Pipeline, descriptor set and vertex buffer changes walking the draws in order
+// Assembles SPIR-V one instruction at a time, ids are picked by hand
+struct SpirvModule
+{
+	std::vector<U32> words { 0x07230203, 0x00010000, 0, 0, 0 };
+
+	void op(U32 opcode, std::initializer_list<U32> operands)
+	{
+		words.push_back(U32(operands.size() + 1) << 16 | opcode);
+		words.insert(words.end(), operands);
+	}
+
+	// OpName, the string is nul terminated and padded to whole words
+	void name(U32 id, const std::string& text)
+	{
+		std::vector<U32> operands(1 + text.size() / 4 + 1, 0);
+		operands[0] = id;
+		memcpy(&operands[1], text.data(), text.size());
+		words.push_back(U32(operands.size() + 1) << 16 | 5);
+		words.insert(words.end(), operands.begin(), operands.end());
+	}
+
+	void decorate(U32 id, U32 decoration, U32 value) { op(71, { id, decoration, value }); }
+	void decorate(U32 id, U32 decoration) { op(71, { id, decoration }); }
+	void memberDecorate(U32 id, U32 member, U32 decoration, U32 value) { op(72, { id, member, decoration, value }); }
+
+	std::vector<U32> finish(U32 bound)
+	{
+		words[3] = bound;
+		return words;
+	}
+};
+
+// SPIR-V numbers the modules below use
+namespace spvBench
+{
+	enum : U32
+	{
+		OpEntryPoint = 15, OpTypeInt = 21, OpTypeFloat = 22, OpTypeVector = 23, OpTypeMatrix = 24,
+		OpTypeImage = 25, OpTypeSampler = 26, OpTypeSampledImage = 27, OpTypeArray = 28,
+		OpTypeRuntimeArray = 29, OpTypeStruct = 30, OpTypePointer = 32, OpConstant = 43, OpVariable = 59,
+		Block = 2, ArrayStride = 6, MatrixStride = 7, BuiltIn = 11, Location = 30, Binding = 33, DescriptorSet = 34, Offset = 35,
+		UniformConstant = 0, Input = 1, Uniform = 2, PushConstant = 9, StorageBuffer = 12
+	};
+}
+
+// Vertex stage: vec3, vec2, mat4 and ivec4 inputs plus a built in, a
+// 128 byte uniform block at 0.0 and a mat4 push constant
+static std::vector<U32> vertexModule()
+{
+	using namespace spvBench;
+	SpirvModule m;
+	m.op(OpEntryPoint, { 0, 100, 0x6E69616D, 0 });
+	m.op(OpTypeFloat, { 1, 32 });
+	m.op(OpTypeVector, { 2, 1, 3 });
+	m.op(OpTypeVector, { 3, 1, 2 });
+	m.op(OpTypeVector, { 4, 1, 4 });
+	m.op(OpTypeMatrix, { 5, 4, 4 });
+	m.op(OpTypeInt, { 6, 32, 1 });
+	m.op(OpTypeVector, { 7, 6, 4 });
+
+	m.op(OpTypePointer, { 10, Input, 2 });
+	m.op(OpTypePointer, { 11, Input, 3 });
+	m.op(OpTypePointer, { 12, Input, 5 });
+	m.op(OpTypePointer, { 13, Input, 7 });
+	m.op(OpTypePointer, { 14, Input, 6 });
+	m.op(OpVariable, { 10, 20, Input });
+	m.op(OpVariable, { 11, 21, Input });
+	m.op(OpVariable, { 12, 22, Input });
+	m.op(OpVariable, { 13, 23, Input });
+	m.op(OpVariable, { 14, 24, Input });
+	m.name(20, "inPosition");
+	m.decorate(20, Location, 0);
+	m.decorate(21, Location, 1);
+	m.decorate(22, Location, 2);
+	m.decorate(23, Location, 6);
+	m.decorate(24, BuiltIn, 42);
+
+	m.op(OpTypeStruct, { 30, 5, 5 });
+	m.name(30, "UniformBufferObject");
+	m.memberDecorate(30, 0, Offset, 0);
+	m.memberDecorate(30, 1, Offset, 64);
+	m.memberDecorate(30, 0, MatrixStride, 16);
+	m.memberDecorate(30, 1, MatrixStride, 16);
+	m.decorate(30, Block);
+	m.op(OpTypePointer, { 31, Uniform, 30 });
+	m.op(OpVariable, { 31, 32, Uniform });
+	m.decorate(32, DescriptorSet, 0);
+	m.decorate(32, Binding, 0);
+
+	m.op(OpTypeStruct, { 40, 5 });
+	m.memberDecorate(40, 0, Offset, 0);
+	m.memberDecorate(40, 0, MatrixStride, 16);
+	m.decorate(40, Block);
+	m.op(OpTypePointer, { 41, PushConstant, 40 });
+	m.op(OpVariable, { 41, 42, PushConstant });
+	return m.finish(50);
+}
+
+// Fragment stage: a 16 byte uniform block sharing 0.0 with the vertex
+// stage, an array of 4 samplers, a storage buffer ending in a runtime
+// array, a lone sampler, a storage image, a runtime array of samplers in
+// set 1 and a push constant from byte 64
+static std::vector<U32> fragmentModule()
+{
+	using namespace spvBench;
+	SpirvModule m;
+	m.op(OpEntryPoint, { 4, 100, 0x6E69616D, 0 });
+	m.op(OpTypeFloat, { 1, 32 });
+	m.op(OpTypeVector, { 4, 1, 4 });
+	m.op(OpTypeInt, { 6, 32, 0 });
+	m.op(OpConstant, { 6, 8, 4 });
+
+	m.op(OpTypeStruct, { 30, 4 });
+	m.memberDecorate(30, 0, Offset, 0);
+	m.decorate(30, Block);
+	m.op(OpTypePointer, { 31, Uniform, 30 });
+	m.op(OpVariable, { 31, 32, Uniform });
+	m.decorate(32, DescriptorSet, 0);
+	m.decorate(32, Binding, 0);
+
+	m.op(OpTypeImage, { 9, 1, 1, 0, 0, 0, 1, 0 });
+	m.op(OpTypeSampledImage, { 10, 9 });
+	m.op(OpTypeArray, { 11, 10, 8 });
+	m.op(OpTypePointer, { 12, UniformConstant, 11 });
+	m.op(OpVariable, { 12, 13, UniformConstant });
+	m.name(13, "textures");
+	m.decorate(13, DescriptorSet, 0);
+	m.decorate(13, Binding, 1);
+
+	m.op(OpTypeRuntimeArray, { 14, 10 });
+	m.op(OpTypePointer, { 15, UniformConstant, 14 });
+	m.op(OpVariable, { 15, 16, UniformConstant });
+	m.decorate(16, DescriptorSet, 1);
+	m.decorate(16, Binding, 0);
+
+	m.op(OpTypeSampler, { 17 });
+	m.op(OpTypePointer, { 18, UniformConstant, 17 });
+	m.op(OpVariable, { 18, 19, UniformConstant });
+	m.decorate(19, DescriptorSet, 0);
+	m.decorate(19, Binding, 3);
+
+	m.op(OpTypeImage, { 20, 1, 1, 0, 0, 0, 2, 1 });
+	m.op(OpTypePointer, { 21, UniformConstant, 20 });
+	m.op(OpVariable, { 21, 22, UniformConstant });
+	m.decorate(22, DescriptorSet, 0);
+	m.decorate(22, Binding, 4);
+
+	m.op(OpTypeRuntimeArray, { 23, 4 });
+	m.decorate(23, ArrayStride, 16);
+	m.op(OpTypeStruct, { 24, 6, 23 });
+	m.memberDecorate(24, 0, Offset, 0);
+	m.memberDecorate(24, 1, Offset, 16);
+	m.decorate(24, Block);
+	m.op(OpTypePointer, { 25, StorageBuffer, 24 });
+	m.op(OpVariable, { 25, 26, StorageBuffer });
+	m.name(26, "lights");
+	m.decorate(26, DescriptorSet, 0);
+	m.decorate(26, Binding, 2);
+
+	m.op(OpTypeStruct, { 40, 4 });
+	m.memberDecorate(40, 0, Offset, 64);
+	m.decorate(40, Block);
+	m.op(OpTypePointer, { 41, PushConstant, 40 });
+	m.op(OpVariable, { 41, 42, PushConstant });
+
+	// Fragment inputs aren't vertex inputs
+	m.op(OpTypePointer, { 43, Input, 4 });
+	m.op(OpVariable, { 43, 44, Input });
+	m.decorate(44, Location, 0);
+	return m.finish(50);
+}
+
+static int benchReflection(const BenchOptions& options)
+{
+	ShaderReflection vertex;
+	expect(vertex.parse(vertexModule()), "vertex module parses");
+	expect(vertex.stages == VK_SHADER_STAGE_VERTEX_BIT, "vertex stage flag");
+
+	const VkFormat inputFormats[] = { VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R32G32B32A32_SINT };
+	expect(vertex.vertexInputs.size() == 7, "vec3, vec2, 4 mat4 columns and ivec4 inputs, no built in");
+	for (U32 i = 0; i < std::min<size_t>(vertex.vertexInputs.size(), 7); ++i)
+	{
+		expect(vertex.vertexInputs[i].location == i, "input " + std::to_string(i) + " location");
+		expect(vertex.vertexInputs[i].format == inputFormats[i], "input " + std::to_string(i) + " format");
+	}
+	expect(!vertex.vertexInputs.empty() && vertex.vertexInputs[0].name == "inPosition", "input named from OpName");
+
+	expect(vertex.bindings.size() == 1, "vertex has one binding");
+	if (vertex.bindings.size() == 1)
+	{
+		const ShaderReflection::DescriptorBinding& ubo = vertex.bindings[0];
+		expect(ubo.set == 0 && ubo.binding == 0 && ubo.count == 1, "uniform block at 0.0");
+		expect(ubo.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, "uniform block type");
+		expect(ubo.blockSize == 128, "uniform block is two mat4s");
+		expect(ubo.name == "UniformBufferObject", "unnamed block instance takes its type name");
+	}
+	expect(vertex.pushConstants.size() == 1 && vertex.pushConstants[0].offset == 0 && vertex.pushConstants[0].size == 64 && vertex.pushConstants[0].stageFlags == VK_SHADER_STAGE_VERTEX_BIT, "vertex push constant is a mat4");
+
+	ShaderReflection fragment;
+	expect(fragment.parse(fragmentModule()), "fragment module parses");
+	expect(fragment.stages == VK_SHADER_STAGE_FRAGMENT_BIT, "fragment stage flag");
+	expect(fragment.vertexInputs.empty(), "fragment inputs aren't vertex inputs");
+
+	struct Expected { U32 set, binding; VkDescriptorType type; U32 count, blockSize; };
+	const Expected expected[] =
+	{
+		{ 0, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, 16 },
+		{ 0, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4, 0 },
+		{ 0, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, 16 },
+		{ 0, 3, VK_DESCRIPTOR_TYPE_SAMPLER, 1, 0 },
+		{ 0, 4, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, 0 },
+		{ 1, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, 0 },
+	};
+	expect(fragment.bindings.size() == 6, "fragment has six bindings");
+	for (size_t i = 0; i < std::min<size_t>(fragment.bindings.size(), 6); ++i)
+	{
+		const ShaderReflection::DescriptorBinding& b = fragment.bindings[i];
+		const Expected& e = expected[i];
+		std::string where = "fragment binding " + std::to_string(e.set) + "." + std::to_string(e.binding);
+		expect(b.set == e.set && b.binding == e.binding, where + " sorted in place");
+		expect(b.type == e.type, where + " type");
+		expect(b.count == e.count, where + " count");
+		expect(b.blockSize == e.blockSize, where + " block size");
+	}
+	expect(fragment.findBinding(1, 0) && fragment.findBinding(1, 0)->type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, "binding found by set and number");
+	expect(!fragment.findBinding(0, 5) && !fragment.findBinding(2, 0), "missing bindings aren't found");
+	expect(fragment.bindings.size() > 2 && fragment.bindings[1].name == "textures" && fragment.bindings[2].name == "lights", "bindings named from their variables");
+	expect(fragment.pushConstants.size() == 1 && fragment.pushConstants[0].offset == 64 && fragment.pushConstants[0].size == 16, "fragment push constant starts at its first member");
+
+	ShaderReflection merged = vertex;
+	expect(merged.merge(fragment), "stages agree");
+	expect(merged.stages == (VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT), "merged stage flags");
+	expect(merged.bindings.size() == 6, "shared binding merged");
+	if (!merged.bindings.empty())
+	{
+		expect(merged.bindings[0].stages == (VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT), "shared binding seen by both stages");
+		expect(merged.bindings[0].blockSize == 128, "shared binding keeps the larger block");
+	}
+	expect(merged.pushConstants.size() == 1 && merged.pushConstants[0].offset == 0 && merged.pushConstants[0].size == 80 && merged.pushConstants[0].stageFlags == (VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT), "push constants merged into one range");
+	expect(merged.getSetCount() == 2, "two sets");
+	expect(merged.getSetLayoutBindings(0).size() == 5 && merged.getSetLayoutBindings(1).size() == 1, "set layout bindings split by set");
+
+	U32 combined = 0, uniform = 0;
+	for (const VkDescriptorPoolSize& size : merged.getPoolSizes(2))
+	{
+		if (size.type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+			combined = size.descriptorCount;
+		if (size.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+			uniform = size.descriptorCount;
+	}
+	expect(combined == 10 && uniform == 2, "pool sizes count arrays and copies");
+
+	// Same binding as a storage buffer in one stage and a uniform block in the other
+	ShaderReflection conflicting;
+	if (conflicting.parse(fragmentModule()) && !conflicting.bindings.empty())
+	{
+		conflicting.bindings[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		ShaderReflection disagreeing = vertex;
+		expect(!disagreeing.merge(conflicting), "stages disagreeing on a binding type fail to merge");
+	}
+
+	ShaderReflection bad;
+	std::vector<U32> words = vertexModule();
+	words[0] = 0xDEADBEEF;
+	expect(!bad.parse(words), "wrong magic is rejected");
+	words = vertexModule();
+	words.resize(words.size() - 2);
+	expect(!bad.parse(words), "truncated instruction is rejected");
+	words = vertexModule();
+	words[3] = 0xFFFFFFFF;
+	expect(!bad.parse(words), "absurd id bound is rejected");
+
+	LOG_INFO("Shader reflection: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+static int benchIncludes(const BenchOptions& options)
+{
+	typedef std::set<std::string> Files;
+
+	// a includes b and c, both include d, which includes e
+	ShaderIncludeGraph graph;
+	graph.addInclude("a", "b");
+	graph.addInclude("a", "c");
+	graph.addInclude("b", "d");
+	graph.addInclude("c", "d");
+	graph.addInclude("d", "e");
+	expect(graph.getIncludes("a") == Files({ "b", "c" }), "direct includes");
+	expect(graph.getDependencies("a") == Files({ "b", "c", "d", "e" }), "dependencies through a diamond");
+	expect(graph.getIncluders("e") == Files({ "a", "b", "c", "d" }), "includers through a diamond");
+	expect(graph.getIncluders("a").empty() && graph.getDependencies("e").empty(), "nothing past either end");
+	expect(graph.getDependencies("unknown").empty(), "unknown file has no dependencies");
+
+	// Guarded includes can loop back
+	graph.addInclude("e", "b");
+	expect(graph.getDependencies("b") == Files({ "b", "d", "e" }), "a cycle reaches its start once");
+	expect(graph.getIncluders("d") == Files({ "a", "b", "c", "d", "e" }), "includers around a cycle");
+
+	graph.clearIncludes("e");
+	expect(graph.getIncludes("e").empty() && graph.getIncluders("b") == Files({ "a" }), "clearing a file's includes drops its edges both ways");
+	graph.clearIncludes("d");
+	expect(graph.getIncluders("e").empty() && graph.getDependencies("a") == Files({ "b", "c", "d" }), "clearing a middle file cuts the chain");
+	graph.clear();
+	expect(graph.getDependencies("a").empty(), "clear empties the graph");
+
+	// ShaderIncluder scanning real files, relative and search path includes
+	std::string directory = "EngineBench_includes";
+	std::filesystem::create_directories(directory + "/lib");
+	auto write = [&](const std::string& name, const std::string& text)
+	{
+		std::ofstream(directory + "/" + name, std::ios::binary) << text;
+		ShaderIncluder::invalidate(directory + "/" + name);
+	};
+	write("main.glsl", "#version 450\n#include \"common.glsl\"\n  #include <noise.glsl>\nvoid main() {}\n");
+	write("common.glsl", "#include \"lib/light.glsl\"\n");
+	write("lib/light.glsl", "#include \"../common.glsl\"\n");
+	write("lib/noise.glsl", "float noise(vec2 p) { return 0.0; }\n");
+
+	std::vector<std::string> searchPaths = ShaderIncluder::searchPaths;
+	ShaderIncluder::searchPaths = { directory + "/lib/" };
+	ShaderIncludeGraph& scanned = ShaderIncluder::graph;
+	std::string mainFile = directory + "/main.glsl", common = directory + "/common.glsl";
+	std::string light = directory + "/lib/light.glsl", noise = directory + "/lib/noise.glsl";
+
+	ShaderIncluder::scan(mainFile);
+	expect(scanned.getIncludes(mainFile) == Files({ common, noise }), "scan resolves relative and search path includes");
+	expect(scanned.getDependencies(mainFile) == Files({ common, light, noise }), "scan follows includes of includes");
+	expect(scanned.getIncluders(light) == Files({ common, light, mainFile }), "scan records the cycle between common and light");
+
+	// common stops including light, rescanning after the edit forgets the old edge
+	write("common.glsl", "#include <noise.glsl>\n");
+	ShaderIncluder::scan(mainFile);
+	expect(scanned.getDependencies(mainFile) == Files({ common, noise }), "rescan after an edit drops stale includes");
+	// light still includes common, so it still pulls in noise
+	expect(scanned.getIncluders(noise) == Files({ common, light, mainFile }), "rescan after an edit adds new includes");
+
+	// Compiles key on the job's own text, which needn't match the file
+	Files pulledIn = ShaderIncluder::scanSource(mainFile, "#version 450\n#include \"lib/light.glsl\"\nvoid main() {}\n");
+	expect(pulledIn == Files({ common, light, noise }), "scanning source text follows its includes, not the file's");
+	expect(scanned.getIncludes(mainFile) == Files({ light }), "scanning source text replaces the recorded includes");
+	write("lib/light.glsl", "#include \"../main.glsl\"\n");
+	expect(ShaderIncluder::scanSource(mainFile, "#include \"lib/light.glsl\"\n") == Files({ light }), "a file including itself isn't its own dependency");
+
+	ShaderIncluder::searchPaths = searchPaths;
+	for (const std::string& file : { mainFile, common, light, noise })
+		ShaderIncluder::invalidate(file);
+	std::filesystem::remove_all(directory);
+
+	LOG_INFO("Shader includes: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+static int benchKeywords(const BenchOptions& options)
+{
+	typedef ShaderKeywords::Key Key;
+
+	ShaderKeywords keywords;
+	Key fog = keywords.addSpecializationKeyword("FOG", 3);
+	Key skinning = keywords.addKeyword("SKINNING");
+	Key shadows = keywords.addSpecializationKeyword("SHADOWS", 7);
+	Key normalMap = keywords.addKeyword("NORMAL_MAP");
+	expect(fog == 1 && skinning == 2 && shadows == 4 && normalMap == 8, "one bit per keyword in declaration order");
+	expect(keywords.addKeyword("SKINNING") == skinning, "declaring a keyword again returns its bit");
+
+	expect(keywords.getKey({ "NORMAL_MAP", "FOG" }) == (fog | normalMap), "key from names");
+	expect(keywords.getKey({ "UNKNOWN", "SHADOWS" }) == shadows, "unknown names are ignored");
+	expect(keywords.getKey({}) == 0, "no names, no bits");
+
+	// Variants are compiled per compile keyword bits only
+	Key all = fog | skinning | shadows | normalMap;
+	expect(keywords.getVariantKey(all) == (skinning | normalMap), "variant key keeps the compile keywords");
+	expect(keywords.getVariantKey(fog) == keywords.getVariantKey(shadows) && keywords.getVariantKey(fog | shadows) == 0, "keys differing in specialization keywords share a variant");
+	expect(keywords.getDefines(all) == std::vector<std::string>({ "SKINNING", "NORMAL_MAP" }), "compile keywords become defines");
+	expect(keywords.getDefines(fog | shadows).empty(), "specialization keywords are never defines");
+
+	expect(keywords.getSpecializationCount() == 0, "specialization infos are built lazily");
+	const VkSpecializationInfo* fogOnly = keywords.getSpecializationInfo(fog | skinning);
+	bool entriesMatch = fogOnly && fogOnly->mapEntryCount == 2 && fogOnly->dataSize == 2 * sizeof(VkBool32)
+		&& fogOnly->pMapEntries[0].constantID == 3 && fogOnly->pMapEntries[0].offset == 0 && fogOnly->pMapEntries[0].size == sizeof(VkBool32)
+		&& fogOnly->pMapEntries[1].constantID == 7 && fogOnly->pMapEntries[1].offset == sizeof(VkBool32) && fogOnly->pMapEntries[1].size == sizeof(VkBool32);
+	expect(entriesMatch, "one map entry per specialization keyword, packed in declaration order");
+	const VkBool32* values = fogOnly ? static_cast<const VkBool32*>(fogOnly->pData) : nullptr;
+	expect(values && values[0] == VK_TRUE && values[1] == VK_FALSE, "enabled keywords true, disabled ones explicitly false");
+
+	expect(keywords.getSpecializationInfo(fog | normalMap) == fogOnly && keywords.getSpecializationCount() == 1, "compile bits don't make a new specialization");
+	const VkSpecializationInfo* both = keywords.getSpecializationInfo(fog | shadows);
+	values = both ? static_cast<const VkBool32*>(both->pData) : nullptr;
+	expect(both != fogOnly && values && values[0] == VK_TRUE && values[1] == VK_TRUE && keywords.getSpecializationCount() == 2, "each combination built once");
+	expect(keywords.getSpecializationInfo(fog) == fogOnly, "built infos stay where they are");
+	keywords.clearSpecializations();
+	expect(keywords.getSpecializationCount() == 0, "clear drops the infos");
+
+	ShaderKeywords plain;
+	Key only = plain.addKeyword("ONLY");
+	expect(plain.getSpecializationInfo(only) == nullptr, "no specialization keywords, no info");
+
+	ShaderKeywords full;
+	for (U32 i = 0; i < ShaderKeywords::maxKeywords; ++i)
+		full.addKeyword("K" + std::to_string(i));
+	expect(full.getKey({ "K63" }) == Key(1) << 63, "the last keyword gets the top bit");
+	expect(full.addKeyword("ONE_TOO_MANY") == 0, "keywords past the limit get no bit");
+
+	LOG_INFO("Shader keywords: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+static const RenderGraph::Step* findStep(RenderGraph& graph, RenderGraph::Pass pass)
+{
+	for (const auto& step : graph.getSteps())
+	{
+		if (step.pass == pass)
+			return &step;
+	}
+	return nullptr;
+}
+
+static const RenderGraph::Barrier* findBarrier(const RenderGraph::Step* step, RenderGraph::Resource resource)
+{
+	if (!step)
+		return nullptr;
+	for (const auto& barrier : step->barriers)
+	{
+		if (barrier.resource == resource)
+			return &barrier;
+	}
+	return nullptr;
+}
+
+static bool matches(const RenderGraph::Barrier* barrier, VkPipelineStageFlags srcStages, VkAccessFlags srcAccess, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess, VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+	return barrier && barrier->srcStages == srcStages && barrier->srcAccess == srcAccess && barrier->dstStages == dstStages && barrier->dstAccess == dstAccess
+		&& barrier->oldLayout == oldLayout && barrier->newLayout == newLayout;
+}
+
+static int benchGraph(const BenchOptions& options)
+{
+	typedef RenderGraph G;
+	const VkAccessFlags colorAccess = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	const VkAccessFlags storageAccess = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	G::ImageDesc color;
+	color.width = 256;
+	color.height = 256;
+	G::ImageDesc depth = color;
+	depth.format = VK_FORMAT_D32_SFLOAT;
+	depth.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+	// Culling and levels: the debug chain is never read by anything that
+	// reaches the swapchain, the stats pass only has effects outside the graph
+	{
+		G graph;
+		G::Resource depthBuffer = graph.createImage("depth", depth);
+		G::Resource gbuffer = graph.createImage("gbuffer", color);
+		G::Resource shadowMap = graph.createImage("shadow", depth);
+		G::Resource debugImage = graph.createImage("debug", color);
+		G::Resource debugBlurred = graph.createImage("debug blurred", color);
+		G::Resource stats = graph.createBuffer("stats", { 256 });
+		G::Resource swapchain = graph.importImage("swapchain", VK_NULL_HANDLE, color, VK_IMAGE_LAYOUT_UNDEFINED, G::Present);
+
+		G::Pass prepass = graph.addPass("depth prepass");
+		graph.write(prepass, depthBuffer, G::DepthAttachment);
+		G::Pass geometry = graph.addPass("gbuffer");
+		graph.read(geometry, depthBuffer, G::DepthRead);
+		graph.write(geometry, gbuffer, G::ColorAttachment);
+		G::Pass shadows = graph.addPass("shadows");
+		graph.write(shadows, shadowMap, G::DepthAttachment);
+		G::Pass debug = graph.addPass("debug");
+		graph.read(debug, gbuffer, G::FragmentSampled);
+		graph.write(debug, debugImage, G::ColorAttachment);
+		G::Pass lighting = graph.addPass("lighting");
+		graph.read(lighting, gbuffer, G::FragmentSampled);
+		graph.read(lighting, shadowMap, G::FragmentSampled);
+		graph.write(lighting, swapchain, G::ColorAttachment);
+		G::Pass readback = graph.addPass("stats");
+		graph.write(readback, stats, G::TransferWrite);
+		graph.setSideEffect(readback);
+		G::Pass blur = graph.addPass("debug blur");
+		graph.read(blur, debugImage, G::FragmentSampled);
+		graph.write(blur, debugBlurred, G::ColorAttachment);
+
+		expect(graph.compile(), "frame compiles");
+		expect(graph.getCulledPasses() == std::vector<G::Pass>({ debug, blur }), "unread passes are culled, through chains of them");
+
+		std::vector<G::Pass> order;
+		for (const auto& step : graph.getSteps())
+			order.push_back(step.pass);
+		expect(order == std::vector<G::Pass>({ prepass, geometry, shadows, lighting, readback }), "passes run in dependency order, ties in declaration order");
+
+		const G::Step* steps[] = { findStep(graph, prepass), findStep(graph, geometry), findStep(graph, shadows), findStep(graph, lighting), findStep(graph, readback) };
+		const U32 levels[] = { 0, 1, 0, 2, 0 };
+		bool levelsMatch = true;
+		for (U32 i = 0; i < 5; ++i)
+			levelsMatch &= steps[i] && steps[i]->level == levels[i];
+		expect(levelsMatch, "levels are the longest dependency chain");
+	}
+
+	// Barriers for RAW, WAR and WAW on an image and a buffer, with and
+	// without layout changes. Imported resources, so no aliasing waits mix in.
+	{
+		G graph;
+		G::Resource args = graph.importBuffer("args", VK_NULL_HANDLE, 64);
+		G::Resource scene = graph.importImage("scene", VK_NULL_HANDLE, color, VK_IMAGE_LAYOUT_UNDEFINED, G::Present);
+		G::Resource post = graph.importImage("post", VK_NULL_HANDLE, color, VK_IMAGE_LAYOUT_UNDEFINED);
+
+		G::Pass clear = graph.addPass("clear");
+		graph.write(clear, args, G::TransferWrite);
+		G::Pass cull = graph.addPass("cull");
+		graph.write(cull, args, G::ComputeStorageWrite);
+		G::Pass draw = graph.addPass("draw");
+		graph.read(draw, args, G::IndirectRead);
+		graph.write(draw, scene, G::ColorAttachment);
+		G::Pass tonemap = graph.addPass("tonemap");
+		graph.read(tonemap, scene, G::FragmentSampled);
+		graph.write(tonemap, post, G::ColorAttachment);
+		G::Pass overlay = graph.addPass("overlay");
+		graph.write(overlay, scene, G::ColorAttachment);
+		G::Pass stats = graph.addPass("stats");
+		graph.read(stats, args, G::IndirectRead);
+		graph.setSideEffect(stats);
+
+		expect(graph.compile(), "barrier frame compiles");
+		expect(graph.getCulledPasses().empty(), "nothing culled with imported outputs");
+
+		const G::Step* drawStep = findStep(graph, draw);
+		expect(findStep(graph, clear) && findStep(graph, clear)->barriers.empty(), "first write of an imported buffer needs no barrier");
+		expect(matches(findBarrier(findStep(graph, cull), args), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, storageAccess, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED),
+			"write after write waits for the transfer");
+		expect(matches(findBarrier(drawStep, args), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, storageAccess, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED),
+			"read after write makes the compute writes visible to indirect reads");
+		expect(matches(findBarrier(drawStep, scene), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccess, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+			"first use of an image only transitions its layout");
+		expect(drawStep && drawStep->srcStages == (VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT)
+			&& drawStep->dstStages == (VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT), "a pass's barriers are merged into one call");
+		expect(matches(findBarrier(findStep(graph, tonemap), scene), VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccess, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+			"read after write with a layout change");
+		expect(matches(findBarrier(findStep(graph, overlay), scene), VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccess, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+			"write after read only waits for the reads to execute");
+		expect(findStep(graph, stats) && findStep(graph, stats)->barriers.empty(), "a second read of visible data needs no barrier");
+		expect(findStep(graph, stats) && findStep(graph, stats)->level == 2, "a reader is only ordered after the writer it reads");
+		expect(matches(findBarrier(&graph.getFinalStep(), scene), VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccess, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR)
+			&& graph.getFinalStep().barriers.size() == 1, "only imports with a final access are transitioned at the end");
+	}
+
+	// Imports chained to their last use outside the graph: an acquired
+	// swapchain image waited for at color output, and a buffer the previous
+	// frame only read
+	{
+		G graph;
+		G::Resource swapchain = graph.importImage("swapchain", VK_NULL_HANDLE, color, VK_IMAGE_LAYOUT_UNDEFINED, G::Present);
+		G::Resource commands = graph.importBuffer("commands", VK_NULL_HANDLE, 64);
+		graph.setInitialAccess(swapchain, G::ColorAttachment);
+		graph.setInitialAccess(commands, G::IndirectRead);
+
+		G::Pass draw = graph.addPass("draw");
+		graph.read(draw, commands, G::IndirectRead);
+		graph.write(draw, swapchain, G::ColorAttachment);
+
+		expect(graph.compile(), "imported frame compiles");
+		const G::Step* step = findStep(graph, draw);
+		expect(matches(findBarrier(step, swapchain), VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccess, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccess, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+			"first use of an import waits for its initial access");
+		expect(step && step->barriers.size() == 1, "read after an initial read needs no barrier");
+	}
+
+	// Aliasing: a, b and c are passed along a chain, a and c never live at
+	// the same time so c takes a's memory, after a's last reads
+	{
+		G graph;
+		G::Resource a = graph.createImage("a", color);
+		G::Resource b = graph.createImage("b", color);
+		G::Resource c = graph.createImage("c", color);
+		G::Resource out = graph.importImage("out", VK_NULL_HANDLE, color, VK_IMAGE_LAYOUT_UNDEFINED);
+
+		G::Pass first = graph.addPass("first");
+		graph.write(first, a, G::ColorAttachment);
+		G::Pass second = graph.addPass("second");
+		graph.read(second, a, G::FragmentSampled);
+		graph.write(second, b, G::ColorAttachment);
+		G::Pass third = graph.addPass("third");
+		graph.read(third, b, G::FragmentSampled);
+		graph.write(third, c, G::ColorAttachment);
+		G::Pass fourth = graph.addPass("fourth");
+		graph.read(fourth, c, G::FragmentSampled);
+		graph.write(fourth, out, G::ColorAttachment);
+
+		expect(graph.compile(), "aliasing frame compiles");
+
+		VkDeviceSize size = G::estimateSize(color);
+		std::map<G::Resource, VkDeviceSize> offsets;
+		for (const auto& placed : graph.getPlacements())
+			offsets[placed.resource] = placed.offset;
+		expect(offsets.size() == 3 && offsets[a] == offsets[c] && offsets[b] != offsets[a], "disjoint lifetimes share an offset");
+		expect(graph.getHeapSize() == 2 * size && graph.getUnaliasedSize() == 3 * size, "heap holds two images instead of three");
+
+		expect(matches(findBarrier(findStep(graph, first), a), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccess, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+			"first occupant waits for nothing");
+		expect(matches(findBarrier(findStep(graph, third), c), VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, colorAccess, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+			"next occupant waits for the previous one's reads and discards its contents");
+	}
+
+	// A read declared with a write access is refused
+	{
+		G graph;
+		G::Resource image = graph.createImage("image", color);
+		G::Pass pass = graph.addPass("pass");
+		graph.read(pass, image, G::ColorAttachment);
+		expect(!graph.compile(), "mismatched access is refused");
+	}
+
+	LOG_INFO("Render graph: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+static U64 countBinds(const std::vector<DrawList::Entry>& entries)
+{
+	U64 binds = 0;
+	U32 pipeline = ~0u;
+	const Material* material = nullptr;
+	const Model* mesh = nullptr;
+	for (const auto& entry : entries)
+	{
+		if (entry.draw->material->pipelineId != pipeline)
+		{
+			pipeline = entry.draw->material->pipelineId;
+			material = nullptr;
+			++binds;
+		}
+		if (entry.draw->material != material)
+		{
+			material = entry.draw->material;
+			++binds;
+		}
+		if (entry.draw->mesh != mesh)
+		{
+			mesh = entry.draw->mesh;
+			++binds;
+		}
+	}
+	return binds;
+}
+
+static int benchDraws(const BenchOptions& options)
+{
+	const U32 pipelineCount = 8;
+	const U32 materialCount = 256;
+	const U32 meshCount = 512;
+
+	std::vector<Material> materials(materialCount);
+	for (U32 i = 0; i < materialCount; ++i)
+		materials[i].pipelineId = i % pipelineCount;
+	std::vector<Model> meshes(meshCount);
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+
+	Clock clock;
+	DrawList drawList;
+	drawList.setCamera(glm::vec3(0.0f), 200.0f);
+
+	LOG_INFO(pipelineCount << " pipelines, " << materialCount << " materials, " << meshCount << " meshes");
+
+	for (U32 count = 10000; count <= options.draws; count *= 10)
+	{
+		// Random submission order, as a scene traversal would give
+		std::vector<DrawList::Draw> draws(count);
+		std::vector<DrawList::Entry> unsorted(count);
+		for (U32 i = 0; i < count; ++i)
+		{
+			DrawList::Draw& draw = draws[i];
+			draw.material = &materials[random() % materialCount];
+			draw.mesh = &meshes[random() % meshCount];
+			draw.transform = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random), position(random)));
+			unsorted[i] = { DrawList::makeKey(0, draw.material, draw.mesh, glm::length(glm::vec3(draw.transform[3])) / 200.0f), &draw };
+		}
+
+		// Enough repeats for a stable time at every size
+		U32 repeats = std::max(1u, 10000000 / count);
+		std::vector<DrawList::Entry> entries, scratch(count);
+
+		Time start = clock.time();
+		for (U32 r = 0; r < repeats; ++r)
+		{
+			entries = unsorted;
+			RadixSort::sort(entries.data(), scratch.data(), count);
+		}
+		double radixSeconds = (clock.time() - start).getSeconds() / repeats;
+
+		std::vector<DrawList::Entry> reference;
+		start = clock.time();
+		for (U32 r = 0; r < repeats; ++r)
+		{
+			reference = unsorted;
+			std::sort(reference.begin(), reference.end(), [](const DrawList::Entry& a, const DrawList::Entry& b) { return a.key < b.key; });
+		}
+		double stdSeconds = (clock.time() - start).getSeconds() / repeats;
+
+		expect(std::equal(entries.begin(), entries.end(), reference.begin(), [](const DrawList::Entry& a, const DrawList::Entry& b) { return a.key == b.key; }), "radix sort orders keys like std::sort, " + std::to_string(count) + " draws");
+
+		// Draws with equal keys keep their submission order
+		std::vector<DrawList::Entry> stable = unsorted;
+		std::stable_sort(stable.begin(), stable.end(), [](const DrawList::Entry& a, const DrawList::Entry& b) { return a.key < b.key; });
+		U32 ties = 0;
+		for (U32 i = 1; i < count; ++i)
+			ties += stable[i].key == stable[i - 1].key ? 1 : 0;
+		expect(std::equal(entries.begin(), entries.end(), stable.begin(), [](const DrawList::Entry& a, const DrawList::Entry& b) { return a.key == b.key && a.draw == b.draw; }), "radix sort is stable over " + std::to_string(ties) + " equal keys, " + std::to_string(count) + " draws");
+
+		// Whole frame through the draw list: submit everything, then sort. The
+		// first frame sizes the buffers, the ones after shouldn't allocate.
+		double frameSeconds = 0.0;
+		for (U32 frame = 0; frame < 4; ++frame)
+		{
+			drawList.reset();
+			start = clock.time();
+			for (const auto& draw : draws)
+				drawList.submit(draw.mesh, draw.material, draw.transform);
+			drawList.sort();
+			drawList.buildBatches(true);
+			if (frame > 0)
+				frameSeconds += (clock.time() - start).getSeconds() / 3;
+		}
+
+		LOG_INFO(count << " draws: radix " << radixSeconds * 1000.0 << " ms (" << count / std::max(radixSeconds, 1e-9) / 1e6 << " M keys/s), std::sort " << stdSeconds * 1000.0 << " ms, " << stdSeconds / std::max(radixSeconds, 1e-9) << "x");
+		LOG_INFO("    binds: " << countBinds(unsorted) << " unsorted, " << countBinds(entries) << " sorted, " << drawList.getBatches().size() << " instanced draw calls; submit + sort " << frameSeconds * 1000.0 << " ms per frame");
+	}
+
+	LOG_INFO("Draw sorting: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+static int benchCull(const BenchOptions& options)
+{
+	FrustumCuller culler(options.threads);
+	FrustumCuller::Isa best = culler.getIsa();
+	LOG_INFO("Best instruction set " << FrustumCuller::getIsaName(best) << ", " << culler.threadCount() << " threads");
+
+	// Camera in the middle of the boxes, so some are in front and most are not
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+	proj[1][1] *= -1;
+	glm::mat4 viewProjection = proj * view;
+
+	std::vector<FrustumCuller::Isa> isas = { FrustumCuller::Scalar };
+	if (best >= FrustumCuller::Sse)
+		isas.push_back(FrustumCuller::Sse);
+	if (best >= FrustumCuller::Avx2)
+		isas.push_back(FrustumCuller::Avx2);
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> size(0.5f, 5.0f);
+
+	Clock clock;
+	for (U32 count : { 100000u, 250000u, 500000u, 1000000u, 2500000u, 5000000u })
+	{
+		if (count > options.objects)
+			break;
+
+		culler.clear();
+		culler.reserve(count);
+		for (U32 i = 0; i < count; ++i)
+		{
+			glm::vec3 minimum(position(random), position(random), position(random));
+			culler.add(minimum, minimum + glm::vec3(size(random), size(random), size(random)));
+		}
+
+		U32 repeats = std::max(1u, 20000000 / count);
+		std::vector<U32> reference, visible;
+		culler.cull(viewProjection, reference, FrustumCuller::Scalar, 1);
+
+		auto measure = [&](FrustumCuller::Isa isa, U32 threads)
+		{
+			Time start = clock.time();
+			for (U32 r = 0; r < repeats; ++r)
+				culler.cull(viewProjection, visible, isa, threads);
+			double seconds = (clock.time() - start).getSeconds() / repeats;
+			LOG_INFO("    " << FrustumCuller::getIsaName(isa) << ", " << threads << " threads: " << seconds * 1000.0 << " ms, " << count / std::max(seconds, 1e-9) / 1e6 << " M objects/s");
+			expect(visible == reference, std::string(FrustumCuller::getIsaName(isa)) + " with " + std::to_string(threads) + " threads culls the same as scalar, " + std::to_string(count) + " objects");
+			return seconds;
+		};
+
+		LOG_INFO(count << " objects, " << reference.size() << " visible (" << 100.0 * reference.size() / count << "%)");
+		double scalar = 0.0, simd = 0.0;
+		for (auto isa : isas)
+		{
+			double seconds = measure(isa, 1);
+			if (isa == FrustumCuller::Scalar)
+				scalar = seconds;
+			simd = seconds;
+		}
+		double threaded = culler.threadCount() > 1 ? measure(best, culler.threadCount()) : simd;
+		LOG_INFO("    speedup over scalar: " << scalar / std::max(simd, 1e-9) << "x SIMD, " << scalar / std::max(threaded, 1e-9) << "x SIMD and threads");
+	}
+
+	LOG_INFO("Frustum culling: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+// Closed box with 12 triangles
+static void addBox(Mesh& mesh, const glm::vec3& minimum, const glm::vec3& maximum)
+{
+	U32 first = U32(mesh.vertices.size());
+	for (U32 corner = 0; corner < 8; ++corner)
+	{
+		Vertex vertex = {};
+		vertex.position = glm::vec3((corner & 1) ? maximum.x : minimum.x, (corner & 2) ? maximum.y : minimum.y, (corner & 4) ? maximum.z : minimum.z);
+		mesh.vertices.push_back(vertex);
+	}
+
+	static const U32 faces[36] = {
+		0, 2, 1, 1, 2, 3,	// -z
+		4, 5, 6, 5, 7, 6,	// +z
+		0, 1, 4, 1, 5, 4,	// -y
+		2, 6, 3, 3, 6, 7,	// +y
+		0, 4, 2, 2, 4, 6,	// -x
+		1, 3, 5, 3, 7, 5	// +x
+	};
+	for (U32 index : faces)
+		mesh.indices.push_back(first + index);
+}
+
+static int benchOcclusion(const BenchOptions& options)
+{
+	OcclusionCuller culler(512, 256, options.threads);
+	U32 threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+	LOG_INFO(culler.getWidth() << "x" << culler.getHeight() << " depth, " << culler.getLevelCount() << " levels, SSE " << (OcclusionCuller::hasSimd() ? "available" : "unavailable") << ", " << threads << " threads");
+
+	// Blocks of buildings on a grid with streets between them, seen from
+	// street level looking down an avenue
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> height(5.0f, 60.0f);
+	std::uniform_real_distribution<float> inset(0.0f, 4.0f);
+
+	U32 side = std::max(1u, U32(std::sqrt(float(options.occluders))));
+	const float block = 30.0f;
+	const float street = 10.0f;
+	std::vector<Mesh> buildings(side * side);
+	Mesh ground;
+	float extent = side * (block + street);
+	addBox(ground, glm::vec3(-extent, -extent, -1.0f), glm::vec3(extent, extent, 0.0f));
+
+	culler.addOccluder(ground, glm::mat4(1.0f));
+	for (U32 y = 0; y < side; ++y)
+	{
+		for (U32 x = 0; x < side; ++x)
+		{
+			glm::vec3 minimum((float(x) - side * 0.5f) * (block + street) + inset(random), float(y) * (block + street) + street + inset(random), 0.0f);
+			glm::vec3 maximum = minimum + glm::vec3(block - inset(random), block - inset(random), height(random));
+			Mesh& building = buildings[y * side + x];
+			addBox(building, minimum - glm::vec3(minimum.x, minimum.y, 0.0f), maximum - glm::vec3(minimum.x, minimum.y, 0.0f));
+			culler.addOccluder(building, glm::translate(glm::mat4(1.0f), glm::vec3(minimum.x, minimum.y, 0.0f)));
+		}
+	}
+
+	glm::vec3 eye((float(side / 2) - side * 0.5f) * (block + street) - street * 0.5f, 0.0f, 2.0f);
+	glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(0.3f, 1.0f, 0.05f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 proj = glm::perspective(glm::radians(75.0f), float(culler.getWidth()) / culler.getHeight(), 0.5f, 2000.0f);
+	proj[1][1] *= -1;
+	glm::mat4 viewProjection = proj * view;
+
+	std::vector<float> reference;
+	culler.rasteriseReference(viewProjection, reference);
+	LOG_INFO(culler.getOccluderCount() << " occluders, " << culler.getTriangleCount() << " triangles");
+
+	Clock clock;
+	U32 repeats = 50;
+	auto measure = [&](const char* name, bool simd, U32 threadCount)
+	{
+		Time start = clock.time();
+		for (U32 r = 0; r < repeats; ++r)
+			culler.rasterise(viewProjection, simd, threadCount);
+		double seconds = (clock.time() - start).getSeconds() / repeats;
+
+		const std::vector<float>& depth = culler.getLevel(0);
+		U32 mismatched = 0;
+		float maxError = 0.0f;
+		for (size_t i = 0; i < depth.size(); ++i)
+		{
+			float error = std::abs(depth[i] - reference[i]);
+			mismatched += error > 0.0f ? 1 : 0;
+			maxError = std::max(maxError, error);
+		}
+		LOG_INFO("    " << name << ", " << threadCount << " threads: " << seconds * 1000.0 << " ms, " << mismatched << " pixels differ from the reference, max error " << maxError);
+		expect(mismatched == 0, std::string(name) + " with " + std::to_string(threadCount) + " threads rasterises the same depth as the reference");
+		return seconds;
+	};
+
+	LOG_INFO("Rasterising");
+	double scalar = measure("scalar", false, 1);
+	double simd = OcclusionCuller::hasSimd() ? measure("SSE", true, 1) : scalar;
+	double threaded = threads > 1 ? measure(OcclusionCuller::hasSimd() ? "SSE" : "scalar", OcclusionCuller::hasSimd(), threads) : simd;
+	LOG_INFO("    speedup over scalar: " << scalar / std::max(simd, 1e-9) << "x SIMD, " << scalar / std::max(threaded, 1e-9) << "x SIMD and threads");
+
+	// Small props scattered over the streets and roofs
+	std::uniform_real_distribution<float> across(-extent * 0.5f, extent * 0.5f);
+	std::uniform_real_distribution<float> along(0.0f, extent);
+	std::uniform_real_distribution<float> size(0.5f, 3.0f);
+	std::vector<glm::vec3> boxes;
+	for (U32 i = 0; i < 100000; ++i)
+	{
+		glm::vec3 minimum(across(random), along(random), 0.0f);
+		boxes.push_back(minimum);
+		boxes.push_back(minimum + glm::vec3(size(random), size(random), size(random)));
+	}
+
+	Time start = clock.time();
+	U32 visible = 0;
+	for (size_t i = 0; i < boxes.size(); i += 2)
+		visible += culler.isVisible(boxes[i], boxes[i + 1]) ? 1 : 0;
+	double seconds = (clock.time() - start).getSeconds();
+	LOG_INFO("Box tests: " << boxes.size() / 2 << " boxes, " << visible << " visible, " << seconds * 1000.0 << " ms, " << boxes.size() / 2 / std::max(seconds, 1e-9) / 1e6 << " M boxes/s");
+
+	if (!options.save.empty())
+	{
+		Image image;
+		OcclusionCuller::toImage(culler.getLevel(0), culler.getWidth(), culler.getHeight(), image);
+		image.save(options.save + "_depth.png");
+		OcclusionCuller::toImage(reference, culler.getWidth(), culler.getHeight(), image);
+		image.save(options.save + "_reference.png");
+		LOG_INFO("Saved " << options.save << "_depth.png and " << options.save << "_reference.png");
+	}
+
+	LOG_INFO("Occlusion culling: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+static int benchBvh(const BenchOptions& options)
+{
+	std::vector<U32> widths = { 4 };
+	if (Bvh(8).getWidth() == 8)
+		widths.push_back(8);
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::uniform_real_distribution<float> size(0.5f, 5.0f);
+
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+	proj[1][1] *= -1;
+	glm::mat4 viewProjection = proj * view;
+	glm::vec4 planes[6];
+	FrustumCuller::getFrustumPlanes(viewProjection, planes);
+
+	Clock clock;
+	for (U32 count : { 100000u, 250000u, 500000u, 1000000u, 2500000u, 5000000u })
+	{
+		if (count > options.objects)
+			break;
+
+		// Same density at every count, so queries return about as many results
+		float extent = 500.0f * std::cbrt(count / 1000000.0f);
+		auto point = [&]() { return glm::vec3(unit(random), unit(random), unit(random)) * (2.0f * extent) - extent; };
+		std::vector<Bvh::Bounds> boxes(count);
+		for (auto& box : boxes)
+		{
+			box.minimum = point();
+			box.maximum = box.minimum + glm::vec3(size(random), size(random), size(random));
+		}
+
+		// Brute force references, same tests as the leaves so results match exactly
+		std::vector<U32> frustumReference;
+		for (U32 i = 0; i < count; ++i)
+		{
+			bool inside = true;
+			for (U32 p = 0; p < 6 && inside; ++p)
+			{
+				const Bvh::Bounds& box = boxes[i];
+				glm::vec3 corner(planes[p].x >= 0.0f ? box.maximum.x : box.minimum.x, planes[p].y >= 0.0f ? box.maximum.y : box.minimum.y, planes[p].z >= 0.0f ? box.maximum.z : box.minimum.z);
+				inside = planes[p].x * corner.x + planes[p].y * corner.y + planes[p].z * corner.z + planes[p].w >= 0.0f;
+			}
+			if (inside)
+				frustumReference.push_back(i);
+		}
+
+		const U32 queryCount = 10000;
+		std::vector<glm::vec3> centres(queryCount), directions(queryCount);
+		for (U32 q = 0; q < queryCount; ++q)
+		{
+			centres[q] = point();
+			directions[q] = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) - 0.5f);
+		}
+
+		LOG_INFO(count << " boxes, " << frustumReference.size() << " in the frustum");
+		for (U32 width : widths)
+		{
+			Bvh bvh(width);
+			Time start = clock.time();
+			bvh.build(boxes);
+			double buildSeconds = (clock.time() - start).getSeconds();
+			LOG_INFO("  " << width << " wide: build " << buildSeconds * 1000.0 << " ms, " << count / std::max(buildSeconds, 1e-9) / 1e6 << " M boxes/s, "
+				<< bvh.getNodes().size() << " binary and " << bvh.getWideNodeCount() << " wide nodes, cost " << bvh.getCost());
+
+			std::vector<U32> results;
+			start = clock.time();
+			bvh.queryFrustum(viewProjection, results);
+			double seconds = (clock.time() - start).getSeconds();
+			std::sort(results.begin(), results.end());
+			LOG_INFO("    frustum: " << seconds * 1000.0 << " ms for " << results.size() << " results");
+			expect(results == frustumReference, std::to_string(width) + " wide frustum query matches brute force, " + std::to_string(count) + " boxes");
+
+			// A few queries of each kind checked against brute force, all of them timed
+			U32 mismatches = 0;
+			U32 found = 0;
+			start = clock.time();
+			for (U32 q = 0; q < queryCount; ++q)
+			{
+				results.clear();
+				bvh.querySphere(centres[q], 10.0f, results);
+				found += U32(results.size());
+			}
+			seconds = (clock.time() - start).getSeconds();
+			for (U32 q = 0; q < 20; ++q)
+			{
+				results.clear();
+				bvh.querySphere(centres[q], 10.0f, results);
+				U32 expected = 0;
+				for (const auto& box : boxes)
+				{
+					glm::vec3 offset = glm::max(glm::max(box.minimum - centres[q], centres[q] - box.maximum), glm::vec3(0.0f));
+					expected += glm::dot(offset, offset) <= 100.0f ? 1 : 0;
+				}
+				mismatches += expected != results.size() ? 1 : 0;
+			}
+			LOG_INFO("    sphere: " << queryCount / std::max(seconds, 1e-9) / 1e6 << " M queries/s, " << float(found) / queryCount << " results each");
+			expect(mismatches == 0, std::to_string(width) + " wide sphere queries match brute force, " + std::to_string(count) + " boxes");
+
+			mismatches = 0;
+			found = 0;
+			start = clock.time();
+			for (U32 q = 0; q < queryCount; ++q)
+			{
+				results.clear();
+				bvh.queryBox({ centres[q] - 10.0f, centres[q] + 10.0f }, results);
+				found += U32(results.size());
+			}
+			seconds = (clock.time() - start).getSeconds();
+			for (U32 q = 0; q < 20; ++q)
+			{
+				results.clear();
+				bvh.queryBox({ centres[q] - 10.0f, centres[q] + 10.0f }, results);
+				U32 expected = 0;
+				glm::vec3 low = centres[q] - 10.0f, high = centres[q] + 10.0f;
+				for (const auto& box : boxes)
+				{
+					bool overlap = box.minimum.x <= high.x && box.maximum.x >= low.x && box.minimum.y <= high.y && box.maximum.y >= low.y && box.minimum.z <= high.z && box.maximum.z >= low.z;
+					expected += overlap ? 1 : 0;
+				}
+				mismatches += expected != results.size() ? 1 : 0;
+			}
+			LOG_INFO("    box: " << queryCount / std::max(seconds, 1e-9) / 1e6 << " M queries/s, " << float(found) / queryCount << " results each");
+			expect(mismatches == 0, std::to_string(width) + " wide box queries match brute force, " + std::to_string(count) + " boxes");
+
+			mismatches = 0;
+			found = 0;
+			Bvh::Hit hit;
+			start = clock.time();
+			for (U32 q = 0; q < queryCount; ++q)
+				found += bvh.raycast(centres[q], directions[q], 100.0f, hit) ? 1 : 0;
+			seconds = (clock.time() - start).getSeconds();
+			for (U32 q = 0; q < 20; ++q)
+			{
+				float nearest = 100.0f;
+				bool expected = false;
+				for (const auto& box : boxes)
+				{
+					float distance = Bvh::intersect(box, centres[q], 1.0f / directions[q], nearest);
+					if (distance >= 0.0f && (distance < nearest || !expected))
+					{
+						nearest = distance;
+						expected = true;
+					}
+				}
+				bool hitFound = bvh.raycast(centres[q], directions[q], 100.0f, hit);
+				mismatches += hitFound != expected || (expected && hit.distance != nearest) ? 1 : 0;
+			}
+			LOG_INFO("    ray: " << queryCount / std::max(seconds, 1e-9) / 1e6 << " M rays/s, " << 100.0f * found / queryCount << "% hit");
+			expect(mismatches == 0, std::to_string(width) + " wide raycasts match brute force, " + std::to_string(count) + " boxes");
+
+			// Everything drifts a little, then a tenth of the boxes jump across the scene
+			std::vector<Bvh::Bounds> moved = boxes;
+			for (auto& box : moved)
+			{
+				glm::vec3 offset = (glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * 2.0f;
+				box.minimum += offset;
+				box.maximum += offset;
+			}
+			start = clock.time();
+			bvh.refit(moved);
+			seconds = (clock.time() - start).getSeconds();
+			LOG_INFO("    refit after a small move: " << seconds * 1000.0 << " ms, cost " << bvh.getCost());
+
+			for (U32 i = 0; i < count; i += 10)
+			{
+				glm::vec3 offset = point() - moved[i].minimum;
+				moved[i].minimum += offset;
+				moved[i].maximum += offset;
+			}
+			bvh.refit(moved);
+			float refitCost = bvh.getCost();
+			start = clock.time();
+			U32 rebuilt = bvh.update(moved);
+			seconds = (clock.time() - start).getSeconds();
+			LOG_INFO("    update after a large move: " << seconds * 1000.0 << " ms, " << rebuilt << " subtrees rebuilt, cost " << refitCost << " refitted, " << bvh.getCost() << " updated");
+		}
+	}
+
+	LOG_INFO("Bvh: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+// Bumpy sphere, for when the model isn't there
+static void generateMesh(Mesh& mesh, U32 rings, U32 segments)
+{
+	for (U32 r = 0; r <= rings; ++r)
+	{
+		for (U32 s = 0; s <= segments; ++s)
+		{
+			float theta = glm::pi<float>() * r / rings;
+			float phi = 2.0f * glm::pi<float>() * s / segments;
+			float radius = 1.0f + 0.05f * std::sin(theta * 23.0f) * std::cos(phi * 17.0f);
+			Vertex vertex = {};
+			vertex.position = radius * glm::vec3(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+			mesh.vertices.push_back(vertex);
+		}
+	}
+	for (U32 r = 0; r < rings; ++r)
+	{
+		for (U32 s = 0; s < segments; ++s)
+		{
+			U32 a = r * (segments + 1) + s;
+			U32 b = a + segments + 1;
+			for (U32 index : { a, b, a + 1, a + 1, b, b + 1 })
+				mesh.indices.push_back(index);
+		}
+	}
+}
+
+static int benchRays(const BenchOptions& options)
+{
+	Mesh mesh;
+	bool cooked = options.model.size() > 5 && options.model.compare(options.model.size() - 5, 5, ".mesh") == 0;
+	if (!(cooked ? mesh.loadCooked(options.model) : mesh.loadObj(options.model)))
+	{
+		LOG_WARN("Using a generated mesh instead of " << options.model);
+		mesh = Mesh();
+		generateMesh(mesh, 400, 600);
+	}
+
+	Clock clock;
+	TriangleBvh bvh;
+	Time start = clock.time();
+	bvh.build(mesh);
+	double seconds = (clock.time() - start).getSeconds();
+	LOG_INFO(bvh.getTriangleCount() << " triangles, " << bvh.getNodeCount() << " nodes of " << sizeof(Bvh::Node) << " bytes, built in " << seconds * 1000.0 << " ms");
+
+	glm::vec3 minimum, maximum;
+	glm::vec4 sphere;
+	mesh.computeBounds(minimum, maximum, sphere);
+	glm::vec3 centre(sphere);
+	float radius = sphere.w;
+
+	// Camera rays on a 512x512 grid, each 2x2 pixel quad is one packet
+	const U32 size = 512;
+	std::vector<TriangleBvh::Ray> camera;
+	camera.reserve(size * size);
+	glm::vec3 eye = centre + glm::vec3(0.6f, -0.8f, 0.5f) * (radius * 2.0f);
+	glm::vec3 forward = glm::normalize(centre - eye);
+	glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 0.0f, 1.0f)));
+	glm::vec3 up = glm::cross(right, forward);
+	for (U32 y = 0; y < size; y += 2)
+	{
+		for (U32 x = 0; x < size; x += 2)
+		{
+			for (U32 quad = 0; quad < 4; ++quad)
+			{
+				float px = (float(x + (quad & 1)) + 0.5f) / size * 2.0f - 1.0f;
+				float py = (float(y + (quad >> 1)) + 0.5f) / size * 2.0f - 1.0f;
+				glm::vec3 direction = glm::normalize(forward + (right * px + up * py) * 0.5f);
+				camera.push_back({ eye, direction, radius * 4.0f });
+			}
+		}
+	}
+
+	// From random points around the model through random points inside it
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<TriangleBvh::Ray> scattered(size * size);
+	for (auto& ray : scattered)
+	{
+		glm::vec3 from = centre + glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * (radius * 1.5f);
+		glm::vec3 to(glm::mix(minimum.x, maximum.x, unit(random)), glm::mix(minimum.y, maximum.y, unit(random)), glm::mix(minimum.z, maximum.z, unit(random)));
+		ray = { from, glm::normalize(to - from), radius * 4.0f };
+	}
+
+	U32 threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+	ThreadPool pool(threads);
+
+	for (auto set : { std::make_pair("camera", &camera), std::make_pair("random", &scattered) })
+	{
+		const std::vector<TriangleBvh::Ray>& rays = *set.second;
+		U32 count = U32(rays.size());
+		std::vector<TriangleBvh::Hit> single(count), packets(count), threaded(count);
+
+		start = clock.time();
+		for (U32 i = 0; i < count; ++i)
+			bvh.raycast(rays[i], single[i]);
+		double singleSeconds = (clock.time() - start).getSeconds();
+
+		start = clock.time();
+		bvh.raycast(rays.data(), count, packets.data());
+		double packetSeconds = (clock.time() - start).getSeconds();
+
+		// Whole packets per task
+		start = clock.time();
+		U32 perTask = ((count + threads - 1) / threads + TriangleBvh::packetSize - 1) & ~(TriangleBvh::packetSize - 1);
+		std::vector<std::future<void>> pending;
+		for (U32 begin = 0; begin < count; begin += perTask)
+		{
+			U32 end = std::min(count, begin + perTask);
+			pending.push_back(pool.submit([&, begin, end]() { bvh.raycast(rays.data() + begin, end - begin, threaded.data() + begin); }));
+		}
+		for (auto& f : pending)
+			f.get();
+		double threadedSeconds = (clock.time() - start).getSeconds();
+
+		auto same = [](const TriangleBvh::Hit& a, const TriangleBvh::Hit& b)
+		{
+			return a.triangle == b.triangle && (a.triangle == ~0u || a.distance == b.distance);
+		};
+		U32 hits = 0, mismatches = 0;
+		for (U32 i = 0; i < count; ++i)
+		{
+			hits += single[i].triangle != ~0u ? 1 : 0;
+			mismatches += same(single[i], packets[i]) && same(single[i], threaded[i]) ? 0 : 1;
+		}
+
+		// Brute force over every triangle for a sample
+		U32 wrong = 0;
+		for (U32 i = 0; i < count; i += count / 64)
+		{
+			const TriangleBvh::Ray& ray = rays[i];
+			float nearest = ray.maxDistance;
+			for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+			{
+				glm::vec3 v0 = mesh.vertices[mesh.indices[t]].position;
+				glm::vec3 e1 = mesh.vertices[mesh.indices[t + 1]].position - v0;
+				glm::vec3 e2 = mesh.vertices[mesh.indices[t + 2]].position - v0;
+				glm::vec3 p = glm::cross(ray.direction, e2);
+				float det = glm::dot(e1, p);
+				if (det == 0.0f)
+					continue;
+				glm::vec3 offset = ray.origin - v0;
+				float u = glm::dot(offset, p) / det;
+				glm::vec3 q = glm::cross(offset, e1);
+				float v = glm::dot(ray.direction, q) / det;
+				float distance = glm::dot(e2, q) / det;
+				if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && distance > 0.0f && distance < nearest)
+					nearest = distance;
+			}
+			bool expected = nearest < ray.maxDistance;
+			bool found = single[i].triangle != ~0u;
+			if (expected != found || (found && std::abs(single[i].distance - nearest) > 1e-4f * radius))
+				++wrong;
+		}
+
+		LOG_INFO(set.first << " rays: " << count << ", " << 100.0 * hits / count << "% hit");
+		expect(mismatches == 0, std::string(set.first) + " rays: packets, alone and threaded, hit the same as single rays");
+		expect(wrong == 0, std::string(set.first) + " rays: single rays hit the same as brute force");
+		LOG_INFO("    single: " << count / std::max(singleSeconds, 1e-9) / 1e6 << " M rays/s");
+		LOG_INFO("    packets of " << TriangleBvh::packetSize << ": " << count / std::max(packetSeconds, 1e-9) / 1e6 << " M rays/s");
+		LOG_INFO("    packets on " << threads << " threads: " << count / std::max(threadedSeconds, 1e-9) / 1e6 << " M rays/s, " << count / std::max(threadedSeconds, 1e-9) / 1e6 / threads << " per thread");
+	}
+
+	LOG_INFO("Ray casting: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+// Sphere resting on a ground slab among pillars, plenty of contact shadows
+static void generateBakeScene(Mesh& mesh)
+{
+	addBox(mesh, glm::vec3(-4.0f, -0.2f, -4.0f), glm::vec3(4.0f, 0.0f, 4.0f));
+	for (S32 x = -2; x <= 2; ++x)
+	{
+		for (S32 z = -2; z <= 2; ++z)
+		{
+			if (x == 0 && z == 0)
+				continue;
+			float height = 0.5f + 0.25f * float((x + 2) * 5 + z + 2) / 5.0f;
+			glm::vec3 base(x * 1.4f, 0.0f, z * 1.4f);
+			addBox(mesh, base - glm::vec3(0.2f, 0.0f, 0.2f), base + glm::vec3(0.2f, height, 0.2f));
+		}
+	}
+	addBox(mesh, glm::vec3(-2.0f, 2.0f, -0.5f), glm::vec3(2.0f, 2.1f, 0.5f));
+
+	Mesh sphere;
+	generateMesh(sphere, 40, 60);
+	U32 first = U32(mesh.vertices.size());
+	for (Vertex vertex : sphere.vertices)
+	{
+		vertex.position = vertex.position * 0.6f + glm::vec3(0.0f, 0.6f, 0.0f);
+		mesh.vertices.push_back(vertex);
+	}
+	for (U32 index : sphere.indices)
+		mesh.indices.push_back(first + index);
+}
+
+static int benchBake(const BenchOptions& options)
+{
+	Mesh mesh;
+	bool cooked = options.model.size() > 5 && options.model.compare(options.model.size() - 5, 5, ".mesh") == 0;
+	if (!(cooked ? mesh.loadCooked(options.model) : mesh.loadObj(options.model)))
+	{
+		LOG_WARN("Using a generated scene instead of " << options.model);
+		mesh = Mesh();
+		generateBakeScene(mesh);
+	}
+
+	LightmapBaker::Settings settings;
+	settings.width = settings.height = 512;
+	settings.samples = 32;
+	settings.samplesPerPass = 16;
+
+	// The bench doesn't know whether the model's texture coordinates overlap
+	LightmapBaker::unwrap(mesh, settings.width, settings.height);
+	TriangleBvh bvh;
+	bvh.build(mesh);
+
+	U32 maxThreads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+	// Always a threaded bake to compare with, even on one core
+	std::vector<U32> threadCounts = { 1, std::max(2u, maxThreads) };
+
+	std::vector<Pixel> firstAo, firstLight;
+	for (bool light : { false, true })
+	{
+		for (U32 threads : threadCounts)
+		{
+			settings.light = light;
+			settings.threads = threads;
+			LightmapBaker baker(mesh, bvh, settings);
+			if (threads == 1 && !light)
+				LOG_INFO(bvh.getTriangleCount() << " triangles, " << baker.getStats().texels << " texels, " << settings.samples << " samples per texel");
+
+			baker.bake();
+			const LightmapBaker::Stats& stats = baker.getStats();
+
+			// The seed alone decides the result, not the thread count
+			Image ambientOcclusion, lightmap;
+			baker.resolve(ambientOcclusion, lightmap);
+			if (threads == 1)
+			{
+				firstAo = ambientOcclusion.data;
+				firstLight = lightmap.data;
+			}
+			else
+			{
+				bool matches = firstAo.size() == ambientOcclusion.data.size() && firstLight.size() == lightmap.data.size()
+					&& std::memcmp(firstAo.data(), ambientOcclusion.data.data(), firstAo.size() * sizeof(Pixel)) == 0
+					&& std::memcmp(firstLight.data(), lightmap.data.data(), firstLight.size() * sizeof(Pixel)) == 0;
+				expect(matches, std::string(light ? "occlusion and light" : "occlusion only") + " bake on " + std::to_string(threads) + " threads matches one thread");
+			}
+
+			LOG_INFO("  " << (light ? "occlusion and light" : "occlusion only") << ", " << threads << " threads: " << stats.rays / 1e6 << " M rays in " << stats.seconds * 1000.0 << " ms, "
+				<< stats.raysPerSecond() / 1e6 << " M rays/s, " << stats.raysPerSecondPerCore() / 1e6 << " M rays/s per core");
+
+			if (light && threads == threadCounts.back() && !options.save.empty())
+			{
+				ambientOcclusion.save(options.save + "_ao.png");
+				lightmap.save(options.save + "_light.png");
+				LOG_INFO("Saved " << options.save << "_ao.png and " << options.save << "_light.png");
+			}
+		}
+	}
+
+	LOG_INFO("Lightmap baking: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+static int benchLights(const BenchOptions& options)
+{
+	const U32 width = 1920, height = 1080;
+	LightClusters clusters(16, 9, 24, options.threads);
+	FrustumCuller::Isa best = clusters.getIsa();
+
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 2.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 proj = glm::perspective(glm::radians(60.0f), float(width) / height, 0.1f, 200.0f);
+	proj[1][1] *= -1;
+	clusters.setProjection(proj, width, height);
+	LOG_INFO(width << "x" << height << ", " << clusters.getClusterCount() << " clusters, best instruction set " << FrustumCuller::getIsaName(best) << ", " << clusters.threadCount() << " threads");
+
+	std::vector<FrustumCuller::Isa> isas = { FrustumCuller::Scalar };
+	if (best >= FrustumCuller::Sse)
+		isas.push_back(FrustumCuller::Sse);
+	if (best >= FrustumCuller::Avx2)
+		isas.push_back(FrustumCuller::Avx2);
+
+	// A third spot lights, scattered through a box mostly in front of the
+	// camera so some fall outside the frustum
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> across(-60.0f, 60.0f);
+	std::uniform_real_distribution<float> up(-5.0f, 20.0f);
+	std::uniform_real_distribution<float> depth(-200.0f, 20.0f);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> range(1.0f, 8.0f);
+	std::uniform_real_distribution<float> angle(0.2f, 1.2f);
+
+	Clock clock;
+	for (U32 count : { 1000u, 2000u, 5000u, 10000u, 20000u, 50000u })
+	{
+		if (count > options.lights)
+			break;
+
+		std::vector<LightClusters::Light> lights;
+		lights.reserve(count);
+		for (U32 i = 0; i < count; ++i)
+		{
+			glm::vec3 position(across(random), up(random), depth(random));
+			glm::vec3 colour(1.0f);
+			if (i % 3)
+			{
+				lights.push_back(LightClusters::Light::point(position, range(random), colour));
+				continue;
+			}
+			glm::vec3 direction(unit(random), unit(random), unit(random));
+			direction = glm::length(direction) > 1e-3f ? glm::normalize(direction) : glm::vec3(0.0f, -1.0f, 0.0f);
+			lights.push_back(LightClusters::Light::spot(position, direction, range(random) * 2.0f, angle(random), colour));
+		}
+
+		std::vector<LightClusters::Cluster> referenceClusters;
+		std::vector<U32> referenceIndices;
+		Time referenceStart = clock.time();
+		clusters.binReference(view, lights.data(), count, referenceClusters, referenceIndices);
+		double referenceSeconds = (clock.time() - referenceStart).getSeconds();
+
+		U32 busiest = 0, occupied = 0;
+		for (const LightClusters::Cluster& cluster : referenceClusters)
+		{
+			busiest = std::max(busiest, cluster.count);
+			occupied += cluster.count ? 1 : 0;
+		}
+		LOG_INFO(count << " lights, " << referenceIndices.size() << " indices, " << double(referenceIndices.size()) / std::max(occupied, 1u) << " average and " << busiest << " most per lit cluster, " << occupied << " lit clusters; brute force " << referenceSeconds * 1000.0 << " ms");
+
+		U32 repeats = std::max(1u, 200000 / count);
+		auto measure = [&](FrustumCuller::Isa isa, U32 threads)
+		{
+			Time start = clock.time();
+			for (U32 r = 0; r < repeats; ++r)
+				clusters.bin(view, lights.data(), count, isa, threads);
+			double seconds = (clock.time() - start).getSeconds() / repeats;
+			bool matches = clusters.getClusters().size() == referenceClusters.size() && clusters.getIndices() == referenceIndices;
+			for (size_t i = 0; matches && i < referenceClusters.size(); ++i)
+				matches = clusters.getClusters()[i].offset == referenceClusters[i].offset && clusters.getClusters()[i].count == referenceClusters[i].count;
+			LOG_INFO("    " << FrustumCuller::getIsaName(isa) << ", " << threads << " threads: " << seconds * 1000.0 << " ms");
+			expect(matches, std::string(FrustumCuller::getIsaName(isa)) + " with " + std::to_string(threads) + " threads bins the same as brute force, " + std::to_string(count) + " lights");
+			return seconds;
+		};
+
+		double scalar = 0.0, simd = 0.0;
+		for (auto isa : isas)
+		{
+			double seconds = measure(isa, 1);
+			if (isa == FrustumCuller::Scalar)
+				scalar = seconds;
+			simd = seconds;
+		}
+		double threaded = clusters.threadCount() > 1 ? measure(best, clusters.threadCount()) : simd;
+		LOG_INFO("    speedup over scalar: " << scalar / std::max(simd, 1e-9) << "x SIMD, " << scalar / std::max(threaded, 1e-9) << "x SIMD and threads");
+	}
+
+	LOG_INFO("Light clusters: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+static int benchHandoff(const BenchOptions& options)
+{
+	// Stress: the producer publishes as fast as it can, every snapshot filled
+	// with its own frame number, and the consumer checks each one it gets is
+	// whole and newer than the last
+	{
+		const U32 drawCount = 64;
+		const double seconds = 1.0;
+		TripleBuffer<RenderSnapshot> snapshots;
+		std::atomic<bool> running { true };
+		U64 published = 0;
+
+		std::thread producer([&]()
+		{
+			while (running)
+			{
+				RenderSnapshot& snapshot = snapshots.writeSlot();
+				snapshot.clear();
+				snapshot.frame = ++published;
+				snapshot.time = double(snapshot.frame);
+				for (U32 i = 0; i < drawCount; ++i)
+					snapshot.draws.push_back({ nullptr, nullptr, glm::mat4(float(snapshot.frame)) });
+				snapshots.publish();
+			}
+		});
+
+		Clock clock;
+		Time start = clock.time();
+		U64 consumed = 0, lastFrame = 0, torn = 0, reordered = 0;
+		while ((clock.time() - start).getSeconds() < seconds)
+		{
+			const RenderSnapshot* snapshot = snapshots.waitAcquire();
+			++consumed;
+			if (snapshot->frame <= lastFrame)
+				++reordered;
+			lastFrame = snapshot->frame;
+			bool whole = snapshot->draws.size() == drawCount && snapshot->time == double(snapshot->frame);
+			for (const RenderSnapshot::Draw& draw : snapshot->draws)
+				whole = whole && draw.transform[0][0] == float(snapshot->frame);
+			torn += whole ? 0 : 1;
+		}
+		running = false;
+		producer.join();
+
+		LOG_INFO("Stress: " << published << " published, " << consumed << " acquired, " << snapshots.getDropped() << " replaced unread in " << seconds << " s; " << torn << " torn, " << reordered << " out of order");
+		expect(consumed > 0, "the consumer acquires snapshots");
+		expect(torn == 0, "no snapshot is acquired half written");
+		expect(reordered == 0, "every snapshot acquired is newer than the last");
+	}
+
+	// Closing: the last value is still acquired, then the consumer gets nullptr
+	{
+		TripleBuffer<RenderSnapshot> snapshots;
+		expect(!snapshots.acquire() && !snapshots.current(), "nothing to acquire before a publish");
+		snapshots.writeSlot().frame = 1;
+		expect(snapshots.publish() && snapshots.pending(), "publish leaves the value pending");
+		snapshots.writeSlot().frame = 2;
+		expect(!snapshots.publish() && snapshots.getDropped() == 1, "a value replaced unread counts as dropped");
+		const RenderSnapshot* snapshot = snapshots.waitAcquire();
+		expect(snapshot && snapshot->frame == 2 && !snapshots.pending(), "the newest value is acquired");
+
+		std::thread consumer([&]()
+		{
+			snapshot = snapshots.waitAcquire();
+		});
+		snapshots.close();
+		consumer.join();
+		expect(!snapshot && !snapshots.acquire() && !snapshots.waitAcquire(), "a closed buffer hands out nothing");
+	}
+
+	// Frame pacing: a simulation and a render stand-in, sleeping for their
+	// cost so the overlap shows on any core count. Serially a frame costs
+	// both, on two threads with the simulation a frame ahead it costs the
+	// larger one.
+	for (auto cost : { std::make_pair(4.0, 8.0), std::make_pair(8.0, 8.0), std::make_pair(8.0, 4.0) })
+	{
+		const U32 frames = 60;
+		auto wait = [](double milliSeconds) { std::this_thread::sleep_for(std::chrono::microseconds(S64(milliSeconds * 1000.0))); };
+
+		Clock clock;
+		Time start = clock.time();
+		for (U32 i = 0; i < frames; ++i)
+		{
+			wait(cost.first);
+			wait(cost.second);
+		}
+		double serial = (clock.time() - start).getSeconds() / frames;
+
+		TripleBuffer<RenderSnapshot> snapshots;
+		U64 rendered = 0;
+		std::thread renderer([&]()
+		{
+			while (snapshots.waitAcquire())
+			{
+				wait(cost.second);
+				++rendered;
+			}
+		});
+
+		start = clock.time();
+		for (U32 i = 0; i < frames; ++i)
+		{
+			// Same pacing as Engine::start
+			snapshots.waitAcquired();
+			RenderSnapshot& snapshot = snapshots.writeSlot();
+			snapshot.clear();
+			snapshot.frame = i;
+			wait(cost.first);
+			snapshots.publish();
+		}
+		snapshots.close();
+		renderer.join();
+		double threaded = (clock.time() - start).getSeconds() / frames;
+
+		LOG_INFO("Simulate " << cost.first << " ms, render " << cost.second << " ms: serial " << serial * 1000.0 << " ms per frame, render thread " << threaded * 1000.0 << " ms per frame, " << serial / std::max(threaded, 1e-9) << "x; " << rendered << " of " << frames << " rendered");
+		expect(rendered == frames, "paced frames are all rendered");
+	}
+
+	LOG_INFO("Handoff: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+// Some arithmetic that can't be folded away, cost grows with rounds
+static U32 spinWork(U32 seed, U32 rounds)
+{
+	U32 h = seed * 2654435761u + 1;
+	for (U32 r = 0; r < rounds; ++r)
+		h = (h ^ (h >> 15)) * 2246822519u + r;
+	return h;
+}
+
+// Binary tree of jobs, each inner node waits on its two children
+static void forkJoin(JobSystem& jobs, U32 depth, std::atomic<U32>& leaves)
+{
+	if (depth == 0)
+	{
+		leaves.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	JobSystem::Counter counter;
+	jobs.run([&jobs, depth, &leaves]() { forkJoin(jobs, depth - 1, leaves); }, &counter);
+	jobs.run([&jobs, depth, &leaves]() { forkJoin(jobs, depth - 1, leaves); }, &counter);
+	jobs.wait(counter);
+}
+
+static int benchJobs(const BenchOptions& options)
+{
+	JobSystem jobs(options.threads);
+	U32 threads = jobs.threadCount();
+	ThreadPool pool(threads);
+	LOG_INFO(threads << " threads, the job system's include the calling thread");
+
+	Clock clock;
+	auto time = [&](const std::function<void()>& f)
+	{
+		Time start = clock.time();
+		f();
+		return (clock.time() - start).getSeconds();
+	};
+
+	// Many small independent tasks: per task overhead of each scheduler
+	for (U32 rounds : { 16u, 256u })
+	{
+		const U32 count = 20000;
+		U32 expected = 0;
+		for (U32 i = 0; i < count; ++i)
+			expected += spinWork(i, rounds);
+
+		std::vector<U32> results(count);
+		auto checksum = [&]() { U32 sum = 0; for (U32 value : results) sum += value; return sum; };
+
+		double jobSeconds = time([&]()
+		{
+			JobSystem::Counter counter;
+			for (U32 i = 0; i < count; ++i)
+				jobs.run([&results, i, rounds]() { results[i] = spinWork(i, rounds); }, &counter);
+			jobs.wait(counter);
+		});
+		bool jobMatches = checksum() == expected;
+
+		std::fill(results.begin(), results.end(), 0u);
+		double poolSeconds = time([&]()
+		{
+			std::vector<std::future<void>> futures;
+			futures.reserve(count);
+			for (U32 i = 0; i < count; ++i)
+				futures.push_back(pool.submit([&results, i, rounds]() { results[i] = spinWork(i, rounds); }));
+			for (auto& future : futures)
+				future.wait();
+		});
+		bool poolMatches = checksum() == expected;
+
+		std::fill(results.begin(), results.end(), 0u);
+		double asyncSeconds = time([&]()
+		{
+			std::vector<std::future<void>> futures;
+			futures.reserve(count);
+			for (U32 i = 0; i < count; ++i)
+				futures.push_back(std::async(std::launch::async, [&results, i, rounds]() { results[i] = spinWork(i, rounds); }));
+			for (auto& future : futures)
+				future.wait();
+		});
+		bool asyncMatches = checksum() == expected;
+
+		LOG_INFO(count << " tasks of " << rounds << " rounds, per task: jobs " << jobSeconds * 1e6 / count << " us, mutex queue " << poolSeconds * 1e6 / count << " us, std::async " << asyncSeconds * 1e6 / count << " us");
+		std::string tasks = std::to_string(count) + " tasks of " + std::to_string(rounds) + " rounds";
+		expect(jobMatches, "job system checksum, " + tasks);
+		expect(poolMatches, "mutex queue checksum, " + tasks);
+		expect(asyncMatches, "std::async checksum, " + tasks);
+	}
+
+	// Data parallel loops, even and uneven cost per item. The others get one
+	// fixed chunk per thread, as a hand written split would.
+	for (bool uneven : { false, true })
+	{
+		const U32 count = uneven ? 8192 : 4000000;
+		// Uneven cost rises with the square of the index, the last thread's
+		// fixed chunk has most of the work
+		auto rounds = [uneven, count](U32 i) { return uneven ? U32(1 + U64(i) * i * 2048 / (U64(count) * count)) : 8u; };
+
+		U32 expected = 0;
+		for (U32 i = 0; i < count; ++i)
+			expected += spinWork(i, rounds(i));
+
+		std::vector<U32> results(count);
+		auto checksum = [&]() { U32 sum = 0; for (U32 value : results) sum += value; return sum; };
+		auto range = [&](U32 begin, U32 end)
+		{
+			for (U32 i = begin; i < end; ++i)
+				results[i] = spinWork(i, rounds(i));
+		};
+
+		double jobSeconds = time([&]() { jobs.parallelFor(count, uneven ? 16 : 4096, range); });
+		bool jobMatches = checksum() == expected;
+
+		U32 chunk = (count + threads - 1) / threads;
+		std::fill(results.begin(), results.end(), 0u);
+		double poolSeconds = time([&]()
+		{
+			std::vector<std::future<void>> futures;
+			for (U32 begin = 0; begin < count; begin += chunk)
+				futures.push_back(pool.submit([&range, begin, chunk, count]() { range(begin, std::min(begin + chunk, count)); }));
+			for (auto& future : futures)
+				future.wait();
+		});
+		bool poolMatches = checksum() == expected;
+
+		std::fill(results.begin(), results.end(), 0u);
+		double asyncSeconds = time([&]()
+		{
+			std::vector<std::future<void>> futures;
+			for (U32 begin = 0; begin < count; begin += chunk)
+				futures.push_back(std::async(std::launch::async, [&range, begin, chunk, count]() { range(begin, std::min(begin + chunk, count)); }));
+			for (auto& future : futures)
+				future.wait();
+		});
+		bool asyncMatches = checksum() == expected;
+
+		double serialSeconds = time([&]() { range(0, count); });
+
+		LOG_INFO((uneven ? "Uneven" : "Even") << " loop of " << count << ": serial " << serialSeconds * 1000.0 << " ms, parallelFor " << jobSeconds * 1000.0 << " ms, mutex queue " << poolSeconds * 1000.0 << " ms, std::async " << asyncSeconds * 1000.0 << " ms");
+		std::string loop = std::string(uneven ? "uneven" : "even") + " loop of " + std::to_string(count);
+		expect(jobMatches, "parallelFor checksum, " + loop);
+		expect(poolMatches, "mutex queue checksum, " + loop);
+		expect(asyncMatches, "std::async checksum, " + loop);
+	}
+
+	// Nested fork-join, only the job system can wait inside a task without
+	// tying up a thread
+	for (U32 depth : { 12u, 16u })
+	{
+		std::atomic<U32> leaves { 0 };
+		double seconds = time([&]() { forkJoin(jobs, depth, leaves); });
+		U32 spawned = (2u << depth) - 2;
+		LOG_INFO("Fork-join tree of depth " << depth << ": " << spawned << " jobs in " << seconds * 1000.0 << " ms, " << spawned / std::max(seconds, 1e-9) / 1e6 << " M jobs/s");
+		expect(leaves == (1u << depth), "fork-join tree of depth " + std::to_string(depth) + " reaches every leaf");
+	}
+
+	LOG_INFO("Jobs: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+template<class Scheduler>
+static void forkJoinOn(Scheduler& scheduler, U32 depth, std::atomic<U32>& leaves)
+{
+	if (depth == 0)
+	{
+		leaves.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	typename Scheduler::Counter counter;
+	scheduler.run([&scheduler, depth, &leaves]() { forkJoinOn(scheduler, depth - 1, leaves); }, &counter);
+	scheduler.run([&scheduler, depth, &leaves]() { forkJoinOn(scheduler, depth - 1, leaves); }, &counter);
+	scheduler.wait(counter);
+}
+
+// Load, decode on another job, wait for it, upload: the straight line code
+// fibers are for. Each step is spinWork of its own cost.
+template<class Scheduler>
+static U32 loadAssets(Scheduler& scheduler, U32 count, std::vector<U32>& results)
+{
+	typename Scheduler::Counter loads;
+	for (U32 i = 0; i < count; ++i)
+	{
+		scheduler.run([&scheduler, &results, i]()
+		{
+			U32 file = spinWork(i, 64);
+			U32 decoded = 0;
+			typename Scheduler::Counter decode;
+			scheduler.run([&decoded, file]() { decoded = spinWork(file, 512); }, &decode);
+			scheduler.wait(decode);
+			results[i] = spinWork(decoded, 64);
+		}, &loads);
+	}
+	scheduler.wait(loads);
+
+	U32 sum = 0;
+	for (U32 value : results)
+		sum += value;
+	return sum;
+}
+
+static int benchFibers(const BenchOptions& options)
+{
+	U32 threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+	Clock clock;
+	auto time = [&](const std::function<void()>& f)
+	{
+		Time start = clock.time();
+		f();
+		return (clock.time() - start).getSeconds();
+	};
+
+	// Context switch cost: jobs on one worker that do nothing but yield, so
+	// every resume is a switch in and a switch back out
+	{
+		FiberScheduler scheduler(1, 16);
+		const U32 fibers = 8, yields = 50000;
+		FiberScheduler::Counter counter;
+		U64 switches = scheduler.getSwitchCount();
+		double seconds = time([&]()
+		{
+			for (U32 i = 0; i < fibers; ++i)
+				scheduler.run([&scheduler]() { for (U32 y = 0; y < yields; ++y) scheduler.yield(); }, &counter);
+			scheduler.wait(counter);
+		});
+		switches = (scheduler.getSwitchCount() - switches) * 2;
+		LOG_INFO("Context switches: " << switches << " in " << seconds * 1000.0 << " ms, " << seconds * 1e9 / std::max<U64>(switches, 1) << " ns each");
+	}
+
+	FiberScheduler fibers(threads);
+	JobSystem jobs(threads);
+	LOG_INFO(threads << " threads, " << fibers.fiberCount() << " fibers");
+
+	// Jobs waiting on jobs: a fiber parks, a JobSystem thread runs other jobs
+	// on top of its stack
+	for (U32 count : { 1000u, 10000u })
+	{
+		std::vector<U32> results(count);
+		U32 expected = 0;
+		for (U32 i = 0; i < count; ++i)
+			expected += spinWork(spinWork(spinWork(i, 64), 512), 64);
+
+		U32 fiberSum = 0, jobSum = 0;
+		U64 switches = fibers.getSwitchCount(), fiberless = fibers.getFiberlessCount();
+		double fiberSeconds = time([&]() { fiberSum = loadAssets(fibers, count, results); });
+		switches = fibers.getSwitchCount() - switches;
+		fiberless = fibers.getFiberlessCount() - fiberless;
+		std::fill(results.begin(), results.end(), 0u);
+		double jobSeconds = time([&]() { jobSum = loadAssets(jobs, count, results); });
+
+		LOG_INFO(count << " loads waiting on a decode: fibers " << fiberSeconds * 1000.0 << " ms (" << switches << " switches, " << fiberless << " without a fiber), job system " << jobSeconds * 1000.0 << " ms");
+		expect(fiberSum == expected, "fiber sum of " + std::to_string(count) + " loads");
+		expect(jobSum == expected, "job system sum of " + std::to_string(count) + " loads");
+	}
+
+	for (U32 depth : { 12u, 16u })
+	{
+		std::atomic<U32> fiberLeaves { 0 }, jobLeaves { 0 };
+		FiberScheduler::Counter root;
+		double fiberSeconds = time([&]()
+		{
+			fibers.run([&fibers, depth, &fiberLeaves]() { forkJoinOn(fibers, depth, fiberLeaves); }, &root);
+			fibers.wait(root);
+		});
+		double jobSeconds = time([&]() { forkJoinOn(jobs, depth, jobLeaves); });
+		U32 spawned = (2u << depth) - 2;
+		LOG_INFO("Fork-join tree of depth " << depth << ", " << spawned << " jobs: fibers " << fiberSeconds * 1000.0 << " ms, job system " << jobSeconds * 1000.0 << " ms");
+		expect(fiberLeaves == (1u << depth), "fiber fork-join tree of depth " + std::to_string(depth) + " reaches every leaf");
+		expect(jobLeaves == (1u << depth), "job system fork-join tree of depth " + std::to_string(depth) + " reaches every leaf");
+	}
+
+	LOG_INFO("Fibers: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+static U32 hashPixels(const std::vector<Pixel>& pixels)
+{
+	U32 hash = 2166136261u;
+	for (const Pixel& pixel : pixels)
+		hash = (hash ^ (U32(U8(pixel.r)) | U32(U8(pixel.g)) << 8 | U32(U8(pixel.b)) << 16 | U32(U8(pixel.a)) << 24)) * 16777619u;
+	return hash;
+}
+
+static Task<U32> addOne(U32 value)
+{
+	co_return value + 1;
+}
+
+static Task<U32> awaitChain(U32 count)
+{
+	U32 value = 0;
+	for (U32 i = 0; i < count; ++i)
+		value = co_await addOne(value);
+	co_return value;
+}
+
+static Task<void> storeChain(U32 count, U32& result)
+{
+	result = co_await awaitChain(count);
+}
+
+// Read, decode, hop to main for the upload, then wait on the stand-in GPU
+static Task<void> loadAsset(AssetScheduler& assets, std::string path, U64 gpuMicroSeconds, std::thread::id mainThread, U32& hash, std::atomic<U32>& offMain)
+{
+	std::vector<U8> bytes = co_await assets.readFile(path);
+	Image image;
+	image.loadMemory(bytes.data(), bytes.size());
+
+	co_await assets.resumeOnMain();
+	if (std::this_thread::get_id() != mainThread)
+		offMain.fetch_add(1, std::memory_order_relaxed);
+	std::vector<Pixel> staging = image.data;
+	Clock clock;
+	U64 done = clock.now() + gpuMicroSeconds;
+	co_await assets.when([done]() { Clock clock; return clock.now() >= done; });
+
+	if (std::this_thread::get_id() != mainThread)
+		offMain.fetch_add(1, std::memory_order_relaxed);
+	hash = hashPixels(staging);
+}
+
+static int benchAssets(const BenchOptions& options)
+{
+	const U32 size = 512;
+	const U64 gpuMicroSeconds = 2000;
+	Clock clock;
+	auto time = [&](const std::function<void()>& f)
+	{
+		Time start = clock.time();
+		f();
+		return (clock.time() - start).getSeconds();
+	};
+
+	AssetScheduler assets(2, options.threads);
+
+	{
+		// Nothing in the chain suspends, it runs to the end inside spawn()
+		const U32 awaits = 1000000;
+		U32 result = 0;
+		double seconds = time([&]() { assets.spawn(storeChain(awaits, result)); });
+		LOG_INFO("Task awaits: " << awaits << " in " << seconds * 1000.0 << " ms, " << seconds * 1e9 / awaits << " ns each");
+		expect(result == awaits, "every await in the chain resumes");
+	}
+
+	// Noise compresses badly, so the PNGs are large and slow to decode
+	std::vector<std::string> paths;
+	std::mt19937 random(7);
+	for (U32 i = 0; i < options.assets; ++i)
+	{
+		Image image;
+		image.width = image.height = int(size);
+		image.data.resize(size * size);
+		for (U32 p = 0; p < size * size; ++p)
+		{
+			U32 noise = random();
+			U32 x = p % size, y = p / size;
+			image.data[p] = { char((x + i * 16) ^ (noise & 15)), char((y * 3) ^ (noise >> 4 & 15)), char(noise >> 8), char(255) };
+		}
+		paths.push_back("EngineBench_asset" + std::to_string(i) + ".png");
+		image.save(paths.back());
+	}
+
+	std::vector<U32> expected(options.assets);
+	double serialSeconds = time([&]()
+	{
+		for (U32 i = 0; i < options.assets; ++i)
+		{
+			File file;
+			file.open(paths[i], File::Mode(File::binary | File::in));
+			std::vector<U8> bytes(size_t(file.getSize()));
+			file.readFile(bytes.data());
+			Image image;
+			image.loadMemory(bytes.data(), bytes.size());
+			std::vector<Pixel> staging = image.data;
+			// endSingleTimeCommands waits for the queue to go idle
+			std::this_thread::sleep_for(std::chrono::microseconds(gpuMicroSeconds));
+			expected[i] = hashPixels(staging);
+		}
+	});
+
+	std::vector<U32> hashes(options.assets);
+	std::atomic<U32> offMain { 0 };
+	std::thread::id mainThread = std::this_thread::get_id();
+	U32 pumps = 0;
+	double coroutineSeconds = time([&]()
+	{
+		for (U32 i = 0; i < options.assets; ++i)
+			assets.spawn(loadAsset(assets, paths[i], gpuMicroSeconds, mainThread, hashes[i], offMain));
+		while (assets.pending() > 0)
+		{
+			assets.pumpMain();
+			++pumps;
+			std::this_thread::yield();
+		}
+	});
+
+	for (const std::string& path : paths)
+		std::remove(path.c_str());
+
+	LOG_INFO(options.assets << " " << size << "x" << size << " PNGs with " << gpuMicroSeconds / 1000.0 << " ms uploads: one after the other " << serialSeconds * 1000.0 << " ms, coroutines on " << assets.workerCount() << " workers " << coroutineSeconds * 1000.0 << " ms over " << pumps << " pumps, " << serialSeconds / std::max(coroutineSeconds, 1e-9) << "x");
+	expect(hashes == expected, "coroutine loads decode the same pixels as serial loads");
+	expect(offMain == 0, "uploads run on the main thread");
+
+	LOG_INFO("Assets: " << (failures ? std::to_string(failures) + " checks FAILED" : "all checks passed"));
+	return failures ? 1 : 0;
+}
+
+static void printUsage()
+{
+	std::cout << "Usage: EngineBench <suite> [options]" << std::endl
+		<< "  shaders           shader compile throughput versus thread count" << std::endl
+		<< "    --features <n>  feature keywords, the corpus has 2^n permutations (default: 6)" << std::endl
+		<< "    --threads <n>   highest thread count to measure (default: all cores)" << std::endl
+		<< "  reflection        SPIR-V reflection checks on hand assembled modules" << std::endl
+		<< "  includes          shader include graph and scanning checks" << std::endl
+		<< "  keywords          shader keyword key and specialization checks" << std::endl
+		<< "  graph             render graph culling, barrier and aliasing checks" << std::endl
+		<< "  draws             draw key sort and state bind counts" << std::endl
+		<< "    --draws <n>     largest draw count (default: 1000000)" << std::endl
+		<< "  cull              frustum culling throughput per instruction set" << std::endl
+		<< "    --objects <n>   largest box count (default: 1000000)" << std::endl
+		<< "    --threads <n>   thread count (default: all cores)" << std::endl
+		<< "  occlusion         CPU occluder rasterising and Hi-Z box tests" << std::endl
+		<< "    --occluders <n> building count (default: 400)" << std::endl
+		<< "    --threads <n>   thread count (default: all cores)" << std::endl
+		<< "    --save <prefix> write <prefix>_depth.png and <prefix>_reference.png" << std::endl
+		<< "  bvh               BVH build, refit and query throughput" << std::endl
+		<< "    --objects <n>   largest box count (default: 1000000)" << std::endl
+		<< "  rays              triangle BVH ray casting throughput" << std::endl
+		<< "    --model <path>  .obj or cooked .mesh (default: models/chalet.obj)" << std::endl
+		<< "    --threads <n>   thread count (default: all cores)" << std::endl
+		<< "  bake              lightmap baking rays per second per core" << std::endl
+		<< "    --model <path>  .obj or cooked .mesh (default: models/chalet.obj)" << std::endl
+		<< "    --threads <n>   thread count (default: all cores)" << std::endl
+		<< "    --save <prefix> write <prefix>_ao.png and <prefix>_light.png" << std::endl
+		<< "  lights            clustered light binning per instruction set" << std::endl
+		<< "    --lights <n>    largest light count (default: 10000)" << std::endl
+		<< "    --threads <n>   thread count (default: all cores)" << std::endl
+		<< "  handoff           render thread snapshot handoff and frame overlap" << std::endl
+		<< "  jobs              job system versus a mutex queue and std::async" << std::endl
+		<< "    --threads <n>   thread count (default: all cores)" << std::endl
+		<< "  fibers            fiber context switches and waits in jobs" << std::endl
+		<< "    --threads <n>   thread count (default: all cores)" << std::endl
+		<< "  assets            coroutine asset loading overlap and await cost" << std::endl
+		<< "    --assets <n>    PNG count (default: 32)" << std::endl
+		<< "    --threads <n>   decode thread count (default: all cores)" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		printUsage();
+		return 1;
+	}
+
+	std::string suite = argv[1];
+	BenchOptions options;
+
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--features" && i + 1 < argc)
+			options.features = U32(std::min(16, std::max(0, std::atoi(argv[++i]))));
+		else if (arg == "--threads" && i + 1 < argc)
+			options.threads = U32(std::max(1, std::atoi(argv[++i])));
+		else if (arg == "--draws" && i + 1 < argc)
+			options.draws = U32(std::max(10000, std::atoi(argv[++i])));
+		else if (arg == "--objects" && i + 1 < argc)
+			options.objects = U32(std::max(100000, std::atoi(argv[++i])));
+		else if (arg == "--occluders" && i + 1 < argc)
+			options.occluders = U32(std::max(1, std::atoi(argv[++i])));
+		else if (arg == "--lights" && i + 1 < argc)
+			options.lights = U32(std::max(1000, std::atoi(argv[++i])));
+		else if (arg == "--assets" && i + 1 < argc)
+			options.assets = U32(std::max(1, std::atoi(argv[++i])));
+		else if (arg == "--save" && i + 1 < argc)
+			options.save = argv[++i];
+		else if (arg == "--model" && i + 1 < argc)
+			options.model = argv[++i];
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (suite == "shaders")
+		return benchShaders(options);
+	if (suite == "reflection")
+		return benchReflection(options);
+	if (suite == "includes")
+		return benchIncludes(options);
+	if (suite == "keywords")
+		return benchKeywords(options);
+	if (suite == "graph")
+		return benchGraph(options);
+	if (suite == "draws")
+		return benchDraws(options);
+	if (suite == "cull")
+		return benchCull(options);
+	if (suite == "occlusion")
+		return benchOcclusion(options);
+	if (suite == "bvh")
+		return benchBvh(options);
+	if (suite == "rays")
+		return benchRays(options);
+	if (suite == "bake")
+		return benchBake(options);
+	if (suite == "lights")
+		return benchLights(options);
+	if (suite == "handoff")
+		return benchHandoff(options);
+	if (suite == "jobs")
+		return benchJobs(options);
+	if (suite == "fibers")
+		return benchFibers(options);
+	if (suite == "assets")
+		return benchAssets(options);
+
+	printUsage();
+	return 1;
+}
@@ -0,0 +1,142 @@
+// Offline lightmap baker
+//
+// Bakes ambient occlusion and sky plus sun light for one model into two
+// images in its texture space:
+//   LightmapBaker models/chalet.obj --out lightmaps/chalet
+//     -> lightmaps/chalet.ao.png     ambient occlusion, grey
+//        lightmaps/chalet.light.png  direct and one bounce light, gamma encoded
+//
+// The model's own texture coordinates are used unless --unwrap is given, which
+// makes a simple non overlapping unwrap and writes the unwrapped mesh as
+// <out>.mesh next to the images. Cooked .mesh files are read too, with the
+// cooked .bvh when it is there.
+//
+// Runs headlessly on every core. The same seed gives the same images whatever
+// the thread count, so a bake can be checked in CI.
+
+#include "PCH.hpp"
+#include "Image.hpp"
+#include "LightmapBaker.hpp"
+#include "Mesh.hpp"
+#include "TriangleBvh.hpp"
+
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static void printUsage()
+{
+	std::cout << "Usage: LightmapBaker [options] <model.obj|model.mesh>" << std::endl
+		<< "  --out <prefix>      output path without extension (default: the model's path)" << std::endl
+		<< "  --size <n>          lightmap width and height in texels (default: 512)" << std::endl
+		<< "  --samples <n>       rays per texel (default: 256)" << std::endl
+		<< "  --pass <n>          rays per texel per refinement pass (default: 16)" << std::endl
+		<< "  --threads <n>       worker threads (default: all cores)" << std::endl
+		<< "  --seed <n>          random seed (default: 1)" << std::endl
+		<< "  --ao-distance <d>   occlusion range in model units (default: a quarter of the model's radius)" << std::endl
+		<< "  --ao-only           bake ambient occlusion only, no light" << std::endl
+		<< "  --unwrap            ignore the model's texture coordinates and unwrap it" << std::endl
+		<< "  --progressive       write the images after every pass" << std::endl;
+}
+
+static void save(const LightmapBaker& baker, const std::string& prefix)
+{
+	Image ambientOcclusion, light;
+	baker.resolve(ambientOcclusion, light);
+	ambientOcclusion.save(prefix + ".ao.png");
+	if (baker.getSettings().light)
+		light.save(prefix + ".light.png");
+}
+
+int main(int argc, char **argv)
+{
+	LightmapBaker::Settings settings;
+	std::string input, prefix;
+	bool unwrap = false;
+	bool progressive = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--out" && i + 1 < argc)
+			prefix = argv[++i];
+		else if (arg == "--size" && i + 1 < argc)
+			settings.width = settings.height = U32(std::max(16, std::atoi(argv[++i])));
+		else if (arg == "--samples" && i + 1 < argc)
+			settings.samples = U32(std::max(1, std::atoi(argv[++i])));
+		else if (arg == "--pass" && i + 1 < argc)
+			settings.samplesPerPass = U32(std::max(1, std::atoi(argv[++i])));
+		else if (arg == "--threads" && i + 1 < argc)
+			settings.threads = U32(std::max(1, std::atoi(argv[++i])));
+		else if (arg == "--seed" && i + 1 < argc)
+			settings.seed = U32(std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--ao-distance" && i + 1 < argc)
+			settings.aoDistance = float(std::atof(argv[++i]));
+		else if (arg == "--ao-only")
+			settings.light = false;
+		else if (arg == "--unwrap")
+			unwrap = true;
+		else if (arg == "--progressive")
+			progressive = true;
+		else if (arg == "--help" || arg == "-h")
+		{
+			printUsage();
+			return 0;
+		}
+		else
+			input = arg;
+	}
+
+	if (input.empty())
+	{
+		printUsage();
+		return 1;
+	}
+	if (prefix.empty())
+		prefix = fs::path(input).replace_extension().string();
+
+	if (fs::path(prefix).has_parent_path())
+		fs::create_directories(fs::path(prefix).parent_path());
+
+	Mesh mesh;
+	bool cooked = fs::path(input).extension() == ".mesh";
+	if (!(cooked ? mesh.loadCooked(input) : mesh.loadObj(input)))
+	{
+		std::cout << "Can't load " << input << std::endl;
+		return 1;
+	}
+
+	if (unwrap)
+	{
+		LightmapBaker::unwrap(mesh, settings.width, settings.height);
+		if (!mesh.saveCooked(prefix + ".mesh"))
+		{
+			std::cout << "Can't write " << prefix << ".mesh" << std::endl;
+			return 1;
+		}
+	}
+
+	// The cooked tree only fits when the mesh hasn't been unwrapped
+	TriangleBvh bvh;
+	std::string bvhPath = fs::path(input).replace_extension(".bvh").string();
+	if (!cooked || unwrap || !bvh.loadCooked(bvhPath) || !bvh.matches(mesh))
+		bvh.build(mesh);
+
+	LightmapBaker baker(mesh, bvh, settings);
+	const LightmapBaker::Stats& stats = baker.getStats();
+	LOG_INFO("Baking " << input << ": " << bvh.getTriangleCount() << " triangles, " << stats.texels << " of " << settings.width * settings.height << " texels covered, " << settings.samples << " samples on " << stats.threads << " threads");
+
+	baker.bake([&](const LightmapBaker::Stats& pass)
+	{
+		LOG_INFO("  pass " << pass.passes << ": " << pass.samples << "/" << settings.samples << " samples, " << pass.seconds << " s, "
+			<< pass.raysPerSecond() / 1e6 << " M rays/s, " << pass.raysPerSecondPerCore() / 1e6 << " M rays/s per core");
+		if (progressive)
+			save(baker, prefix);
+	});
+
+	if (!progressive)
+		save(baker, prefix);
+
+	LOG_INFO("Baked " << stats.rays << " rays in " << stats.seconds << " s, " << stats.raysPerSecondPerCore() / 1e6 << " M rays/s per core -> " << prefix << ".ao.png");
+	return stats.texels ? 0 : 1;
+}